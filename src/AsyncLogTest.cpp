@@ -0,0 +1,180 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "AsyncLog.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace McBopomofo {
+
+namespace {
+
+// Collects the messages written by the shared log, and can hold the
+// background thread in the writer to let the queue fill up.
+class AsyncLogTest : public ::testing::Test {
+ protected:
+  AsyncLogTest() {
+    AsyncLog::shared().flush();
+    AsyncLog::shared().setWriter(
+        [this](LogLevel, const char*, int, const std::string& message) {
+          std::unique_lock<std::mutex> lock(mutex_);
+          messages_.push_back(message);
+          blocked_ = held_;
+          changed_.notify_all();
+          changed_.wait(lock, [this] { return !held_; });
+          blocked_ = false;
+        });
+  }
+
+  ~AsyncLogTest() override {
+    release();
+    AsyncLog::shared().flush();
+    AsyncLog::shared().setWriter(nullptr);
+  }
+
+  void log(const std::string& message) {
+    AsyncLog::shared().log(LogLevel::Info, __FILE__, __LINE__, message);
+  }
+
+  // Makes the writer wait in the next message until release().
+  void hold() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    held_ = true;
+  }
+
+  void waitUntilBlocked() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this] { return blocked_; });
+  }
+
+  void release() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    held_ = false;
+    changed_.notify_all();
+  }
+
+  std::vector<std::string> messages() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return messages_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  bool held_ = false;
+  bool blocked_ = false;
+  std::vector<std::string> messages_;
+};
+
+TEST_F(AsyncLogTest, WritesMessagesInOrderBeforeFlushReturns) {
+  std::vector<std::string> expected;
+  for (int i = 0; i < 100; i++) {
+    expected.push_back(std::to_string(i));
+    log(expected.back());
+  }
+  AsyncLog::shared().flush();
+  EXPECT_EQ(messages(), expected);
+}
+
+TEST_F(AsyncLogTest, WakesUpForEachMessage) {
+  // Each message is written without another one to push it along.
+  for (int i = 0; i < 20; i++) {
+    log(std::to_string(i));
+    AsyncLog::shared().flush();
+    ASSERT_EQ(messages().size(), static_cast<size_t>(i + 1));
+  }
+}
+
+TEST_F(AsyncLogTest, CountsMessagesDroppedWhenFull) {
+  uint64_t dropped = AsyncLog::shared().droppedCount();
+  hold();
+  log("first");
+  // The first message is out of the queue once the writer has it.
+  waitUntilBlocked();
+
+  constexpr size_t kExtra = 5;
+  for (size_t i = 0; i < AsyncLog::QueueCapacity + kExtra; i++) {
+    log(std::to_string(i));
+  }
+  EXPECT_EQ(AsyncLog::shared().droppedCount() - dropped, kExtra);
+
+  release();
+  AsyncLog::shared().flush();
+  std::vector<std::string> written = messages();
+  ASSERT_EQ(written.size(), AsyncLog::QueueCapacity + 1);
+  EXPECT_EQ(written.front(), "first");
+  for (size_t i = 0; i < AsyncLog::QueueCapacity; i++) {
+    ASSERT_EQ(written[i + 1], std::to_string(i));
+  }
+
+  // There is room again after the queue is drained.
+  log("after");
+  AsyncLog::shared().flush();
+  EXPECT_EQ(messages().back(), "after");
+  EXPECT_EQ(AsyncLog::shared().droppedCount() - dropped, kExtra);
+}
+
+TEST(LogRateLimiterTest, AllowsBurstPerInterval) {
+  LogRateLimiter limiter;
+  uint64_t suppressed = 0;
+  for (uint32_t i = 0; i < LogRateLimiter::Burst; i++) {
+    EXPECT_TRUE(limiter.allow(1000, suppressed));
+    EXPECT_EQ(suppressed, 0);
+  }
+  EXPECT_FALSE(limiter.allow(1000, suppressed));
+  EXPECT_FALSE(
+      limiter.allow(1000 + LogRateLimiter::IntervalMilliseconds - 1,
+                    suppressed));
+}
+
+TEST(LogRateLimiterTest, ReportsSuppressedWithNextMessage) {
+  LogRateLimiter limiter;
+  uint64_t suppressed = 0;
+  for (uint32_t i = 0; i < LogRateLimiter::Burst + 3; i++) {
+    limiter.allow(0, suppressed);
+  }
+
+  int64_t next = LogRateLimiter::IntervalMilliseconds;
+  EXPECT_TRUE(limiter.allow(next, suppressed));
+  EXPECT_EQ(suppressed, 3);
+  // The count is reported once.
+  EXPECT_TRUE(limiter.allow(next, suppressed));
+  EXPECT_EQ(suppressed, 0);
+}
+
+TEST(LogRateLimiterTest, AllowsFirstMessageAtAnyTime) {
+  LogRateLimiter limiter;
+  uint64_t suppressed = 0;
+  EXPECT_TRUE(limiter.allow(-5000, suppressed));
+  EXPECT_EQ(suppressed, 0);
+}
+
+}  // namespace
+
+}  // namespace McBopomofo
@@ -0,0 +1,100 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "BackgroundWalker.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace McBopomofo {
+
+BackgroundWalker::BackgroundWalker(std::function<void()> notifier)
+    : notifier_(std::move(notifier)),
+      thread_(&BackgroundWalker::run, this) {}
+
+BackgroundWalker::~BackgroundWalker() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  condition_.notify_one();
+  thread_.join();
+}
+
+void BackgroundWalker::request(uint64_t generation,
+                               const Formosa::Gramambular::Grid& grid) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    latestGeneration_ = generation;
+    job_ = Job{generation, grid};
+    result_.reset();
+  }
+  condition_.notify_one();
+}
+
+void BackgroundWalker::cancel() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Makes the result of a walk in progress stale.
+  latestGeneration_++;
+  job_.reset();
+  result_.reset();
+}
+
+std::optional<BackgroundWalker::Result> BackgroundWalker::takeResult() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::optional<Result> result;
+  result.swap(result_);
+  return result;
+}
+
+void BackgroundWalker::run() {
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [this] { return stopping_ || job_.has_value(); });
+      if (stopping_) {
+        return;
+      }
+      job = std::move(*job_);
+      job_.reset();
+    }
+
+    Formosa::Gramambular::Walker walker(&job.grid);
+    std::vector<Formosa::Gramambular::NodeAnchor> walkedNodes =
+        walker.reverseWalk(job.grid.width());
+    std::reverse(walkedNodes.begin(), walkedNodes.end());
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (job.generation != latestGeneration_) {
+        continue;
+      }
+      result_ = Result{job.generation, std::move(job.grid),
+                       std::move(walkedNodes)};
+    }
+    notifier_();
+  }
+}
+
+}  // namespace McBopomofo
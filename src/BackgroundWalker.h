@@ -0,0 +1,94 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SRC_BACKGROUNDWALKER_H_
+#define SRC_BACKGROUNDWALKER_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "Gramambular.h"
+
+namespace McBopomofo {
+
+// Walks grids on a worker thread.
+//
+// Only the most recent request is walked. Each request carries a generation,
+// and a result is only kept if no newer request was made while it was being
+// walked, so stale walks are discarded.
+//
+// The grid to walk is copied when requested. Since a grid copies its spans
+// before modifying them when they are shared, the requester can keep changing
+// its own grid while the worker reads the copy.
+class BackgroundWalker {
+ public:
+  // The notifier is called on the worker thread when a result is ready. It is
+  // expected to arrange for takeResult() to be called on the main thread.
+  explicit BackgroundWalker(std::function<void()> notifier);
+  ~BackgroundWalker();
+
+  BackgroundWalker(const BackgroundWalker&) = delete;
+  BackgroundWalker& operator=(const BackgroundWalker&) = delete;
+
+  struct Result {
+    uint64_t generation;
+    // The walked grid; it keeps the spans the walked nodes point to alive.
+    Formosa::Gramambular::Grid grid;
+    // The walked nodes, in the forward order.
+    std::vector<Formosa::Gramambular::NodeAnchor> walkedNodes;
+  };
+
+  void request(uint64_t generation, const Formosa::Gramambular::Grid& grid);
+
+  // Discards the pending request and result, if any.
+  void cancel();
+
+  // Returns the result of the most recent request, if it is ready.
+  std::optional<Result> takeResult();
+
+ private:
+  void run();
+
+  struct Job {
+    uint64_t generation = 0;
+    Formosa::Gramambular::Grid grid;
+  };
+
+  std::function<void()> notifier_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::optional<Job> job_;
+  std::optional<Result> result_;
+  uint64_t latestGeneration_ = 0;
+  bool stopping_ = false;
+  std::thread thread_;
+};
+
+}  // namespace McBopomofo
+
+#endif  // SRC_BACKGROUNDWALKER_H_
@@ -0,0 +1,346 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+// A load generator for the conversion daemon. It opens a number of
+// connections, keeps a number of requests in flight on each, and reports the
+// throughput and the latency distribution. Without --socket, it serves the
+// requests with an in-process ConversionServer.
+//
+// Usage: McBopomofoDaemonBenchmark [--socket=PATH] [--data=PATH] [--workers=N]
+//            [--connections=N] [--pipeline=N] [--requests=N] [--seed=N]
+//            [--max-length=N] [--op=convert|candidates|mixed]
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ConversionProtocol.h"
+#include "ConversionServer.h"
+#include "McBopomofoLM.h"
+
+#ifndef MCBOPOMOFO_BENCHMARK_DATA_PATH
+#define MCBOPOMOFO_BENCHMARK_DATA_PATH "data/data.txt"
+#endif
+
+namespace McBopomofo {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::string socketPath;
+  std::string dataPath = MCBOPOMOFO_BENCHMARK_DATA_PATH;
+  size_t workers = std::max(1u, std::thread::hardware_concurrency());
+  size_t connections = 4;
+  size_t pipeline = 16;
+  size_t requests = 200000;
+  uint32_t seed = 5381;
+  size_t maxLength = 12;
+  std::string op = "mixed";
+};
+
+constexpr const char* kSyllables[] = {
+    "ㄋㄧˇ",   "ㄏㄠˇ",   "ㄨㄛˇ",  "ㄕˋ",    "ㄉㄜ˙",   "ㄓㄨㄥ",
+    "ㄍㄨㄛˊ", "ㄖㄣˊ",   "ㄧ",     "ㄅㄨˋ",  "ㄗㄞˋ",   "ㄧㄡˇ",
+    "ㄊㄚ",    "ㄓㄜˋ",   "ㄍㄜˋ",  "ㄕㄤˋ",  "ㄒㄧㄚˋ", "ㄉㄚˋ",
+    "ㄒㄧㄠˇ", "ㄌㄞˊ",   "ㄑㄩˋ",  "ㄕㄨㄛ", "ㄏㄨㄚˋ", "ㄒㄩㄝˊ",
+    "ㄕㄥ",    "ㄍㄨㄥ",  "ㄗㄨㄛˋ", "ㄉㄧㄢˋ", "ㄋㄠˇ",  "ㄖˋ",
+    "ㄅㄣˇ",   "ㄐㄧㄣ",  "ㄊㄧㄢ", "ㄑㄧˋ",  "ㄇㄟˇ",   "ㄌㄧˋ",
+    "ㄒㄧㄣ",  "ㄕˊ",     "ㄐㄧㄢ", "ㄊㄞˊ",  "ㄨㄢ",    "ㄉㄨㄟˋ"};
+
+struct Request {
+  ConversionProtocol::Opcode opcode;
+  std::string payload;
+};
+
+// Synthesizes a pool of requests that the connections cycle through.
+std::vector<Request> SynthesizeRequests(const Options& options) {
+  std::mt19937 random(options.seed);
+  std::uniform_int_distribution<size_t> length(
+      1, std::max<size_t>(1, options.maxLength));
+  std::uniform_int_distribution<size_t> pick(0, std::size(kSyllables) - 1);
+  std::vector<Request> requests;
+  for (size_t i = 0; i < 1024; i++) {
+    size_t n = length(random);
+    std::string readings;
+    for (size_t j = 0; j < n; j++) {
+      if (j > 0) {
+        readings += "-";
+      }
+      readings += kSyllables[pick(random)];
+    }
+
+    bool candidates = options.op == "candidates" ||
+                      (options.op == "mixed" && random() % 4 == 0);
+    Request request;
+    if (candidates) {
+      request.opcode = ConversionProtocol::Opcode::kCandidates;
+      ConversionProtocol::AppendU16(
+          &request.payload,
+          static_cast<uint16_t>(std::uniform_int_distribution<size_t>(
+              0, n - 1)(random)));
+    } else {
+      request.opcode = ConversionProtocol::Opcode::kConvert;
+    }
+    request.payload += readings;
+    requests.push_back(std::move(request));
+  }
+  return requests;
+}
+
+int Connect(const std::string& socketPath) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socketPath.size() >= sizeof(address.sun_path)) {
+    return -1;
+  }
+  memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd != -1 &&
+      connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) ==
+          -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool WriteAll(int fd, const std::string& data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t n = send(fd, data.data() + written, data.size() - written,
+                     MSG_NOSIGNAL);
+    if (n < 0 && errno != EINTR) {
+      return false;
+    }
+    if (n > 0) {
+      written += static_cast<size_t>(n);
+    }
+  }
+  return true;
+}
+
+struct ClientResult {
+  std::vector<double> latencies;
+  size_t errors = 0;
+  bool failed = false;
+};
+
+// Sends `count` requests over one connection, keeping up to `pipeline` of them
+// in flight.
+void RunClient(const Options& options, const std::vector<Request>& requests,
+               size_t first, size_t count, ClientResult* result) {
+  int fd = Connect(options.socketPath);
+  if (fd == -1) {
+    result->failed = true;
+    return;
+  }
+
+  std::vector<Clock::time_point> sentAt(count);
+  ConversionProtocol::FrameReader reader;
+  std::string output;
+  std::vector<char> buffer(64 * 1024);
+  size_t sent = 0;
+  size_t received = 0;
+  while (received < count) {
+    output.clear();
+    while (sent < count && sent - received < options.pipeline) {
+      const Request& request = requests[(first + sent) % requests.size()];
+      ConversionProtocol::AppendFrame(&output, static_cast<uint32_t>(sent),
+                                      static_cast<uint8_t>(request.opcode),
+                                      request.payload);
+      sentAt[sent] = Clock::now();
+      sent++;
+    }
+    if (!output.empty() && !WriteAll(fd, output)) {
+      result->failed = true;
+      break;
+    }
+
+    ssize_t n = read(fd, buffer.data(), buffer.size());
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      result->failed = true;
+      break;
+    }
+    auto now = Clock::now();
+    reader.append(buffer.data(), static_cast<size_t>(n));
+    ConversionProtocol::Frame frame;
+    while (reader.next(&frame)) {
+      if (frame.requestId >= count) {
+        result->failed = true;
+        break;
+      }
+      result->latencies.push_back(
+          std::chrono::duration<double, std::micro>(now -
+                                                    sentAt[frame.requestId])
+              .count());
+      if (frame.code != static_cast<uint8_t>(ConversionProtocol::Status::kOk)) {
+        result->errors++;
+      }
+      received++;
+    }
+    if (result->failed || reader.malformed()) {
+      result->failed = true;
+      break;
+    }
+  }
+  close(fd);
+}
+
+double Percentile(std::vector<double>* sorted, double p) {
+  if (sorted->empty()) {
+    return 0;
+  }
+  size_t index = static_cast<size_t>(p * static_cast<double>(sorted->size()));
+  return (*sorted)[std::min(index, sorted->size() - 1)];
+}
+
+bool ParseOptions(int argc, char* argv[], Options* options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+      return false;
+    }
+    std::string name = arg.substr(2, eq - 2);
+    std::string value = arg.substr(eq + 1);
+    if (name == "socket") {
+      options->socketPath = value;
+    } else if (name == "data") {
+      options->dataPath = value;
+    } else if (name == "workers") {
+      options->workers = std::max<size_t>(1, std::stoull(value));
+    } else if (name == "connections") {
+      options->connections = std::max<size_t>(1, std::stoull(value));
+    } else if (name == "pipeline") {
+      options->pipeline = std::max<size_t>(1, std::stoull(value));
+    } else if (name == "requests") {
+      options->requests = std::stoull(value);
+    } else if (name == "seed") {
+      options->seed = static_cast<uint32_t>(std::stoul(value));
+    } else if (name == "max-length") {
+      options->maxLength = std::stoull(value);
+    } else if (name == "op" && (value == "convert" || value == "candidates" ||
+                                value == "mixed")) {
+      options->op = value;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int RunDaemonBenchmark(int argc, char* argv[]) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    fprintf(stderr,
+            "usage: %s [--socket=PATH] [--data=PATH] [--workers=N] "
+            "[--connections=N] [--pipeline=N] [--requests=N] [--seed=N] "
+            "[--max-length=N] [--op=convert|candidates|mixed]\n",
+            argv[0]);
+    return 2;
+  }
+
+  std::unique_ptr<ConversionServer> server;
+  if (options.socketPath.empty()) {
+    auto lm = std::make_shared<McBopomofoLM>();
+    lm->setPhraseReplacementEnabled(false);
+    lm->setExternalConverterEnabled(false);
+    lm->loadLanguageModel(options.dataPath.c_str());
+    if (!lm->isDataModelLoaded()) {
+      fprintf(stderr, "failed to load the language model: %s\n",
+              options.dataPath.c_str());
+      return 2;
+    }
+    options.socketPath =
+        "/tmp/mcbopomofo-benchmark-" + std::to_string(getpid()) + ".sock";
+    server = std::make_unique<ConversionServer>(lm, options.workers);
+    if (!server->listen(options.socketPath)) {
+      fprintf(stderr, "failed to listen on %s: %s\n",
+              options.socketPath.c_str(), strerror(errno));
+      return 2;
+    }
+    server->start();
+  }
+
+  std::vector<Request> requests = SynthesizeRequests(options);
+  std::vector<ClientResult> results(options.connections);
+  std::vector<std::thread> clients;
+  auto start = Clock::now();
+  for (size_t i = 0; i < options.connections; i++) {
+    size_t count = options.requests / options.connections +
+                   (i < options.requests % options.connections ? 1 : 0);
+    clients.emplace_back(RunClient, std::cref(options), std::cref(requests),
+                         i * 101, count, &results[i]);
+  }
+  for (std::thread& client : clients) {
+    client.join();
+  }
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  std::vector<double> latencies;
+  size_t errors = 0;
+  for (const ClientResult& result : results) {
+    if (result.failed) {
+      fprintf(stderr, "a connection failed\n");
+      return 1;
+    }
+    latencies.insert(latencies.end(), result.latencies.begin(),
+                     result.latencies.end());
+    errors += result.errors;
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  printf("%zu requests (%s) over %zu connections, pipeline depth %zu\n",
+         latencies.size(), options.op.c_str(), options.connections,
+         options.pipeline);
+  printf("  %.0f requests/s  p50 %.1f us  p99 %.1f us  p99.9 %.1f us  "
+         "max %.1f us  errors %zu\n",
+         static_cast<double>(latencies.size()) / seconds,
+         Percentile(&latencies, 0.5), Percentile(&latencies, 0.99),
+         Percentile(&latencies, 0.999),
+         latencies.empty() ? 0 : latencies.back(), errors);
+  return 0;
+}
+
+}  // namespace McBopomofo
+
+int main(int argc, char* argv[]) {
+  return McBopomofo::RunDaemonBenchmark(argc, argv);
+}
@@ -0,0 +1,134 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "ConversionProtocol.h"
+
+#include <cstring>
+
+namespace McBopomofo::ConversionProtocol {
+
+namespace {
+
+void AppendU32(std::string* output, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    output->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+uint32_t ReadU32(const char* data) {
+  const auto* bytes = reinterpret_cast<const unsigned char*>(data);
+  return static_cast<uint32_t>(bytes[0]) |
+         static_cast<uint32_t>(bytes[1]) << 8 |
+         static_cast<uint32_t>(bytes[2]) << 16 |
+         static_cast<uint32_t>(bytes[3]) << 24;
+}
+
+}  // namespace
+
+void AppendFrame(std::string* output, uint32_t requestId, uint8_t code,
+                 std::string_view payload) {
+  AppendU32(output, static_cast<uint32_t>(kHeaderSize - 4 + payload.size()));
+  AppendU32(output, requestId);
+  output->push_back(static_cast<char>(code));
+  output->append(payload);
+}
+
+void AppendU16(std::string* output, uint16_t value) {
+  output->push_back(static_cast<char>(value & 0xff));
+  output->push_back(static_cast<char>(value >> 8));
+}
+
+void AppendString(std::string* output, std::string_view value) {
+  AppendU16(output, static_cast<uint16_t>(value.size()));
+  output->append(value);
+}
+
+bool PayloadReader::readU16(uint16_t* value) {
+  if (payload_.size() < 2) {
+    payload_ = std::string_view();
+    return false;
+  }
+  const auto* bytes = reinterpret_cast<const unsigned char*>(payload_.data());
+  *value = static_cast<uint16_t>(bytes[0] | bytes[1] << 8);
+  payload_.remove_prefix(2);
+  return true;
+}
+
+bool PayloadReader::readString(std::string* value) {
+  uint16_t length;
+  if (!readU16(&length)) {
+    return false;
+  }
+  if (payload_.size() < length) {
+    payload_ = std::string_view();
+    return false;
+  }
+  value->assign(payload_.data(), length);
+  payload_.remove_prefix(length);
+  return true;
+}
+
+void FrameReader::append(const char* data, size_t length) {
+  // Drop the consumed frames before growing the buffer.
+  if (offset_ > 0 && offset_ >= buffer_.size() / 2) {
+    buffer_.erase(0, offset_);
+    offset_ = 0;
+  }
+  buffer_.append(data, length);
+}
+
+bool FrameReader::next(Frame* frame) {
+  size_t available = buffer_.size() - offset_;
+  if (malformed_ || available < 4) {
+    return false;
+  }
+  const char* data = buffer_.data() + offset_;
+  uint32_t length = ReadU32(data);
+  if (length < kHeaderSize - 4 || length > kMaxFrameLength) {
+    malformed_ = true;
+    return false;
+  }
+  if (available < 4 + static_cast<size_t>(length)) {
+    return false;
+  }
+  frame->requestId = ReadU32(data + 4);
+  frame->code = static_cast<uint8_t>(data[8]);
+  frame->payload.assign(data + kHeaderSize, length - (kHeaderSize - 4));
+  offset_ += 4 + length;
+  return true;
+}
+
+std::vector<std::string> SplitReadings(std::string_view readings) {
+  std::vector<std::string> result;
+  while (!readings.empty()) {
+    size_t separator = readings.find('-');
+    result.emplace_back(readings.substr(0, separator));
+    if (separator == std::string_view::npos) {
+      break;
+    }
+    readings.remove_prefix(separator + 1);
+  }
+  return result;
+}
+
+}  // namespace McBopomofo::ConversionProtocol
@@ -0,0 +1,128 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SRC_CONVERSIONPROTOCOL_H_
+#define SRC_CONVERSIONPROTOCOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The binary protocol of the conversion daemon.
+//
+// A request frame is, with all integers little-endian:
+//
+//   u32 length     the number of bytes that follow this field
+//   u32 requestId  chosen by the client, echoed in the response
+//   u8  opcode     an Opcode
+//   ... payload
+//
+// A response frame has the same layout, with a Status in place of the opcode.
+// Requests may be pipelined; responses may arrive out of order, and are
+// matched to their requests by the request ID.
+//
+// Payloads:
+//
+//   kConvert      request:  the readings, joined by "-", e.g. "ㄋㄧˇ-ㄏㄠˇ"
+//                 response: u16 count, then for each walked node:
+//                           u16 spanning length (in readings), string value
+//   kCandidates   request:  u16 location, then the readings as above
+//                 response: u16 count, then count strings; the candidates of
+//                           the nodes crossing or ending at the location, the
+//                           longer phrases first
+//
+// A string is a u16 byte length followed by the UTF-8 bytes.
+namespace McBopomofo::ConversionProtocol {
+
+enum class Opcode : uint8_t {
+  kConvert = 1,
+  kCandidates = 2,
+};
+
+enum class Status : uint8_t {
+  kOk = 0,
+  kBadRequest = 1,
+  kUnknownOpcode = 2,
+};
+
+// The size of the length, request ID, and opcode or status fields.
+constexpr size_t kHeaderSize = 9;
+
+// Frames longer than this close the connection.
+constexpr size_t kMaxFrameLength = 64 * 1024;
+
+// Requests with more readings than this are rejected.
+constexpr size_t kMaxReadings = 256;
+
+struct Frame {
+  uint32_t requestId = 0;
+  // The opcode of a request, or the status of a response.
+  uint8_t code = 0;
+  std::string payload;
+};
+
+// Appends an encoded frame to the output.
+void AppendFrame(std::string* output, uint32_t requestId, uint8_t code,
+                 std::string_view payload);
+
+void AppendU16(std::string* output, uint16_t value);
+void AppendString(std::string* output, std::string_view value);
+
+// Reads fields from a payload. Each returns false, leaving the reader at the
+// end, if the payload is too short.
+class PayloadReader {
+ public:
+  explicit PayloadReader(std::string_view payload) : payload_(payload) {}
+  bool readU16(uint16_t* value);
+  bool readString(std::string* value);
+  std::string_view rest() const { return payload_; }
+
+ private:
+  std::string_view payload_;
+};
+
+// Accumulates bytes received from a stream and splits them into frames.
+class FrameReader {
+ public:
+  void append(const char* data, size_t length);
+
+  // Takes the next complete frame. Returns false if there is none yet.
+  bool next(Frame* frame);
+
+  // Returns true if the stream announced a frame longer than kMaxFrameLength.
+  bool malformed() const { return malformed_; }
+
+ private:
+  std::string buffer_;
+  size_t offset_ = 0;
+  bool malformed_ = false;
+};
+
+// Splits readings joined by "-". Returns an empty vector for empty input.
+std::vector<std::string> SplitReadings(std::string_view readings);
+
+}  // namespace McBopomofo::ConversionProtocol
+
+#endif  // SRC_CONVERSIONPROTOCOL_H_
@@ -0,0 +1,263 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "ConversionProtocol.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ConversionServer.h"
+#include "TestSupport.h"
+#include "gtest/gtest.h"
+
+namespace McBopomofo::ConversionProtocol {
+
+namespace {
+
+std::string EncodeFrame(uint32_t requestId, uint8_t code,
+                        const std::string& payload) {
+  std::string output;
+  AppendFrame(&output, requestId, code, payload);
+  return output;
+}
+
+// Only the length field of a frame header, little-endian.
+std::string EncodeLength(uint32_t length) {
+  std::string output;
+  AppendU16(&output, static_cast<uint16_t>(length & 0xffff));
+  AppendU16(&output, static_cast<uint16_t>(length >> 16));
+  return output;
+}
+
+}  // namespace
+
+TEST(ConversionProtocolTest, ReadsFrameSplitAcrossReads) {
+  std::string bytes =
+      EncodeFrame(42, static_cast<uint8_t>(Opcode::kConvert), "ㄋㄧˇ-ㄏㄠˇ");
+  FrameReader reader;
+  Frame frame;
+  // Every prefix, including ones that end inside the header, is incomplete.
+  for (size_t i = 0; i + 1 < bytes.size(); i++) {
+    reader.append(&bytes[i], 1);
+    EXPECT_FALSE(reader.next(&frame)) << "after " << i + 1 << " bytes";
+  }
+  reader.append(&bytes.back(), 1);
+  ASSERT_TRUE(reader.next(&frame));
+  EXPECT_EQ(frame.requestId, 42);
+  EXPECT_EQ(frame.code, static_cast<uint8_t>(Opcode::kConvert));
+  EXPECT_EQ(frame.payload, "ㄋㄧˇ-ㄏㄠˇ");
+  EXPECT_FALSE(reader.next(&frame));
+  EXPECT_FALSE(reader.malformed());
+}
+
+TEST(ConversionProtocolTest, ReadsPipelinedFramesInOrder) {
+  std::string bytes;
+  for (uint32_t id = 1; id <= 3; id++) {
+    AppendFrame(&bytes, id, static_cast<uint8_t>(Opcode::kConvert),
+                std::string(id, 'x'));
+  }
+  // The third frame is cut short and completed by the next read.
+  std::string rest = bytes.substr(bytes.size() - 2);
+  bytes.resize(bytes.size() - 2);
+
+  FrameReader reader;
+  reader.append(bytes.data(), bytes.size());
+  Frame frame;
+  for (uint32_t id = 1; id <= 2; id++) {
+    ASSERT_TRUE(reader.next(&frame));
+    EXPECT_EQ(frame.requestId, id);
+    EXPECT_EQ(frame.payload, std::string(id, 'x'));
+  }
+  EXPECT_FALSE(reader.next(&frame));
+
+  reader.append(rest.data(), rest.size());
+  ASSERT_TRUE(reader.next(&frame));
+  EXPECT_EQ(frame.requestId, 3);
+  EXPECT_EQ(frame.payload, "xxx");
+  EXPECT_FALSE(reader.next(&frame));
+}
+
+TEST(ConversionProtocolTest, ReadsEmptyPayload) {
+  std::string bytes = EncodeFrame(7, 9, "");
+  FrameReader reader;
+  reader.append(bytes.data(), bytes.size());
+  Frame frame;
+  ASSERT_TRUE(reader.next(&frame));
+  EXPECT_EQ(frame.requestId, 7);
+  EXPECT_EQ(frame.code, 9);
+  EXPECT_TRUE(frame.payload.empty());
+}
+
+TEST(ConversionProtocolTest, RejectsLengthShorterThanHeader) {
+  std::string bytes = EncodeLength(kHeaderSize - 5) + "abcd";
+  FrameReader reader;
+  reader.append(bytes.data(), bytes.size());
+  Frame frame;
+  EXPECT_FALSE(reader.next(&frame));
+  EXPECT_TRUE(reader.malformed());
+}
+
+TEST(ConversionProtocolTest, RejectsOversizedLength) {
+  FrameReader reader;
+  Frame frame;
+  // The length alone is enough to reject the frame, before its bytes arrive.
+  std::string bytes = EncodeLength(kMaxFrameLength + 1);
+  reader.append(bytes.data(), bytes.size());
+  EXPECT_FALSE(reader.next(&frame));
+  EXPECT_TRUE(reader.malformed());
+
+  // Nothing more is read from a malformed stream.
+  bytes = EncodeFrame(1, static_cast<uint8_t>(Opcode::kConvert), "ㄋㄧˇ");
+  reader.append(bytes.data(), bytes.size());
+  EXPECT_FALSE(reader.next(&frame));
+}
+
+TEST(ConversionProtocolTest, AcceptsMaximumLength) {
+  std::string payload(kMaxFrameLength - (kHeaderSize - 4), 'x');
+  std::string bytes = EncodeFrame(1, 0, payload);
+  FrameReader reader;
+  reader.append(bytes.data(), bytes.size());
+  Frame frame;
+  ASSERT_TRUE(reader.next(&frame));
+  EXPECT_EQ(frame.payload.size(), payload.size());
+  EXPECT_FALSE(reader.malformed());
+}
+
+TEST(ConversionProtocolTest, ReadsPayloadFields) {
+  std::string payload;
+  AppendU16(&payload, 513);
+  AppendString(&payload, "你好");
+  payload += "rest";
+
+  PayloadReader reader(payload);
+  uint16_t value = 0;
+  std::string text;
+  ASSERT_TRUE(reader.readU16(&value));
+  EXPECT_EQ(value, 513);
+  ASSERT_TRUE(reader.readString(&text));
+  EXPECT_EQ(text, "你好");
+  EXPECT_EQ(reader.rest(), "rest");
+}
+
+TEST(ConversionProtocolTest, RejectsTruncatedPayloadFields) {
+  std::string payload;
+  AppendString(&payload, "你好");
+  payload.pop_back();
+  PayloadReader reader(payload);
+  std::string text;
+  EXPECT_FALSE(reader.readString(&text));
+  EXPECT_TRUE(reader.rest().empty());
+
+  PayloadReader shortReader(std::string_view("x", 1));
+  uint16_t value = 0;
+  EXPECT_FALSE(shortReader.readU16(&value));
+  EXPECT_TRUE(shortReader.rest().empty());
+}
+
+TEST(ConversionProtocolTest, SplitsReadings) {
+  EXPECT_EQ(SplitReadings("ㄋㄧˇ-ㄏㄠˇ"),
+            (std::vector<std::string>{"ㄋㄧˇ", "ㄏㄠˇ"}));
+  EXPECT_EQ(SplitReadings("ㄋㄧˇ"), (std::vector<std::string>{"ㄋㄧˇ"}));
+  EXPECT_TRUE(SplitReadings("").empty());
+  EXPECT_EQ(SplitReadings("ㄋㄧˇ-"), (std::vector<std::string>{"ㄋㄧˇ"}));
+  EXPECT_EQ(SplitReadings("-ㄋㄧˇ"), (std::vector<std::string>{"", "ㄋㄧˇ"}));
+}
+
+class ConversionServerRequestTest : public ::testing::Test {
+ protected:
+  ConversionServerRequestTest() {
+    lm_->add("ㄋㄧˇ", "你", -5.0);
+    lm_->add("ㄏㄠˇ", "好", -5.0);
+    lm_->add("ㄋㄧˇ-ㄏㄠˇ", "你好", -2.0);
+  }
+
+  std::string handle(uint8_t opcode, const std::string& payload,
+                     Status* status) {
+    return server_.handleRequest(opcode, payload, status);
+  }
+
+  std::shared_ptr<TestLanguageModel> lm_ =
+      std::make_shared<TestLanguageModel>();
+  ConversionServer server_{lm_, 1};
+};
+
+TEST_F(ConversionServerRequestTest, Converts) {
+  Status status = Status::kBadRequest;
+  std::string result =
+      handle(static_cast<uint8_t>(Opcode::kConvert), "ㄋㄧˇ-ㄏㄠˇ", &status);
+  EXPECT_EQ(status, Status::kOk);
+
+  PayloadReader reader(result);
+  uint16_t count = 0;
+  uint16_t span = 0;
+  std::string value;
+  ASSERT_TRUE(reader.readU16(&count));
+  EXPECT_EQ(count, 1);
+  ASSERT_TRUE(reader.readU16(&span));
+  EXPECT_EQ(span, 2);
+  ASSERT_TRUE(reader.readString(&value));
+  EXPECT_EQ(value, "你好");
+  EXPECT_TRUE(reader.rest().empty());
+}
+
+TEST_F(ConversionServerRequestTest, RejectsUnknownOpcode) {
+  for (uint8_t opcode : {0, 3, 255}) {
+    Status status = Status::kOk;
+    std::string result = handle(opcode, "ㄋㄧˇ", &status);
+    EXPECT_EQ(status, Status::kUnknownOpcode) << static_cast<int>(opcode);
+    EXPECT_TRUE(result.empty());
+  }
+}
+
+TEST_F(ConversionServerRequestTest, RejectsBadRequests) {
+  Status status = Status::kOk;
+  handle(static_cast<uint8_t>(Opcode::kConvert), "", &status);
+  EXPECT_EQ(status, Status::kBadRequest);
+
+  status = Status::kOk;
+  handle(static_cast<uint8_t>(Opcode::kConvert), "ㄋㄧˇ--ㄏㄠˇ", &status);
+  EXPECT_EQ(status, Status::kBadRequest);
+
+  // The location of a candidates request is cut short.
+  status = Status::kOk;
+  handle(static_cast<uint8_t>(Opcode::kCandidates), "x", &status);
+  EXPECT_EQ(status, Status::kBadRequest);
+
+  std::string payload;
+  AppendU16(&payload, 3);
+  payload += "ㄋㄧˇ-ㄏㄠˇ";
+  status = Status::kOk;
+  handle(static_cast<uint8_t>(Opcode::kCandidates), payload, &status);
+  EXPECT_EQ(status, Status::kBadRequest);
+
+  std::string tooMany = "ㄋㄧˇ";
+  for (size_t i = 0; i < kMaxReadings; i++) {
+    tooMany += "-ㄋㄧˇ";
+  }
+  status = Status::kOk;
+  handle(static_cast<uint8_t>(Opcode::kConvert), tooMany, &status);
+  EXPECT_EQ(status, Status::kBadRequest);
+}
+
+}  // namespace McBopomofo::ConversionProtocol
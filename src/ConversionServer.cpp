@@ -0,0 +1,461 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "ConversionServer.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+namespace McBopomofo {
+
+namespace {
+
+// The I/O thread stops reading requests while this many are queued.
+constexpr size_t kMaxQueuedTasks = 4096;
+
+constexpr size_t kReadBufferSize = 64 * 1024;
+
+// A client is cut off once this much of the responses to it is left unread.
+constexpr size_t kMaxOutboundSize = 4 * 1024 * 1024;
+
+bool SetNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+bool IsValidReadings(const std::vector<std::string>& readings) {
+  if (readings.empty() ||
+      readings.size() > ConversionProtocol::kMaxReadings) {
+    return false;
+  }
+  return std::none_of(readings.begin(), readings.end(),
+                      [](const std::string& r) { return r.empty(); });
+}
+
+}  // namespace
+
+struct ConversionServer::Connection {
+  explicit Connection(int fd) : fd(fd) {}
+  ~Connection() { ::close(fd); }
+
+  // Sends as much of the data as the socket takes now, and keeps the rest for
+  // flush(), so that a worker never waits for a client that stops reading.
+  // Returns true if some is kept. A client that leaves too much unread is cut
+  // off. Called by the workers.
+  bool write(const std::string& data) {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    if (broken) {
+      return false;
+    }
+    size_t written = outbound.empty() ? send(data.data(), data.size()) : 0;
+    if (!broken && written < data.size()) {
+      outbound.append(data, written, std::string::npos);
+      if (outbound.size() > kMaxOutboundSize) {
+        shutDownLocked();
+      }
+    }
+    return !broken && !outbound.empty();
+  }
+
+  // Sends the data kept by write(). Called by the I/O thread when the socket
+  // is writable.
+  void flush() {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    if (!broken) {
+      outbound.erase(0, send(outbound.data(), outbound.size()));
+    }
+  }
+
+  bool hasOutbound() {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    return !broken && !outbound.empty();
+  }
+
+  bool isBroken() {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    return broken;
+  }
+
+  // Shuts the socket down, so that the client sees the connection closed, and
+  // drops the data not sent yet.
+  void shutDown() {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    shutDownLocked();
+  }
+
+  const int fd;
+  // Only used by the I/O thread.
+  ConversionProtocol::FrameReader reader;
+  // Set once no more requests are read, after which the connection is kept
+  // only until the pending requests are responded to.
+  std::atomic<bool> readClosed{false};
+  std::atomic<size_t> pendingRequests{0};
+
+ private:
+  // Returns the number of bytes the socket took. Requires writeMutex.
+  size_t send(const char* data, size_t size) {
+    size_t written = 0;
+    while (written < size) {
+      ssize_t n = ::send(fd, data + written, size - written, MSG_NOSIGNAL);
+      if (n >= 0) {
+        written += static_cast<size_t>(n);
+      } else if (errno != EINTR) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+          broken = true;
+        }
+        break;
+      }
+    }
+    return written;
+  }
+
+  void shutDownLocked() {
+    broken = true;
+    outbound.clear();
+    outbound.shrink_to_fit();
+    ::shutdown(fd, SHUT_RDWR);
+  }
+
+  std::mutex writeMutex;
+  std::string outbound;
+  bool broken = false;
+};
+
+ConversionServer::ConversionServer(
+    std::shared_ptr<Formosa::Gramambular::LanguageModel> lm,
+    size_t workerCount)
+    : lm_(std::move(lm)), workerCount_(std::max<size_t>(1, workerCount)) {}
+
+ConversionServer::~ConversionServer() {
+  stop();
+  for (int fd : wakeFds_) {
+    if (fd != -1) {
+      ::close(fd);
+    }
+  }
+  if (listenFd_ != -1) {
+    ::close(listenFd_);
+    ::unlink(socketPath_.c_str());
+  }
+}
+
+bool ConversionServer::listen(const std::string& socketPath) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socketPath.size() >= sizeof(address.sun_path)) {
+    errno = ENAMETOOLONG;
+    return false;
+  }
+  memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    return false;
+  }
+
+  // Replace the socket left over by a previous instance, but nothing else.
+  struct stat sb;
+  if (lstat(socketPath.c_str(), &sb) == 0 && S_ISSOCK(sb.st_mode)) {
+    ::unlink(socketPath.c_str());
+  }
+
+  if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1 ||
+      chmod(socketPath.c_str(), 0600) == -1 || ::listen(fd, SOMAXCONN) == -1 ||
+      !SetNonBlocking(fd) || pipe2(wakeFds_, O_CLOEXEC | O_NONBLOCK) == -1) {
+    int error = errno;
+    ::close(fd);
+    errno = error;
+    return false;
+  }
+
+  listenFd_ = fd;
+  socketPath_ = socketPath;
+  return true;
+}
+
+void ConversionServer::start() {
+  ioThread_ = std::thread(&ConversionServer::serveConnections, this);
+  for (size_t i = 0; i < workerCount_; i++) {
+    workers_.emplace_back(&ConversionServer::runWorker, this);
+  }
+}
+
+void ConversionServer::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) {
+      return;
+    }
+    stopping_ = true;
+    tasks_.clear();
+  }
+  taskQueued_.notify_all();
+  taskTaken_.notify_all();
+  wakeIOThread();
+
+  // The I/O thread shuts the open connections down before it returns.
+  if (ioThread_.joinable()) {
+    ioThread_.join();
+  }
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+}
+
+void ConversionServer::wakeIOThread() {
+  if (wakeFds_[1] != -1) {
+    char c = 0;
+    (void)::write(wakeFds_[1], &c, 1);
+  }
+}
+
+void ConversionServer::serveConnections() {
+  std::vector<std::shared_ptr<Connection>> connections;
+  pollConnections(&connections);
+  for (const auto& connection : connections) {
+    connection->shutDown();
+  }
+}
+
+void ConversionServer::pollConnections(
+    std::vector<std::shared_ptr<Connection>>* connections) {
+  std::vector<pollfd> pollFds;
+  std::vector<char> buffer(kReadBufferSize);
+
+  while (true) {
+    pollFds.clear();
+    pollFds.push_back({wakeFds_[0], POLLIN, 0});
+    pollFds.push_back({listenFd_, POLLIN, 0});
+    for (const auto& connection : *connections) {
+      short events = connection->readClosed ? 0 : POLLIN;
+      if (connection->hasOutbound()) {
+        events |= POLLOUT;
+      }
+      pollFds.push_back({connection->fd, events, 0});
+    }
+
+    if (poll(pollFds.data(), pollFds.size(), -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+
+    if (pollFds[0].revents != 0) {
+      char drained[64];
+      while (::read(wakeFds_[0], drained, sizeof(drained)) > 0) {
+      }
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stopping_) {
+        return;
+      }
+    }
+
+    if (pollFds[1].revents & POLLIN) {
+      int fd;
+      while ((fd = accept4(listenFd_, nullptr, nullptr,
+                           SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        connections->push_back(std::make_shared<Connection>(fd));
+      }
+    }
+
+    // Connections accepted above are not in pollFds yet.
+    for (size_t i = 0; i + 2 < pollFds.size(); i++) {
+      Connection* connection = (*connections)[i].get();
+      short revents = pollFds[i + 2].revents;
+      if (revents & (POLLOUT | POLLERR | POLLHUP)) {
+        connection->flush();
+      }
+      if (connection->readClosed || !(revents & (POLLIN | POLLERR | POLLHUP))) {
+        continue;
+      }
+
+      ssize_t n = ::read(connection->fd, buffer.data(), buffer.size());
+      if (n > 0) {
+        connection->reader.append(buffer.data(), static_cast<size_t>(n));
+      } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+        // The peer may have only shut down its writing side and still be
+        // waiting for the responses.
+        connection->readClosed = true;
+      }
+
+      ConversionProtocol::Frame frame;
+      while (connection->reader.next(&frame)) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        taskTaken_.wait(lock, [this] {
+          return stopping_ || tasks_.size() < kMaxQueuedTasks;
+        });
+        if (stopping_) {
+          return;
+        }
+        connection->pendingRequests++;
+        tasks_.push_back(Task{(*connections)[i], std::move(frame)});
+        lock.unlock();
+        taskQueued_.notify_one();
+      }
+      if (connection->reader.malformed()) {
+        connection->readClosed = true;
+      }
+    }
+
+    // Keep the connections until the responses to them are sent.
+    connections->erase(
+        std::remove_if(connections->begin(), connections->end(),
+                       [](const std::shared_ptr<Connection>& connection) {
+                         return connection->isBroken() ||
+                                (connection->readClosed &&
+                                 connection->pendingRequests == 0 &&
+                                 !connection->hasOutbound());
+                       }),
+        connections->end());
+  }
+}
+
+void ConversionServer::runWorker() {
+  std::string response;
+  while (true) {
+    Task task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      taskQueued_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+      if (stopping_) {
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    taskTaken_.notify_one();
+
+    Connection* connection = task.connection.get();
+    bool needsIOThread = false;
+    if (!connection->isBroken()) {
+      ConversionProtocol::Status status;
+      std::string payload =
+          handleRequest(task.frame.code, task.frame.payload, &status);
+      response.clear();
+      ConversionProtocol::AppendFrame(&response, task.frame.requestId,
+                                      static_cast<uint8_t>(status), payload);
+      needsIOThread = connection->write(response);
+    }
+    // The I/O thread flushes what the socket did not take, and lets go of the
+    // connection once it is done with.
+    if (--connection->pendingRequests == 0 && connection->readClosed) {
+      needsIOThread = true;
+    }
+    if (needsIOThread) {
+      wakeIOThread();
+    }
+  }
+}
+
+std::string ConversionServer::handleRequest(
+    uint8_t opcode, const std::string& payload,
+    ConversionProtocol::Status* status) {
+  using ConversionProtocol::Opcode;
+  using ConversionProtocol::Status;
+
+  auto op = static_cast<Opcode>(opcode);
+  if (op != Opcode::kConvert && op != Opcode::kCandidates) {
+    *status = Status::kUnknownOpcode;
+    return std::string();
+  }
+
+  ConversionProtocol::PayloadReader reader(payload);
+  uint16_t location = 0;
+  if (op == Opcode::kCandidates && !reader.readU16(&location)) {
+    *status = Status::kBadRequest;
+    return std::string();
+  }
+
+  std::vector<std::string> readings =
+      ConversionProtocol::SplitReadings(reader.rest());
+  if (!IsValidReadings(readings) || location > readings.size()) {
+    *status = Status::kBadRequest;
+    return std::string();
+  }
+
+  Formosa::Gramambular::BlockReadingBuilder builder(lm_.get());
+  // Phrases are keyed by their readings joined the same way as in a request.
+  builder.setJoinSeparator("-");
+  for (const std::string& reading : readings) {
+    builder.insertReadingAtCursor(reading);
+  }
+
+  std::string result;
+  *status = Status::kOk;
+  if (op == Opcode::kConvert) {
+    Formosa::Gramambular::Walker walker(&builder.grid());
+    std::vector<Formosa::Gramambular::NodeAnchor> walkedNodes =
+        walker.reverseWalk(builder.grid().width());
+    ConversionProtocol::AppendU16(&result,
+                                  static_cast<uint16_t>(walkedNodes.size()));
+    for (auto it = walkedNodes.rbegin(); it != walkedNodes.rend(); ++it) {
+      ConversionProtocol::AppendU16(&result,
+                                    static_cast<uint16_t>(it->spanningLength));
+      ConversionProtocol::AppendString(&result, it->currentKeyValue().value);
+    }
+    return result;
+  }
+
+  // Same order as the candidate panel: longer phrases first.
+  std::vector<Formosa::Gramambular::NodeAnchor> anchoredNodes =
+      builder.grid().nodesCrossingOrEndingAt(location);
+  std::stable_sort(anchoredNodes.begin(), anchoredNodes.end(),
+                   [](const Formosa::Gramambular::NodeAnchor& a,
+                      const Formosa::Gramambular::NodeAnchor& b) {
+                     return a.node->key().length() > b.node->key().length();
+                   });
+
+  // Leave out the candidates that do not fit into a frame.
+  std::string candidates;
+  uint16_t count = 0;
+  for (const Formosa::Gramambular::NodeAnchor& anchor : anchoredNodes) {
+    for (const Formosa::Gramambular::KeyValuePair& kv :
+         anchor.node->candidates()) {
+      if (count == UINT16_MAX ||
+          candidates.size() + kv.value.size() + 2 >
+              ConversionProtocol::kMaxFrameLength -
+                  ConversionProtocol::kHeaderSize - 2) {
+        break;
+      }
+      ConversionProtocol::AppendString(&candidates, kv.value);
+      count++;
+    }
+  }
+  ConversionProtocol::AppendU16(&result, count);
+  result += candidates;
+  return result;
+}
+
+}  // namespace McBopomofo
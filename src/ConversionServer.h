@@ -0,0 +1,110 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SRC_CONVERSIONSERVER_H_
+#define SRC_CONVERSIONSERVER_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ConversionProtocol.h"
+#include "Gramambular.h"
+
+namespace McBopomofo {
+
+// Serves conversion requests over a Unix domain socket; see
+// ConversionProtocol.h for the protocol.
+//
+// One I/O thread accepts connections and reads requests, which are handled by
+// a pool of workers. The workers send the responses without waiting for the
+// sockets, leaving what a socket does not take to the I/O thread. The workers
+// share the language model, which must not be changed while the server is
+// running.
+class ConversionServer {
+ public:
+  ConversionServer(std::shared_ptr<Formosa::Gramambular::LanguageModel> lm,
+                   size_t workerCount);
+  ~ConversionServer();
+
+  ConversionServer(const ConversionServer&) = delete;
+  ConversionServer& operator=(const ConversionServer&) = delete;
+
+  // Binds and listens on the socket path, replacing a stale socket file.
+  // Returns false and sets errno on failure.
+  bool listen(const std::string& socketPath);
+
+  // Starts the I/O thread and the workers.
+  void start();
+
+  // Stops serving, shuts the open connections down and joins the threads.
+  // Pending requests are dropped.
+  void stop();
+
+  // Handles one request. Exposed for the benchmark and for testing.
+  std::string handleRequest(uint8_t opcode, const std::string& payload,
+                            ConversionProtocol::Status* status);
+
+ private:
+  struct Connection;
+
+  struct Task {
+    std::shared_ptr<Connection> connection;
+    ConversionProtocol::Frame frame;
+  };
+
+  void serveConnections();
+  // Serves the connections until the server stops, leaving those still open.
+  void pollConnections(std::vector<std::shared_ptr<Connection>>* connections);
+  void runWorker();
+  // Makes the I/O thread poll again, such as for a connection that has
+  // responses left to send.
+  void wakeIOThread();
+
+  std::shared_ptr<Formosa::Gramambular::LanguageModel> lm_;
+  size_t workerCount_;
+  std::string socketPath_;
+  int listenFd_ = -1;
+  // Written to by stop() and the workers to wake up the I/O thread.
+  int wakeFds_[2] = {-1, -1};
+
+  std::mutex mutex_;
+  // Signaled when a task is queued or the server stops.
+  std::condition_variable taskQueued_;
+  // Signaled when the queue has room again.
+  std::condition_variable taskTaken_;
+  std::deque<Task> tasks_;
+  bool stopping_ = false;
+
+  std::thread ioThread_;
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace McBopomofo
+
+#endif  // SRC_CONVERSIONSERVER_H_
@@ -0,0 +1,223 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "AsyncLog.h"
+
+#include <chrono>
+#include <cstdio>
+#include <utility>
+
+namespace McBopomofo {
+
+namespace {
+
+int64_t NowInMilliseconds()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+const char* LevelName(LogLevel level)
+{
+    switch (level) {
+    case LogLevel::Debug:
+        return "D";
+    case LogLevel::Info:
+        return "I";
+    case LogLevel::Warn:
+        return "W";
+    case LogLevel::Error:
+        return "E";
+    }
+    return "";
+}
+
+void WriteToStderr(LogLevel level, const char* file, int line, const std::string& message)
+{
+    fprintf(stderr, "%s %s:%d] %s\n", LevelName(level), file, line, message.c_str());
+}
+
+}
+
+bool LogRateLimiter::allow(int64_t nowMilliseconds, uint64_t& suppressed)
+{
+    int64_t windowStart = m_windowStart.load(std::memory_order_relaxed);
+    if (windowStart == INT64_MIN || nowMilliseconds - windowStart >= IntervalMilliseconds) {
+        if (m_windowStart.compare_exchange_strong(windowStart, nowMilliseconds, std::memory_order_relaxed)) {
+            m_count.store(0, std::memory_order_relaxed);
+        }
+    }
+    if (m_count.fetch_add(1, std::memory_order_relaxed) < Burst) {
+        suppressed = m_suppressed.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+    m_suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+AsyncLog& AsyncLog::shared()
+{
+    static AsyncLog log;
+    return log;
+}
+
+AsyncLog::AsyncLog()
+    : m_cells(new Cell[QueueCapacity])
+    , m_writer(WriteToStderr)
+{
+    for (size_t i = 0; i < QueueCapacity; i++) {
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    m_thread = std::thread(&AsyncLog::run, this);
+}
+
+AsyncLog::~AsyncLog()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_queued.notify_one();
+    m_thread.join();
+}
+
+void AsyncLog::setWriter(Writer writer)
+{
+    std::lock_guard<std::mutex> lock(m_writerMutex);
+    m_writer = writer ? std::move(writer) : Writer(WriteToStderr);
+}
+
+void AsyncLog::log(LogLevel level, const char* file, int line, std::string message)
+{
+    if (!push(Entry { level, file, line, std::move(message) })) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    // The entry and m_sleeping are both sequentially consistent, so either the
+    // background thread sees the entry before it sleeps, or this sees it
+    // sleeping. Notifying under the mutex keeps the wakeup from falling
+    // between its check and its wait.
+    if (m_sleeping.load(std::memory_order_seq_cst)) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queued.notify_one();
+    }
+}
+
+void AsyncLog::flush()
+{
+    size_t target = m_enqueuePosition.load(std::memory_order_acquire);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_written.wait(lock, [this, target] {
+        return m_writtenPosition.load(std::memory_order_acquire) >= target;
+    });
+}
+
+// A bounded multi-producer queue, after Dmitry Vyukov's. Each cell's sequence
+// tells whether it is free to be written at a position, or holds the entry of
+// a position and is ready to be read.
+bool AsyncLog::push(Entry&& entry)
+{
+    size_t position = m_enqueuePosition.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+        cell = &m_cells[position % QueueCapacity];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        auto difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+        if (difference == 0) {
+            if (m_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return false;
+        } else {
+            position = m_enqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+    cell->entry = std::move(entry);
+    cell->sequence.store(position + 1, std::memory_order_seq_cst);
+    return true;
+}
+
+bool AsyncLog::hasEntry() const
+{
+    const Cell& cell = m_cells[m_dequeuePosition % QueueCapacity];
+    return cell.sequence.load(std::memory_order_seq_cst) == m_dequeuePosition + 1;
+}
+
+bool AsyncLog::pop(Entry& entry)
+{
+    Cell* cell = &m_cells[m_dequeuePosition % QueueCapacity];
+    size_t sequence = cell->sequence.load(std::memory_order_acquire);
+    if (sequence != m_dequeuePosition + 1) {
+        return false;
+    }
+    entry = std::move(cell->entry);
+    cell->sequence.store(m_dequeuePosition + QueueCapacity, std::memory_order_release);
+    m_dequeuePosition++;
+    return true;
+}
+
+void AsyncLog::run()
+{
+    Entry entry;
+    while (true) {
+        while (pop(entry)) {
+            {
+                std::lock_guard<std::mutex> lock(m_writerMutex);
+                m_writer(entry.level, entry.file, entry.line, entry.message);
+            }
+            m_writtenPosition.store(m_dequeuePosition, std::memory_order_release);
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_written.notify_all();
+        if (m_stopping && m_dequeuePosition == m_enqueuePosition.load(std::memory_order_acquire)) {
+            return;
+        }
+        m_sleeping.store(true, std::memory_order_seq_cst);
+        m_queued.wait(lock, [this] { return m_stopping || hasEntry(); });
+        m_sleeping.store(false, std::memory_order_relaxed);
+    }
+}
+
+LogMessage::LogMessage(LogLevel level, const char* file, int line, bool enabled, LogRateLimiter& limiter)
+    : m_level(level)
+    , m_file(file)
+    , m_line(line)
+{
+    if (enabled && limiter.allow(NowInMilliseconds(), m_suppressed)) {
+        m_stream.emplace();
+    }
+}
+
+void LogMessage::submit()
+{
+    if (m_suppressed > 0) {
+        *m_stream << " (" << m_suppressed << " similar messages suppressed)";
+    }
+    AsyncLog::shared().log(m_level, m_file, m_line, m_stream->str());
+    m_stream.reset();
+}
+
+} // namespace McBopomofo
@@ -0,0 +1,174 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef ASYNCLOG_H
+#define ASYNCLOG_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace McBopomofo {
+
+enum class LogLevel {
+    Debug,
+    Info,
+    Warn,
+    Error,
+};
+
+/// The rate limit of a logging call site. Each call site may log a burst of
+/// messages per interval; the messages beyond it are counted and reported with
+/// the next message logged.
+class LogRateLimiter {
+public:
+    static constexpr uint32_t Burst = 10;
+    static constexpr int64_t IntervalMilliseconds = 1000;
+
+    /// Returns true if a message may be logged now, and sets suppressed to the
+    /// number of messages suppressed since the last one logged.
+    bool allow(int64_t nowMilliseconds, uint64_t& suppressed);
+
+private:
+    std::atomic<int64_t> m_windowStart { INT64_MIN };
+    std::atomic<uint32_t> m_count { 0 };
+    std::atomic<uint64_t> m_suppressed { 0 };
+};
+
+/// An asynchronous log sink. Messages are put into a bounded lock-free queue
+/// and written by a background thread, so logging does not block the caller
+/// on I/O. Messages are dropped if the queue is full.
+class AsyncLog {
+public:
+    using Writer = std::function<void(LogLevel level, const char* file, int line, const std::string& message)>;
+
+    /// The number of messages the queue holds before dropping more.
+    static constexpr size_t QueueCapacity = 1024;
+
+    static AsyncLog& shared();
+
+    ~AsyncLog();
+
+    /// Sets the function that writes the messages, called on the background
+    /// thread. The default, also set by nullptr, writes to stderr.
+    void setWriter(Writer writer);
+
+    /// Sets the minimum level logged by MCBOPOMOFO_LOG.
+    void setLevel(LogLevel level) { m_level.store(level, std::memory_order_relaxed); }
+    bool isEnabled(LogLevel level) const { return level >= m_level.load(std::memory_order_relaxed); }
+
+    void log(LogLevel level, const char* file, int line, std::string message);
+
+    /// Blocks until the messages logged so far are written.
+    void flush();
+
+    /// The number of messages dropped because the queue was full.
+    uint64_t droppedCount() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+    AsyncLog();
+
+    struct Entry {
+        LogLevel level;
+        const char* file;
+        int line;
+        std::string message;
+    };
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        Entry entry;
+    };
+
+    bool push(Entry&& entry);
+    bool pop(Entry& entry);
+    bool hasEntry() const;
+    void run();
+
+    std::unique_ptr<Cell[]> m_cells;
+    std::atomic<size_t> m_enqueuePosition { 0 };
+    // Only used by the background thread.
+    size_t m_dequeuePosition { 0 };
+    std::atomic<size_t> m_writtenPosition { 0 };
+    std::atomic<uint64_t> m_dropped { 0 };
+    std::atomic<LogLevel> m_level { LogLevel::Info };
+
+    std::mutex m_writerMutex;
+    Writer m_writer;
+
+    // Only used to sleep and wake up, not to guard the queue.
+    std::mutex m_mutex;
+    std::condition_variable m_queued;
+    std::condition_variable m_written;
+    bool m_stopping { false };
+    // Set while the background thread waits for messages, so that only then
+    // do the callers take the mutex to wake it up.
+    std::atomic<bool> m_sleeping { false };
+    std::thread m_thread;
+};
+
+/// A message being built by the logging macros below. The message is only
+/// formatted if it is enabled and not rate limited.
+class LogMessage {
+public:
+    LogMessage(LogLevel level, const char* file, int line, bool enabled, LogRateLimiter& limiter);
+
+    bool pending() const { return m_stream.has_value(); }
+    std::ostringstream& stream() { return *m_stream; }
+    void submit();
+
+private:
+    LogLevel m_level;
+    const char* m_file;
+    int m_line;
+    uint64_t m_suppressed { 0 };
+    std::optional<std::ostringstream> m_stream;
+};
+
+} // namespace McBopomofo
+
+// Logs a message built with operator<< if enabled is true, e.g.
+// MCBOPOMOFO_ASYNC_LOG(level, enabled) << "loaded " << path. The operands are
+// not evaluated if the message is not logged.
+#define MCBOPOMOFO_ASYNC_LOG(level, enabled)                                                   \
+    for (::McBopomofo::LogMessage mcbopomofoLogMessage((level), __FILE__, __LINE__, (enabled), \
+             []() -> ::McBopomofo::LogRateLimiter& {                                           \
+                 static ::McBopomofo::LogRateLimiter limiter;                                  \
+                 return limiter;                                                               \
+             }());                                                                             \
+         mcbopomofoLogMessage.pending(); mcbopomofoLogMessage.submit())                        \
+    mcbopomofoLogMessage.stream()
+
+// Logs a message at the given level, e.g. MCBOPOMOFO_LOG(Warn) << "...".
+#define MCBOPOMOFO_LOG(level)                         \
+    MCBOPOMOFO_ASYNC_LOG(::McBopomofo::LogLevel::level, \
+        ::McBopomofo::AsyncLog::shared().isEnabled(::McBopomofo::LogLevel::level))
+
+#endif
@@ -58,6 +58,9 @@ class BlockReadingBuilder {
 
   Grid& grid();
 
+  // 最多使用六個字組成一個詞
+  static const size_t MaximumBuildSpanLength = 6;
+
  protected:
   void build();
 
@@ -65,9 +68,6 @@ class BlockReadingBuilder {
                                 std::vector<std::string>::const_iterator end,
                                 const std::string& separator);
 
-  // 最多使用六個字組成一個詞
-  static const size_t MaximumBuildSpanLength = 6;
-
   size_t m_cursorIndex = 0;
   std::vector<std::string> m_readings;
 
@@ -176,18 +176,33 @@ inline void BlockReadingBuilder::build() {
     end = m_readings.size();
   }
 
+  // Most of the keys built here already have nodes. The keys are joined into
+  // one buffer and looked up without a copy, and node keys are interned, so
+  // those keys take neither allocations nor string comparisons.
+  std::string combinedReading;
+  combinedReading.reserve(MaximumBuildSpanLength * 16);
   for (size_t p = begin; p < end; p++) {
+    combinedReading.clear();
     for (size_t q = 1; q <= MaximumBuildSpanLength && p + q <= end; q++) {
-      std::string combinedReading = Join(
-          m_readings.begin() + p, m_readings.begin() + p + q, m_joinSeparator);
-      if (!m_grid.hasNodeAtLocationSpanningLengthMatchingKey(p, q,
-                                                             combinedReading)) {
-        std::vector<Unigram> unigrams = m_LM->unigramsForKey(combinedReading);
-
-        if (unigrams.size() > 0) {
-          Node n(combinedReading, unigrams, std::vector<Bigram>());
-          m_grid.insertNode(n, p, q);
-        }
+      if (q > 1) {
+        combinedReading += m_joinSeparator;
+      }
+      combinedReading += m_readings[p + q - 1];
+
+      const std::string* internedKey =
+          m_grid.keyPool().find(combinedReading);
+      if (internedKey &&
+          m_grid.hasNodeAtLocationSpanningLengthMatchingKey(p, q,
+                                                            internedKey)) {
+        continue;
+      }
+
+      // The walker only needs the top unigram; the node asks for the others
+      // when its candidates are needed.
+      Unigram topUnigram;
+      if (m_LM->topUnigramForKey(combinedReading, &topUnigram)) {
+        Node n(m_grid.keyPool().intern(combinedReading), topUnigram, m_LM);
+        m_grid.insertNode(n, p, q);
       }
     }
   }
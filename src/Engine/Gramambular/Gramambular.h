@@ -35,6 +35,7 @@
 #include "LanguageModel.h"
 #include "Node.h"
 #include "NodeAnchor.h"
+#include "ScoreOverlay.h"
 #include "Span.h"
 #include "Unigram.h"
 #include "Walker.h"
@@ -28,16 +28,26 @@
 #ifndef GRID_H_
 #define GRID_H_
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "KeyPool.h"
 #include "NodeAnchor.h"
+#include "ScoreOverlay.h"
 #include "Span.h"
 
 namespace Formosa {
 namespace Gramambular {
 
+// Spans are shared between copies of a grid and are only copied when a copy
+// is about to modify one of them (copy-on-write). Copying a grid is therefore
+// cheap, and a copy can be kept as a snapshot of the grid, including the
+// candidates fixed in its nodes.
 class Grid {
  public:
   void clear();
@@ -45,11 +55,25 @@ class Grid {
   bool hasNodeAtLocationSpanningLengthMatchingKey(size_t location,
                                                   size_t spanningLength,
                                                   const std::string& key);
+  // Same as above, with a key interned by the grid's KeyPool.
+  bool hasNodeAtLocationSpanningLengthMatchingKey(
+      size_t location, size_t spanningLength, const std::string* internedKey);
+
+  // The pool that interns the keys of the nodes inserted into the grid. It is
+  // shared with the copies of the grid, and dropped when the grid is cleared.
+  KeyPool& keyPool();
 
   void expandGridByOneAtLocation(size_t location);
   void shrinkGridByOneAtLocation(size_t location);
 
   size_t width() const;
+
+  // Changes whenever a node is added or removed, so that what is derived from
+  // the nodes, such as candidate lists, can be cached. A copy of the grid has
+  // the same generation until either of them changes. Fixing or overriding a
+  // candidate does not change the generation.
+  uint64_t generation() const;
+
   std::vector<NodeAnchor> nodesEndingAt(size_t location);
   std::vector<NodeAnchor> nodesCrossingOrEndingAt(size_t location);
 
@@ -69,13 +93,66 @@ class Grid {
                                              const std::string& value,
                                              float overridingScore);
 
+  // Similar to overrideNodeScoreForSelectedCandidate, but the nodes are left
+  // unchanged: the score overlay evaluates them as the candidate with the
+  // overriding score in walks instead, and nodesEndingAt() reports them so.
+  // Other overlapping nodes, and their adjustments, are left as they are, and
+  // so are nodes with a fixed candidate.
+  void overlayScoreForSelectedCandidate(size_t location,
+                                        const std::string& value,
+                                        double overridingScore);
+
+  // The best path to each location, as last found by Walker. Changing the
+  // nodes or their scores invalidates the paths to the locations after the
+  // change, so walks only walk again from the first location whose path may
+  // have changed.
+  struct BestPaths {
+    // For each location, the last node of the best path ending there, and
+    // the path's score. The paths to locations up to validLocation are valid.
+    std::vector<NodeAnchor> lastNodes;
+    std::vector<double> scores;
+    size_t validLocation = 0;
+  };
+  BestPaths& bestPaths();
+
   std::string dumpDOT();
 
  protected:
-  std::vector<Span> m_spans;
+  // Returns the span at the location for modification, copying it first if it
+  // is shared with another grid.
+  Span& mutableSpanAt(size_t location);
+
+  // Makes sure none of the spans that have nodes crossing or ending at the
+  // location is shared with another grid.
+  void unshareSpansCrossingOrEndingAt(size_t location);
+
+  // Generations are unique among all grids, so that the generation of a grid
+  // never matches what was cached for another one.
+  static uint64_t NextGeneration();
+
+  // Sets the overlaid candidate and score of the anchor, if any.
+  void applyScoreOverlay(NodeAnchor* anchor) const;
+
+  // Invalidates the best paths to the locations after the location, which
+  // may now pass through nodes starting there.
+  void invalidateBestPathsAfter(size_t location);
+
+  std::vector<std::shared_ptr<Span>> m_spans;
+  uint64_t m_generation = 0;
+  ScoreOverlay m_scoreOverlay;
+  BestPaths m_bestPaths;
+  // Created when the first key is interned.
+  std::shared_ptr<KeyPool> m_keyPool;
 };
 
-inline void Grid::clear() { m_spans.clear(); }
+inline void Grid::clear() {
+  m_spans.clear();
+  // The copies of the grid keep the pool for their nodes.
+  m_keyPool.reset();
+  m_scoreOverlay.clear();
+  m_generation = NextGeneration();
+  invalidateBestPathsAfter(0);
+}
 
 inline void Grid::insertNode(const Node& node, size_t location,
                              size_t spanningLength) {
@@ -83,35 +160,58 @@ inline void Grid::insertNode(const Node& node, size_t location,
     size_t diff = location - m_spans.size() + 1;
 
     for (size_t i = 0; i < diff; i++) {
-      m_spans.push_back(Span());
+      m_spans.push_back(std::make_shared<Span>());
     }
   }
 
-  m_spans[location].insertNodeOfLength(node, spanningLength);
+  mutableSpanAt(location).insertNodeOfLength(node, spanningLength);
+  m_scoreOverlay.erase(location, spanningLength);
+  m_generation = NextGeneration();
+  invalidateBestPathsAfter(location);
 }
 
 inline bool Grid::hasNodeAtLocationSpanningLengthMatchingKey(
     size_t location, size_t spanningLength, const std::string& key) {
-  if (location > m_spans.size()) {
+  const std::string* internedKey = m_keyPool ? m_keyPool->find(key) : nullptr;
+  return internedKey && hasNodeAtLocationSpanningLengthMatchingKey(
+                            location, spanningLength, internedKey);
+}
+
+inline bool Grid::hasNodeAtLocationSpanningLengthMatchingKey(
+    size_t location, size_t spanningLength, const std::string* internedKey) {
+  if (location >= m_spans.size()) {
     return false;
   }
 
-  const Node* n = m_spans[location].nodeOfLength(spanningLength);
+  const Node* n = m_spans[location]->nodeOfLength(spanningLength);
   if (!n) {
     return false;
   }
 
-  return key == n->key();
+  // Node keys are interned, so equal keys are the same string.
+  return &n->key() == internedKey;
+}
+
+inline KeyPool& Grid::keyPool() {
+  if (!m_keyPool) {
+    m_keyPool = std::make_shared<KeyPool>();
+  }
+  return *m_keyPool;
 }
 
 inline void Grid::expandGridByOneAtLocation(size_t location) {
+  m_generation = NextGeneration();
+  invalidateBestPathsAfter(location);
+  m_scoreOverlay.expandByOneAtLocation(location);
   if (!location || location == m_spans.size()) {
-    m_spans.insert(m_spans.begin() + location, Span());
+    m_spans.insert(m_spans.begin() + location, std::make_shared<Span>());
   } else {
-    m_spans.insert(m_spans.begin() + location, Span());
+    m_spans.insert(m_spans.begin() + location, std::make_shared<Span>());
     for (size_t i = 0; i < location; i++) {
       // zaps overlapping spans
-      m_spans[i].removeNodeOfLengthGreaterThan(location - i);
+      if (m_spans[i]->maximumLength() > location - i) {
+        mutableSpanAt(i).removeNodeOfLengthGreaterThan(location - i);
+      }
     }
   }
 }
@@ -122,20 +222,27 @@ inline void Grid::shrinkGridByOneAtLocation(size_t location) {
   }
 
   m_spans.erase(m_spans.begin() + location);
+  m_generation = NextGeneration();
+  invalidateBestPathsAfter(location);
+  m_scoreOverlay.shrinkByOneAtLocation(location);
   for (size_t i = 0; i < location; i++) {
     // zaps overlapping spans
-    m_spans[i].removeNodeOfLengthGreaterThan(location - i);
+    if (m_spans[i]->maximumLength() > location - i) {
+      mutableSpanAt(i).removeNodeOfLengthGreaterThan(location - i);
+    }
   }
 }
 
 inline size_t Grid::width() const { return m_spans.size(); }
 
+inline uint64_t Grid::generation() const { return m_generation; }
+
 inline std::vector<NodeAnchor> Grid::nodesEndingAt(size_t location) {
   std::vector<NodeAnchor> result;
 
   if (m_spans.size() && location <= m_spans.size()) {
     for (size_t i = 0; i < location; i++) {
-      Span& span = m_spans[i];
+      Span& span = *m_spans[i];
       if (i + span.maximumLength() >= location) {
         Node* np = span.nodeOfLength(location - i);
         if (np) {
@@ -143,6 +250,7 @@ inline std::vector<NodeAnchor> Grid::nodesEndingAt(size_t location) {
           na.node = np;
           na.location = i;
           na.spanningLength = location - i;
+          applyScoreOverlay(&na);
 
           result.push_back(na);
         }
@@ -158,7 +266,7 @@ inline std::vector<NodeAnchor> Grid::nodesCrossingOrEndingAt(size_t location) {
 
   if (m_spans.size() && location <= m_spans.size()) {
     for (size_t i = 0; i < location; i++) {
-      Span& span = m_spans[i];
+      Span& span = *m_spans[i];
 
       if (i + span.maximumLength() >= location) {
         for (size_t j = 1, m = span.maximumLength(); j <= m; j++) {
@@ -187,6 +295,8 @@ inline std::vector<NodeAnchor> Grid::nodesCrossingOrEndingAt(size_t location) {
 // the supplied string value.
 inline NodeAnchor Grid::fixNodeSelectedCandidate(size_t location,
                                                  const std::string& value) {
+  unshareSpansCrossingOrEndingAt(location);
+  m_scoreOverlay.eraseCrossingOrEndingAt(location);
   std::vector<NodeAnchor> nodes = nodesCrossingOrEndingAt(location);
   NodeAnchor node;
   for (auto nodeAnchor : nodes) {
@@ -208,6 +318,7 @@ inline NodeAnchor Grid::fixNodeSelectedCandidate(size_t location,
 
 inline void Grid::overrideNodeScoreForSelectedCandidate(
     size_t location, const std::string& value, float overridingScore) {
+  unshareSpansCrossingOrEndingAt(location);
   std::vector<NodeAnchor> nodes = nodesCrossingOrEndingAt(location);
   for (auto nodeAnchor : nodes) {
     auto candidates = nodeAnchor.node->candidates();
@@ -225,6 +336,77 @@ inline void Grid::overrideNodeScoreForSelectedCandidate(
   }
 }
 
+inline void Grid::overlayScoreForSelectedCandidate(size_t location,
+                                                   const std::string& value,
+                                                   double overridingScore) {
+  if (location > m_spans.size()) {
+    return;
+  }
+  for (size_t i = 0; i < location; i++) {
+    Span& span = *m_spans[i];
+    for (size_t j = location - i, m = span.maximumLength(); j <= m; j++) {
+      const Node* node = span.nodeOfLength(j);
+      if (!node || node->isCandidateFixed()) {
+        continue;
+      }
+      for (const KeyValuePair& candidate : node->candidates()) {
+        if (candidate.value == value) {
+          m_scoreOverlay.set(i, j, value, overridingScore);
+          invalidateBestPathsAfter(i);
+          break;
+        }
+      }
+    }
+  }
+}
+
+inline void Grid::applyScoreOverlay(NodeAnchor* anchor) const {
+  const ScoreOverlay::Adjustment* adjustment =
+      m_scoreOverlay.find(anchor->location, anchor->spanningLength);
+  if (!adjustment || anchor->node->isCandidateFixed()) {
+    return;
+  }
+  for (const KeyValuePair& candidate : anchor->node->candidates()) {
+    if (candidate.value == adjustment->value) {
+      anchor->overlaidKeyValue = &candidate;
+      anchor->overlaidScore = adjustment->score;
+      return;
+    }
+  }
+}
+
+inline Grid::BestPaths& Grid::bestPaths() { return m_bestPaths; }
+
+inline void Grid::invalidateBestPathsAfter(size_t location) {
+  m_bestPaths.validLocation = std::min(m_bestPaths.validLocation, location);
+}
+
+inline uint64_t Grid::NextGeneration() {
+  static std::atomic<uint64_t> nextGeneration{1};
+  return nextGeneration.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline Span& Grid::mutableSpanAt(size_t location) {
+  // The nodes of the span may be changed, or copied elsewhere.
+  invalidateBestPathsAfter(location);
+  std::shared_ptr<Span>& span = m_spans[location];
+  if (span.use_count() > 1) {
+    span = std::make_shared<Span>(*span);
+  }
+  return *span;
+}
+
+inline void Grid::unshareSpansCrossingOrEndingAt(size_t location) {
+  if (location > m_spans.size()) {
+    return;
+  }
+  for (size_t i = 0; i < location; i++) {
+    if (i + m_spans[i]->maximumLength() >= location) {
+      mutableSpanAt(i);
+    }
+  }
+}
+
 }  // namespace Gramambular
 }  // namespace Formosa
 
@@ -0,0 +1,86 @@
+//
+// KeyPool.h
+//
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+#ifndef KEYPOOL_H_
+#define KEYPOOL_H_
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace Formosa {
+namespace Gramambular {
+
+// Interns the keys of nodes. A node only holds the address of its key, so the
+// nodes copied along with the spans of a grid do not copy their keys, and two
+// keys interned by the same pool are equal if and only if their addresses are.
+//
+// Each grid has its own pool, shared with its copies, and a cleared grid starts
+// a new one, so the keys are released along with the last grid that has nodes
+// of them. A pool is only changed by the thread that builds the grid, and is
+// not locked; copies of the grid walked on other threads only read the keys,
+// which never move.
+class KeyPool {
+ public:
+  // Returns the interned copy of the key, interning it first if needed.
+  const std::string* intern(std::string_view key);
+
+  // Returns the interned copy of the key, or nullptr if it has never been
+  // interned. Does not allocate.
+  const std::string* find(std::string_view key) const;
+
+  // The number of keys interned.
+  size_t size() const;
+
+ protected:
+  // The keys of the map point into the strings they map to.
+  std::unordered_map<std::string_view, std::unique_ptr<std::string>> m_keys;
+};
+
+inline const std::string* KeyPool::intern(std::string_view key) {
+  auto f = m_keys.find(key);
+  if (f != m_keys.end()) {
+    return f->second.get();
+  }
+  auto interned = std::make_unique<std::string>(key);
+  const std::string* result = interned.get();
+  m_keys.emplace(std::string_view(*result), std::move(interned));
+  return result;
+}
+
+inline const std::string* KeyPool::find(std::string_view key) const {
+  auto f = m_keys.find(key);
+  return f == m_keys.end() ? nullptr : f->second.get();
+}
+
+inline size_t KeyPool::size() const { return m_keys.size(); }
+}  // namespace Gramambular
+}  // namespace Formosa
+
+#endif
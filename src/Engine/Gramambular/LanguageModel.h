@@ -28,6 +28,7 @@
 #ifndef LANGUAGEMODEL_H_
 #define LANGUAGEMODEL_H_
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -45,6 +46,35 @@ class LanguageModel {
       const std::string& preceedingKey, const std::string& key) = 0;
   virtual const std::vector<Unigram> unigramsForKey(const std::string& key) = 0;
   virtual bool hasUnigramsForKey(const std::string& key) = 0;
+
+  // Returns true if the key has a unigram of the value. Language models that
+  // can tell without building the unigrams override this.
+  virtual bool hasKeyValue(const std::string& key, const std::string& value) {
+    if (!hasUnigramsForKey(key)) {
+      return false;
+    }
+    for (const Unigram& unigram : unigramsForKey(key)) {
+      if (unigram.keyValue.value == value) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Sets the unigram of the key with the highest score, the first one of them
+  // in the order of unigramsForKey() if several have it, and returns true.
+  // Returns false if the key has no unigrams. Language models that can find it
+  // without building all the unigrams override this.
+  virtual bool topUnigramForKey(const std::string& key, Unigram* unigram) {
+    std::vector<Unigram> unigrams = unigramsForKey(key);
+    if (unigrams.empty()) {
+      return false;
+    }
+    *unigram = *std::max_element(
+        unigrams.begin(), unigrams.end(),
+        [](const Unigram& a, const Unigram& b) { return a.score < b.score; });
+    return true;
+  }
 };
 }  // namespace Gramambular
 }  // namespace Formosa
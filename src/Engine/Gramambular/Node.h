@@ -30,6 +30,8 @@
 
 #include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <algorithm>
@@ -44,6 +46,14 @@ class Node {
   Node() {}
   Node(const std::string& key, const std::vector<Unigram>& unigrams,
        const std::vector<Bigram>& bigrams);
+  // Creates a node that only holds the top unigram of the key, as set by
+  // LanguageModel::topUnigramForKey(). The other unigrams are asked from the
+  // language model when first needed, such as to list the candidates, and the
+  // top unigram stays the first of them. The key is interned by the KeyPool of
+  // the grid the node is inserted into. The language model and the pool must
+  // outlive the node and its copies.
+  Node(const std::string* internedKey, const Unigram& topUnigram,
+       LanguageModel* lm);
 
   void primeNodeWithPreceedingKeyValues(
       const std::vector<KeyValuePair>& keyValues);
@@ -61,14 +71,31 @@ class Node {
   double highestUnigramScore() const;
 
  protected:
-  const LanguageModel* m_LM;
-
-  std::string m_key;
+  // The unigrams sorted by score and what is derived from them. They are
+  // loaded at most once and shared by the copies of a node.
+  struct Unigrams {
+    std::once_flag loaded;
+    std::vector<Unigram> unigrams;
+    std::vector<KeyValuePair> candidates;
+    std::map<std::string, size_t> valueUnigramIndexMap;
+  };
+
+  // Returns the unigrams, loading them first if needed.
+  const Unigrams& unigrams() const;
+
+  LanguageModel* m_LM = nullptr;
+
+  // Interned by a KeyPool, or owned by the node, or nullptr for the empty key.
+  const std::string* m_key = nullptr;
+  std::shared_ptr<const std::string> m_ownedKey;
   double m_score = 0.0;
 
-  std::vector<Unigram> m_unigrams;
-  std::vector<KeyValuePair> m_candidates;
-  std::map<std::string, size_t> m_valueUnigramIndexMap;
+  // The first of the unigrams, known without loading them.
+  bool m_hasTopUnigram = false;
+  std::string m_topValue;
+  double m_topScore = 0.0;
+
+  std::shared_ptr<Unigrams> m_unigrams;
   std::map<KeyValuePair, std::vector<Bigram> > m_preceedingGramBigramMap;
 
   bool m_candidateFixed = false;
@@ -78,33 +105,43 @@ class Node {
 };
 
 inline std::ostream& operator<<(std::ostream& stream, const Node& node) {
-  stream << "(node,key:" << node.m_key
+  stream << "(node,key:" << node.key()
          << ",fixed:" << (node.m_candidateFixed ? "true" : "false")
          << ",selected:" << node.m_selectedUnigramIndex << ","
-         << node.m_unigrams << ")";
+         << node.unigrams().unigrams << ")";
   return stream;
 }
 
 inline Node::Node(const std::string& key, const std::vector<Unigram>& unigrams,
                   const std::vector<Bigram>& bigrams)
-    : m_key(key),
+    : m_key(nullptr),
+      m_ownedKey(std::make_shared<const std::string>(key)),
       m_score(0.0),
-      m_unigrams(unigrams),
+      m_unigrams(std::make_shared<Unigrams>()),
       m_candidateFixed(false),
       m_selectedUnigramIndex(0) {
-  stable_sort(m_unigrams.begin(), m_unigrams.end(), Unigram::ScoreCompare);
-
-  if (m_unigrams.size()) {
-    m_score = m_unigrams[0].score;
-  }
-
-  size_t i = 0;
-  for (std::vector<Unigram>::const_iterator ui = m_unigrams.begin();
-       ui != m_unigrams.end(); ++ui) {
-    m_valueUnigramIndexMap[(*ui).keyValue.value] = i;
-    i++;
+  m_key = m_ownedKey.get();
+  std::call_once(m_unigrams->loaded, [&] {
+    m_unigrams->unigrams = unigrams;
+    stable_sort(m_unigrams->unigrams.begin(), m_unigrams->unigrams.end(),
+                Unigram::ScoreCompare);
+
+    size_t i = 0;
+    for (std::vector<Unigram>::const_iterator ui =
+             m_unigrams->unigrams.begin();
+         ui != m_unigrams->unigrams.end(); ++ui) {
+      m_unigrams->valueUnigramIndexMap[(*ui).keyValue.value] = i;
+      i++;
+
+      m_unigrams->candidates.push_back((*ui).keyValue);
+    }
+  });
 
-    m_candidates.push_back((*ui).keyValue);
+  if (m_unigrams->unigrams.size()) {
+    m_hasTopUnigram = true;
+    m_topValue = m_unigrams->unigrams[0].keyValue.value;
+    m_topScore = m_unigrams->unigrams[0].score;
+    m_score = m_topScore;
   }
 
   for (std::vector<Bigram>::const_iterator bi = bigrams.begin();
@@ -113,6 +150,50 @@ inline Node::Node(const std::string& key, const std::vector<Unigram>& unigrams,
   }
 }
 
+inline Node::Node(const std::string* internedKey, const Unigram& topUnigram,
+                  LanguageModel* lm)
+    : m_LM(lm),
+      m_key(internedKey),
+      m_score(topUnigram.score),
+      m_hasTopUnigram(true),
+      m_topValue(topUnigram.keyValue.value),
+      m_topScore(topUnigram.score),
+      m_unigrams(std::make_shared<Unigrams>()) {}
+
+inline const Node::Unigrams& Node::unigrams() const {
+  static const Unigrams emptyUnigrams;
+  if (!m_unigrams) {
+    return emptyUnigrams;
+  }
+
+  std::call_once(m_unigrams->loaded, [this] {
+    Unigrams& loaded = *m_unigrams;
+    loaded.unigrams = m_LM->unigramsForKey(key());
+    stable_sort(loaded.unigrams.begin(), loaded.unigrams.end(),
+                Unigram::ScoreCompare);
+
+    // Keep the top unigram first, as the node has already been walked with
+    // it, even if the language model has changed its mind since.
+    auto top = std::find_if(loaded.unigrams.begin(), loaded.unigrams.end(),
+                            [this](const Unigram& unigram) {
+                              return unigram.keyValue.value == m_topValue;
+                            });
+    Unigram topUnigram;
+    topUnigram.keyValue = KeyValuePair{key(), m_topValue};
+    topUnigram.score = m_topScore;
+    if (top != loaded.unigrams.end()) {
+      loaded.unigrams.erase(top);
+    }
+    loaded.unigrams.insert(loaded.unigrams.begin(), topUnigram);
+
+    for (size_t i = 0; i < loaded.unigrams.size(); i++) {
+      loaded.valueUnigramIndexMap[loaded.unigrams[i].keyValue.value] = i;
+      loaded.candidates.push_back(loaded.unigrams[i].keyValue);
+    }
+  });
+  return *m_unigrams;
+}
+
 inline void Node::primeNodeWithPreceedingKeyValues(
     const std::vector<KeyValuePair>& keyValues) {
   size_t newIndex = m_selectedUnigramIndex;
@@ -125,14 +206,16 @@ inline void Node::primeNodeWithPreceedingKeyValues(
           m_preceedingGramBigramMap.find(*kvi);
       if (f != m_preceedingGramBigramMap.end()) {
         const std::vector<Bigram>& bigrams = (*f).second;
+        const std::map<std::string, size_t>& valueUnigramIndexMap =
+            unigrams().valueUnigramIndexMap;
 
         for (std::vector<Bigram>::const_iterator bi = bigrams.begin();
              bi != bigrams.end(); ++bi) {
           const Bigram& bigram = *bi;
           if (bigram.score > max) {
             std::map<std::string, size_t>::const_iterator uf =
-                m_valueUnigramIndexMap.find((*bi).keyValue.value);
-            if (uf != m_valueUnigramIndexMap.end()) {
+                valueUnigramIndexMap.find((*bi).keyValue.value);
+            if (uf != valueUnigramIndexMap.end()) {
               newIndex = (*uf).second;
               max = bigram.score;
             }
@@ -154,11 +237,12 @@ inline void Node::primeNodeWithPreceedingKeyValues(
 inline bool Node::isCandidateFixed() const { return m_candidateFixed; }
 
 inline const std::vector<KeyValuePair>& Node::candidates() const {
-  return m_candidates;
+  return unigrams().candidates;
 }
 
 inline void Node::selectCandidateAtIndex(size_t index, bool fix) {
-  if (index >= m_unigrams.size()) {
+  // The first candidate is known without loading the others.
+  if (index != 0 && index >= unigrams().unigrams.size()) {
     m_selectedUnigramIndex = 0;
   } else {
     m_selectedUnigramIndex = index;
@@ -171,13 +255,13 @@ inline void Node::selectCandidateAtIndex(size_t index, bool fix) {
 inline void Node::resetCandidate() {
   m_selectedUnigramIndex = 0;
   m_candidateFixed = 0;
-  if (m_unigrams.size()) {
-    m_score = m_unigrams[0].score;
+  if (m_hasTopUnigram) {
+    m_score = m_topScore;
   }
 }
 
 inline void Node::selectFloatingCandidateAtIndex(size_t index, double score) {
-  if (index >= m_unigrams.size()) {
+  if (index != 0 && index >= unigrams().unigrams.size()) {
     m_selectedUnigramIndex = 0;
   } else {
     m_selectedUnigramIndex = index;
@@ -186,12 +270,18 @@ inline void Node::selectFloatingCandidateAtIndex(size_t index, double score) {
   m_score = score;
 }
 
-inline const std::string& Node::key() const { return m_key; }
+inline const std::string& Node::key() const {
+  static const std::string emptyKey;
+  return m_key ? *m_key : emptyKey;
+}
 
 inline double Node::score() const { return m_score; }
 
 inline double Node::scoreForCandidate(const std::string& candidate) const {
-  for (auto unigram : m_unigrams) {
+  if (m_hasTopUnigram && candidate == m_topValue) {
+    return m_topScore;
+  }
+  for (const auto& unigram : unigrams().unigrams) {
     if (unigram.keyValue.value == candidate) {
       return unigram.score;
     }
@@ -200,17 +290,24 @@ inline double Node::scoreForCandidate(const std::string& candidate) const {
 }
 
 inline double Node::highestUnigramScore() const {
-  if (m_unigrams.empty()) {
+  if (!m_hasTopUnigram) {
     return 0.0;
   }
-  return m_unigrams[0].score;
+  return m_topScore;
 }
 
 inline const KeyValuePair Node::currentKeyValue() const {
-  if (m_selectedUnigramIndex >= m_unigrams.size()) {
+  if (m_selectedUnigramIndex == 0) {
+    if (!m_hasTopUnigram) {
+      return KeyValuePair();
+    }
+    return KeyValuePair{key(), m_topValue};
+  }
+  const Unigrams& loaded = unigrams();
+  if (m_selectedUnigramIndex >= loaded.unigrams.size()) {
     return KeyValuePair();
   } else {
-    return m_candidates[m_selectedUnigramIndex];
+    return loaded.candidates[m_selectedUnigramIndex];
   }
 }
 }  // namespace Gramambular
@@ -40,6 +40,19 @@ struct NodeAnchor {
   size_t location = 0;
   size_t spanningLength = 0;
   double accumulatedScore = 0.0;
+
+  // Set if the grid's score overlay evaluates the node as another candidate.
+  // Points into the node's candidates.
+  const KeyValuePair* overlaidKeyValue = nullptr;
+  double overlaidScore = 0.0;
+
+  // The node's score and candidate, as adjusted by the score overlay.
+  double score() const {
+    return overlaidKeyValue ? overlaidScore : node->score();
+  }
+  const KeyValuePair currentKeyValue() const {
+    return overlaidKeyValue ? *overlaidKeyValue : node->currentKeyValue();
+  }
 };
 
 inline std::ostream& operator<<(std::ostream& stream,
@@ -0,0 +1,146 @@
+//
+// ScoreOverlay.h
+//
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+#ifndef SCOREOVERLAY_H_
+#define SCOREOVERLAY_H_
+
+#include <map>
+#include <string>
+#include <utility>
+
+namespace Formosa {
+namespace Gramambular {
+
+// Score adjustments that a walk applies to the nodes of a grid without
+// changing the nodes. An adjustment evaluates the node at a location and
+// spanning length as one of its candidates with the given score, unless the
+// node's candidate is fixed. Adjustments of different nodes coexist, even if
+// the nodes overlap.
+class ScoreOverlay {
+ public:
+  struct Adjustment {
+    std::string value;
+    double score = 0.0;
+  };
+
+  void clear();
+  bool empty() const;
+
+  void set(size_t location, size_t spanningLength, const std::string& value,
+           double score);
+  void erase(size_t location, size_t spanningLength);
+
+  // Erases the adjustments of the nodes crossing or ending at the location.
+  void eraseCrossingOrEndingAt(size_t location);
+
+  // Returns the adjustment of the node, or nullptr.
+  const Adjustment* find(size_t location, size_t spanningLength) const;
+
+  // Follow the nodes as the grid expands or shrinks by one at the location.
+  // The adjustments of the nodes that the grid removes by doing so are erased.
+  void expandByOneAtLocation(size_t location);
+  void shrinkByOneAtLocation(size_t location);
+
+ protected:
+  // Keyed by location and spanning length.
+  std::map<std::pair<size_t, size_t>, Adjustment> m_adjustments;
+};
+
+inline void ScoreOverlay::clear() { m_adjustments.clear(); }
+
+inline bool ScoreOverlay::empty() const { return m_adjustments.empty(); }
+
+inline void ScoreOverlay::set(size_t location, size_t spanningLength,
+                              const std::string& value, double score) {
+  Adjustment& adjustment = m_adjustments[{location, spanningLength}];
+  adjustment.value = value;
+  adjustment.score = score;
+}
+
+inline void ScoreOverlay::erase(size_t location, size_t spanningLength) {
+  if (!m_adjustments.empty()) {
+    m_adjustments.erase({location, spanningLength});
+  }
+}
+
+inline void ScoreOverlay::eraseCrossingOrEndingAt(size_t location) {
+  for (auto i = m_adjustments.begin();
+       i != m_adjustments.end() && i->first.first < location;) {
+    if (i->first.first + i->first.second >= location) {
+      i = m_adjustments.erase(i);
+    } else {
+      ++i;
+    }
+  }
+}
+
+inline const ScoreOverlay::Adjustment* ScoreOverlay::find(
+    size_t location, size_t spanningLength) const {
+  if (m_adjustments.empty()) {
+    return nullptr;
+  }
+  auto f = m_adjustments.find({location, spanningLength});
+  return f == m_adjustments.end() ? nullptr : &f->second;
+}
+
+inline void ScoreOverlay::expandByOneAtLocation(size_t location) {
+  if (m_adjustments.empty()) {
+    return;
+  }
+  std::map<std::pair<size_t, size_t>, Adjustment> adjustments;
+  for (auto& [key, adjustment] : m_adjustments) {
+    if (key.first >= location) {
+      adjustments.emplace(std::make_pair(key.first + 1, key.second),
+                          std::move(adjustment));
+    } else if (key.first + key.second <= location) {
+      adjustments.emplace(key, std::move(adjustment));
+    }
+  }
+  m_adjustments.swap(adjustments);
+}
+
+inline void ScoreOverlay::shrinkByOneAtLocation(size_t location) {
+  if (m_adjustments.empty()) {
+    return;
+  }
+  std::map<std::pair<size_t, size_t>, Adjustment> adjustments;
+  for (auto& [key, adjustment] : m_adjustments) {
+    if (key.first > location) {
+      adjustments.emplace(std::make_pair(key.first - 1, key.second),
+                          std::move(adjustment));
+    } else if (key.first + key.second <= location) {
+      adjustments.emplace(key, std::move(adjustment));
+    }
+  }
+  m_adjustments.swap(adjustments);
+}
+
+}  // namespace Gramambular
+}  // namespace Formosa
+
+#endif
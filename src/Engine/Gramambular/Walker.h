@@ -42,50 +42,106 @@ class Walker {
   const std::vector<NodeAnchor> reverseWalk(size_t location,
                                             double accumulatedScore = 0.0);
 
+  // Returns the furthest location that the best paths ending at each of the
+  // last lookahead locations up to the location all pass through, or 0 if
+  // there is none. Readings appended at the location only add nodes starting
+  // at those locations, if lookahead is the longest span of a node, so the
+  // best path up to the returned location no longer changes, as long as the
+  // nodes before it are left as they are.
+  size_t convergenceLocation(size_t location, size_t lookahead);
+
  protected:
+  // Finds the best paths up to the location, starting after the last
+  // location whose best path is still valid.
+  void walkTo(size_t location);
+
   Grid* m_grid;
 };
 
 inline Walker::Walker(Grid* inGrid) : m_grid(inGrid) {}
 
+// The best path to a location does not depend on the path after it, so the
+// best path to each location is computed once, from the start of the grid,
+// and kept in the grid until the nodes before the location change. A path
+// ending at a location without nodes ending there is empty, and therefore
+// scores zero. The first best path is chosen among equally scored ones, in
+// the order of the nodes ending at the location.
+inline void Walker::walkTo(size_t location) {
+  Grid::BestPaths& best = m_grid->bestPaths();
+  if (best.lastNodes.size() < location + 1) {
+    best.lastNodes.resize(location + 1);
+    best.scores.resize(location + 1, 0.0);
+  }
+  if (best.validLocation >= location) {
+    return;
+  }
+
+  for (size_t i = best.validLocation + 1; i <= location; i++) {
+    std::vector<NodeAnchor> nodes = m_grid->nodesEndingAt(i);
+    best.lastNodes[i] = NodeAnchor();
+    best.scores[i] = 0.0;
+    bool found = false;
+    for (const NodeAnchor& anchor : nodes) {
+      if (!anchor.node || anchor.spanningLength > i) {
+        continue;
+      }
+      double score = best.scores[i - anchor.spanningLength] + anchor.score();
+      if (!found || score > best.scores[i]) {
+        best.lastNodes[i] = anchor;
+        best.scores[i] = score;
+        found = true;
+      }
+    }
+  }
+  best.validLocation = location;
+}
+
 inline const std::vector<NodeAnchor> Walker::reverseWalk(
     size_t location, double accumulatedScore) {
   if (!location || location > m_grid->width()) {
     return std::vector<NodeAnchor>();
   }
 
-  std::vector<std::vector<NodeAnchor> > paths;
-
-  std::vector<NodeAnchor> nodes = m_grid->nodesEndingAt(location);
-
-  for (std::vector<NodeAnchor>::iterator ni = nodes.begin(); ni != nodes.end();
-       ++ni) {
-    if (!(*ni).node) {
-      continue;
-    }
-
-    (*ni).accumulatedScore = accumulatedScore + (*ni).node->score();
-
-    std::vector<NodeAnchor> path =
-        reverseWalk(location - (*ni).spanningLength, (*ni).accumulatedScore);
-    path.insert(path.begin(), *ni);
-
-    paths.push_back(path);
+  walkTo(location);
+  const std::vector<NodeAnchor>& lastNodes = m_grid->bestPaths().lastNodes;
+  std::vector<NodeAnchor> path;
+  size_t i = location;
+  while (i > 0 && lastNodes[i].node) {
+    NodeAnchor anchor = lastNodes[i];
+    accumulatedScore += anchor.score();
+    anchor.accumulatedScore = accumulatedScore;
+    path.push_back(anchor);
+    i -= anchor.spanningLength;
   }
+  return path;
+}
 
-  if (!paths.size()) {
-    return std::vector<NodeAnchor>();
+inline size_t Walker::convergenceLocation(size_t location, size_t lookahead) {
+  if (!lookahead || location < lookahead || location > m_grid->width()) {
+    return 0;
   }
 
-  std::vector<NodeAnchor>* result = &*(paths.begin());
-  for (std::vector<std::vector<NodeAnchor> >::iterator pi = paths.begin();
-       pi != paths.end(); ++pi) {
-    if ((*pi).back().accumulatedScore > result->back().accumulatedScore) {
-      result = &*pi;
+  // Count the paths passing through each location. A path ending at a
+  // location without nodes ending there passes through no earlier location.
+  walkTo(location);
+  const std::vector<NodeAnchor>& lastNodes = m_grid->bestPaths().lastNodes;
+  size_t first = location + 1 - lookahead;
+  std::vector<size_t> counts(location + 1, 0);
+  for (size_t end = first; end <= location; end++) {
+    size_t i = end;
+    counts[i]++;
+    while (i > 0 && lastNodes[i].node) {
+      i -= lastNodes[i].spanningLength;
+      counts[i]++;
     }
   }
 
-  return *result;
+  for (size_t i = first; i > 0; i--) {
+    if (counts[i] == lookahead) {
+      return i;
+    }
+  }
+  return 0;
 }
 }  // namespace Gramambular
 }  // namespace Formosa
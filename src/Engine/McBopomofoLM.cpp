@@ -24,6 +24,7 @@
 #include "McBopomofoLM.h"
 #include <algorithm>
 #include <iterator>
+#include <utility>
 
 namespace McBopomofo {
 
@@ -33,7 +34,6 @@ McBopomofoLM::McBopomofoLM()
 
 McBopomofoLM::~McBopomofoLM()
 {
-    m_languageModel.close();
     m_userPhrases.close();
     m_excludedPhrases.close();
     m_phraseReplacement.close();
@@ -43,14 +43,22 @@ McBopomofoLM::~McBopomofoLM()
 void McBopomofoLM::loadLanguageModel(const char* languageModelDataPath)
 {
     if (languageModelDataPath) {
-        m_languageModel.close();
-        m_languageModel.open(languageModelDataPath);
+        dropWarmedUpKeys();
+        // The completion index points into the data being closed.
+        m_completionIndex.clear();
+        m_languageModel = ParselessLM::openShared(languageModelDataPath);
+        if (m_phraseCompletionEnabled && m_languageModel != nullptr) {
+            m_completionIndex.build(m_languageModel->rows());
+        }
+        if (m_phraseReplacementEnabled) {
+            updateOverlayReplacements();
+        }
     }
 }
 
 bool McBopomofoLM::isDataModelLoaded()
 {
-    return m_languageModel.isLoaded();
+    return m_languageModel != nullptr && m_languageModel->isLoaded();
 }
 
 // void McBopomofoLM::loadAssociatedPhrases(const char* associatedPhrasesPath)
@@ -69,6 +77,7 @@ bool McBopomofoLM::isDataModelLoaded()
 void McBopomofoLM::loadUserPhrases(const char* userPhrasesDataPath,
     const char* excludedPhrasesDataPath)
 {
+    dropWarmedUpKeys();
     if (userPhrasesDataPath) {
         m_userPhrases.close();
         m_userPhrases.open(userPhrasesDataPath);
@@ -77,13 +86,18 @@ void McBopomofoLM::loadUserPhrases(const char* userPhrasesDataPath,
         m_excludedPhrases.close();
         m_excludedPhrases.open(excludedPhrasesDataPath);
     }
+    m_overlay.updatePhrases(overlaySources());
 }
 
 void McBopomofoLM::loadPhraseReplacementMap(const char* phraseReplacementPath)
 {
     if (phraseReplacementPath) {
+        dropWarmedUpKeys();
         m_phraseReplacement.close();
         m_phraseReplacement.open(phraseReplacementPath);
+        if (m_phraseReplacementEnabled) {
+            updateOverlayReplacements();
+        }
     }
 }
 
@@ -94,6 +108,8 @@ const std::vector<Formosa::Gramambular::Bigram> McBopomofoLM::bigramsForKeys(con
 
 const std::vector<Formosa::Gramambular::Unigram> McBopomofoLM::unigramsForKey(const std::string& key)
 {
+    m_unigramLookupCount.fetch_add(1, std::memory_order_relaxed);
+
     if (key == " ") {
         std::vector<Formosa::Gramambular::Unigram> spaceUnigrams;
         Formosa::Gramambular::Unigram g;
@@ -104,31 +120,90 @@ const std::vector<Formosa::Gramambular::Unigram> McBopomofoLM::unigramsForKey(co
         return spaceUnigrams;
     }
 
-    std::vector<Formosa::Gramambular::Unigram> allUnigrams;
-    std::vector<Formosa::Gramambular::Unigram> userUnigrams;
+    return unigramsInRows(rowsForKey(key));
+}
+
+McBopomofoLM::LayerRows McBopomofoLM::rowsForKey(const std::string& key)
+{
+    LayerRows rows;
+    rows.overlay = m_overlay.entryForKey(key);
+    if (m_languageModel != nullptr) {
+        rows.global = m_languageModel->rowsForKey(key);
+    }
+    return rows;
+}
 
-    std::unordered_set<std::string> excludedValues;
+const std::vector<Formosa::Gramambular::Unigram> McBopomofoLM::unigramsInRows(const LayerRows& rows)
+{
+    std::vector<Formosa::Gramambular::Unigram> results;
     std::unordered_set<std::string> insertedValues;
 
-    if (m_excludedPhrases.hasUnigramsForKey(key)) {
-        std::vector<Formosa::Gramambular::Unigram> excludedUnigrams = m_excludedPhrases.unigramsForKey(key);
-        transform(excludedUnigrams.begin(), excludedUnigrams.end(),
-            inserter(excludedValues, excludedValues.end()),
-            [](const Formosa::Gramambular::Unigram& u) { return u.keyValue.value; });
+    // The user phrases in the overlay are already excluded, replaced and
+    // deduplicated.
+    if (rows.overlay != nullptr) {
+        for (Formosa::Gramambular::Unigram unigram : rows.overlay->userUnigrams) {
+            if (convertsValues()) {
+                unigram.keyValue.value = m_externalConverter(unigram.keyValue.value);
+            }
+            insertUnigram(std::move(unigram), results, insertedValues);
+        }
+    }
+
+    if (!rows.global.empty()) {
+        std::vector<Formosa::Gramambular::Unigram> globalUnigrams = m_languageModel->unigramsInRows(rows.global);
+        for (auto& unigram : globalUnigrams) {
+            if (transformGlobalValue(rows.overlay, &unigram.keyValue.value)) {
+                insertUnigram(std::move(unigram), results, insertedValues);
+            }
+        }
+    }
+    return results;
+}
+
+bool McBopomofoLM::convertsValues() const
+{
+    return m_externalConverterEnabled && m_externalConverter;
+}
+
+bool McBopomofoLM::transformGlobalValue(const PhraseOverlayIndex::Entry* overlay, std::string* value)
+{
+    if (overlay != nullptr) {
+        if (overlay->excludedValues.find(*value) != overlay->excludedValues.end()) {
+            return false;
+        }
+        auto replaced = overlay->replacedValues.find(*value);
+        if (replaced != overlay->replacedValues.end()) {
+            *value = replaced->second;
+        }
+    }
+    if (convertsValues()) {
+        *value = m_externalConverter(*value);
     }
+    return true;
+}
 
-    if (m_userPhrases.hasUnigramsForKey(key)) {
-        std::vector<Formosa::Gramambular::Unigram> rawUserUnigrams = m_userPhrases.unigramsForKey(key);
-        userUnigrams = filterAndTransformUnigrams(rawUserUnigrams, excludedValues, insertedValues);
+void McBopomofoLM::insertUnigram(Formosa::Gramambular::Unigram&& unigram, std::vector<Formosa::Gramambular::Unigram>& results,
+    std::unordered_set<std::string>& insertedValues)
+{
+    if (insertedValues.insert(unigram.keyValue.value).second) {
+        results.push_back(std::move(unigram));
     }
+}
 
-    if (m_languageModel.hasUnigramsForKey(key)) {
-        std::vector<Formosa::Gramambular::Unigram> rawGlobalUnigrams = m_languageModel.unigramsForKey(key);
-        allUnigrams = filterAndTransformUnigrams(rawGlobalUnigrams, excludedValues, insertedValues);
+PhraseOverlayIndex::Sources McBopomofoLM::overlaySources() const
+{
+    PhraseOverlayIndex::Sources sources;
+    sources.userPhrases = &m_userPhrases;
+    sources.excludedPhrases = &m_excludedPhrases;
+    if (m_phraseReplacementEnabled) {
+        sources.phraseReplacement = &m_phraseReplacement;
     }
+    return sources;
+}
 
-    allUnigrams.insert(allUnigrams.begin(), userUnigrams.begin(), userUnigrams.end());
-    return allUnigrams;
+void McBopomofoLM::updateOverlayReplacements()
+{
+    m_overlay.updateReplacements(overlaySources(), m_languageModel != nullptr ? m_languageModel->rows() : std::string_view());
 }
 
 bool McBopomofoLM::hasUnigramsForKey(const std::string& key)
@@ -137,16 +212,193 @@ bool McBopomofoLM::hasUnigramsForKey(const std::string& key)
         return true;
     }
 
-    if (!m_excludedPhrases.hasUnigramsForKey(key)) {
-        return m_userPhrases.hasUnigramsForKey(key) || m_languageModel.hasUnigramsForKey(key);
+    bool found = false;
+    if (findWarmedUpKey(key, &found, nullptr)) {
+        return found;
+    }
+
+    // Replacing and converting values do not drop unigrams.
+    const PhraseOverlayIndex::Entry* overlay = m_overlay.entryForKey(key);
+    if (overlay != nullptr && !overlay->userUnigrams.empty()) {
+        return true;
+    }
+    if (overlay == nullptr || overlay->excludedValues.empty()) {
+        return m_languageModel != nullptr && m_languageModel->hasUnigramsForKey(key);
     }
 
     return unigramsForKey(key).size() > 0;
 }
 
+bool McBopomofoLM::hasKeyValue(const std::string& key, const std::string& value)
+{
+    if (key == " ") {
+        return value == " ";
+    }
+
+    // A converted or replaced value may come from any original value of the
+    // key.
+    const PhraseOverlayIndex::Entry* overlay = m_overlay.entryForKey(key);
+    if (convertsValues() || (overlay != nullptr && !overlay->replacedValues.empty())) {
+        return LanguageModel::hasKeyValue(key, value);
+    }
+
+    if (overlay != nullptr) {
+        for (const auto& unigram : overlay->userUnigrams) {
+            if (unigram.keyValue.value == value) {
+                return true;
+            }
+        }
+        if (overlay->excludedValues.find(value) != overlay->excludedValues.end()) {
+            return false;
+        }
+    }
+    return m_languageModel != nullptr && m_languageModel->hasKeyValue(key, value);
+}
+
+bool McBopomofoLM::topUnigramForKey(const std::string& key, Formosa::Gramambular::Unigram* unigram)
+{
+    bool found = false;
+    if (findWarmedUpKey(key, &found, unigram)) {
+        return found;
+    }
+    return lookUpTopUnigram(key, unigram);
+}
+
+bool McBopomofoLM::lookUpTopUnigram(const std::string& key, Formosa::Gramambular::Unigram* unigram)
+{
+    if (key == " ") {
+        unigram->keyValue.key = " ";
+        unigram->keyValue.value = " ";
+        unigram->score = 0;
+        return true;
+    }
+
+    // The overlay changes which unigrams are listed first, and a transformed
+    // value may merge with another one. In those cases, and when the top
+    // value repeats, the unigrams are built from the rows already found.
+    LayerRows rows = rowsForKey(key);
+    if (!convertsValues() && rows.overlay == nullptr && m_languageModel != nullptr) {
+        bool valueRepeated = false;
+        if (!m_languageModel->topUnigramInRows(rows.global, unigram, &valueRepeated)) {
+            return false;
+        }
+        if (!valueRepeated) {
+            return true;
+        }
+    }
+
+    std::vector<Formosa::Gramambular::Unigram> unigrams = unigramsInRows(rows);
+    if (unigrams.empty()) {
+        return false;
+    }
+    *unigram = *std::max_element(unigrams.begin(), unigrams.end(),
+        [](const Formosa::Gramambular::Unigram& a, const Formosa::Gramambular::Unigram& b) { return a.score < b.score; });
+    return true;
+}
+
+uint64_t McBopomofoLM::unigramLookupCount() const
+{
+    return m_unigramLookupCount.load(std::memory_order_relaxed);
+}
+
+uint64_t McBopomofoLM::languageModelSearchCount() const
+{
+    return m_languageModel != nullptr ? m_languageModel->searchCount() : 0;
+}
+
+void McBopomofoLM::warmUpTopUnigrams(const std::vector<WarmUpGroup>& groups)
+{
+    dropWarmedUpKeys();
+    for (const WarmUpGroup& group : groups) {
+        auto inserted = m_warmedUpKeys.emplace(group.reading, WarmedUpKey());
+        WarmedUpKey& warmedUp = inserted.first->second;
+        if (inserted.second) {
+            warmedUp.found = lookUpTopUnigram(group.reading, &warmedUp.unigram);
+        }
+        // A reading without unigrams is rejected when typed, so the phrases
+        // with it are never asked for.
+        if (!warmedUp.found) {
+            continue;
+        }
+        for (const std::string& key : group.phraseKeys) {
+            inserted = m_warmedUpKeys.emplace(key, WarmedUpKey());
+            if (inserted.second) {
+                WarmedUpKey& phrase = inserted.first->second;
+                phrase.found = lookUpTopUnigram(key, &phrase.unigram);
+            }
+        }
+    }
+    m_warmedUpKeyCount.fetch_add(m_warmedUpKeys.size(), std::memory_order_relaxed);
+    if (!m_warmedUpKeys.empty()) {
+        m_warmUpThread.store(std::this_thread::get_id(), std::memory_order_relaxed);
+    }
+}
+
+uint64_t McBopomofoLM::warmedUpKeyCount() const
+{
+    return m_warmedUpKeyCount.load(std::memory_order_relaxed);
+}
+
+uint64_t McBopomofoLM::warmUpHitCount() const
+{
+    return m_warmUpHitCount.load(std::memory_order_relaxed);
+}
+
+uint64_t McBopomofoLM::warmUpWasteCount() const
+{
+    return m_warmUpWasteCount.load(std::memory_order_relaxed);
+}
+
+bool McBopomofoLM::findWarmedUpKey(const std::string& key, bool* found, Formosa::Gramambular::Unigram* unigram)
+{
+    // Only the thread that warmed up the keys touches them, so they need no
+    // lock; the other threads look their keys up as usual.
+    if (m_warmUpThread.load(std::memory_order_relaxed) != std::this_thread::get_id()) {
+        return false;
+    }
+
+    auto it = m_warmedUpKeys.find(key);
+    if (it == m_warmedUpKeys.end()) {
+        return false;
+    }
+    if (!it->second.asked) {
+        it->second.asked = true;
+        m_warmUpHitCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    *found = it->second.found;
+    if (unigram != nullptr && it->second.found) {
+        *unigram = it->second.unigram;
+    }
+    return true;
+}
+
+void McBopomofoLM::dropWarmedUpKeys()
+{
+    if (m_warmUpThread.load(std::memory_order_relaxed) != std::this_thread::get_id()) {
+        return;
+    }
+    m_warmUpThread.store(std::thread::id(), std::memory_order_relaxed);
+    countWastedKeys(m_warmedUpKeys);
+    m_warmedUpKeys.clear();
+}
+
+void McBopomofoLM::countWastedKeys(const std::unordered_map<std::string, WarmedUpKey>& keys)
+{
+    for (const auto& entry : keys) {
+        if (!entry.second.asked) {
+            m_warmUpWasteCount.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
 void McBopomofoLM::setPhraseReplacementEnabled(bool enabled)
 {
+    if (enabled == m_phraseReplacementEnabled) {
+        return;
+    }
+    dropWarmedUpKeys();
     m_phraseReplacementEnabled = enabled;
+    updateOverlayReplacements();
 }
 
 bool McBopomofoLM::phraseReplacementEnabled()
@@ -156,6 +408,9 @@ bool McBopomofoLM::phraseReplacementEnabled()
 
 void McBopomofoLM::setExternalConverterEnabled(bool enabled)
 {
+    if (enabled != m_externalConverterEnabled) {
+        dropWarmedUpKeys();
+    }
     m_externalConverterEnabled = enabled;
 }
 
@@ -166,39 +421,52 @@ bool McBopomofoLM::externalConverterEnabled()
 
 void McBopomofoLM::setExternalConverter(std::function<std::string(std::string)> externalConverter)
 {
+    dropWarmedUpKeys();
     m_externalConverter = externalConverter;
 }
 
-const std::vector<Formosa::Gramambular::Unigram> McBopomofoLM::filterAndTransformUnigrams(const std::vector<Formosa::Gramambular::Unigram> unigrams, const std::unordered_set<std::string>& excludedValues, std::unordered_set<std::string>& insertedValues)
+void McBopomofoLM::setPhraseCompletionEnabled(bool enabled)
+{
+    if (enabled == m_phraseCompletionEnabled) {
+        return;
+    }
+    m_phraseCompletionEnabled = enabled;
+    if (enabled && m_languageModel != nullptr) {
+        m_completionIndex.build(m_languageModel->rows());
+    } else {
+        m_completionIndex.clear();
+    }
+}
+
+bool McBopomofoLM::phraseCompletionEnabled()
+{
+    return m_phraseCompletionEnabled;
+}
+
+const std::vector<Formosa::Gramambular::Unigram> McBopomofoLM::completionsForReadings(const std::vector<std::string>& readings, size_t maxCount)
 {
     std::vector<Formosa::Gramambular::Unigram> results;
+    if (readings.empty() || readings.size() > PhraseCompletionIndex::MaxPrefixLength) {
+        return results;
+    }
 
-    for (auto&& unigram : unigrams) {
-        // excludedValues filters out the unigrams with the original value.
-        // insertedValues filters out the ones with the converted value
-        std::string originalValue = unigram.keyValue.value;
-        if (excludedValues.find(originalValue) != excludedValues.end()) {
-            continue;
-        }
+    std::string prefix = readings[0];
+    for (size_t i = 1; i < readings.size(); i++) {
+        prefix += "-" + readings[i];
+    }
 
-        std::string value = originalValue;
-        if (m_phraseReplacementEnabled) {
-            std::string replacement = m_phraseReplacement.valueForKey(value);
-            if (replacement != "") {
-                value = replacement;
-            }
+    std::unordered_set<std::string> insertedValues;
+    for (const auto& completion : m_completionIndex.completionsForPrefix(prefix, PhraseCompletionIndex::MaxCompletionsPerPrefix)) {
+        Formosa::Gramambular::Unigram unigram;
+        unigram.keyValue.key = std::string(completion.key);
+        unigram.keyValue.value = std::string(completion.value);
+        unigram.score = completion.score;
+
+        if (transformGlobalValue(m_overlay.entryForKey(unigram.keyValue.key), &unigram.keyValue.value)) {
+            insertUnigram(std::move(unigram), results, insertedValues);
         }
-        if (m_externalConverterEnabled && m_externalConverter) {
-            std::string replacement = m_externalConverter(value);
-            value = replacement;
-        }
-        if (insertedValues.find(value) == insertedValues.end()) {
-            Formosa::Gramambular::Unigram g;
-            g.keyValue.value = value;
-            g.keyValue.key = unigram.keyValue.key;
-            g.score = unigram.score;
-            results.push_back(g);
-            insertedValues.insert(value);
+        if (results.size() >= maxCount) {
+            break;
         }
     }
     return results;
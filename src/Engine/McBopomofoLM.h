@@ -26,9 +26,14 @@
 
 // #include "AssociatedPhrases.h"
 #include "ParselessLM.h"
+#include "PhraseCompletionIndex.h"
+#include "PhraseOverlayIndex.h"
 #include "PhraseReplacementMap.h"
 #include "UserPhrasesLM.h"
+#include <atomic>
 #include <stdio.h>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
 #include <functional>
 
@@ -52,6 +57,10 @@ namespace McBopomofo {
 /// 4) Replace the values of the unigrams using an external converter lambda.
 /// 5) Drop the duplicated phrases.
 ///
+/// Steps 2 and 3, and the user phrases, are merged by reading into a
+/// PhraseOverlayIndex when the files are loaded, so a lookup asks the index
+/// and the primary language model once each.
+///
 /// The controller can ask the model to load the primary input method language
 /// model while launching and to load the user phrases anytime if the custom
 /// files are modified. It does not keep the reference of the data pathes but
@@ -61,7 +70,10 @@ public:
     McBopomofoLM();
     ~McBopomofoLM();
 
-    /// Asks to load the primary language model at the given path.
+    /// Asks to load the primary language model at the given path. The
+    /// language model is shared with the other models that load the same
+    /// path, and the one loaded before is released rather than closed, so it
+    /// stays valid for whoever else holds it.
     /// @param languageModelPath The path of the language model.
     void loadLanguageModel(const char* languageModelPath);
     /// If the data model is already loaded.
@@ -90,6 +102,48 @@ public:
     /// If the model has unigrams for the given key.
     /// @param key The key.
     bool hasUnigramsForKey(const std::string& key);
+    /// If the given key has a unigram of the given value, as unigramsForKey()
+    /// would return it. Unless the values are converted or replaced, the
+    /// models are asked directly, without building unigrams.
+    /// @param key The key.
+    /// @param value The value.
+    bool hasKeyValue(const std::string& key, const std::string& value);
+    /// Sets the unigram with the highest score for the given key, the one
+    /// unigramsForKey() would list first among them. Unless the values are
+    /// converted or the overlay has the key, only the primary language model
+    /// is asked, without building unigrams.
+    /// @param key The key.
+    /// @param unigram The unigram to set.
+    bool topUnigramForKey(const std::string& key, Formosa::Gramambular::Unigram* unigram);
+    /// The number of unigramsForKey() calls so far.
+    uint64_t unigramLookupCount() const;
+    /// The number of searches in the primary language model so far.
+    uint64_t languageModelSearchCount() const;
+
+    /// A reading the next key may compose, and the keys of the phrases it
+    /// would form with the readings around it.
+    struct WarmUpGroup {
+        std::string reading;
+        std::vector<std::string> phraseKeys;
+    };
+    /// Looks up the top unigrams of the given readings ahead of time, and
+    /// those of the phrase keys of each reading that has unigrams, so that
+    /// asking topUnigramForKey() or hasUnigramsForKey() for them later takes
+    /// no search. The keys replace the ones warmed up before and are only
+    /// found by the calling thread.
+    /// @param groups The readings and their phrase keys.
+    void warmUpTopUnigrams(const std::vector<WarmUpGroup>& groups);
+    /// Drops the warmed-up keys, counting those never asked for as waste.
+    /// The key handler drops them once the key they were warmed up for is
+    /// handled, and they are dropped when the models or the settings change.
+    /// Does nothing unless called by the thread that warmed them up.
+    void dropWarmedUpKeys();
+    /// The number of keys warmed up so far.
+    uint64_t warmedUpKeyCount() const;
+    /// The number of warmed-up keys that were asked for.
+    uint64_t warmUpHitCount() const;
+    /// The number of warmed-up keys dropped without being asked for.
+    uint64_t warmUpWasteCount() const;
 
     /// Enables or disables phrase replacement.
     void setPhraseReplacementEnabled(bool enabled);
@@ -103,29 +157,86 @@ public:
     /// Sets a lambda to let the values of unigrams could be converted by it.
     void setExternalConverter(std::function<std::string(std::string)> externalConverter);
 
+    /// Enables or disables phrase completion. The completion index is built
+    /// from the primary language model when enabled.
+    void setPhraseCompletionEnabled(bool enabled);
+    /// If phrase completion is enabled or not.
+    bool phraseCompletionEnabled();
+    /// Returns the phrases of the primary language model whose readings start
+    /// with the given readings and are longer, the most likely ones first.
+    /// Excluded phrases are left out, and the values are transformed as the
+    /// values of unigrams are.
+    /// @param readings One or two readings.
+    /// @param maxCount The maximum number of phrases returned.
+    const std::vector<Formosa::Gramambular::Unigram> completionsForReadings(const std::vector<std::string>& readings, size_t maxCount);
+
     const std::vector<std::string> associatedPhrasesForKey(const std::string& key);
     bool hasAssociatedPhrasesForKey(const std::string& key);
 
 protected:
-    /// Filters and converts the input unigrams and return a new list of unigrams.
-    ///
-    /// @param unigrams The unigrams to be processed.
-    /// @param excludedValues The values to excluded unigrams.
-    /// @param insertedValues The values for unigrams already in the results.
-    ///   It helps to prevent duplicated unigrams. Please note that the method
-    ///   has a side effect that it inserts values to `insertedValues`.
-    const std::vector<Formosa::Gramambular::Unigram> filterAndTransformUnigrams(const std::vector<Formosa::Gramambular::Unigram> unigrams,
-        const std::unordered_set<std::string>& excludedValues,
+    /// The overlay entry and the rows of the primary language model of a key,
+    /// each found by one lookup.
+    struct LayerRows {
+        const PhraseOverlayIndex::Entry* overlay = nullptr;
+        ParselessPhraseDB::RowRange global;
+    };
+    /// Looks up the key in the overlay and the primary language model.
+    LayerRows rowsForKey(const std::string& key);
+    /// Returns the unigrams from the rows, as unigramsForKey() does.
+    const std::vector<Formosa::Gramambular::Unigram> unigramsInRows(const LayerRows& rows);
+    /// Looks up the top unigram of the key, without the warmed-up keys.
+    bool lookUpTopUnigram(const std::string& key, Formosa::Gramambular::Unigram* unigram);
+
+    /// The top unigram of a warmed-up key.
+    struct WarmedUpKey {
+        bool found = false;
+        Formosa::Gramambular::Unigram unigram;
+        bool asked = false;
+    };
+    /// Finds the warmed-up key and sets whether it has unigrams and, if
+    /// unigram is not null, its top unigram. Returns false if the key is
+    /// not warmed up.
+    bool findWarmedUpKey(const std::string& key, bool* found, Formosa::Gramambular::Unigram* unigram);
+    /// Counts the keys never asked for as waste.
+    void countWastedKeys(const std::unordered_map<std::string, WarmedUpKey>& keys);
+
+    /// If the external converter converts the values.
+    bool convertsValues() const;
+    /// Excludes, replaces and converts the value of a unigram of the primary
+    /// language model. Returns false if the value is excluded.
+    /// @param overlay The overlay entry of the key of the unigram, or nullptr.
+    /// @param value The value to transform.
+    bool transformGlobalValue(const PhraseOverlayIndex::Entry* overlay, std::string* value);
+    /// Adds the unigram to the results unless a unigram of the same value is
+    /// already there. insertedValues holds the values in the results.
+    void insertUnigram(Formosa::Gramambular::Unigram&& unigram, std::vector<Formosa::Gramambular::Unigram>& results,
         std::unordered_set<std::string>& insertedValues);
+    /// The files the overlay is merged from.
+    PhraseOverlayIndex::Sources overlaySources() const;
+    /// Merges the replaced values of the primary language model into the
+    /// overlay again.
+    void updateOverlayReplacements();
 
-    ParselessLM m_languageModel;
+    std::shared_ptr<ParselessLM> m_languageModel;
     UserPhrasesLM m_userPhrases;
     UserPhrasesLM m_excludedPhrases;
     PhraseReplacementMap m_phraseReplacement;
+    PhraseCompletionIndex m_completionIndex;
+    PhraseOverlayIndex m_overlay;
     // AssociatedPhrases m_associatedPhrases;
-    bool m_phraseReplacementEnabled;
-    bool m_externalConverterEnabled;
+    bool m_phraseReplacementEnabled = false;
+    bool m_externalConverterEnabled = false;
+    bool m_phraseCompletionEnabled = false;
     std::function<std::string(std::string)> m_externalConverter;
+    std::atomic<uint64_t> m_unigramLookupCount { 0 };
+
+    std::unordered_map<std::string, WarmedUpKey> m_warmedUpKeys;
+    // The thread that warmed up the keys, the only one that finds them; no
+    // thread when nothing is warmed up.
+    std::atomic<std::thread::id> m_warmUpThread {};
+    std::atomic<uint64_t> m_warmedUpKeyCount { 0 };
+    std::atomic<uint64_t> m_warmUpHitCount { 0 };
+    std::atomic<uint64_t> m_warmUpWasteCount { 0 };
 };
 };
 
@@ -28,10 +28,37 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <map>
 #include <memory>
+#include <mutex>
+
+#include "AsyncLog.h"
+#include "PhraseDataVerifier.h"
 
 McBopomofo::ParselessLM::~ParselessLM() { close(); }
 
+std::shared_ptr<McBopomofo::ParselessLM> McBopomofo::ParselessLM::openShared(
+    const std::string& path)
+{
+    static std::mutex mutex;
+    static std::map<std::string, std::weak_ptr<ParselessLM>> opened;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<ParselessLM> lm = opened[path].lock();
+    if (lm != nullptr) {
+        return lm;
+    }
+
+    lm = std::make_shared<ParselessLM>();
+    if (!lm->open(path)) {
+        opened.erase(path);
+        return nullptr;
+    }
+    opened[path] = lm;
+    return lm;
+}
+
 bool McBopomofo::ParselessLM::isLoaded()
 {
     if (data_) {
@@ -61,13 +88,25 @@ bool McBopomofo::ParselessLM::open(const std::string_view& path)
     length_ = static_cast<size_t>(sb.st_size);
 
     data_ = mmap(NULL, length_, PROT_READ, MAP_SHARED, fd_, 0);
-    if (data_ == nullptr) {
+    if (data_ == MAP_FAILED) {
+        data_ = nullptr;
         ::close(fd_);
         fd_ = -1;
         length_ = 0;
         return false;
     }
 
+    // The binary search trusts the rows to be well-formed and sorted.
+    PhraseDataVerifier::Result verdict = PhraseDataVerifier::verifyFile(sb,
+        std::string_view(static_cast<char*>(data_), length_),
+        PhraseDataVerifier::Format::Sorted);
+    if (!verdict.valid) {
+        MCBOPOMOFO_LOG(Warn) << "open:: rejected " << path << ":"
+                             << verdict.line << ": " << verdict.error;
+        close();
+        return false;
+    }
+
     db_ = std::unique_ptr<ParselessPhraseDB>(new ParselessPhraseDB(
         static_cast<char*>(data_), length_, /*validate_pragme=*/
         true));
@@ -83,6 +122,7 @@ void McBopomofo::ParselessLM::close()
         length_ = 0;
         data_ = nullptr;
     }
+    db_.reset();
 }
 
 const std::vector<Formosa::Gramambular::Bigram>
@@ -94,13 +134,34 @@ McBopomofo::ParselessLM::bigramsForKeys(
 
 const std::vector<Formosa::Gramambular::Unigram>
 McBopomofo::ParselessLM::unigramsForKey(const std::string& key)
+{
+    return unigramsInRows(rowsForKey(key));
+}
+
+McBopomofo::ParselessPhraseDB::RowRange McBopomofo::ParselessLM::rowsForKey(
+    const std::string& key)
 {
     if (db_ == nullptr) {
-        return std::vector<Formosa::Gramambular::Unigram>();
+        return ParselessPhraseDB::RowRange();
     }
+    return db_->findRowRange(key + " ");
+}
 
+uint64_t McBopomofo::ParselessLM::searchCount() const
+{
+    if (db_ == nullptr) {
+        return 0;
+    }
+    return db_->searchCount();
+}
+
+const std::vector<Formosa::Gramambular::Unigram>
+McBopomofo::ParselessLM::unigramsInRows(
+    const ParselessPhraseDB::RowRange& rows) const
+{
     std::vector<Formosa::Gramambular::Unigram> results;
-    for (const auto& row : db_->findRows(key + " ")) {
+    results.reserve(rows.size());
+    for (const auto& row : rows) {
         Formosa::Gramambular::Unigram unigram;
 
         // Move ahead until we encounter the first space. This is the key.
@@ -141,6 +202,14 @@ McBopomofo::ParselessLM::unigramsForKey(const std::string& key)
     return results;
 }
 
+std::string_view McBopomofo::ParselessLM::rows() const
+{
+    if (db_ == nullptr) {
+        return std::string_view();
+    }
+    return db_->rows();
+}
+
 bool McBopomofo::ParselessLM::hasUnigramsForKey(const std::string& key)
 {
     if (db_ == nullptr) {
@@ -149,3 +218,71 @@ bool McBopomofo::ParselessLM::hasUnigramsForKey(const std::string& key)
 
     return db_->findFirstMatchingLine(key + " ") != nullptr;
 }
+
+bool McBopomofo::ParselessLM::hasKeyValue(
+    const std::string& key, const std::string& value)
+{
+    if (db_ == nullptr) {
+        return false;
+    }
+
+    // The rows are "key value score"; compare the values in place.
+    std::string prefix = key + " " + value;
+    for (const auto& row : rowsForKey(key)) {
+        if (row.length() > prefix.length()
+            && row.compare(0, prefix.length(), prefix) == 0
+            && row[prefix.length()] == ' ') {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool McBopomofo::ParselessLM::topUnigramForKey(
+    const std::string& key, Formosa::Gramambular::Unigram* unigram)
+{
+    bool valueRepeated;
+    return topUnigramInRows(rowsForKey(key), unigram, &valueRepeated);
+}
+
+bool McBopomofo::ParselessLM::topUnigramInRows(
+    const ParselessPhraseDB::RowRange& rows,
+    Formosa::Gramambular::Unigram* unigram, bool* valueRepeated) const
+{
+    // The rows are "key value score"; parse only the values and the scores,
+    // and keep the first row with the highest score.
+    std::vector<std::string_view> values;
+    values.reserve(rows.size());
+    std::string_view topKey;
+    size_t topIndex = 0;
+    double topScore = 0.0;
+    for (std::string_view row : rows) {
+        size_t keyEnd = row.find(' ');
+        std::string_view value = keyEnd == std::string_view::npos
+            ? std::string_view()
+            : row.substr(keyEnd + 1);
+        size_t space = value.find(' ');
+        double score = 0.0;
+        if (space != std::string_view::npos) {
+            score = std::stod(std::string(value.substr(space + 1)));
+            value = value.substr(0, space);
+        }
+        if (values.empty() || score > topScore) {
+            topKey = row.substr(0, keyEnd);
+            topIndex = values.size();
+            topScore = score;
+        }
+        values.push_back(value);
+    }
+    if (values.empty()) {
+        return false;
+    }
+
+    *valueRepeated = std::find(values.begin(), values.begin() + topIndex,
+                         values[topIndex])
+        != values.begin() + topIndex;
+    unigram->keyValue.key = std::string(topKey);
+    unigram->keyValue.value = std::string(values[topIndex]);
+    unigram->score = topScore;
+    return true;
+}
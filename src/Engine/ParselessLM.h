@@ -37,6 +37,12 @@ class ParselessLM : public Formosa::Gramambular::LanguageModel {
 public:
     ~ParselessLM() override;
 
+    // Returns the database at the path, opened read-only. A database is only
+    // opened once while it is in use: the callers share it, and it is closed
+    // when the last of them releases it. Returns nullptr if it cannot be
+    // opened. The shared database must not be closed or reopened.
+    static std::shared_ptr<ParselessLM> openShared(const std::string& path);
+
     bool isLoaded();
     bool open(const std::string_view& path);
     void close();
@@ -46,6 +52,30 @@ public:
     const std::vector<Formosa::Gramambular::Unigram> unigramsForKey(
         const std::string& key) override;
     bool hasUnigramsForKey(const std::string& key) override;
+    bool hasKeyValue(const std::string& key, const std::string& value) override;
+    bool topUnigramForKey(const std::string& key,
+        Formosa::Gramambular::Unigram* unigram) override;
+
+    // Returns the rows of the key, found by one search, or an empty range if
+    // the database is not loaded. The methods below read the unigrams from
+    // them, so that a caller asking several questions about a key searches
+    // once.
+    ParselessPhraseDB::RowRange rowsForKey(const std::string& key);
+    const std::vector<Formosa::Gramambular::Unigram> unigramsInRows(
+        const ParselessPhraseDB::RowRange& rows) const;
+
+    // Sets the first unigram with the highest score in the rows. Also sets
+    // valueRepeated to whether a row before it has the same value, in which
+    // case a list that drops repeated values keeps that row's score instead.
+    bool topUnigramInRows(const ParselessPhraseDB::RowRange& rows,
+        Formosa::Gramambular::Unigram* unigram, bool* valueRepeated) const;
+
+    // The number of searches in the database so far.
+    uint64_t searchCount() const;
+
+    // Returns all the rows of the database, one per line, or an empty string
+    // if it is not loaded. The rows are valid until the database is closed.
+    std::string_view rows() const;
 
 private:
     int fd_ = -1;
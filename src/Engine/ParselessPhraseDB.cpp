@@ -23,6 +23,7 @@
 
 #include "ParselessPhraseDB.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 
@@ -36,7 +37,10 @@ ParselessPhraseDB::ParselessPhraseDB(
     assert(buf != nullptr);
     assert(length > 0);
 
-    if (validate_pragma) {
+    // The asserts are compiled out in release builds. Data from a file is
+    // checked by PhraseDataVerifier before it gets here, and a header that is
+    // missing anyway is not skipped past the end of the data.
+    if (validate_pragma && length >= SORTED_PRAGMA_HEADER.length()) {
         assert(length > SORTED_PRAGMA_HEADER.length());
 
         std::string_view header(buf, SORTED_PRAGMA_HEADER.length());
@@ -49,20 +53,71 @@ ParselessPhraseDB::ParselessPhraseDB(
 
         assert(x == uint32_t { 3012373384 });
 
-        begin_ += header.length();
+        if (header == SORTED_PRAGMA_HEADER) {
+            begin_ += header.length();
+        }
+    }
+}
+
+ParselessPhraseDB::RowRange::Iterator::Iterator(
+    const char* ptr, const char* end)
+    : ptr_(ptr)
+    , eol_(ptr)
+    , end_(end)
+{
+    while (eol_ != end_ && *eol_ != '\n') {
+        ++eol_;
     }
 }
 
+std::string_view ParselessPhraseDB::RowRange::Iterator::operator*() const
+{
+    return std::string_view(ptr_, eol_ - ptr_);
+}
+
+ParselessPhraseDB::RowRange::Iterator&
+ParselessPhraseDB::RowRange::Iterator::operator++()
+{
+    ptr_ = eol_ == end_ ? end_ : eol_ + 1;
+    eol_ = ptr_;
+    while (eol_ != end_ && *eol_ != '\n') {
+        ++eol_;
+    }
+    return *this;
+}
+
+ParselessPhraseDB::RowRange::RowRange(const char* begin, const char* end)
+    : begin_(begin)
+    , end_(end)
+{
+}
+
+size_t ParselessPhraseDB::RowRange::size() const
+{
+    if (empty()) {
+        return 0;
+    }
+    // Every row but the last line of the database ends with a newline.
+    size_t count = std::count(begin_, end_, '\n');
+    return end_[-1] == '\n' ? count : count + 1;
+}
+
 std::vector<std::string_view> ParselessPhraseDB::findRows(
     const std::string_view& key)
 {
-    std::vector<std::string_view> rows;
+    RowRange range = findRowRange(key);
+    return std::vector<std::string_view>(range.begin(), range.end());
+}
 
+ParselessPhraseDB::RowRange ParselessPhraseDB::findRowRange(
+    const std::string_view& key)
+{
     const char* ptr = findFirstMatchingLine(key);
     if (ptr == nullptr) {
-        return rows;
+        return RowRange();
     }
 
+    const char* begin = ptr;
     while (ptr + key.length() <= end_
         && memcmp(ptr, key.data(), key.length()) == 0) {
         const char* eol = ptr;
@@ -71,15 +126,25 @@ std::vector<std::string_view> ParselessPhraseDB::findRows(
             ++eol;
         }
 
-        rows.emplace_back(ptr, eol - ptr);
         if (eol == end_) {
+            ptr = end_;
             break;
         }
 
         ptr = ++eol;
     }
 
-    return rows;
+    return RowRange(begin, ptr);
+}
+
+uint64_t ParselessPhraseDB::searchCount() const
+{
+    return searchCount_.load(std::memory_order_relaxed);
+}
+
+std::string_view ParselessPhraseDB::rows() const
+{
+    return std::string_view(begin_, end_ - begin_);
 }
 
 // Implements a binary search that returns the pointer to the first matching
@@ -91,6 +156,8 @@ std::vector<std::string_view> ParselessPhraseDB::findRows(
 const char* ParselessPhraseDB::findFirstMatchingLine(
     const std::string_view& key)
 {
+    searchCount_.fetch_add(1, std::memory_order_relaxed);
+
     if (key.empty()) {
         return begin_;
     }
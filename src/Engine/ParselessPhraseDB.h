@@ -24,8 +24,12 @@
 #ifndef SOURCE_ENGINE_PARSELESSPHRASEDB_H_
 #define SOURCE_ENGINE_PARSELESSPHRASEDB_H_
 
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <iterator>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace McBopomofo {
@@ -40,6 +44,47 @@ constexpr std::string_view SORTED_PRAGMA_HEADER
 // rows.
 class ParselessPhraseDB {
 public:
+    // The rows that match a key, as found by one search. They are consecutive
+    // lines of the database, so the range tells whether there are any, counts
+    // and iterates them without searching again. It is valid as long as the
+    // database is.
+    class RowRange {
+    public:
+        class Iterator {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = std::string_view;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const std::string_view*;
+            using reference = std::string_view;
+
+            Iterator(const char* ptr, const char* end);
+            std::string_view operator*() const;
+            Iterator& operator++();
+            bool operator==(const Iterator& another) const { return ptr_ == another.ptr_; }
+            bool operator!=(const Iterator& another) const { return ptr_ != another.ptr_; }
+
+        private:
+            const char* ptr_;
+            const char* eol_;
+            const char* end_;
+        };
+
+        RowRange() = default;
+        RowRange(const char* begin, const char* end);
+
+        bool empty() const { return begin_ == end_; }
+        size_t size() const;
+        Iterator begin() const { return Iterator(begin_, end_); }
+        Iterator end() const { return Iterator(end_, end_); }
+
+    private:
+        // From the start of the first row to the start of the line after the
+        // last one, or the end of the database.
+        const char* begin_ = nullptr;
+        const char* end_ = nullptr;
+    };
+
     ParselessPhraseDB(
         const char* buf, size_t length, bool validate_pragma = false);
 
@@ -48,11 +93,21 @@ public:
     // at the end.
     std::vector<std::string_view> findRows(const std::string_view& key);
 
+    // Same as findRows(), without copying the rows.
+    RowRange findRowRange(const std::string_view& key);
+
     const char* findFirstMatchingLine(const std::string_view& key);
 
+    // The number of binary searches done so far.
+    uint64_t searchCount() const;
+
+    // Returns all the rows, one per line.
+    std::string_view rows() const;
+
 private:
     const char* begin_;
     const char* end_;
+    std::atomic<uint64_t> searchCount_ { 0 };
 };
 
 }; // namespace McBopomofo
@@ -0,0 +1,120 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "PhraseCompletionIndex.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+
+namespace McBopomofo {
+
+namespace {
+
+bool isBetter(const PhraseCompletionIndex::Completion& a, const PhraseCompletionIndex::Completion& b)
+{
+    return a.score > b.score;
+}
+
+} // namespace
+
+void PhraseCompletionIndex::build(std::string_view rows)
+{
+    clear();
+
+    // The best completions of each prefix so far, as a heap with the worst one
+    // at the front.
+    std::unordered_map<std::string_view, std::vector<Completion>> candidates;
+
+    size_t pos = 0;
+    while (pos < rows.length()) {
+        size_t eol = rows.find('\n', pos);
+        if (eol == std::string_view::npos) {
+            eol = rows.length();
+        }
+        std::string_view row = rows.substr(pos, eol - pos);
+        pos = eol + 1;
+
+        // Skip comments and the keys of punctuations and symbols.
+        if (row.empty() || row[0] == '#' || row[0] == '_') {
+            continue;
+        }
+
+        size_t keyEnd = row.find(' ');
+        if (keyEnd == std::string_view::npos) {
+            continue;
+        }
+        size_t valueEnd = row.find(' ', keyEnd + 1);
+        if (valueEnd == std::string_view::npos) {
+            continue;
+        }
+        std::string_view key = row.substr(0, keyEnd);
+        size_t length = std::count(key.begin(), key.end(), '-') + 1;
+        if (length < 2 || length > MaxPhraseLength) {
+            continue;
+        }
+
+        // The rows are not null-terminated.
+        std::string scoreString(row.substr(valueEnd + 1));
+        Completion completion { key, row.substr(keyEnd + 1, valueEnd - keyEnd - 1), std::strtod(scoreString.c_str(), nullptr) };
+
+        size_t prefixEnd = 0;
+        for (size_t prefixLength = 1; prefixLength < length && prefixLength <= MaxPrefixLength; prefixLength++) {
+            prefixEnd = key.find('-', prefixEnd + (prefixLength > 1 ? 1 : 0));
+            std::vector<Completion>& heap = candidates[key.substr(0, prefixEnd)];
+            if (heap.size() < MaxCompletionsPerPrefix) {
+                heap.push_back(completion);
+                std::push_heap(heap.begin(), heap.end(), isBetter);
+            } else if (isBetter(completion, heap.front())) {
+                std::pop_heap(heap.begin(), heap.end(), isBetter);
+                heap.back() = completion;
+                std::push_heap(heap.begin(), heap.end(), isBetter);
+            }
+        }
+    }
+
+    m_prefixes.reserve(candidates.size());
+    for (auto& [prefix, heap] : candidates) {
+        std::sort_heap(heap.begin(), heap.end(), isBetter);
+        m_prefixes[prefix] = { static_cast<uint32_t>(m_completions.size()), static_cast<uint32_t>(heap.size()) };
+        m_completions.insert(m_completions.end(), heap.begin(), heap.end());
+    }
+}
+
+void PhraseCompletionIndex::clear()
+{
+    m_completions.clear();
+    m_prefixes.clear();
+}
+
+std::vector<PhraseCompletionIndex::Completion> PhraseCompletionIndex::completionsForPrefix(std::string_view prefix, size_t maxCount) const
+{
+    auto it = m_prefixes.find(prefix);
+    if (it == m_prefixes.end()) {
+        return std::vector<Completion>();
+    }
+    auto begin = m_completions.begin() + it->second.first;
+    return std::vector<Completion>(begin, begin + std::min<size_t>(it->second.second, maxCount));
+}
+
+} // namespace McBopomofo
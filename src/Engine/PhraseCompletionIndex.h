@@ -0,0 +1,82 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef PHRASECOMPLETIONINDEX_H
+#define PHRASECOMPLETIONINDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace McBopomofo {
+
+/// An index of the most likely phrases starting with the first one or two
+/// readings, for completing a phrase while its first readings are typed.
+///
+/// The completions of every prefix are ranked and kept when the index is
+/// built, so a lookup is one hash lookup, and each completion returned is
+/// read from a contiguous array.
+class PhraseCompletionIndex {
+public:
+    struct Completion {
+        /// The readings of the phrase, joined by "-".
+        std::string_view key;
+        std::string_view value;
+        double score;
+    };
+
+    /// The number of completions kept for each prefix.
+    static constexpr size_t MaxCompletionsPerPrefix = 16;
+    /// The number of readings of the longest prefix indexed.
+    static constexpr size_t MaxPrefixLength = 2;
+    /// The number of readings of the longest phrase indexed. Longer phrases
+    /// could not be selected, as the reading builder does not build nodes
+    /// spanning more readings.
+    static constexpr size_t MaxPhraseLength = 6;
+
+    /// Indexes the rows of a sorted phrase database, one "key value score" per
+    /// line. The rows must outlive the index, or the index must be cleared
+    /// first.
+    void build(std::string_view rows);
+
+    void clear();
+
+    bool isEmpty() const { return m_completions.empty(); }
+
+    /// Returns up to maxCount completions of the phrases whose keys start with
+    /// the prefix, of one or two readings joined by "-", and are longer than
+    /// it. The most likely ones come first.
+    std::vector<Completion> completionsForPrefix(std::string_view prefix, size_t maxCount) const;
+
+private:
+    std::vector<Completion> m_completions;
+    /// The range of m_completions of each prefix, as (offset, count).
+    std::unordered_map<std::string_view, std::pair<uint32_t, uint32_t>> m_prefixes;
+};
+
+} // namespace McBopomofo
+
+#endif // PHRASECOMPLETIONINDEX_H
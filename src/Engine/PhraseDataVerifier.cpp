@@ -0,0 +1,325 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "PhraseDataVerifier.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <utility>
+
+#include "ParselessPhraseDB.h"
+
+namespace McBopomofo {
+
+namespace {
+
+constexpr std::string_view ChecksumPrefix = "# checksum ";
+constexpr size_t ChecksumDigits = 16;
+
+PhraseDataVerifier::Result failure(std::string error, size_t line)
+{
+    PhraseDataVerifier::Result result;
+    result.valid = false;
+    result.error = std::move(error);
+    result.line = line;
+    return result;
+}
+
+// The line of the offset, counted from 1.
+size_t lineAt(std::string_view data, size_t offset)
+{
+    return std::count(data.begin(), data.begin() + std::min(offset, data.length()), '\n') + 1;
+}
+
+bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// A decimal number such as "-5.28", as written by the data scripts.
+bool isScore(std::string_view s)
+{
+    size_t i = 0;
+    if (i < s.length() && (s[i] == '-' || s[i] == '+')) {
+        i++;
+    }
+    size_t digits = 0;
+    while (i < s.length() && isDigit(s[i])) {
+        i++;
+        digits++;
+    }
+    if (i < s.length() && s[i] == '.') {
+        i++;
+        while (i < s.length() && isDigit(s[i])) {
+            i++;
+            digits++;
+        }
+    }
+    if (digits == 0) {
+        return false;
+    }
+    if (i < s.length() && (s[i] == 'e' || s[i] == 'E')) {
+        i++;
+        if (i < s.length() && (s[i] == '-' || s[i] == '+')) {
+            i++;
+        }
+        size_t exponentDigits = 0;
+        while (i < s.length() && isDigit(s[i])) {
+            i++;
+            exponentDigits++;
+        }
+        if (exponentDigits == 0) {
+            return false;
+        }
+    }
+    return i == s.length();
+}
+
+bool parseChecksum(std::string_view hex, uint64_t* checksum)
+{
+    if (hex.length() != ChecksumDigits) {
+        return false;
+    }
+    uint64_t value = 0;
+    for (char c : hex) {
+        int digit;
+        if (isDigit(c)) {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            return false;
+        }
+        value = (value << 4) | static_cast<uint64_t>(digit);
+    }
+    *checksum = value;
+    return true;
+}
+
+PhraseDataVerifier::Result verifySortedRows(std::string_view data)
+{
+    if (data.substr(0, SORTED_PRAGMA_HEADER.length()) != SORTED_PRAGMA_HEADER) {
+        return failure("missing the format header", 1);
+    }
+    size_t pos = SORTED_PRAGMA_HEADER.length();
+    size_t line = 2;
+
+    if (data.substr(pos, ChecksumPrefix.length()) == ChecksumPrefix) {
+        size_t eol = data.find('\n', pos);
+        if (eol == std::string_view::npos) {
+            return failure("truncated checksum line", line);
+        }
+        uint64_t expected;
+        if (!parseChecksum(data.substr(pos + ChecksumPrefix.length(), eol - pos - ChecksumPrefix.length()), &expected)) {
+            return failure("malformed checksum line", line);
+        }
+        pos = eol + 1;
+        line++;
+        if (PhraseDataVerifier::checksum(data.substr(pos)) != expected) {
+            return failure("checksum mismatch", 0);
+        }
+    }
+
+    // Each key ends with the space after it, so that the keys compare as
+    // the binary search compares them with the key searched.
+    std::string_view previousKey;
+    for (; pos < data.length(); line++) {
+        size_t eol = data.find('\n', pos);
+        if (eol == std::string_view::npos) {
+            eol = data.length();
+        }
+        std::string_view row = data.substr(pos, eol - pos);
+        pos = eol + 1;
+
+        size_t keyEnd = row.find(' ');
+        size_t valueEnd = keyEnd == std::string_view::npos ? std::string_view::npos : row.find(' ', keyEnd + 1);
+        if (keyEnd == 0 || valueEnd == std::string_view::npos || valueEnd == keyEnd + 1) {
+            return failure("not a \"key value score\" row", line);
+        }
+        if (!isScore(row.substr(valueEnd + 1))) {
+            return failure("malformed score", line);
+        }
+
+        std::string_view key = row.substr(0, keyEnd + 1);
+        if (key < previousKey) {
+            return failure("rows not sorted by key", line);
+        }
+        previousKey = key;
+    }
+    return PhraseDataVerifier::Result();
+}
+
+PhraseDataVerifier::Result verifyKeyValueLines(std::string_view data)
+{
+    PhraseDataVerifier::Result result;
+    size_t pos = 0;
+    size_t errorOffset = 0;
+    // No sequence spans a line feed, so each invalid one is within its line.
+    while (!PhraseDataVerifier::isValidUTF8(data.substr(pos), &errorOffset)) {
+        size_t offset = pos + errorOffset;
+        if (result.rejectedLines == 0) {
+            result.error = "invalid UTF-8";
+            result.line = lineAt(data, offset);
+        }
+        result.rejectedLines++;
+        size_t eol = data.find('\n', offset);
+        if (eol == std::string_view::npos) {
+            break;
+        }
+        pos = eol + 1;
+    }
+    return result;
+}
+
+} // namespace
+
+PhraseDataVerifier::Result PhraseDataVerifier::verify(std::string_view data, Format format)
+{
+    if (format == Format::KeyValue) {
+        return verifyKeyValueLines(data);
+    }
+    size_t errorOffset = 0;
+    if (!isValidUTF8(data, &errorOffset)) {
+        return failure("invalid UTF-8", lineAt(data, errorOffset));
+    }
+    return verifySortedRows(data);
+}
+
+PhraseDataVerifier::Result PhraseDataVerifier::verifyFile(const struct stat& sb, std::string_view data, Format format)
+{
+    struct Verdict {
+        off_t size;
+        struct timespec modified;
+        Result result;
+    };
+    static std::mutex mutex;
+    // The last verdict of each file. A file written again gets a new one.
+    static std::map<std::tuple<dev_t, ino_t, Format>, Verdict> verdicts;
+
+    auto identity = std::make_tuple(sb.st_dev, sb.st_ino, format);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = verdicts.find(identity);
+        if (it != verdicts.end() && it->second.size == sb.st_size
+            && it->second.modified.tv_sec == sb.st_mtim.tv_sec
+            && it->second.modified.tv_nsec == sb.st_mtim.tv_nsec) {
+            return it->second.result;
+        }
+    }
+
+    Result result = verify(data, format);
+    std::lock_guard<std::mutex> lock(mutex);
+    verdicts[identity] = Verdict { sb.st_size, sb.st_mtim, result };
+    return result;
+}
+
+bool PhraseDataVerifier::isValidUTF8(std::string_view data, size_t* errorOffset)
+{
+    const unsigned char* s = reinterpret_cast<const unsigned char*>(data.data());
+    size_t length = data.length();
+    size_t i = 0;
+    while (i < length) {
+        unsigned char c = s[i];
+        if (c < 0x80) {
+            // Skip ASCII a word at a time. The scores and the keys of
+            // punctuations are mostly ASCII.
+            i++;
+            while (i + sizeof(uint64_t) <= length) {
+                uint64_t word;
+                memcpy(&word, s + i, sizeof(word));
+                if ((word & 0x8080808080808080ULL) != 0) {
+                    break;
+                }
+                i += sizeof(word);
+            }
+            continue;
+        }
+
+        // The well-formed byte sequences of the Unicode standard (Table 3-7),
+        // which leave out overlong forms, surrogates and code points past
+        // U+10FFFF. The second byte has a range that depends on the first.
+        size_t count;
+        unsigned char low = 0x80;
+        unsigned char high = 0xBF;
+        if (c >= 0xC2 && c <= 0xDF) {
+            count = 2;
+        } else if (c >= 0xE0 && c <= 0xEF) {
+            count = 3;
+            if (c == 0xE0) {
+                low = 0xA0;
+            } else if (c == 0xED) {
+                high = 0x9F;
+            }
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            count = 4;
+            if (c == 0xF0) {
+                low = 0x90;
+            } else if (c == 0xF4) {
+                high = 0x8F;
+            }
+        } else {
+            *errorOffset = i;
+            return false;
+        }
+        if (count > length - i || s[i + 1] < low || s[i + 1] > high) {
+            *errorOffset = i;
+            return false;
+        }
+        for (size_t j = 2; j < count; j++) {
+            if ((s[i + j] & 0xC0) != 0x80) {
+                *errorOffset = i;
+                return false;
+            }
+        }
+        i += count;
+    }
+    return true;
+}
+
+uint64_t PhraseDataVerifier::checksum(std::string_view data)
+{
+    const unsigned char* s = reinterpret_cast<const unsigned char*>(data.data());
+    size_t length = data.length();
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word = 0;
+        for (size_t j = 0; j < 8; j++) {
+            word |= static_cast<uint64_t>(s[i + j]) << (8 * j);
+        }
+        hash ^= word;
+        hash *= 0x100000001b3ULL;
+    }
+    for (; i < length; i++) {
+        hash ^= s[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+} // namespace McBopomofo
@@ -0,0 +1,91 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef PHRASEDATAVERIFIER_H
+#define PHRASEDATAVERIFIER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+
+namespace McBopomofo {
+
+/// Verifies a phrase data file before it is used, so that a corrupted or
+/// truncated file is rejected instead of sending the binary search or the
+/// parsers past the rows.
+///
+/// A file in the sorted format of the primary language model must be valid
+/// UTF-8, start with the pragma header, have one "key value score" row per
+/// line, and keep the rows sorted by their keys. If the line after the header
+/// is "# checksum " followed by 16 hex digits, the checksum() of the rows
+/// after that line must match it. In the other files, which users edit, only
+/// the lines that are not valid UTF-8 are rejected.
+class PhraseDataVerifier {
+public:
+    enum class Format {
+        /// The primary language model, read by ParselessPhraseDB.
+        Sorted,
+        /// The user phrases, excluded phrases and phrase replacements, read
+        /// by KeyValueBlobReader, and other files of space-separated columns
+        /// such as the symbol table. The lines that are not valid UTF-8 are
+        /// counted, and the readers skip the pairs that are not.
+        KeyValue,
+    };
+
+    struct Result {
+        bool valid = true;
+        /// What is wrong, if not valid.
+        std::string error;
+        /// The line where it is wrong, counted from 1, or 0 for the whole file.
+        size_t line = 0;
+        /// The number of lines that are not valid UTF-8 in a KeyValue file,
+        /// which is still valid; error and line tell about the first one.
+        size_t rejectedLines = 0;
+    };
+
+    /// Verifies the data of a file.
+    static Result verify(std::string_view data, Format format);
+
+    /// Verifies the data of an opened file, unless it was verified before and
+    /// its device, inode, size and modification time are the same, in which
+    /// case the verdict is returned again.
+    /// @param sb The status of the file, as returned by fstat().
+    /// @param data The whole file.
+    /// @param format The format of the file.
+    static Result verifyFile(const struct stat& sb, std::string_view data, Format format);
+
+    /// Returns whether the data is valid UTF-8. If not, sets errorOffset to
+    /// the offset of the first invalid sequence.
+    static bool isValidUTF8(std::string_view data, size_t* errorOffset);
+
+    /// The checksum written in a checksum line: the 64-bit FNV-1a hash of the
+    /// data taken as little-endian 8-byte words, then the bytes left one by
+    /// one.
+    static uint64_t checksum(std::string_view data);
+};
+
+} // namespace McBopomofo
+
+#endif // PHRASEDATAVERIFIER_H
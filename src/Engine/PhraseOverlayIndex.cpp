@@ -0,0 +1,160 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "PhraseOverlayIndex.h"
+
+#include <utility>
+
+namespace McBopomofo {
+
+const PhraseOverlayIndex::Entry* PhraseOverlayIndex::entryForKey(const std::string& key) const
+{
+    auto it = m_entries.find(key);
+    if (it == m_entries.end()) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+void PhraseOverlayIndex::updatePhrases(const Sources& sources)
+{
+    // The readings the files had and have.
+    std::unordered_set<std::string> keys;
+    keys.swap(m_phraseKeys);
+    for (const UserPhrasesLM* phrases : { sources.userPhrases, sources.excludedPhrases }) {
+        if (phrases == nullptr) {
+            continue;
+        }
+        for (const auto& key : phrases->keys()) {
+            m_phraseKeys.insert(std::string(key));
+        }
+    }
+    keys.insert(m_phraseKeys.begin(), m_phraseKeys.end());
+    mergeKeys(keys, sources);
+}
+
+void PhraseOverlayIndex::updateReplacements(const Sources& sources, std::string_view languageModelRows)
+{
+    std::unordered_set<std::string> keys;
+    for (const auto& entry : m_replacedValues) {
+        keys.insert(entry.first);
+    }
+    m_replacedValues.clear();
+
+    if (sources.phraseReplacement != nullptr && !sources.phraseReplacement->isEmpty()) {
+        size_t pos = 0;
+        while (pos < languageModelRows.length()) {
+            size_t eol = languageModelRows.find('\n', pos);
+            if (eol == std::string_view::npos) {
+                eol = languageModelRows.length();
+            }
+            std::string_view row = languageModelRows.substr(pos, eol - pos);
+            pos = eol + 1;
+
+            if (row.empty() || row[0] == '#') {
+                continue;
+            }
+            size_t keyEnd = row.find(' ');
+            if (keyEnd == std::string_view::npos) {
+                continue;
+            }
+            size_t valueEnd = row.find(' ', keyEnd + 1);
+            if (valueEnd == std::string_view::npos) {
+                valueEnd = row.length();
+            }
+            std::string_view value = row.substr(keyEnd + 1, valueEnd - keyEnd - 1);
+            std::string replacement = sources.phraseReplacement->valueForKey(value);
+            if (replacement.empty()) {
+                continue;
+            }
+            std::string key(row.substr(0, keyEnd));
+            m_replacedValues[key][std::string(value)] = replacement;
+            keys.insert(key);
+        }
+    }
+
+    // The values of the user phrases may be replaced too.
+    keys.insert(m_phraseKeys.begin(), m_phraseKeys.end());
+    mergeKeys(keys, sources);
+}
+
+void PhraseOverlayIndex::clear()
+{
+    m_entries.clear();
+    m_phraseKeys.clear();
+    m_replacedValues.clear();
+}
+
+void PhraseOverlayIndex::mergeKeys(const std::unordered_set<std::string>& keys, const Sources& sources)
+{
+    for (const std::string& key : keys) {
+        Entry entry;
+
+        const std::vector<UserPhrasesLM::Row>* excludedRows = sources.excludedPhrases != nullptr ? sources.excludedPhrases->rowsForKey(key) : nullptr;
+        if (excludedRows != nullptr) {
+            for (const auto& row : *excludedRows) {
+                entry.excludedValues.insert(std::string(row.value));
+            }
+        }
+
+        const std::vector<UserPhrasesLM::Row>* userRows = sources.userPhrases != nullptr ? sources.userPhrases->rowsForKey(key) : nullptr;
+        if (userRows != nullptr) {
+            std::unordered_set<std::string> insertedValues;
+            for (const auto& row : *userRows) {
+                std::string value(row.value);
+                // Excluded by the original value, and deduplicated by the
+                // replaced one.
+                if (entry.excludedValues.find(value) != entry.excludedValues.end()) {
+                    continue;
+                }
+                if (sources.phraseReplacement != nullptr) {
+                    std::string replacement = sources.phraseReplacement->valueForKey(value);
+                    if (!replacement.empty()) {
+                        value = replacement;
+                    }
+                }
+                if (!insertedValues.insert(value).second) {
+                    continue;
+                }
+                Formosa::Gramambular::Unigram unigram;
+                unigram.keyValue.key = key;
+                unigram.keyValue.value = value;
+                unigram.score = 0.0;
+                entry.userUnigrams.push_back(unigram);
+            }
+        }
+
+        auto replaced = m_replacedValues.find(key);
+        if (replaced != m_replacedValues.end()) {
+            entry.replacedValues = replaced->second;
+        }
+
+        if (userRows == nullptr && excludedRows == nullptr && entry.replacedValues.empty()) {
+            m_entries.erase(key);
+        } else {
+            m_entries[key] = std::move(entry);
+        }
+    }
+}
+
+} // namespace McBopomofo
@@ -0,0 +1,102 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef PHRASEOVERLAYINDEX_H
+#define PHRASEOVERLAYINDEX_H
+
+#include "LanguageModel.h"
+#include "PhraseReplacementMap.h"
+#include "UserPhrasesLM.h"
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace McBopomofo {
+
+/// The user phrases, excluded phrases and phrase replacements merged by
+/// reading, so that a lookup of a key is one hash lookup instead of one per
+/// file, and no values are filtered or replaced while typing.
+///
+/// Only the readings that the files change have an entry. When a file is
+/// reloaded, only the entries of the readings it had or has are merged again.
+class PhraseOverlayIndex {
+public:
+    /// What the files change about the unigrams of a reading.
+    struct Entry {
+        /// The user phrases of the reading that are not excluded, with their
+        /// values replaced and the duplicates dropped, in the order of the
+        /// file. They are listed before the unigrams of the primary language
+        /// model.
+        std::vector<Formosa::Gramambular::Unigram> userUnigrams;
+        /// The values of the primary language model that are excluded.
+        std::unordered_set<std::string> excludedValues;
+        /// The values of the primary language model that are replaced, and
+        /// their replacements.
+        std::unordered_map<std::string, std::string> replacedValues;
+    };
+
+    /// The files merged. The phrase replacement map is nullptr when phrase
+    /// replacement is disabled.
+    struct Sources {
+        const UserPhrasesLM* userPhrases = nullptr;
+        const UserPhrasesLM* excludedPhrases = nullptr;
+        const PhraseReplacementMap* phraseReplacement = nullptr;
+    };
+
+    /// Returns the entry of the key, or nullptr if the files do not change
+    /// its unigrams. It is valid until the index is updated.
+    const Entry* entryForKey(const std::string& key) const;
+
+    /// Merges the user and excluded phrases again, after either is reloaded.
+    void updatePhrases(const Sources& sources);
+
+    /// Finds the values of the primary language model that the phrase
+    /// replacement map replaces, and merges the user phrases whose values it
+    /// replaces again. Called after the map or the language model is
+    /// reloaded, or phrase replacement is enabled or disabled.
+    /// @param sources The files.
+    /// @param languageModelRows The rows of the primary language model, one
+    ///     "key value score" per line.
+    void updateReplacements(const Sources& sources, std::string_view languageModelRows);
+
+    void clear();
+
+    /// The number of readings with an entry.
+    size_t size() const { return m_entries.size(); }
+
+private:
+    /// Merges the entries of the keys again, dropping those left empty.
+    void mergeKeys(const std::unordered_set<std::string>& keys, const Sources& sources);
+
+    std::unordered_map<std::string, Entry> m_entries;
+    /// The readings of the user and excluded phrases.
+    std::unordered_set<std::string> m_phraseKeys;
+    /// The replaced values of the primary language model, by reading.
+    std::unordered_map<std::string, std::unordered_map<std::string, std::string>> m_replacedValues;
+};
+
+} // namespace McBopomofo
+
+#endif // PHRASEOVERLAYINDEX_H
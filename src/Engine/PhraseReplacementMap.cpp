@@ -6,7 +6,9 @@
 #include <fstream>
 #include <unistd.h>
 
+#include "AsyncLog.h"
 #include "KeyValueBlobReader.h"
+#include "PhraseDataVerifier.h"
 
 namespace McBopomofo {
 
@@ -34,28 +36,56 @@ bool PhraseReplacementMap::open(const char *path)
 
     fd = ::open(path, O_RDONLY);
     if (fd == -1) {
-        printf("open:: file not exist");
+        MCBOPOMOFO_LOG(Warn) << "open:: file not exist: " << path;
         return false;
     }
 
     struct stat sb;
     if (fstat(fd, &sb) == -1) {
-        printf("open:: cannot open file");
+        MCBOPOMOFO_LOG(Warn) << "open:: cannot open file: " << path;
+        ::close(fd);
+        fd = -1;
         return false;
     }
 
     length = (size_t)sb.st_size;
 
     data = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
-    if (!data) {
+    if (data == MAP_FAILED) {
+        data = 0;
         ::close(fd);
+        fd = -1;
         return false;
     }
 
+    PhraseDataVerifier::Result verdict = PhraseDataVerifier::verifyFile(sb,
+        std::string_view(static_cast<char*>(data), length),
+        PhraseDataVerifier::Format::KeyValue);
+    if (!verdict.valid) {
+        MCBOPOMOFO_LOG(Warn) << "open:: rejected " << path << ":"
+                             << verdict.line << ": " << verdict.error;
+        close();
+        return false;
+    }
+    // A stray byte rejects only the pairs with it, not the user's other
+    // phrases.
+    bool skipsInvalidPairs = verdict.rejectedLines > 0;
+    if (skipsInvalidPairs) {
+        MCBOPOMOFO_LOG(Warn) << "open:: skipping " << verdict.rejectedLines
+                             << " lines of " << path << ", the first at line "
+                             << verdict.line << ": " << verdict.error;
+    }
+
     KeyValueBlobReader reader(static_cast<char*>(data), length);
     KeyValueBlobReader::KeyValue keyValue;
     KeyValueBlobReader::State state;
+    size_t errorOffset;
     while ((state = reader.Next(&keyValue)) == KeyValueBlobReader::State::HAS_PAIR) {
+        if (skipsInvalidPairs
+            && (!PhraseDataVerifier::isValidUTF8(keyValue.key, &errorOffset)
+                || !PhraseDataVerifier::isValidUTF8(keyValue.value, &errorOffset))) {
+            continue;
+        }
         keyValueMap[keyValue.key] = keyValue.value;
     }
     return true;
@@ -72,7 +102,7 @@ void PhraseReplacementMap::close()
     keyValueMap.clear();
 }
 
-const std::string PhraseReplacementMap::valueForKey(const std::string& key)
+const std::string PhraseReplacementMap::valueForKey(std::string_view key) const
 {
     auto iter = keyValueMap.find(key);
     if (iter != keyValueMap.end()) {
@@ -38,7 +38,8 @@ public:
 
     bool open(const char *path);
     void close();
-    const std::string valueForKey(const std::string& key);
+    const std::string valueForKey(std::string_view key) const;
+    bool isEmpty() const { return keyValueMap.empty(); }
 
 protected:
     std::map<std::string_view, std::string_view> keyValueMap;
@@ -0,0 +1,242 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "SymbolTable.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "AsyncLog.h"
+#include "PhraseDataVerifier.h"
+
+namespace McBopomofo {
+
+namespace {
+
+bool isUTF8ContinuationByte(char c)
+{
+    return (static_cast<unsigned char>(c) & 0xc0) == 0x80;
+}
+
+} // namespace
+
+SymbolTable::SymbolTable()
+    : m_fd(-1)
+    , m_data(nullptr)
+    , m_length(0)
+{
+}
+
+SymbolTable::~SymbolTable()
+{
+    if (m_data) {
+        close();
+    }
+}
+
+bool SymbolTable::open(const char* path)
+{
+    if (m_data) {
+        return false;
+    }
+
+    m_fd = ::open(path, O_RDONLY);
+    if (m_fd == -1) {
+        MCBOPOMOFO_LOG(Warn) << "open:: file not exist: " << path;
+        return false;
+    }
+
+    struct stat sb;
+    if (fstat(m_fd, &sb) == -1) {
+        MCBOPOMOFO_LOG(Warn) << "open:: cannot open file: " << path;
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+
+    m_length = static_cast<size_t>(sb.st_size);
+    m_data = mmap(NULL, m_length, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (m_data == MAP_FAILED) {
+        m_data = nullptr;
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+
+    std::string_view data(static_cast<char*>(m_data), m_length);
+    PhraseDataVerifier::Result verdict = PhraseDataVerifier::verifyFile(sb, data, PhraseDataVerifier::Format::KeyValue);
+    // The table ships with the data rather than being edited by users, so a
+    // line that is not valid UTF-8 means the file is corrupted.
+    if (verdict.rejectedLines > 0) {
+        verdict.valid = false;
+    }
+    if (verdict.valid && data.substr(0, SYMBOLS_PRAGMA_HEADER.length()) != SYMBOLS_PRAGMA_HEADER) {
+        verdict = { false, "missing the format header", 1 };
+    }
+    if (!verdict.valid) {
+        MCBOPOMOFO_LOG(Warn) << "open:: rejected " << path << ":"
+                             << verdict.line << ": " << verdict.error;
+        close();
+        return false;
+    }
+
+    build();
+    return true;
+}
+
+void SymbolTable::close()
+{
+    if (m_data) {
+        munmap(m_data, m_length);
+        ::close(m_fd);
+        m_fd = -1;
+        m_data = nullptr;
+    }
+
+    m_symbols.clear();
+    m_categories.clear();
+    m_prefixSymbols.clear();
+    m_prefixes.clear();
+}
+
+void SymbolTable::build()
+{
+    std::string_view data(static_cast<char*>(m_data), m_length);
+
+    // The symbols of every prefix so far. A symbol's keywords are indexed one
+    // after another, so comparing with the last symbol is enough to list each
+    // symbol once.
+    std::unordered_map<std::string_view, std::vector<uint32_t>> prefixSymbols;
+
+    size_t pos = 0;
+    while (pos < data.length()) {
+        size_t eol = data.find('\n', pos);
+        if (eol == std::string_view::npos) {
+            eol = data.length();
+        }
+        std::string_view row = data.substr(pos, eol - pos);
+        pos = eol + 1;
+
+        if (row.empty() || row[0] == '#') {
+            continue;
+        }
+
+        std::vector<std::string_view> columns;
+        size_t columnPos = 0;
+        while (columnPos < row.length()) {
+            size_t columnEnd = row.find(' ', columnPos);
+            if (columnEnd == std::string_view::npos) {
+                columnEnd = row.length();
+            }
+            if (columnEnd > columnPos) {
+                columns.push_back(row.substr(columnPos, columnEnd - columnPos));
+            }
+            columnPos = columnEnd + 1;
+        }
+        if (columns.size() < 2) {
+            continue;
+        }
+
+        uint32_t symbol = static_cast<uint32_t>(m_symbols.size());
+        m_symbols.push_back(columns[1]);
+
+        auto category = std::find_if(m_categories.rbegin(), m_categories.rend(), [&](const Category& c) { return c.name == columns[0]; });
+        if (category == m_categories.rend()) {
+            m_categories.push_back({ columns[0], {} });
+            category = m_categories.rbegin();
+        }
+        category->symbols.push_back(symbol);
+
+        for (size_t i = 2; i < columns.size(); i++) {
+            // Index the readings from each of their syllables too, so that
+            // "ㄒㄧㄣ" finds what "ㄞˋ-ㄒㄧㄣ" names.
+            for (size_t start = 0; start < columns[i].length(); start = columns[i].find('-', start) + 1) {
+                std::string_view keyword = columns[i].substr(start);
+                for (size_t end = 1; end <= keyword.length(); end++) {
+                    if (end < keyword.length() && (isUTF8ContinuationByte(keyword[end]) || keyword[end - 1] == '-')) {
+                        continue;
+                    }
+                    std::vector<uint32_t>& symbols = prefixSymbols[keyword.substr(0, end)];
+                    if (symbols.size() < MaxSymbolsPerPrefix && (symbols.empty() || symbols.back() != symbol)) {
+                        symbols.push_back(symbol);
+                    }
+                }
+                if (keyword.find('-') == std::string_view::npos) {
+                    break;
+                }
+            }
+        }
+    }
+
+    m_prefixes.reserve(prefixSymbols.size());
+    for (auto& [prefix, symbols] : prefixSymbols) {
+        m_prefixes[prefix] = { static_cast<uint32_t>(m_prefixSymbols.size()), static_cast<uint32_t>(symbols.size()) };
+        m_prefixSymbols.insert(m_prefixSymbols.end(), symbols.begin(), symbols.end());
+    }
+}
+
+std::vector<std::string_view> SymbolTable::categories() const
+{
+    std::vector<std::string_view> names;
+    names.reserve(m_categories.size());
+    for (const Category& category : m_categories) {
+        names.push_back(category.name);
+    }
+    return names;
+}
+
+std::vector<std::string_view> SymbolTable::symbolsInCategory(std::string_view category) const
+{
+    std::vector<std::string_view> symbols;
+    for (const Category& c : m_categories) {
+        if (c.name == category) {
+            symbols.reserve(c.symbols.size());
+            for (uint32_t symbol : c.symbols) {
+                symbols.push_back(m_symbols[symbol]);
+            }
+            break;
+        }
+    }
+    return symbols;
+}
+
+std::vector<std::string_view> SymbolTable::symbolsForPrefix(std::string_view prefix, size_t maxCount) const
+{
+    std::vector<std::string_view> symbols;
+    auto it = m_prefixes.find(prefix);
+    if (it == m_prefixes.end()) {
+        return symbols;
+    }
+    size_t count = std::min<size_t>(it->second.second, maxCount);
+    symbols.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        symbols.push_back(m_symbols[m_prefixSymbols[it->second.first + i]]);
+    }
+    return symbols;
+}
+
+} // namespace McBopomofo
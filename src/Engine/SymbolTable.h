@@ -0,0 +1,99 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SYMBOLTABLE_H
+#define SYMBOLTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace McBopomofo {
+
+constexpr std::string_view SYMBOLS_PRAGMA_HEADER
+    = "# format org.openvanilla.mcbopomofo.symbols\n";
+
+/// A table of symbols and emoji in categories, with an index of their
+/// keywords for searching as they are typed.
+///
+/// The table is a file of "category symbol keyword..." rows, where a keyword
+/// is either the Bopomofo readings of a name, joined by "-", or an English
+/// word in lowercase. The file is mapped into memory and the symbols,
+/// categories and keywords are views into it. Every prefix of every keyword is
+/// indexed with the symbols it matches when the file is opened, so a search is
+/// one hash lookup no matter how large the table is.
+///
+/// The index is built on the heap rather than shipped in the file. The table
+/// has a few hundred rows and the index takes about a millisecond to build,
+/// once when the models are loaded and not while typing, so a prebuilt binary
+/// index would save little, and the table stays a text file anyone can edit.
+class SymbolTable {
+public:
+    /// The number of symbols kept for each prefix.
+    static constexpr size_t MaxSymbolsPerPrefix = 32;
+
+    SymbolTable();
+    ~SymbolTable();
+    SymbolTable(const SymbolTable&) = delete;
+    SymbolTable& operator=(const SymbolTable&) = delete;
+
+    bool open(const char* path);
+    void close();
+    bool isLoaded() const { return m_data != nullptr; }
+
+    /// The categories, in the order of the file.
+    std::vector<std::string_view> categories() const;
+
+    /// The symbols of the category, in the order of the file.
+    std::vector<std::string_view> symbolsInCategory(std::string_view category) const;
+
+    /// Returns up to maxCount symbols that have a keyword starting with the
+    /// prefix, in the order of the file.
+    std::vector<std::string_view> symbolsForPrefix(std::string_view prefix, size_t maxCount) const;
+
+private:
+    void build();
+
+    struct Category {
+        std::string_view name;
+        std::vector<uint32_t> symbols;
+    };
+
+    std::vector<std::string_view> m_symbols;
+    std::vector<Category> m_categories;
+    /// The symbols of every prefix, each a range of m_prefixSymbols given as
+    /// (offset, count).
+    std::vector<uint32_t> m_prefixSymbols;
+    std::unordered_map<std::string_view, std::pair<uint32_t, uint32_t>> m_prefixes;
+
+    int m_fd;
+    void* m_data;
+    size_t m_length;
+};
+
+} // namespace McBopomofo
+
+#endif // SYMBOLTABLE_H
@@ -123,6 +123,11 @@ std::string UserOverrideModel::suggest(const std::vector<Formosa::Gramambular::N
     return candidate;
 }
 
+size_t UserOverrideModel::size() const
+{
+    return m_lruList.size();
+}
+
 void UserOverrideModel::Observation::update(const std::string& candidate,
     double timestamp)
 {
@@ -174,19 +179,19 @@ static std::string WalkedNodesToKey(const std::vector<Formosa::Gramambular::Node
         return "";
     }
 
-    std::string current = (*r).node->currentKeyValue().key;
+    std::string current = (*r).currentKeyValue().key;
     ++r;
 
     s.clear();
     s.str(std::string());
     if (r != n.rend()) {
-        std::string value = (*r).node->currentKeyValue().value;
+        std::string value = (*r).currentKeyValue().value;
         if (IsEndingPunctuation(value)) {
             s << "()";
             r = n.rend();
         } else {
             s << "("
-              << (*r).node->currentKeyValue().key
+              << (*r).currentKeyValue().key
               << ","
               << value
               << ")";
@@ -200,13 +205,13 @@ static std::string WalkedNodesToKey(const std::vector<Formosa::Gramambular::Node
     s.clear();
     s.str(std::string());
     if (r != n.rend()) {
-        std::string value = (*r).node->currentKeyValue().value;
+        std::string value = (*r).currentKeyValue().value;
         if (IsEndingPunctuation(value)) {
             s << "()";
             r = n.rend();
         } else {
             s << "("
-              << (*r).node->currentKeyValue().key
+              << (*r).currentKeyValue().key
               << ","
               << value
               << ")";
@@ -45,6 +45,9 @@ public:
         size_t cursorIndex,
         double timestamp);
 
+    // Returns the number of observed contexts currently held by the model.
+    size_t size() const;
+
 private:
     struct Override {
         size_t count;
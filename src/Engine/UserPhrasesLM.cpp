@@ -29,7 +29,9 @@
 #include <fstream>
 #include <unistd.h>
 
+#include "AsyncLog.h"
 #include "KeyValueBlobReader.h"
+#include "PhraseDataVerifier.h"
 
 namespace McBopomofo {
 
@@ -63,28 +65,56 @@ bool UserPhrasesLM::open(const char *path)
 
     fd = ::open(path, O_RDONLY);
     if (fd == -1) {
-        printf("open:: file not exist");
+        MCBOPOMOFO_LOG(Warn) << "open:: file not exist: " << path;
         return false;
     }
 
     struct stat sb;
     if (fstat(fd, &sb) == -1) {
-        printf("open:: cannot open file");
+        MCBOPOMOFO_LOG(Warn) << "open:: cannot open file: " << path;
+        ::close(fd);
+        fd = -1;
         return false;
     }
 
     length = (size_t)sb.st_size;
 
     data = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
-    if (!data) {
+    if (data == MAP_FAILED) {
+        data = 0;
         ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    PhraseDataVerifier::Result verdict = PhraseDataVerifier::verifyFile(sb,
+        std::string_view(static_cast<char*>(data), length),
+        PhraseDataVerifier::Format::KeyValue);
+    if (!verdict.valid) {
+        MCBOPOMOFO_LOG(Warn) << "open:: rejected " << path << ":"
+                             << verdict.line << ": " << verdict.error;
+        close();
         return false;
     }
+    // A stray byte rejects only the pairs with it, not the user's other
+    // phrases.
+    bool skipsInvalidPairs = verdict.rejectedLines > 0;
+    if (skipsInvalidPairs) {
+        MCBOPOMOFO_LOG(Warn) << "open:: skipping " << verdict.rejectedLines
+                             << " lines of " << path << ", the first at line "
+                             << verdict.line << ": " << verdict.error;
+    }
 
     KeyValueBlobReader reader(static_cast<char*>(data), length);
     KeyValueBlobReader::KeyValue keyValue;
     KeyValueBlobReader::State state;
+    size_t errorOffset;
     while ((state = reader.Next(&keyValue)) == KeyValueBlobReader::State::HAS_PAIR) {
+        if (skipsInvalidPairs
+            && (!PhraseDataVerifier::isValidUTF8(keyValue.key, &errorOffset)
+                || !PhraseDataVerifier::isValidUTF8(keyValue.value, &errorOffset))) {
+            continue;
+        }
         // We invert the key and value, since in user phrases, "key" is the phrase value, and "value" is the BPMF reading.
         keyRowMap[keyValue.value].emplace_back(keyValue.value, keyValue.key);
     }
@@ -119,11 +149,23 @@ const std::vector<Formosa::Gramambular::Bigram> UserPhrasesLM::bigramsForKeys(co
 
 const std::vector<Formosa::Gramambular::Unigram> UserPhrasesLM::unigramsForKey(const std::string& key)
 {
-    std::vector<Formosa::Gramambular::Unigram> v;
+    return unigramsInRows(rowsForKey(key));
+}
+
+const std::vector<UserPhrasesLM::Row>* UserPhrasesLM::rowsForKey(const std::string& key) const
+{
     auto iter = keyRowMap.find(key);
-    if (iter != keyRowMap.end()) {
-        const std::vector<Row>& rows = iter->second;
-        for (const auto& row : rows) {
+    if (iter == keyRowMap.end()) {
+        return nullptr;
+    }
+    return &iter->second;
+}
+
+const std::vector<Formosa::Gramambular::Unigram> UserPhrasesLM::unigramsInRows(const std::vector<Row>* rows) const
+{
+    std::vector<Formosa::Gramambular::Unigram> v;
+    if (rows != nullptr) {
+        for (const auto& row : *rows) {
             Formosa::Gramambular::Unigram g;
             g.keyValue.key = row.key;
             g.keyValue.value = row.value;
@@ -135,9 +177,33 @@ const std::vector<Formosa::Gramambular::Unigram> UserPhrasesLM::unigramsForKey(c
     return v;
 }
 
+std::vector<std::string_view> UserPhrasesLM::keys() const
+{
+    std::vector<std::string_view> v;
+    v.reserve(keyRowMap.size());
+    for (const auto& entry : keyRowMap) {
+        v.push_back(entry.first);
+    }
+    return v;
+}
+
 bool UserPhrasesLM::hasUnigramsForKey(const std::string& key)
 {
     return keyRowMap.find(key) != keyRowMap.end();
 }
 
+bool UserPhrasesLM::hasKeyValue(const std::string& key, const std::string& value)
+{
+    const std::vector<Row>* rows = rowsForKey(key);
+    if (rows == nullptr) {
+        return false;
+    }
+    for (const auto& row : *rows) {
+        if (row.value == value) {
+            return true;
+        }
+    }
+    return false;
+}
+
 };  // namespace McBopomofo
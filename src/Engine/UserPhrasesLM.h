@@ -45,14 +45,22 @@ public:
     virtual const std::vector<Formosa::Gramambular::Bigram> bigramsForKeys(const std::string& preceedingKey, const std::string& key);
     virtual const std::vector<Formosa::Gramambular::Unigram> unigramsForKey(const std::string& key);
     virtual bool hasUnigramsForKey(const std::string& key);
-    
-protected:
+    virtual bool hasKeyValue(const std::string& key, const std::string& value);
+
     struct Row {
         Row(std::string_view& k, std::string_view& v) : key(k), value(v) {}
         std::string_view key;
         std::string_view value;
     };
-    
+
+    // Returns the rows of the key, found by one lookup, or nullptr if there
+    // are none. They are valid until the phrases are closed.
+    const std::vector<Row>* rowsForKey(const std::string& key) const;
+    const std::vector<Formosa::Gramambular::Unigram> unigramsInRows(const std::vector<Row>* rows) const;
+    // Returns the keys that have rows, valid until the phrases are closed.
+    std::vector<std::string_view> keys() const;
+
+protected:
     std::map<std::string_view, std::vector<Row>> keyRowMap;
     int fd;
     void *data;
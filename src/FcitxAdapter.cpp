@@ -0,0 +1,111 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "FcitxAdapter.h"
+
+#include <fcitx-utils/i18n.h>
+#include <fmt/format.h>
+
+namespace McBopomofo {
+
+Key ConvertFcitxKey(const fcitx::Key& key) {
+  fcitx::KeyStates states = key.states();
+  if (states.testAny(fcitx::KeyStates{fcitx::KeyState::Alt,
+                                      fcitx::KeyState::Super,
+                                      fcitx::KeyState::Hyper})) {
+    return Key();
+  }
+  bool shiftPressed = states.test(fcitx::KeyState::Shift);
+  bool ctrlPressed = states.test(fcitx::KeyState::Ctrl);
+
+  FcitxKeySym sym = key.sym();
+  if (sym >= FcitxKey_space && sym <= FcitxKey_asciitilde) {
+    return Key::asciiKey(static_cast<char>(sym), shiftPressed, ctrlPressed);
+  }
+
+  Key::Name name = Key::Name::kUnknown;
+  switch (sym) {
+    case FcitxKey_Return:
+      name = Key::Name::kReturn;
+      break;
+    case FcitxKey_Escape:
+      name = Key::Name::kEscape;
+      break;
+    case FcitxKey_BackSpace:
+      name = Key::Name::kBackSpace;
+      break;
+    case FcitxKey_Delete:
+      name = Key::Name::kDelete;
+      break;
+    case FcitxKey_Left:
+      name = Key::Name::kLeft;
+      break;
+    case FcitxKey_Right:
+      name = Key::Name::kRight;
+      break;
+    case FcitxKey_Home:
+      name = Key::Name::kHome;
+      break;
+    case FcitxKey_End:
+      name = Key::Name::kEnd;
+      break;
+    default:
+      break;
+  }
+  return Key::namedKey(name, shiftPressed, ctrlPressed);
+}
+
+std::string FcitxLocalizedStrings::cursorIsBetweenSyllables(
+    const std::string& prevReading, const std::string& nextReading) {
+  return fmt::format(_("Cursor is between syllables {0} and {1}"),
+                     prevReading, nextReading);
+}
+
+std::string FcitxLocalizedStrings::syllablesRequired(size_t count) {
+  return fmt::format(_("{0} syllables required"), std::to_string(count));
+}
+
+std::string FcitxLocalizedStrings::syllablesMaximum(size_t count) {
+  return fmt::format(_("{0} syllables maximum"), std::to_string(count));
+}
+
+std::string FcitxLocalizedStrings::phraseAlreadyExists() {
+  return _("phrase already exists");
+}
+
+std::string FcitxLocalizedStrings::pressEnterToAddThePhrase() {
+  return _("press Enter to add the phrase");
+}
+
+std::string FcitxLocalizedStrings::markedWithSyllablesAndStatus(
+    const std::string& marked, const std::string& readingUiText,
+    const std::string& status) {
+  return fmt::format(_("Marked: {0}, syllables: {1}, {2}"), marked,
+                     readingUiText, status);
+}
+
+std::string FcitxLocalizedStrings::symbolSearch(const std::string& search) {
+  return fmt::format(_("Search symbols: {0}"), search);
+}
+
+}  // namespace McBopomofo
@@ -0,0 +1,57 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SRC_FCITXADAPTER_H_
+#define SRC_FCITXADAPTER_H_
+
+#include <fcitx-utils/key.h>
+
+#include <string>
+
+#include "Key.h"
+#include "KeyHandler.h"
+
+namespace McBopomofo {
+
+// Converts a Fcitx key to the key the key handler takes. Keys pressed with
+// modifiers other than Shift and Ctrl are unknown to the key handler.
+Key ConvertFcitxKey(const fcitx::Key& key);
+
+// The key handler's strings, translated with the add-on's gettext domain.
+class FcitxLocalizedStrings : public KeyHandler::LocalizedStrings {
+ public:
+  std::string cursorIsBetweenSyllables(const std::string& prevReading,
+                                       const std::string& nextReading) override;
+  std::string syllablesRequired(size_t count) override;
+  std::string syllablesMaximum(size_t count) override;
+  std::string phraseAlreadyExists() override;
+  std::string pressEnterToAddThePhrase() override;
+  std::string markedWithSyllablesAndStatus(const std::string& marked,
+                                           const std::string& readingUiText,
+                                           const std::string& status) override;
+  std::string symbolSearch(const std::string& search) override;
+};
+
+}  // namespace McBopomofo
+
+#endif  // SRC_FCITXADAPTER_H_
@@ -0,0 +1,581 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+// A randomized differential test of the Gramambular data structures and
+// walker. It drives the reference implementation in GramambularReference.h and
+// the optimized one with the same random sequence of builder and grid
+// operations over a synthetic language model, compares what they observe
+// after every operation, and then replays the sequence on each of them to
+// report their relative speed.
+//
+// The scores of the synthetic language model are multiples of 1/256, so that
+// the path scores are exact whatever the order they are summed in, and a
+// difference in the walk is a difference in the walk, not a rounding one.
+//
+// Usage: McBopomofoGramambularDiffTest [--operations=N] [--seed=N]
+//            [--max-readings=N] [--timing-rounds=N]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Gramambular.h"
+#include "GramambularReference.h"
+
+namespace McBopomofo {
+
+namespace {
+
+struct Options {
+  uint64_t operations = 20'000;
+  uint32_t seed = 5381;
+  // The reference walker takes exponential time in the width of the grid.
+  size_t maxReadings = 16;
+  uint64_t timingRounds = 3;
+};
+
+constexpr char kJoinSeparator[] = "-";
+constexpr const char* kSyllables[] = {"a", "b", "c", "d", "e", "f", "g", "h"};
+constexpr size_t kSyllableCount = sizeof(kSyllables) / sizeof(kSyllables[0]);
+
+// A language model where every syllable has unigrams, and fewer keys of more
+// syllables do. Some values are shared between keys, so that fixing a
+// candidate affects overlapping nodes.
+class SyntheticLanguageModel : public Formosa::Gramambular::LanguageModel {
+ public:
+  explicit SyntheticLanguageModel(uint32_t seed) : seed_(seed) {}
+
+  const std::vector<Formosa::Gramambular::Bigram> bigramsForKeys(
+      const std::string&, const std::string&) override {
+    return std::vector<Formosa::Gramambular::Bigram>();
+  }
+
+  const std::vector<Formosa::Gramambular::Unigram> unigramsForKey(
+      const std::string& key) override {
+    std::vector<Formosa::Gramambular::Unigram> unigrams;
+    if (!hasUnigramsForKey(key)) {
+      return unigrams;
+    }
+    uint64_t hash = Hash(key);
+    size_t count = 1 + (hash >> 8) % 4;
+    for (size_t i = 0; i < count; i++) {
+      uint64_t h = Mix(hash + i);
+      Formosa::Gramambular::Unigram unigram;
+      unigram.keyValue.key = key;
+      unigram.keyValue.value = h % 5 == 0 ? "v" + std::to_string(h % 7)
+                                          : key + "#" + std::to_string(i);
+      unigram.score = -static_cast<double>((h >> 16) % 4096) / 256.0;
+      unigrams.push_back(unigram);
+    }
+    return unigrams;
+  }
+
+  bool hasUnigramsForKey(const std::string& key) override {
+    size_t syllables = 1;
+    for (char c : key) {
+      syllables += c == kJoinSeparator[0];
+    }
+    if (syllables == 1) {
+      return true;
+    }
+    uint64_t percentage = Hash(key) % 100;
+    if (syllables == 2) {
+      return percentage < 50;
+    }
+    return syllables == 3 ? percentage < 25 : percentage < 10;
+  }
+
+ private:
+  static uint64_t Mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+  }
+
+  uint64_t Hash(const std::string& key) const {
+    uint64_t hash = 1469598103934665603ULL ^ seed_;
+    for (unsigned char c : key) {
+      hash = (hash ^ c) * 1099511628211ULL;
+    }
+    return Mix(hash);
+  }
+
+  uint32_t seed_;
+};
+
+struct Operation {
+  enum class Type {
+    kInsert,
+    kDeleteBefore,
+    kDeleteAfter,
+    kSetCursor,
+    kRemoveHead,
+    kFix,
+    kOverride,
+    kOverlay,
+    kWalk,
+  };
+  Type type;
+  // The reading to insert, or the candidate value to fix, override or overlay
+  // with.
+  std::string text;
+  // The cursor, the number of head readings, or the location to fix at.
+  size_t index = 0;
+  float score = 0;
+};
+
+// Drives one implementation, given as its builder, walker and node anchor
+// types, and describes what it observes as text, so that the observations of
+// the two implementations can be compared.
+template <typename Builder, typename Walker, typename NodeAnchor>
+class Driver {
+ public:
+  explicit Driver(Formosa::Gramambular::LanguageModel* lm) : builder_(lm) {
+    builder_.setJoinSeparator(kJoinSeparator);
+  }
+
+  Builder& builder() { return builder_; }
+
+  // Applies the operation and returns what it returned, if anything.
+  std::string apply(const Operation& op) {
+    std::ostringstream result;
+    switch (op.type) {
+      case Operation::Type::kInsert:
+        builder_.insertReadingAtCursor(op.text);
+        break;
+      case Operation::Type::kDeleteBefore:
+        result << builder_.deleteReadingBeforeCursor();
+        break;
+      case Operation::Type::kDeleteAfter:
+        result << builder_.deleteReadingAfterCursor();
+        break;
+      case Operation::Type::kSetCursor:
+        builder_.setCursorIndex(op.index);
+        break;
+      case Operation::Type::kRemoveHead:
+        result << builder_.removeHeadReadings(op.index);
+        break;
+      case Operation::Type::kFix: {
+        NodeAnchor anchor =
+            builder_.grid().fixNodeSelectedCandidate(op.index, op.text);
+        if (anchor.node) {
+          result << Describe(anchor);
+        }
+        break;
+      }
+      case Operation::Type::kOverride:
+        builder_.grid().overrideNodeScoreForSelectedCandidate(op.index, op.text,
+                                                              op.score);
+        break;
+      case Operation::Type::kOverlay:
+        builder_.grid().overlayScoreForSelectedCandidate(op.index, op.text,
+                                                         op.score);
+        break;
+      case Operation::Type::kWalk: {
+        Walker walker(&builder_.grid());
+        for (const NodeAnchor& anchor :
+             walker.reverseWalk(builder_.grid().width())) {
+          result << Describe(anchor) << "=" << anchor.accumulatedScore << ";";
+        }
+        break;
+      }
+    }
+    return result.str();
+  }
+
+  // Describes the readings, the cursor and every node of the grid.
+  std::string describe() {
+    std::ostringstream result;
+    for (const std::string& reading : builder_.readings()) {
+      result << reading << " ";
+    }
+    result << "| cursor " << builder_.cursorIndex() << " | width "
+           << builder_.grid().width() << "\n";
+    for (size_t i = 1; i <= builder_.grid().width(); i++) {
+      for (const NodeAnchor& anchor : builder_.grid().nodesEndingAt(i)) {
+        result << "  " << Describe(anchor) << " score " << anchor.node->score()
+               << " walked as " << anchor.score()
+               << (anchor.node->isCandidateFixed() ? " fixed" : "") << " [";
+        for (const auto& candidate : anchor.node->candidates()) {
+          result << candidate.value << " ";
+        }
+        result << "]\n";
+      }
+    }
+    return result.str();
+  }
+
+ private:
+  static std::string Describe(const NodeAnchor& anchor) {
+    std::ostringstream result;
+    result << "(" << anchor.location << "," << anchor.spanningLength << ") "
+           << anchor.node->key() << ":" << anchor.currentKeyValue().value;
+    return result.str();
+  }
+
+  Builder builder_;
+};
+
+using ReferenceDriver =
+    Driver<Formosa::Gramambular::Reference::BlockReadingBuilder,
+           Formosa::Gramambular::Reference::Walker,
+           Formosa::Gramambular::Reference::NodeAnchor>;
+using OptimizedDriver = Driver<Formosa::Gramambular::BlockReadingBuilder,
+                               Formosa::Gramambular::Walker,
+                               Formosa::Gramambular::NodeAnchor>;
+
+// Generates the next operation for the state of the reference builder.
+Operation NextOperation(Formosa::Gramambular::Reference::BlockReadingBuilder*
+                            builder,
+                        const Options& options, std::mt19937* random) {
+  auto pick = [random](size_t n) {
+    return std::uniform_int_distribution<size_t>(0, n - 1)(*random);
+  };
+
+  Operation op;
+  size_t dice = pick(100);
+  size_t length = builder->length();
+  if (dice < 45) {
+    if (length >= options.maxReadings) {
+      op.type = Operation::Type::kRemoveHead;
+      op.index = 1 + pick(3);
+    } else {
+      op.type = Operation::Type::kInsert;
+      op.text = kSyllables[pick(kSyllableCount)];
+    }
+  } else if (dice < 53) {
+    op.type = Operation::Type::kDeleteBefore;
+  } else if (dice < 58) {
+    op.type = Operation::Type::kDeleteAfter;
+  } else if (dice < 68) {
+    op.type = Operation::Type::kSetCursor;
+    op.index = pick(length + 2);
+  } else if (dice < 72) {
+    op.type = Operation::Type::kRemoveHead;
+    // Sometimes more than there are, which fails.
+    op.index = pick(4);
+  } else if (dice < 88) {
+    op.type = dice < 78   ? Operation::Type::kFix
+              : dice < 82 ? Operation::Type::kOverride
+                          : Operation::Type::kOverlay;
+    op.index = pick(length + 1);
+    op.score = static_cast<float>(pick(64)) / 4.0f;
+    auto anchors = builder->grid().nodesCrossingOrEndingAt(op.index);
+    if (anchors.empty() || pick(10) == 0) {
+      op.text = "none";
+    } else {
+      const auto& candidates = anchors[pick(anchors.size())].node->candidates();
+      op.text = candidates[pick(candidates.size())].value;
+    }
+  } else {
+    op.type = Operation::Type::kWalk;
+  }
+  return op;
+}
+
+// Describes a walk, given in the reverse order, node by node.
+std::string DescribeWalk(
+    const std::vector<Formosa::Gramambular::NodeAnchor>& walk) {
+  std::ostringstream result;
+  for (const auto& anchor : walk) {
+    result << "(" << anchor.location << "," << anchor.spanningLength << ") "
+           << anchor.node->key() << ":" << anchor.currentKeyValue().value
+           << "=" << anchor.accumulatedScore << ";";
+  }
+  return result.str();
+}
+
+// Walks the grid from the best paths it keeps from earlier walks, and again
+// from none, and returns what differs, if anything. Copies of the grid are
+// walked, so that the grid keeps its best paths as the operations left them.
+std::string CheckIncrementalWalk(const Formosa::Gramambular::Grid& grid) {
+  Formosa::Gramambular::Grid incremental = grid;
+  Formosa::Gramambular::Grid fresh = grid;
+  fresh.bestPaths() = Formosa::Gramambular::Grid::BestPaths();
+  for (size_t location = 1; location <= grid.width(); location++) {
+    std::string expected = DescribeWalk(
+        Formosa::Gramambular::Walker(&fresh).reverseWalk(location));
+    std::string actual = DescribeWalk(
+        Formosa::Gramambular::Walker(&incremental).reverseWalk(location));
+    if (expected != actual) {
+      std::ostringstream result;
+      result << "walk to " << location << " from scratch: " << expected
+             << "\nwalk to " << location << " from kept paths: " << actual
+             << "\n";
+      return result.str();
+    }
+  }
+  return std::string();
+}
+
+// Appends the readings to a copy of the builder, and returns what differs, if
+// anything, between the best paths before and after up to the location where
+// the best paths to the last locations converged before. Sets whether they
+// converged at all.
+std::string CheckConvergence(
+    const Formosa::Gramambular::BlockReadingBuilder& builder,
+    const std::vector<std::string>& appended, bool* converged) {
+  using Formosa::Gramambular::BlockReadingBuilder;
+  BlockReadingBuilder copy = builder;
+  copy.setCursorIndex(copy.length());
+  size_t width = copy.grid().width();
+  Formosa::Gramambular::Walker walker(&copy.grid());
+  size_t convergence = walker.convergenceLocation(
+      width, BlockReadingBuilder::MaximumBuildSpanLength);
+  *converged = convergence > 0;
+  if (!*converged) {
+    return std::string();
+  }
+
+  // The nodes of the best path up to the convergence location, forward.
+  auto prefix = [convergence](
+                    std::vector<Formosa::Gramambular::NodeAnchor> walk) {
+    std::reverse(walk.begin(), walk.end());
+    std::ostringstream result;
+    for (const auto& anchor : walk) {
+      if (anchor.location + anchor.spanningLength > convergence) {
+        break;
+      }
+      result << "(" << anchor.location << "," << anchor.spanningLength << ") "
+             << anchor.node->key() << ":" << anchor.currentKeyValue().value
+             << ";";
+    }
+    return result.str();
+  };
+
+  std::string before = prefix(walker.reverseWalk(width));
+  for (const std::string& reading : appended) {
+    copy.insertReadingAtCursor(reading);
+  }
+  std::string after = prefix(Formosa::Gramambular::Walker(&copy.grid())
+                                 .reverseWalk(copy.grid().width()));
+  if (before == after) {
+    return std::string();
+  }
+  std::ostringstream result;
+  result << "best path up to convergence location " << convergence << ": "
+         << before << "\nafter appending " << appended.size()
+         << " readings: " << after << "\n";
+  return result.str();
+}
+
+// The number of nodes of the reference grid that the score overlay adjusts.
+size_t CountOverlaidNodes(Formosa::Gramambular::Reference::Grid* grid) {
+  size_t count = 0;
+  for (size_t i = 1; i <= grid->width(); i++) {
+    for (const auto& anchor : grid->nodesEndingAt(i)) {
+      count += anchor.node->isOverlaid();
+    }
+  }
+  return count;
+}
+
+// How often the operations exercised what the score overlay must get right,
+// so that a run that compared no such case fails rather than passes.
+struct OverlayCoverage {
+  // Adjustments were kept as the grid expanded or shrank.
+  uint64_t keptOnExpand = 0;
+  uint64_t keptOnShrink = 0;
+  // Fixing a candidate erased adjustments.
+  uint64_t erasedOnFix = 0;
+
+  void count(const Operation& op, const std::string& result, size_t before,
+             size_t after) {
+    switch (op.type) {
+      case Operation::Type::kInsert:
+        keptOnExpand += before > 0 && after > 0;
+        break;
+      case Operation::Type::kDeleteBefore:
+      case Operation::Type::kDeleteAfter:
+      case Operation::Type::kRemoveHead:
+        keptOnShrink += result == "1" && before > 0 && after > 0;
+        break;
+      case Operation::Type::kFix:
+        erasedOnFix += after < before;
+        break;
+      default:
+        break;
+    }
+  }
+
+  bool complete() const {
+    return keptOnExpand > 0 && keptOnShrink > 0 && erasedOnFix > 0;
+  }
+};
+
+template <typename DriverType>
+double TimeReplay(Formosa::Gramambular::LanguageModel* lm,
+                  const std::vector<Operation>& operations) {
+  auto start = std::chrono::steady_clock::now();
+  DriverType driver(lm);
+  for (const Operation& op : operations) {
+    driver.apply(op);
+  }
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+bool ParseOptions(int argc, char* argv[], Options* options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+      return false;
+    }
+    std::string name = arg.substr(2, eq - 2);
+    std::string value = arg.substr(eq + 1);
+    if (name == "operations") {
+      options->operations = std::stoull(value);
+    } else if (name == "seed") {
+      options->seed = static_cast<uint32_t>(std::stoul(value));
+    } else if (name == "max-readings") {
+      options->maxReadings = std::stoull(value);
+    } else if (name == "timing-rounds") {
+      options->timingRounds = std::stoull(value);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int RunGramambularDifferentialTest(int argc, char* argv[]) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    fprintf(stderr,
+            "usage: %s [--operations=N] [--seed=N] [--max-readings=N] "
+            "[--timing-rounds=N]\n",
+            argv[0]);
+    return 2;
+  }
+
+  SyntheticLanguageModel lm(options.seed);
+  std::mt19937 random(options.seed);
+  ReferenceDriver reference(&lm);
+  OptimizedDriver optimized(&lm);
+
+  // Picks the readings appended to check the convergence location, apart from
+  // the operations, so that they are generated as without the checks.
+  std::mt19937 appendRandom(options.seed + 1);
+  uint64_t convergenceChecks = 0;
+
+  std::vector<Operation> operations;
+  OverlayCoverage coverage;
+  for (uint64_t i = 0; i < options.operations; i++) {
+    Operation op = NextOperation(&reference.builder(), options, &random);
+    operations.push_back(op);
+
+    size_t overlaidBefore = CountOverlaidNodes(&reference.builder().grid());
+    std::string expected = reference.apply(op);
+    std::string actual = optimized.apply(op);
+    coverage.count(op, expected, overlaidBefore,
+                   CountOverlaidNodes(&reference.builder().grid()));
+    std::string expectedState = reference.describe();
+    std::string actualState = optimized.describe();
+    if (expected != actual || expectedState != actualState) {
+      printf("FAILED: operation %llu (type %d, text \"%s\", index %zu, score "
+             "%g) differs\n",
+             static_cast<unsigned long long>(i), static_cast<int>(op.type),
+             op.text.c_str(), op.index, op.score);
+      printf("reference returned: %s\nreference state:\n%s", expected.c_str(),
+             expectedState.c_str());
+      printf("optimized returned: %s\noptimized state:\n%s", actual.c_str(),
+             actualState.c_str());
+      printf("rerun with --seed=%u --operations=%llu to reproduce\n",
+             options.seed, static_cast<unsigned long long>(i + 1));
+      return 1;
+    }
+
+    std::string walkDifference =
+        CheckIncrementalWalk(optimized.builder().grid());
+    std::vector<std::string> appended(
+        1 + appendRandom() %
+                (2 * Formosa::Gramambular::BlockReadingBuilder::
+                         MaximumBuildSpanLength));
+    for (std::string& reading : appended) {
+      reading = kSyllables[appendRandom() % kSyllableCount];
+    }
+    bool converged = false;
+    std::string convergenceDifference =
+        CheckConvergence(optimized.builder(), appended, &converged);
+    convergenceChecks += converged;
+    if (!walkDifference.empty() || !convergenceDifference.empty()) {
+      printf("FAILED: after operation %llu (type %d, text \"%s\", index %zu, "
+             "score %g)\n%s%s",
+             static_cast<unsigned long long>(i), static_cast<int>(op.type),
+             op.text.c_str(), op.index, op.score, walkDifference.c_str(),
+             convergenceDifference.c_str());
+      printf("optimized state:\n%s", actualState.c_str());
+      printf("rerun with --seed=%u --operations=%llu to reproduce\n",
+             options.seed, static_cast<unsigned long long>(i + 1));
+      return 1;
+    }
+  }
+  printf("%llu operations matched\n",
+         static_cast<unsigned long long>(operations.size()));
+  printf("incremental walks matched walks from scratch after every operation, "
+         "and best paths up to the convergence location held in %llu checks\n",
+         static_cast<unsigned long long>(convergenceChecks));
+  printf("score overlay kept on %llu expansions and %llu shrinks, erased on "
+         "%llu fixes\n",
+         static_cast<unsigned long long>(coverage.keptOnExpand),
+         static_cast<unsigned long long>(coverage.keptOnShrink),
+         static_cast<unsigned long long>(coverage.erasedOnFix));
+  if (!coverage.complete()) {
+    printf("FAILED: the operations did not cover the score overlay; run more "
+           "of them\n");
+    return 1;
+  }
+
+  double referenceMs = 0;
+  double optimizedMs = 0;
+  for (uint64_t round = 0; round < options.timingRounds; round++) {
+    referenceMs += TimeReplay<ReferenceDriver>(&lm, operations);
+    optimizedMs += TimeReplay<OptimizedDriver>(&lm, operations);
+  }
+  if (options.timingRounds > 0) {
+    printf("reference %.1f ms, optimized %.1f ms per round, speedup %.2fx\n",
+           referenceMs / options.timingRounds,
+           optimizedMs / options.timingRounds,
+           optimizedMs > 0 ? referenceMs / optimizedMs : 0.0);
+  }
+  printf("PASSED\n");
+  return 0;
+}
+
+}  // namespace McBopomofo
+
+int main(int argc, char* argv[]) {
+  return McBopomofo::RunGramambularDifferentialTest(argc, argv);
+}
@@ -0,0 +1,763 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+// The Gramambular data structures and walker as they were before they were
+// optimized, kept as the reference that GramambularDifferentialTest compares
+// the optimized ones against. Only the types that were changed are kept here;
+// the language model, unigram, bigram and key-value pair types are shared.
+// The score overlay, which came with the optimizations, is modeled as state of
+// the nodes rather than a separate map. Do not optimize this file.
+
+#ifndef SRC_GRAMAMBULARREFERENCE_H_
+#define SRC_GRAMAMBULARREFERENCE_H_
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "LanguageModel.h"
+
+namespace Formosa {
+namespace Gramambular {
+namespace Reference {
+
+class Node {
+ public:
+  Node() {}
+  Node(const std::string& key, const std::vector<Unigram>& unigrams,
+       const std::vector<Bigram>& bigrams);
+
+  void primeNodeWithPreceedingKeyValues(
+      const std::vector<KeyValuePair>& keyValues);
+
+  bool isCandidateFixed() const;
+  const std::vector<KeyValuePair>& candidates() const;
+  void selectCandidateAtIndex(size_t index = 0, bool fix = true);
+  void resetCandidate();
+  void selectFloatingCandidateAtIndex(size_t index, double score);
+
+  const std::string& key() const;
+  double score() const;
+  double scoreForCandidate(const std::string& candidate) const;
+  const KeyValuePair currentKeyValue() const;
+  double highestUnigramScore() const;
+
+  // The score overlay of the node. It is kept with the node, so that it moves
+  // and goes away with the node. Unless the node's candidate is fixed, it
+  // evaluates the node as the candidate of the value, with the score.
+  void setOverlay(const std::string& value, double score);
+  void clearOverlay();
+  bool isOverlaid() const;
+  double overlaidScore() const;
+  const KeyValuePair overlaidKeyValue() const;
+
+ protected:
+  const LanguageModel* m_LM;
+
+  std::string m_key;
+  double m_score = 0.0;
+
+  std::vector<Unigram> m_unigrams;
+  std::vector<KeyValuePair> m_candidates;
+  std::map<std::string, size_t> m_valueUnigramIndexMap;
+  std::map<KeyValuePair, std::vector<Bigram> > m_preceedingGramBigramMap;
+
+  bool m_candidateFixed = false;
+  size_t m_selectedUnigramIndex = 0;
+
+  bool m_overlaid = false;
+  std::string m_overlayValue;
+  double m_overlayScore = 0.0;
+};
+
+inline Node::Node(const std::string& key, const std::vector<Unigram>& unigrams,
+                  const std::vector<Bigram>& bigrams)
+    : m_key(key),
+      m_score(0.0),
+      m_unigrams(unigrams),
+      m_candidateFixed(false),
+      m_selectedUnigramIndex(0) {
+  stable_sort(m_unigrams.begin(), m_unigrams.end(), Unigram::ScoreCompare);
+
+  if (m_unigrams.size()) {
+    m_score = m_unigrams[0].score;
+  }
+
+  size_t i = 0;
+  for (std::vector<Unigram>::const_iterator ui = m_unigrams.begin();
+       ui != m_unigrams.end(); ++ui) {
+    m_valueUnigramIndexMap[(*ui).keyValue.value] = i;
+    i++;
+
+    m_candidates.push_back((*ui).keyValue);
+  }
+
+  for (std::vector<Bigram>::const_iterator bi = bigrams.begin();
+       bi != bigrams.end(); ++bi) {
+    m_preceedingGramBigramMap[(*bi).preceedingKeyValue].push_back(*bi);
+  }
+}
+
+inline void Node::primeNodeWithPreceedingKeyValues(
+    const std::vector<KeyValuePair>& keyValues) {
+  size_t newIndex = m_selectedUnigramIndex;
+  double max = m_score;
+
+  if (!isCandidateFixed()) {
+    for (std::vector<KeyValuePair>::const_iterator kvi = keyValues.begin();
+         kvi != keyValues.end(); ++kvi) {
+      std::map<KeyValuePair, std::vector<Bigram> >::const_iterator f =
+          m_preceedingGramBigramMap.find(*kvi);
+      if (f != m_preceedingGramBigramMap.end()) {
+        const std::vector<Bigram>& bigrams = (*f).second;
+
+        for (std::vector<Bigram>::const_iterator bi = bigrams.begin();
+             bi != bigrams.end(); ++bi) {
+          const Bigram& bigram = *bi;
+          if (bigram.score > max) {
+            std::map<std::string, size_t>::const_iterator uf =
+                m_valueUnigramIndexMap.find((*bi).keyValue.value);
+            if (uf != m_valueUnigramIndexMap.end()) {
+              newIndex = (*uf).second;
+              max = bigram.score;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  if (m_score != max) {
+    m_score = max;
+  }
+
+  if (newIndex != m_selectedUnigramIndex) {
+    m_selectedUnigramIndex = newIndex;
+  }
+}
+
+inline bool Node::isCandidateFixed() const { return m_candidateFixed; }
+
+inline const std::vector<KeyValuePair>& Node::candidates() const {
+  return m_candidates;
+}
+
+inline void Node::selectCandidateAtIndex(size_t index, bool fix) {
+  if (index >= m_unigrams.size()) {
+    m_selectedUnigramIndex = 0;
+  } else {
+    m_selectedUnigramIndex = index;
+  }
+
+  m_candidateFixed = fix;
+  m_score = 99;
+}
+
+inline void Node::resetCandidate() {
+  m_selectedUnigramIndex = 0;
+  m_candidateFixed = 0;
+  if (m_unigrams.size()) {
+    m_score = m_unigrams[0].score;
+  }
+}
+
+inline void Node::selectFloatingCandidateAtIndex(size_t index, double score) {
+  if (index >= m_unigrams.size()) {
+    m_selectedUnigramIndex = 0;
+  } else {
+    m_selectedUnigramIndex = index;
+  }
+  m_candidateFixed = false;
+  m_score = score;
+}
+
+inline const std::string& Node::key() const { return m_key; }
+
+inline double Node::score() const { return m_score; }
+
+inline double Node::scoreForCandidate(const std::string& candidate) const {
+  for (auto unigram : m_unigrams) {
+    if (unigram.keyValue.value == candidate) {
+      return unigram.score;
+    }
+  }
+  return 0.0;
+}
+
+inline double Node::highestUnigramScore() const {
+  if (m_unigrams.empty()) {
+    return 0.0;
+  }
+  return m_unigrams[0].score;
+}
+
+inline const KeyValuePair Node::currentKeyValue() const {
+  if (m_selectedUnigramIndex >= m_unigrams.size()) {
+    return KeyValuePair();
+  } else {
+    return m_candidates[m_selectedUnigramIndex];
+  }
+}
+
+inline void Node::setOverlay(const std::string& value, double score) {
+  m_overlaid = true;
+  m_overlayValue = value;
+  m_overlayScore = score;
+}
+
+inline void Node::clearOverlay() { m_overlaid = false; }
+
+inline bool Node::isOverlaid() const {
+  return m_overlaid && !m_candidateFixed;
+}
+
+inline double Node::overlaidScore() const {
+  return isOverlaid() ? m_overlayScore : m_score;
+}
+
+inline const KeyValuePair Node::overlaidKeyValue() const {
+  if (isOverlaid()) {
+    for (const KeyValuePair& candidate : m_candidates) {
+      if (candidate.value == m_overlayValue) {
+        return candidate;
+      }
+    }
+  }
+  return currentKeyValue();
+}
+
+class Span {
+ public:
+  void clear();
+  void insertNodeOfLength(const Node& node, size_t length);
+  void removeNodeOfLengthGreaterThan(size_t length);
+
+  Node* nodeOfLength(size_t length);
+  size_t maximumLength() const;
+
+ protected:
+  std::map<size_t, Node> m_lengthNodeMap;
+  size_t m_maximumLength = 0;
+};
+
+inline void Span::clear() {
+  m_lengthNodeMap.clear();
+  m_maximumLength = 0;
+}
+
+inline void Span::insertNodeOfLength(const Node& node, size_t length) {
+  m_lengthNodeMap[length] = node;
+  if (length > m_maximumLength) {
+    m_maximumLength = length;
+  }
+}
+
+inline void Span::removeNodeOfLengthGreaterThan(size_t length) {
+  if (length > m_maximumLength) {
+    return;
+  }
+
+  size_t max = 0;
+  std::set<size_t> removeSet;
+  for (std::map<size_t, Node>::iterator i = m_lengthNodeMap.begin(),
+                                        e = m_lengthNodeMap.end();
+       i != e; ++i) {
+    if ((*i).first > length) {
+      removeSet.insert((*i).first);
+    } else {
+      if ((*i).first > max) {
+        max = (*i).first;
+      }
+    }
+  }
+
+  for (std::set<size_t>::iterator i = removeSet.begin(), e = removeSet.end();
+       i != e; ++i) {
+    m_lengthNodeMap.erase(*i);
+  }
+
+  m_maximumLength = max;
+}
+
+inline Node* Span::nodeOfLength(size_t length) {
+  std::map<size_t, Node>::iterator f = m_lengthNodeMap.find(length);
+  return f == m_lengthNodeMap.end() ? 0 : &(*f).second;
+}
+
+inline size_t Span::maximumLength() const { return m_maximumLength; }
+
+struct NodeAnchor {
+  const Node* node = nullptr;
+  size_t location = 0;
+  size_t spanningLength = 0;
+  double accumulatedScore = 0.0;
+
+  // The node's score and candidate, as adjusted by its overlay.
+  double score() const { return node->overlaidScore(); }
+  const KeyValuePair currentKeyValue() const {
+    return node->overlaidKeyValue();
+  }
+};
+
+class Grid {
+ public:
+  void clear();
+  void insertNode(const Node& node, size_t location, size_t spanningLength);
+  bool hasNodeAtLocationSpanningLengthMatchingKey(size_t location,
+                                                  size_t spanningLength,
+                                                  const std::string& key);
+
+  void expandGridByOneAtLocation(size_t location);
+  void shrinkGridByOneAtLocation(size_t location);
+
+  size_t width() const;
+  std::vector<NodeAnchor> nodesEndingAt(size_t location);
+  std::vector<NodeAnchor> nodesCrossingOrEndingAt(size_t location);
+
+  // "Freeze" the node with the unigram that represents the selected candidate
+  // value. After this, the node that contains the unigram will always be
+  // evaluated to that unigram, while all other overlapping nodes will be reset
+  // to their initial state (that is, if any of those nodes were "frozen" or
+  // fixed, they will be unfrozen.)
+  NodeAnchor fixNodeSelectedCandidate(size_t location,
+                                      const std::string& value);
+
+  // Similar to fixNodeSelectedCandidate, but instead of "freezing" the node,
+  // only boost the unigram that represents the value with an overriding score.
+  // This has the same side effect as fixNodeSelectedCandidate, which is that
+  // all other overlapping nodes will be reset to their initial state.
+  void overrideNodeScoreForSelectedCandidate(size_t location,
+                                             const std::string& value,
+                                             float overridingScore);
+
+  // Sets the overlay of every node crossing or ending at the location that
+  // has the value as a candidate, unless the node's candidate is fixed.
+  // fixNodeSelectedCandidate() clears the overlays of the nodes it resets.
+  void overlayScoreForSelectedCandidate(size_t location,
+                                        const std::string& value,
+                                        double overridingScore);
+
+ protected:
+  std::vector<Span> m_spans;
+};
+
+inline void Grid::clear() { m_spans.clear(); }
+
+inline void Grid::insertNode(const Node& node, size_t location,
+                             size_t spanningLength) {
+  if (location >= m_spans.size()) {
+    size_t diff = location - m_spans.size() + 1;
+
+    for (size_t i = 0; i < diff; i++) {
+      m_spans.push_back(Span());
+    }
+  }
+
+  m_spans[location].insertNodeOfLength(node, spanningLength);
+}
+
+inline bool Grid::hasNodeAtLocationSpanningLengthMatchingKey(
+    size_t location, size_t spanningLength, const std::string& key) {
+  if (location > m_spans.size()) {
+    return false;
+  }
+
+  const Node* n = m_spans[location].nodeOfLength(spanningLength);
+  if (!n) {
+    return false;
+  }
+
+  return key == n->key();
+}
+
+inline void Grid::expandGridByOneAtLocation(size_t location) {
+  if (!location || location == m_spans.size()) {
+    m_spans.insert(m_spans.begin() + location, Span());
+  } else {
+    m_spans.insert(m_spans.begin() + location, Span());
+    for (size_t i = 0; i < location; i++) {
+      // zaps overlapping spans
+      m_spans[i].removeNodeOfLengthGreaterThan(location - i);
+    }
+  }
+}
+
+inline void Grid::shrinkGridByOneAtLocation(size_t location) {
+  if (location >= m_spans.size()) {
+    return;
+  }
+
+  m_spans.erase(m_spans.begin() + location);
+  for (size_t i = 0; i < location; i++) {
+    // zaps overlapping spans
+    m_spans[i].removeNodeOfLengthGreaterThan(location - i);
+  }
+}
+
+inline size_t Grid::width() const { return m_spans.size(); }
+
+inline std::vector<NodeAnchor> Grid::nodesEndingAt(size_t location) {
+  std::vector<NodeAnchor> result;
+
+  if (m_spans.size() && location <= m_spans.size()) {
+    for (size_t i = 0; i < location; i++) {
+      Span& span = m_spans[i];
+      if (i + span.maximumLength() >= location) {
+        Node* np = span.nodeOfLength(location - i);
+        if (np) {
+          NodeAnchor na;
+          na.node = np;
+          na.location = i;
+          na.spanningLength = location - i;
+
+          result.push_back(na);
+        }
+      }
+    }
+  }
+
+  return result;
+}
+
+inline std::vector<NodeAnchor> Grid::nodesCrossingOrEndingAt(size_t location) {
+  std::vector<NodeAnchor> result;
+
+  if (m_spans.size() && location <= m_spans.size()) {
+    for (size_t i = 0; i < location; i++) {
+      Span& span = m_spans[i];
+
+      if (i + span.maximumLength() >= location) {
+        for (size_t j = 1, m = span.maximumLength(); j <= m; j++) {
+          if (i + j < location) {
+            continue;
+          }
+
+          Node* np = span.nodeOfLength(j);
+          if (np) {
+            NodeAnchor na;
+            na.node = np;
+            na.location = i;
+            na.spanningLength = location - i;
+
+            result.push_back(na);
+          }
+        }
+      }
+    }
+  }
+
+  return result;
+}
+
+// For nodes found at the location, fix their currently-selected candidate using
+// the supplied string value.
+inline NodeAnchor Grid::fixNodeSelectedCandidate(size_t location,
+                                                 const std::string& value) {
+  std::vector<NodeAnchor> nodes = nodesCrossingOrEndingAt(location);
+  NodeAnchor node;
+  for (auto nodeAnchor : nodes) {
+    auto candidates = nodeAnchor.node->candidates();
+
+    // Reset the candidate-fixed state of every node at the location.
+    const_cast<Node*>(nodeAnchor.node)->resetCandidate();
+    const_cast<Node*>(nodeAnchor.node)->clearOverlay();
+
+    for (size_t i = 0, c = candidates.size(); i < c; ++i) {
+      if (candidates[i].value == value) {
+        const_cast<Node*>(nodeAnchor.node)->selectCandidateAtIndex(i);
+        node = nodeAnchor;
+        break;
+      }
+    }
+  }
+  return node;
+}
+
+inline void Grid::overrideNodeScoreForSelectedCandidate(
+    size_t location, const std::string& value, float overridingScore) {
+  std::vector<NodeAnchor> nodes = nodesCrossingOrEndingAt(location);
+  for (auto nodeAnchor : nodes) {
+    auto candidates = nodeAnchor.node->candidates();
+
+    // Reset the candidate-fixed state of every node at the location.
+    const_cast<Node*>(nodeAnchor.node)->resetCandidate();
+
+    for (size_t i = 0, c = candidates.size(); i < c; ++i) {
+      if (candidates[i].value == value) {
+        const_cast<Node*>(nodeAnchor.node)
+            ->selectFloatingCandidateAtIndex(i, overridingScore);
+        break;
+      }
+    }
+  }
+}
+
+inline void Grid::overlayScoreForSelectedCandidate(size_t location,
+                                                   const std::string& value,
+                                                   double overridingScore) {
+  for (auto nodeAnchor : nodesCrossingOrEndingAt(location)) {
+    Node* node = const_cast<Node*>(nodeAnchor.node);
+    if (node->isCandidateFixed()) {
+      continue;
+    }
+    for (const KeyValuePair& candidate : node->candidates()) {
+      if (candidate.value == value) {
+        node->setOverlay(value, overridingScore);
+        break;
+      }
+    }
+  }
+}
+
+class Walker {
+ public:
+  explicit Walker(Grid* inGrid);
+  const std::vector<NodeAnchor> reverseWalk(size_t location,
+                                            double accumulatedScore = 0.0);
+
+ protected:
+  Grid* m_grid;
+};
+
+inline Walker::Walker(Grid* inGrid) : m_grid(inGrid) {}
+
+inline const std::vector<NodeAnchor> Walker::reverseWalk(
+    size_t location, double accumulatedScore) {
+  if (!location || location > m_grid->width()) {
+    return std::vector<NodeAnchor>();
+  }
+
+  std::vector<std::vector<NodeAnchor> > paths;
+
+  std::vector<NodeAnchor> nodes = m_grid->nodesEndingAt(location);
+
+  for (std::vector<NodeAnchor>::iterator ni = nodes.begin(); ni != nodes.end();
+       ++ni) {
+    if (!(*ni).node) {
+      continue;
+    }
+
+    (*ni).accumulatedScore = accumulatedScore + (*ni).score();
+
+    std::vector<NodeAnchor> path =
+        reverseWalk(location - (*ni).spanningLength, (*ni).accumulatedScore);
+    path.insert(path.begin(), *ni);
+
+    paths.push_back(path);
+  }
+
+  if (!paths.size()) {
+    return std::vector<NodeAnchor>();
+  }
+
+  std::vector<NodeAnchor>* result = &*(paths.begin());
+  for (std::vector<std::vector<NodeAnchor> >::iterator pi = paths.begin();
+       pi != paths.end(); ++pi) {
+    if ((*pi).back().accumulatedScore > result->back().accumulatedScore) {
+      result = &*pi;
+    }
+  }
+
+  return *result;
+}
+
+class BlockReadingBuilder {
+ public:
+  explicit BlockReadingBuilder(LanguageModel* lm);
+  void clear();
+
+  size_t length() const;
+  size_t cursorIndex() const;
+  void setCursorIndex(size_t newIndex);
+  void insertReadingAtCursor(const std::string& reading);
+  bool deleteReadingBeforeCursor();  // backspace
+  bool deleteReadingAfterCursor();   // delete
+
+  bool removeHeadReadings(size_t count);
+
+  void setJoinSeparator(const std::string& separator);
+  const std::string joinSeparator() const;
+
+  const std::vector<std::string>& readings() const;
+
+  Grid& grid();
+
+ protected:
+  void build();
+
+  static const std::string Join(std::vector<std::string>::const_iterator begin,
+                                std::vector<std::string>::const_iterator end,
+                                const std::string& separator);
+
+  // 最多使用六個字組成一個詞
+  static const size_t MaximumBuildSpanLength = 6;
+
+  size_t m_cursorIndex = 0;
+  std::vector<std::string> m_readings;
+
+  Grid m_grid;
+  LanguageModel* m_LM;
+  std::string m_joinSeparator;
+};
+
+inline BlockReadingBuilder::BlockReadingBuilder(LanguageModel* lm) : m_LM(lm) {}
+
+inline void BlockReadingBuilder::clear() {
+  m_cursorIndex = 0;
+  m_readings.clear();
+  m_grid.clear();
+}
+
+inline size_t BlockReadingBuilder::length() const { return m_readings.size(); }
+
+inline size_t BlockReadingBuilder::cursorIndex() const { return m_cursorIndex; }
+
+inline void BlockReadingBuilder::setCursorIndex(size_t newIndex) {
+  m_cursorIndex = newIndex > m_readings.size() ? m_readings.size() : newIndex;
+}
+
+inline void BlockReadingBuilder::insertReadingAtCursor(
+    const std::string& reading) {
+  m_readings.insert(m_readings.begin() + m_cursorIndex, reading);
+
+  m_grid.expandGridByOneAtLocation(m_cursorIndex);
+  build();
+  m_cursorIndex++;
+}
+
+inline const std::vector<std::string>& BlockReadingBuilder::readings() const {
+  return m_readings;
+}
+
+inline bool BlockReadingBuilder::deleteReadingBeforeCursor() {
+  if (!m_cursorIndex) {
+    return false;
+  }
+
+  m_readings.erase(m_readings.begin() + m_cursorIndex - 1,
+                   m_readings.begin() + m_cursorIndex);
+  m_cursorIndex--;
+  m_grid.shrinkGridByOneAtLocation(m_cursorIndex);
+  build();
+  return true;
+}
+
+inline bool BlockReadingBuilder::deleteReadingAfterCursor() {
+  if (m_cursorIndex == m_readings.size()) {
+    return false;
+  }
+
+  m_readings.erase(m_readings.begin() + m_cursorIndex,
+                   m_readings.begin() + m_cursorIndex + 1);
+  m_grid.shrinkGridByOneAtLocation(m_cursorIndex);
+  build();
+  return true;
+}
+
+inline bool BlockReadingBuilder::removeHeadReadings(size_t count) {
+  if (count > length()) {
+    return false;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    if (m_cursorIndex) {
+      m_cursorIndex--;
+    }
+    m_readings.erase(m_readings.begin(), m_readings.begin() + 1);
+    m_grid.shrinkGridByOneAtLocation(0);
+    build();
+  }
+
+  return true;
+}
+
+inline void BlockReadingBuilder::setJoinSeparator(
+    const std::string& separator) {
+  m_joinSeparator = separator;
+}
+
+inline const std::string BlockReadingBuilder::joinSeparator() const {
+  return m_joinSeparator;
+}
+
+inline Grid& BlockReadingBuilder::grid() { return m_grid; }
+
+inline void BlockReadingBuilder::build() {
+  if (!m_LM) {
+    return;
+  }
+
+  size_t begin = 0;
+  size_t end = m_cursorIndex + MaximumBuildSpanLength;
+
+  if (m_cursorIndex < MaximumBuildSpanLength) {
+    begin = 0;
+  } else {
+    begin = m_cursorIndex - MaximumBuildSpanLength;
+  }
+
+  if (end > m_readings.size()) {
+    end = m_readings.size();
+  }
+
+  for (size_t p = begin; p < end; p++) {
+    for (size_t q = 1; q <= MaximumBuildSpanLength && p + q <= end; q++) {
+      std::string combinedReading = Join(
+          m_readings.begin() + p, m_readings.begin() + p + q, m_joinSeparator);
+      if (!m_grid.hasNodeAtLocationSpanningLengthMatchingKey(p, q,
+                                                             combinedReading)) {
+        std::vector<Unigram> unigrams = m_LM->unigramsForKey(combinedReading);
+
+        if (unigrams.size() > 0) {
+          Node n(combinedReading, unigrams, std::vector<Bigram>());
+          m_grid.insertNode(n, p, q);
+        }
+      }
+    }
+  }
+}
+
+inline const std::string BlockReadingBuilder::Join(
+    std::vector<std::string>::const_iterator begin,
+    std::vector<std::string>::const_iterator end,
+    const std::string& separator) {
+  std::string result;
+  for (std::vector<std::string>::const_iterator iter = begin; iter != end;) {
+    result += *iter;
+    ++iter;
+    if (iter != end) {
+      result += separator;
+    }
+  }
+  return result;
+}
+
+}  // namespace Reference
+}  // namespace Gramambular
+}  // namespace Formosa
+
+#endif  // SRC_GRAMAMBULARREFERENCE_H_
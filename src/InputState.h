@@ -24,6 +24,7 @@
 #ifndef SRC_INPUTSTATE_H_
 #define SRC_INPUTSTATE_H_
 
+#include <memory>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -89,9 +90,40 @@ struct Inputting : NotEmpty {
 struct ChoosingCandidate : NotEmpty {
   ChoosingCandidate(const std::string& buf, const size_t index,
                     const std::vector<std::string>& cs)
-      : NotEmpty(buf, index), candidates(cs) {}
+      : ChoosingCandidate(buf, index,
+                          std::make_shared<const std::vector<std::string>>(cs)) {
+  }
 
-  const std::vector<std::string> candidates;
+  // The list may be shared, such as with the key handler's candidate cache.
+  ChoosingCandidate(const std::string& buf, const size_t index,
+                    std::shared_ptr<const std::vector<std::string>> cs,
+                    const std::string_view& tooltipText = "")
+      : NotEmpty(buf, index, tooltipText),
+        candidateList(std::move(cs)),
+        candidates(*candidateList) {}
+
+  const std::shared_ptr<const std::vector<std::string>> candidateList;
+  const std::vector<std::string>& candidates;
+};
+
+// Choosing a symbol from the symbol table. The candidates are the symbols
+// found by the search typed so far, those of the category chosen, or, before
+// either, the categories. The tooltip shows the search.
+struct SymbolPicking : ChoosingCandidate {
+  SymbolPicking(const std::string& buf, const size_t index,
+                const std::vector<std::string>& cs,
+                const std::string& searchText, const bool choosingCategory,
+                const std::string_view& tooltipText)
+      : ChoosingCandidate(buf, index,
+                          std::make_shared<const std::vector<std::string>>(cs),
+                          tooltipText),
+        search(searchText),
+        categories(choosingCategory) {}
+
+  // The keys typed to search, as typed.
+  const std::string search;
+  // Whether the candidates are the categories.
+  const bool categories;
 };
 
 // Represents the Marking state where the user uses Shift-Left/Shift-Right to
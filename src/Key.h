@@ -0,0 +1,81 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SRC_KEY_H_
+#define SRC_KEY_H_
+
+namespace McBopomofo {
+
+// A key press as seen by KeyHandler. Frontends convert their key events to it,
+// so that the key handler does not depend on any input method framework.
+struct Key {
+  enum class Name {
+    kAscii,
+    kSpace,
+    kReturn,
+    kEscape,
+    kBackSpace,
+    kDelete,
+    kLeft,
+    kRight,
+    kHome,
+    kEnd,
+    kUnknown,
+  };
+
+  Name name = Name::kUnknown;
+  // The printable ASCII character of the key, including space, or 0.
+  char ascii = 0;
+  bool shiftPressed = false;
+  bool ctrlPressed = false;
+
+  // A printable ASCII key. A space is a kSpace key.
+  static Key asciiKey(char c, bool shiftPressed = false,
+                      bool ctrlPressed = false) {
+    Name name = c == ' ' ? Name::kSpace : Name::kAscii;
+    return Key{name, c, shiftPressed, ctrlPressed};
+  }
+
+  static Key namedKey(Name name, bool shiftPressed = false,
+                      bool ctrlPressed = false) {
+    char ascii = name == Name::kSpace ? ' ' : 0;
+    return Key{name, ascii, shiftPressed, ctrlPressed};
+  }
+
+  // Returns true if the key is a printable ASCII key without modifiers.
+  bool isSimple() const {
+    return ascii != 0 && !shiftPressed && !ctrlPressed;
+  }
+
+  // Returns true if the key is the named key without modifiers.
+  bool check(Name n) const {
+    return name == n && !shiftPressed && !ctrlPressed;
+  }
+
+  // Returns true if the key is the ASCII character without modifiers.
+  bool check(char c) const { return ascii == c && isSimple(); }
+};
+
+}  // namespace McBopomofo
+
+#endif  // SRC_KEY_H_
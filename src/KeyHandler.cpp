@@ -23,10 +23,10 @@
 
 #include "KeyHandler.h"
 
-#include <fcitx-utils/i18n.h>
 #include <fmt/format.h>
 
 #include <algorithm>
+#include <cctype>
 #include <chrono>
 #include <utility>
 
@@ -46,9 +46,38 @@ constexpr double kObservedOverrideHalfLife = 5400.0;  // 1.5 hr.
 constexpr double kNoOverrideThreshold = -8.0;
 constexpr double kEpsilon = 0.000001;
 
-// Maximum composing buffer size, roughly in codepoints.
-// TODO(unassigned): maybe make this configurable.
-constexpr size_t kComposingBufferSize = 10;
+// Default maximum composing buffer size, roughly in codepoints.
+constexpr size_t kDefaultComposingBufferSize = 10;
+
+// Grids narrower than this are walked right away even with a background walker,
+// as that is cheaper than handing them over to the worker thread.
+constexpr size_t kMinBackgroundWalkGridWidth = 32;
+
+// Maximum number of composition changes that can be undone.
+constexpr size_t kMaxUndoDepth = 50;
+
+// The memory a node of the grid is taken to hold, with its key and a few
+// dozen unigrams, when the size of a composition is estimated.
+constexpr size_t kEstimatedNodeSize = 1024;
+
+// Phrases are completed from up to this many readings before the cursor.
+constexpr size_t kMaxPhraseCompletionPrefix = 2;
+constexpr size_t kMaxPhraseCompletions = 8;
+
+// The values of a reading suggested for a rare reading that are candidates.
+constexpr size_t kMaxReadingCorrections = 3;
+
+static std::vector<std::string> SplitReadings(const std::string& key) {
+  std::vector<std::string> readings;
+  size_t begin = 0;
+  size_t end;
+  while ((end = key.find(kJoinSeparator, begin)) != std::string::npos) {
+    readings.push_back(key.substr(begin, end - begin));
+    begin = end + 1;
+  }
+  readings.push_back(key.substr(begin));
+  return readings;
+}
 
 static const char* GetKeyboardLayoutName(
     const Formosa::Mandarin::BopomofoKeyboardLayout* layout) {
@@ -68,18 +97,13 @@ static const char* GetKeyboardLayoutName(
   return "Standard";
 }
 
-static bool MarkedPhraseExists(Formosa::Gramambular::LanguageModel* lm,
-                               const std::string& reading,
-                               const std::string& value) {
-  if (!lm->hasUnigramsForKey(reading)) {
-    return false;
+static std::string TopUnigramValue(Formosa::Gramambular::LanguageModel* lm,
+                                   const std::string& reading) {
+  Formosa::Gramambular::Unigram top;
+  if (!lm->topUnigramForKey(reading, &top)) {
+    return reading;
   }
-
-  auto unigrams = lm->unigramsForKey(reading);
-  return std::any_of(unigrams.begin(), unigrams.end(),
-                     [&value](const auto& unigram) {
-                       return unigram.keyValue.value == value;
-                     });
+  return top.keyValue.value;
 }
 
 static double GetEpochNowInSeconds() {
@@ -103,23 +127,113 @@ static double FindHighestScore(
   return highestScore + epsilon;
 }
 
+std::string KeyHandler::LocalizedStrings::cursorIsBetweenSyllables(
+    const std::string& prevReading, const std::string& nextReading) {
+  return fmt::format("Cursor is between syllables {0} and {1}", prevReading,
+                     nextReading);
+}
+
+std::string KeyHandler::LocalizedStrings::syllablesRequired(size_t count) {
+  return fmt::format("{0} syllables required", count);
+}
+
+std::string KeyHandler::LocalizedStrings::syllablesMaximum(size_t count) {
+  return fmt::format("{0} syllables maximum", count);
+}
+
+std::string KeyHandler::LocalizedStrings::phraseAlreadyExists() {
+  return "phrase already exists";
+}
+
+std::string KeyHandler::LocalizedStrings::pressEnterToAddThePhrase() {
+  return "press Enter to add the phrase";
+}
+
+std::string KeyHandler::LocalizedStrings::markedWithSyllablesAndStatus(
+    const std::string& marked, const std::string& readingUiText,
+    const std::string& status) {
+  return fmt::format("Marked: {0}, syllables: {1}, {2}", marked, readingUiText,
+                     status);
+}
+
+std::string KeyHandler::LocalizedStrings::symbolSearch(
+    const std::string& search) {
+  return fmt::format("Search symbols: {0}", search);
+}
+
 KeyHandler::KeyHandler(
     std::shared_ptr<Formosa::Gramambular::LanguageModel> languageModel,
-    std::shared_ptr<LanguageModelLoader> languageModelLoader)
+    std::shared_ptr<UserPhraseAdder> userPhraseAdder,
+    std::unique_ptr<LocalizedStrings> localizedStrings)
     : languageModel_(std::move(languageModel)),
-      languageModelLoader_(std::move(languageModelLoader)),
+      userPhraseAdder_(std::move(userPhraseAdder)),
+      localizedStrings_(localizedStrings != nullptr
+                            ? std::move(localizedStrings)
+                            : std::make_unique<LocalizedStrings>()),
       userOverrideModel_(kUserOverrideModelCapacity, kObservedOverrideHalfLife),
-      reading_(Formosa::Mandarin::BopomofoKeyboardLayout::StandardLayout()) {
+      reading_(Formosa::Mandarin::BopomofoKeyboardLayout::StandardLayout()),
+      composingBufferSize_(kDefaultComposingBufferSize) {
   builder_ = std::make_unique<Formosa::Gramambular::BlockReadingBuilder>(
       languageModel_.get());
   builder_->setJoinSeparator(kJoinSeparator);
 }
 
-bool KeyHandler::handle(fcitx::Key key, McBopomofo::InputState* state,
+bool KeyHandler::handle(Key key, McBopomofo::InputState* state,
                         const StateCallback& stateCallback,
                         const ErrorCallback& errorCallback) {
-  // key.isSimple() is true => key.sym() guaranteed to be printable ASCII.
-  char asciiChar = key.isSimple() ? key.sym() : 0;
+  // The keys warmed up for the key handled last are of no use to this one.
+  if (warmedUpKeysUsed_) {
+    auto* lm = dynamic_cast<McBopomofoLM*>(languageModel_.get());
+    if (lm != nullptr) {
+      lm->dropWarmedUpKeys();
+    }
+    warmedUpKeysLive_ = false;
+  }
+  warmedUpKeysUsed_ = warmedUpKeysLive_;
+
+  if (pendingLanguageModel_ != nullptr && !hasComposition()) {
+    applyPendingLanguageModel();
+  }
+
+  if (metrics_ == nullptr) {
+    return handleKey(key, state, stateCallback, errorCallback);
+  }
+
+  ScopedLatency latency(metrics_, Metrics::Histogram::kKeyHandling);
+  metrics_->increment(Metrics::Counter::kKeystrokes);
+  bool accepted = handleKey(key, state, stateCallback, errorCallback);
+  if (accepted) {
+    metrics_->increment(Metrics::Counter::kKeystrokesAccepted);
+  }
+  return accepted;
+}
+
+bool KeyHandler::handleKey(Key key, McBopomofo::InputState* state,
+                           const StateCallback& stateCallback,
+                           const ErrorCallback& errorCallback) {
+  char asciiChar = key.isSimple() ? key.ascii : 0;
+  warmUpPending_ = false;
+
+  // Keys that do not compose readings need the pending readings in the grid.
+  // The state is then replaced by the refined one, which is kept here since
+  // the caller's state goes away when the refined state is entered.
+  std::unique_ptr<InputStates::Inputting> refinedState;
+  bool continuousPinyin = isContinuousPinyinActive();
+  bool isComposingKey =
+      continuousPinyin
+          ? (asciiChar >= 'a' && asciiChar <= 'z') || !pinyinSegmenter_->empty()
+          : reading_.isValidKey(asciiChar) ||
+                (!reading_.isEmpty() && key.check(Key::Name::kSpace));
+  if (!isComposingKey && (!pendingReadings_.empty() || walkPending_)) {
+    refinedState = insertPendingReadings(/*walkInBackground=*/false);
+    stateCallback(std::make_unique<InputStates::Inputting>(*refinedState));
+    state = refinedState.get();
+  }
+
+  if (continuousPinyin &&
+      handleContinuousPinyin(key, asciiChar, stateCallback, errorCallback)) {
+    return true;
+  }
 
   // See if it's valid BPMF reading.
   if (reading_.isValidKey(asciiChar)) {
@@ -128,6 +242,7 @@ bool KeyHandler::handle(fcitx::Key key, McBopomofo::InputState* state,
     // If asciiChar does not lead to a tone marker, we are done. Tone marker
     // would lead to composing of the reading, which is handled after this.
     if (!reading_.hasToneMarker()) {
+      warmUpPending_ = speculativeWarmUp_;
       stateCallback(buildInputtingState());
       return true;
     }
@@ -137,10 +252,17 @@ bool KeyHandler::handle(fcitx::Key key, McBopomofo::InputState* state,
   // not empty, and space is pressed.
   bool shouldComposeReading =
       reading_.hasToneMarker() ||
-      (!reading_.isEmpty() && key.check(FcitxKey_space));
+      (!reading_.isEmpty() && key.check(Key::Name::kSpace));
 
   if (shouldComposeReading) {
     std::string syllable = reading_.syllable().composedString();
+    if (readingCorrector_ != nullptr) {
+      auto corrected = readingCorrector_->correct(reading_.syllable(),
+                                                  reading_.keyboardLayout());
+      if (corrected.has_value()) {
+        syllable = corrected->composedString();
+      }
+    }
     reading_.clear();
 
     if (!languageModel_->hasUnigramsForKey(syllable)) {
@@ -149,36 +271,40 @@ bool KeyHandler::handle(fcitx::Key key, McBopomofo::InputState* state,
       return true;
     }
 
-    builder_->insertReadingAtCursor(syllable);
-    std::string evictedText = popEvictedTextAndWalk();
-
-    std::string overrideValue = userOverrideModel_.suggest(
-        walkedNodes_, builder_->cursorIndex(), GetEpochNowInSeconds());
-    if (!overrideValue.empty()) {
-      size_t cursorIndex = actualCandidateCursorIndex();
-      std::vector<Formosa::Gramambular::NodeAnchor> nodes =
-          builder_->grid().nodesCrossingOrEndingAt(cursorIndex);
-      double highestScore = FindHighestScore(nodes, kEpsilon);
-      builder_->grid().overrideNodeScoreForSelectedCandidate(
-          cursorIndex, overrideValue, static_cast<float>(highestScore));
+    if (instantPreview_ || backgroundWalker_ != nullptr) {
+      // Show the most likely value of the reading right away, and leave the
+      // grid to flushPendingReadings().
+      pendingReadings_.push_back(syllable);
+      pendingPreview_ += TopUnigramValue(languageModel_.get(), syllable);
+      stateCallback(buildInputtingState());
+      return true;
     }
 
+    std::string evictedText = insertReadingAndWalk(syllable);
+
     auto inputtingState = buildInputtingState();
     inputtingState->evictedText = evictedText;
     stateCallback(std::move(inputtingState));
     return true;
   }
 
+  // Undo and redo: Ctrl-Z undoes; Ctrl-Y and Ctrl-Shift-Z redo.
+  bool isZ = key.ascii == 'z' || key.ascii == 'Z';
+  bool isY = key.ascii == 'y' || key.ascii == 'Y';
+  if (key.ctrlPressed && (isZ || (isY && !key.shiftPressed))) {
+    return handleUndoRedoKeys(key, state, stateCallback, errorCallback);
+  }
+
   // Space hit: see if we should enter the candidate choosing state.
   auto maybeNotEmptyState = dynamic_cast<InputStates::NotEmpty*>(state);
-  if (key.check(FcitxKey_space) && maybeNotEmptyState != nullptr &&
+  if (key.check(Key::Name::kSpace) && maybeNotEmptyState != nullptr &&
       reading_.isEmpty()) {
     stateCallback(buildChoosingCandidateState(maybeNotEmptyState));
     return true;
   }
 
   // Esc hit.
-  if (key.check(FcitxKey_Escape)) {
+  if (key.check(Key::Name::kEscape)) {
     if (maybeNotEmptyState == nullptr) {
       return false;
     }
@@ -196,26 +322,21 @@ bool KeyHandler::handle(fcitx::Key key, McBopomofo::InputState* state,
     return true;
   }
 
-  // Cursor keys.
-  auto shift = fcitx::KeyStates{fcitx::KeyState::Shift};
-  static std::array<fcitx::Key, 8> cursorKeys{
-      fcitx::Key(FcitxKey_Left),        fcitx::Key(FcitxKey_Right),
-      fcitx::Key(FcitxKey_Home),        fcitx::Key(FcitxKey_End),
-      fcitx::Key(FcitxKey_Left, shift), fcitx::Key(FcitxKey_Right, shift),
-      fcitx::Key(FcitxKey_Home, shift), fcitx::Key(FcitxKey_End, shift)};
-  if (key.checkKeyList(cursorKeys)) {
+  // Cursor keys, with or without Shift.
+  bool isCursorKey =
+      key.name == Key::Name::kLeft || key.name == Key::Name::kRight ||
+      key.name == Key::Name::kHome || key.name == Key::Name::kEnd;
+  if (isCursorKey && !key.ctrlPressed) {
     return handleCursorKeys(key, state, stateCallback, errorCallback);
   }
 
   // Backspace and Del.
-  static std::array<fcitx::Key, 2> deleteKeys{fcitx::Key(FcitxKey_BackSpace),
-                                              fcitx::Key(FcitxKey_Delete)};
-  if (key.checkKeyList(deleteKeys)) {
+  if (key.check(Key::Name::kBackSpace) || key.check(Key::Name::kDelete)) {
     return handleDeleteKeys(key, state, stateCallback, errorCallback);
   }
 
   // Enter.
-  if (key.check(FcitxKey_Return)) {
+  if (key.check(Key::Name::kReturn)) {
     if (maybeNotEmptyState == nullptr) {
       return false;
     }
@@ -229,8 +350,10 @@ bool KeyHandler::handle(fcitx::Key key, McBopomofo::InputState* state,
     // See if we are in Marking state, and, if a valid mark, accept it.
     if (auto marking = dynamic_cast<InputStates::Marking*>(state)) {
       if (marking->acceptable) {
-        languageModelLoader_->addUserPhrase(marking->reading,
-                                            marking->markedText);
+        if (userPhraseAdder_ != nullptr) {
+          userPhraseAdder_->addUserPhrase(marking->reading,
+                                          marking->markedText);
+        }
         stateCallback(buildInputtingState());
       } else {
         errorCallback();
@@ -248,10 +371,26 @@ bool KeyHandler::handle(fcitx::Key key, McBopomofo::InputState* state,
     return true;
   }
 
+  // Symbol picker: Ctrl-backtick.
+  if (key.ascii == '`' && key.ctrlPressed && !key.shiftPressed &&
+      symbolTable_ != nullptr && symbolTable_->isLoaded()) {
+    if (!reading_.isEmpty()) {
+      errorCallback();
+      stateCallback(buildInputtingState());
+      return true;
+    }
+    symbolPicking_ = true;
+    symbolSearch_.clear();
+    symbolCategory_.clear();
+    stateCallback(buildSymbolPickingState());
+    return true;
+  }
+
   // Punctuation key: backtick or grave accent.
-  if (key.check(FcitxKey_grave) &&
+  if (key.check('`') &&
       languageModel_->hasUnigramsForKey(kPunctuationListKey)) {
     if (reading_.isEmpty()) {
+      saveUndoSnapshot();
       builder_->insertReadingAtCursor(kPunctuationListKey);
 
       std::string evictedText = popEvictedTextAndWalk();
@@ -297,25 +436,348 @@ bool KeyHandler::handle(fcitx::Key key, McBopomofo::InputState* state,
   return false;
 }
 
+bool KeyHandler::handleContinuousPinyin(Key key, char asciiChar,
+                                        const StateCallback& stateCallback,
+                                        const ErrorCallback& errorCallback) {
+  if (asciiChar >= 'a' && asciiChar <= 'z') {
+    if (!pinyinSegmenter_->appendLetter(asciiChar)) {
+      errorCallback();
+    }
+    stateCallback(buildInputtingState());
+    return true;
+  }
+
+  // Other keys only matter to the segmenter while there are letters typed.
+  if (pinyinSegmenter_->empty()) {
+    return false;
+  }
+
+  if (asciiChar >= '1' && asciiChar <= '5') {
+    if (!pinyinSegmenter_->appendTone(asciiChar - '0')) {
+      errorCallback();
+    }
+    stateCallback(buildInputtingState());
+    return true;
+  }
+
+  if (key.check(Key::Name::kSpace)) {
+    if (!pinyinSegmenter_->isComplete()) {
+      errorCallback();
+      stateCallback(buildInputtingState());
+      return true;
+    }
+
+    std::vector<std::string> readings = pinyinSegmenter_->readings();
+    pinyinSegmenter_->clear();
+    for (const std::string& reading : readings) {
+      pendingReadings_.push_back(reading);
+      pendingPreview_ += TopUnigramValue(languageModel_.get(), reading);
+    }
+    if (instantPreview_ || backgroundWalker_ != nullptr) {
+      stateCallback(buildInputtingState());
+      return true;
+    }
+    stateCallback(insertPendingReadings(/*walkInBackground=*/false));
+    return true;
+  }
+
+  if (key.check(Key::Name::kBackSpace) || key.check(Key::Name::kEscape)) {
+    if (key.check(Key::Name::kBackSpace)) {
+      pinyinSegmenter_->backspace();
+    } else {
+      pinyinSegmenter_->clear();
+    }
+    if (pinyinSegmenter_->empty() && builder_->length() == 0 &&
+        pendingReadings_.empty() && !walkPending_) {
+      stateCallback(std::make_unique<InputStates::EmptyIgnoringPrevious>());
+    } else {
+      stateCallback(buildInputtingState());
+    }
+    return true;
+  }
+
+  // The letters must be converted or removed first.
+  errorCallback();
+  stateCallback(buildInputtingState());
+  return true;
+}
+
 void KeyHandler::candidateSelected(const std::string& candidate,
                                    const StateCallback& stateCallback) {
+  if (symbolPicking_) {
+    if (symbolSearch_.empty() && symbolCategory_.empty()) {
+      symbolCategory_ = candidate;
+      stateCallback(buildSymbolPickingState());
+      return;
+    }
+
+    // Symbols are not in the language model, so the text before the cursor is
+    // committed with the symbol, and the readings after it are still composed.
+    closeSymbolPicker();
+    std::string evictedText = evictTextBeforeCursor() + candidate;
+    if (builder_->length() == 0) {
+      stateCallback(std::make_unique<InputStates::Committing>(evictedText));
+      reset();
+      return;
+    }
+    auto inputtingState = buildInputtingState();
+    inputtingState->evictedText = evictedText;
+    stateCallback(std::move(inputtingState));
+    return;
+  }
+
+  std::vector<PhraseCompletion> completions;
+  completions.swap(phraseCompletions_);
+  std::vector<ReadingCorrection> corrections;
+  corrections.swap(readingCorrections_);
+  for (const PhraseCompletion& completion : completions) {
+    if (completion.value == candidate) {
+      std::string evictedText = insertPhraseCompletion(completion);
+      auto inputtingState = buildInputtingState();
+      inputtingState->evictedText = evictedText;
+      stateCallback(std::move(inputtingState));
+      return;
+    }
+  }
+
+  for (const ReadingCorrection& correction : corrections) {
+    if (correction.value == candidate) {
+      applyReadingCorrection(correction);
+      stateCallback(buildInputtingState());
+      return;
+    }
+  }
+
+  saveUndoSnapshot();
   pinNode(candidate);
   stateCallback(buildInputtingState());
 }
 
 void KeyHandler::candidatePanelCancelled(const StateCallback& stateCallback) {
+  if (symbolPicking_) {
+    closeSymbolPicker();
+    if (builder_->length() == 0) {
+      stateCallback(std::make_unique<InputStates::EmptyIgnoringPrevious>());
+      return;
+    }
+  }
+  phraseCompletions_.clear();
+  readingCorrections_.clear();
   stateCallback(buildInputtingState());
 }
 
+bool KeyHandler::handleSymbolSearchKey(Key key,
+                                       const StateCallback& stateCallback) {
+  if (!symbolPicking_) {
+    return false;
+  }
+
+  if (key.check(Key::Name::kBackSpace)) {
+    if (!symbolSearch_.empty()) {
+      symbolSearch_.pop_back();
+    } else if (!symbolCategory_.empty()) {
+      symbolCategory_.clear();
+    } else {
+      candidatePanelCancelled(stateCallback);
+      return true;
+    }
+    stateCallback(buildSymbolPickingState());
+    return true;
+  }
+
+  // Shift is allowed, as some layouts use it for the tones.
+  if (key.name == Key::Name::kAscii && !key.ctrlPressed) {
+    symbolSearch_ += key.ascii;
+    symbolCategory_.clear();
+    stateCallback(buildSymbolPickingState());
+    return true;
+  }
+  return false;
+}
+
+bool KeyHandler::isSymbolSearchKey(Key key) const {
+  if (!symbolPicking_ || key.name != Key::Name::kAscii || key.ctrlPressed) {
+    return false;
+  }
+  return !symbolSearch_.empty() || reading_.isValidKey(key.ascii);
+}
+
+void KeyHandler::closeSymbolPicker() {
+  symbolPicking_ = false;
+  symbolSearch_.clear();
+  symbolCategory_.clear();
+}
+
+bool KeyHandler::hasPendingReadings() const {
+  return !pendingReadings_.empty();
+}
+
+void KeyHandler::flushPendingReadings(const StateCallback& stateCallback,
+                                      bool walkInBackground) {
+  if (pendingReadings_.empty() && !walkPending_) {
+    return;
+  }
+  ScopedLatency latency(metrics_, Metrics::Histogram::kRefinement);
+  auto inputtingState = insertPendingReadings(walkInBackground);
+  if (inputtingState != nullptr) {
+    stateCallback(std::move(inputtingState));
+  }
+}
+
+void KeyHandler::applyBackgroundWalk(const StateCallback& stateCallback) {
+  if (backgroundWalker_ == nullptr) {
+    return;
+  }
+  auto result = backgroundWalker_->takeResult();
+  if (!result.has_value() || !walkPending_ ||
+      result->generation != walkGeneration_) {
+    return;
+  }
+
+  // The grid has not changed since the request, so the walked nodes point to
+  // the spans of the builder's grid.
+  walkedNodes_ = std::move(result->walkedNodes);
+  // The best paths found by the worker are those of this grid too, so the
+  // next walk only walks the locations changed after them.
+  builder_->grid().bestPaths() = std::move(result->grid.bestPaths());
+  walkPending_ = false;
+  if (metrics_ != nullptr) {
+    metrics_->increment(Metrics::Counter::kBackgroundWalksApplied);
+  }
+  previewGrid_ = Formosa::Gramambular::Grid();
+  unwalkedPreview_.clear();
+
+  std::string evictedText = evictOverflownText();
+  applyUserOverrideModelSuggestion();
+
+  auto inputtingState = buildInputtingState();
+  inputtingState->evictedText = evictedText;
+  stateCallback(std::move(inputtingState));
+}
+
 void KeyHandler::reset() {
+  pendingReadings_.clear();
+  pendingPreview_.clear();
+  cancelBackgroundWalk();
   reading_.clear();
+  if (pinyinSegmenter_ != nullptr) {
+    pinyinSegmenter_->clear();
+  }
   builder_->clear();
   walkedNodes_.clear();
+  closeSymbolPicker();
+  clearUndoHistory();
+  applyPendingLanguageModel();
+}
+
+bool KeyHandler::hasComposition() const {
+  return builder_->length() > 0 || !reading_.isEmpty() ||
+         !pendingReadings_.empty() || walkPending_ ||
+         (pinyinSegmenter_ != nullptr && !pinyinSegmenter_->empty());
+}
+
+KeyHandler::Composition KeyHandler::composition() const {
+  return Composition{*builder_, walkedNodes_, reading_, languageModel_,
+                     pinyinSegmenter_ != nullptr ? pinyinSegmenter_->input()
+                                                 : std::string()};
+}
+
+size_t KeyHandler::Composition::estimatedSize() const {
+  size_t size = sizeof(Composition) + pinyinInput.size();
+  for (const std::string& reading : builder.readings()) {
+    size += sizeof(std::string) + reading.size();
+  }
+  size += builder.readings().size() *
+          Formosa::Gramambular::BlockReadingBuilder::MaximumBuildSpanLength *
+          kEstimatedNodeSize;
+  size += walkedNodes.size() * sizeof(Formosa::Gramambular::NodeAnchor);
+  return size;
+}
+
+void KeyHandler::restoreComposition(Composition composition,
+                                    const StateCallback& stateCallback) {
+  const Formosa::Mandarin::BopomofoKeyboardLayout* layout =
+      reading_.keyboardLayout();
+  *builder_ = std::move(composition.builder);
+  walkedNodes_ = std::move(composition.walkedNodes);
+  reading_ = std::move(composition.reading);
+  if (reading_.keyboardLayout() != layout) {
+    reading_.clear();
+    reading_.setKeyboardLayout(layout);
+  }
+  if (composition.languageModel != nullptr &&
+      composition.languageModel != languageModel_) {
+    // The builder needs the language model it was built with. The newest
+    // one is switched to once the composition is done.
+    if (pendingLanguageModel_ == nullptr) {
+      pendingLanguageModel_ = std::move(languageModel_);
+    }
+    languageModel_ = std::move(composition.languageModel);
+    if (pendingLanguageModel_ == languageModel_) {
+      pendingLanguageModel_.reset();
+    }
+    rebuildLanguageModelHelpers();
+  }
+  if (pinyinSegmenter_ != nullptr) {
+    pinyinSegmenter_->clear();
+    for (char c : composition.pinyinInput) {
+      if (c >= '1' && c <= '5') {
+        pinyinSegmenter_->appendTone(c - '0');
+      } else {
+        pinyinSegmenter_->appendLetter(c);
+      }
+    }
+  }
+  clearUndoHistory();
+  stateCallback(buildInputtingState());
+}
+
+void KeyHandler::setLanguageModel(
+    std::shared_ptr<Formosa::Gramambular::LanguageModel> languageModel) {
+  if (languageModel == languageModel_) {
+    pendingLanguageModel_.reset();
+    return;
+  }
+  pendingLanguageModel_ = std::move(languageModel);
+  if (!hasComposition()) {
+    applyPendingLanguageModel();
+  }
+}
+
+void KeyHandler::applyPendingLanguageModel() {
+  if (pendingLanguageModel_ == nullptr) {
+    return;
+  }
+  languageModel_ = std::move(pendingLanguageModel_);
+  pendingLanguageModel_.reset();
+  builder_ = std::make_unique<Formosa::Gramambular::BlockReadingBuilder>(
+      languageModel_.get());
+  builder_->setJoinSeparator(kJoinSeparator);
+  walkedNodes_.clear();
+  clearUndoHistory();
+  rebuildLanguageModelHelpers();
+}
+
+void KeyHandler::rebuildLanguageModelHelpers() {
+  candidateCache_.clear();
+  markedPhraseExistence_.clear();
+  if (readingCorrector_ != nullptr) {
+    readingCorrector_ =
+        std::make_unique<ReadingCorrector>(languageModel_.get());
+  }
+  if (pinyinSegmenter_ != nullptr) {
+    pinyinSegmenter_ = std::make_unique<PinyinSegmenter>(languageModel_.get());
+  }
 }
 
 void KeyHandler::setKeyboardLayout(
     const Formosa::Mandarin::BopomofoKeyboardLayout* layout) {
   reading_.setKeyboardLayout(layout);
+  if (pinyinSegmenter_ != nullptr) {
+    pinyinSegmenter_->clear();
+  }
+  // The readings suggested for rare ones depend on the layout.
+  candidateCache_.clear();
 }
 
 void KeyHandler::setSelectPhraseAfterCursorAsCandidate(bool flag) {
@@ -326,7 +788,135 @@ void KeyHandler::setMoveCursorAfterSelection(bool flag) {
   moveCursorAfterSelection_ = flag;
 }
 
-bool KeyHandler::handleCursorKeys(fcitx::Key key, McBopomofo::InputState* state,
+void KeyHandler::setInstantPreview(bool flag) { instantPreview_ = flag; }
+
+void KeyHandler::setPhraseCompletion(bool flag) {
+  phraseCompletion_ = flag;
+  candidateCache_.clear();
+}
+
+void KeyHandler::setReadingCorrection(bool flag) {
+  if (!flag) {
+    readingCorrector_.reset();
+  } else if (readingCorrector_ == nullptr) {
+    readingCorrector_ =
+        std::make_unique<ReadingCorrector>(languageModel_.get());
+  }
+  candidateCache_.clear();
+}
+
+void KeyHandler::setContinuousPinyin(bool flag) {
+  if (!flag) {
+    pinyinSegmenter_.reset();
+  } else if (pinyinSegmenter_ == nullptr) {
+    pinyinSegmenter_ = std::make_unique<PinyinSegmenter>(languageModel_.get());
+  }
+}
+
+bool KeyHandler::isContinuousPinyinActive() const {
+  return pinyinSegmenter_ != nullptr &&
+         reading_.keyboardLayout() ==
+             Formosa::Mandarin::BopomofoKeyboardLayout::HanyuPinyinLayout();
+}
+
+void KeyHandler::setBackgroundWalker(BackgroundWalker* walker) {
+  if (walkPending_) {
+    // The current walker may be going away, so walk the grid here instead.
+    cancelBackgroundWalk();
+    walk();
+  }
+  backgroundWalker_ = walker;
+}
+
+void KeyHandler::setSymbolTable(
+    std::shared_ptr<const SymbolTable> symbolTable) {
+  symbolTable_ = std::move(symbolTable);
+}
+
+void KeyHandler::setComposingBufferSize(size_t size) {
+  composingBufferSize_ = size;
+}
+
+void KeyHandler::setCommitConvergedText(bool flag) {
+  commitConvergedText_ = flag;
+}
+
+void KeyHandler::setSpeculativeWarmUp(bool flag) {
+  speculativeWarmUp_ = flag;
+}
+
+bool KeyHandler::hasPendingWarmUp() const {
+  return warmUpPending_ && !reading_.isEmpty() && !reading_.hasToneMarker();
+}
+
+void KeyHandler::warmUp() {
+  if (!hasPendingWarmUp()) {
+    return;
+  }
+  warmUpPending_ = false;
+  auto* lm = dynamic_cast<McBopomofoLM*>(languageModel_.get());
+  if (lm == nullptr) {
+    return;
+  }
+
+  // The composed reading goes to the cursor, after the pending readings. The
+  // phrases it forms span at most MaximumBuildSpanLength readings.
+  constexpr size_t kMaxNeighbors =
+      Formosa::Gramambular::BlockReadingBuilder::MaximumBuildSpanLength - 1;
+  const std::vector<std::string>& readings = builder_->readings();
+  size_t cursor = builder_->cursorIndex();
+  std::vector<std::string> before(
+      readings.begin() + (cursor - std::min(cursor, kMaxNeighbors)),
+      readings.begin() + cursor);
+  before.insert(before.end(), pendingReadings_.begin(),
+                pendingReadings_.end());
+  if (before.size() > kMaxNeighbors) {
+    before.erase(before.begin(), before.end() - kMaxNeighbors);
+  }
+  std::vector<std::string> after(
+      readings.begin() + cursor,
+      readings.begin() + cursor +
+          std::min(readings.size() - cursor, kMaxNeighbors));
+
+  std::vector<McBopomofoLM::WarmUpGroup> groups;
+  Formosa::Mandarin::BopomofoSyllable syllable = reading_.syllable();
+  for (Formosa::Mandarin::BopomofoSyllable::Component tone :
+       {Formosa::Mandarin::BopomofoSyllable::Tone1,
+        Formosa::Mandarin::BopomofoSyllable::Tone2,
+        Formosa::Mandarin::BopomofoSyllable::Tone3,
+        Formosa::Mandarin::BopomofoSyllable::Tone4,
+        Formosa::Mandarin::BopomofoSyllable::Tone5}) {
+    McBopomofoLM::WarmUpGroup group;
+    group.reading = (syllable + Formosa::Mandarin::BopomofoSyllable(tone))
+                        .composedString();
+    // Each longer window of readings that includes the composed one.
+    for (size_t headCount = 0; headCount <= before.size(); headCount++) {
+      for (size_t tailCount = headCount == 0 ? 1 : 0;
+           tailCount <= after.size() && headCount + tailCount <= kMaxNeighbors;
+           tailCount++) {
+        std::string key;
+        for (size_t i = before.size() - headCount; i < before.size(); i++) {
+          key += before[i];
+          key += kJoinSeparator;
+        }
+        key += group.reading;
+        for (size_t i = 0; i < tailCount; i++) {
+          key += kJoinSeparator;
+          key += after[i];
+        }
+        group.phraseKeys.push_back(std::move(key));
+      }
+    }
+    groups.push_back(std::move(group));
+  }
+  lm->warmUpTopUnigrams(groups);
+  warmedUpKeysLive_ = true;
+  warmedUpKeysUsed_ = false;
+}
+
+void KeyHandler::setMetrics(Metrics* metrics) { metrics_ = metrics; }
+
+bool KeyHandler::handleCursorKeys(Key key, McBopomofo::InputState* state,
                                   const StateCallback& stateCallback,
                                   const ErrorCallback& errorCallback) {
   if (dynamic_cast<InputStates::Inputting*>(state) == nullptr &&
@@ -337,6 +927,9 @@ bool KeyHandler::handleCursorKeys(fcitx::Key key, McBopomofo::InputState* state,
   auto marking = dynamic_cast<InputStates::Marking*>(state);
   if (marking != nullptr) {
     markBeginCursorIndex = marking->markStartGridCursorIndex;
+  } else {
+    // A new marking session; the user phrases may have changed since the last.
+    markedPhraseExistence_.clear();
   }
 
   if (!reading_.isEmpty()) {
@@ -346,24 +939,24 @@ bool KeyHandler::handleCursorKeys(fcitx::Key key, McBopomofo::InputState* state,
   }
 
   bool isValidMove = false;
-  switch (key.sym()) {
-    case FcitxKey_Left:
+  switch (key.name) {
+    case Key::Name::kLeft:
       if (builder_->cursorIndex() > 0) {
         builder_->setCursorIndex(builder_->cursorIndex() - 1);
         isValidMove = true;
       }
       break;
-    case FcitxKey_Right:
+    case Key::Name::kRight:
       if (builder_->cursorIndex() < builder_->length()) {
         builder_->setCursorIndex(builder_->cursorIndex() + 1);
         isValidMove = true;
       }
       break;
-    case FcitxKey_Home:
+    case Key::Name::kHome:
       builder_->setCursorIndex(0);
       isValidMove = true;
       break;
-    case FcitxKey_End:
+    case Key::Name::kEnd:
       builder_->setCursorIndex(builder_->length());
       isValidMove = true;
       break;
@@ -376,7 +969,7 @@ bool KeyHandler::handleCursorKeys(fcitx::Key key, McBopomofo::InputState* state,
     errorCallback();
   }
 
-  if (key.states() & fcitx::KeyState::Shift &&
+  if (key.shiftPressed &&
       builder_->cursorIndex() != markBeginCursorIndex) {
     stateCallback(buildMarkingState(markBeginCursorIndex));
   } else {
@@ -385,7 +978,7 @@ bool KeyHandler::handleCursorKeys(fcitx::Key key, McBopomofo::InputState* state,
   return true;
 }
 
-bool KeyHandler::handleDeleteKeys(fcitx::Key key, McBopomofo::InputState* state,
+bool KeyHandler::handleDeleteKeys(Key key, McBopomofo::InputState* state,
                                   const StateCallback& stateCallback,
                                   const ErrorCallback& errorCallback) {
   if (dynamic_cast<InputStates::NotEmpty*>(state) == nullptr) {
@@ -395,11 +988,13 @@ bool KeyHandler::handleDeleteKeys(fcitx::Key key, McBopomofo::InputState* state,
   if (reading_.isEmpty()) {
     bool isValidDelete = false;
 
-    if (key.check(FcitxKey_BackSpace) && builder_->cursorIndex() > 0) {
+    if (key.check(Key::Name::kBackSpace) && builder_->cursorIndex() > 0) {
+      saveUndoSnapshot();
       builder_->deleteReadingBeforeCursor();
       isValidDelete = true;
-    } else if (key.check(FcitxKey_Delete) &&
+    } else if (key.check(Key::Name::kDelete) &&
                builder_->cursorIndex() < builder_->length()) {
+      saveUndoSnapshot();
       builder_->deleteReadingAfterCursor();
       isValidDelete = true;
     }
@@ -410,7 +1005,7 @@ bool KeyHandler::handleDeleteKeys(fcitx::Key key, McBopomofo::InputState* state,
     }
     walk();
   } else {
-    if (key.check(FcitxKey_BackSpace)) {
+    if (key.check(Key::Name::kBackSpace)) {
       reading_.backspace();
     } else {
       // Del not supported when bopomofo reading is active.
@@ -419,7 +1014,41 @@ bool KeyHandler::handleDeleteKeys(fcitx::Key key, McBopomofo::InputState* state,
   }
 
   if (reading_.isEmpty() && builder_->length() == 0) {
-    // Cancel the previous input state if everything is empty now.
+    // Cancel the previous input state if everything is empty now. Undo is only
+    // available while composing, so the history goes away with the
+    // composition.
+    clearUndoHistory();
+    stateCallback(std::make_unique<InputStates::EmptyIgnoringPrevious>());
+  } else {
+    stateCallback(buildInputtingState());
+  }
+  return true;
+}
+
+bool KeyHandler::handleUndoRedoKeys(Key key, McBopomofo::InputState* state,
+                                    const StateCallback& stateCallback,
+                                    const ErrorCallback& errorCallback) {
+  if (dynamic_cast<InputStates::NotEmpty*>(state) == nullptr) {
+    return false;
+  }
+
+  bool isUndo = (key.ascii == 'z' || key.ascii == 'Z') && !key.shiftPressed;
+  auto& from = isUndo ? undoStack_ : redoStack_;
+  auto& to = isUndo ? redoStack_ : undoStack_;
+
+  if (!reading_.isEmpty() || from.empty()) {
+    errorCallback();
+    stateCallback(buildInputtingState());
+    return true;
+  }
+
+  to.push_back(takeSnapshot());
+  restoreSnapshot(from.back());
+  from.pop_back();
+
+  if (builder_->length() == 0) {
+    // Undone to before the first reading; same as deleting everything.
+    clearUndoHistory();
     stateCallback(std::make_unique<InputStates::EmptyIgnoringPrevious>());
   } else {
     stateCallback(buildInputtingState());
@@ -440,6 +1069,7 @@ bool KeyHandler::handlePunctuation(const std::string& punctuationUnigramKey,
     return true;
   }
 
+  saveUndoSnapshot();
   builder_->insertReadingAtCursor(punctuationUnigramKey);
   std::string evictedText = popEvictedTextAndWalk();
 
@@ -476,7 +1106,7 @@ KeyHandler::ComposedString KeyHandler::getComposedString(size_t builderCursor) {
       continue;
     }
 
-    const std::string& value = node->currentKeyValue().value;
+    const std::string& value = anchor.currentKeyValue().value;
     composed += value;
 
     // No work if runningCursor has already caught up with builderCursor.
@@ -516,8 +1146,8 @@ KeyHandler::ComposedString KeyHandler::getComposedString(size_t builderCursor) {
       const std::string& prevReading = builder_->readings()[builderCursor - 1];
       const std::string& nextReading = builder_->readings()[builderCursor];
 
-      tooltip = fmt::format(_("Cursor is between syllables {0} and {1}"),
-                            prevReading, nextReading);
+      tooltip = localizedStrings_->cursorIsBetweenSyllables(prevReading,
+                                                            nextReading);
     }
   }
 
@@ -529,10 +1159,17 @@ KeyHandler::ComposedString KeyHandler::getComposedString(size_t builderCursor) {
 }
 
 std::unique_ptr<InputStates::Inputting> KeyHandler::buildInputtingState() {
-  auto composedString = getComposedString(builder_->cursorIndex());
-
-  std::string head = composedString.head;
-  std::string reading = reading_.composedString();
+  // While a background walk is pending, the previous walk is shown with the
+  // cursor at where it was then.
+  auto composedString = getComposedString(
+      walkPending_ ? previewCursorIndex_ : builder_->cursorIndex());
+
+  // Pending readings are previewed at the cursor, where they will be inserted.
+  std::string head = composedString.head + unwalkedPreview_ + pendingPreview_;
+  bool hasPinyinLetters =
+      pinyinSegmenter_ != nullptr && !pinyinSegmenter_->empty();
+  std::string reading = hasPinyinLetters ? pinyinSegmenter_->displayString()
+                                         : reading_.composedString();
   std::string tail = composedString.tail;
 
   std::string composingBuffer = head + reading + tail;
@@ -543,8 +1180,24 @@ std::unique_ptr<InputStates::Inputting> KeyHandler::buildInputtingState() {
 
 std::unique_ptr<InputStates::ChoosingCandidate>
 KeyHandler::buildChoosingCandidateState(InputStates::NotEmpty* nonEmptyState) {
+  size_t candidateCursorIndex = actualCandidateCursorIndex();
+  if (candidateCacheGeneration_ != builder_->grid().generation()) {
+    candidateCache_.clear();
+    candidateCacheGeneration_ = builder_->grid().generation();
+  }
+  std::pair<size_t, size_t> cacheKey(builder_->cursorIndex(),
+                                     candidateCursorIndex);
+  auto cached = candidateCache_.find(cacheKey);
+  if (cached != candidateCache_.end()) {
+    phraseCompletions_ = cached->second.phraseCompletions;
+    readingCorrections_ = cached->second.readingCorrections;
+    return std::make_unique<InputStates::ChoosingCandidate>(
+        nonEmptyState->composingBuffer, nonEmptyState->cursorIndex,
+        cached->second.candidates);
+  }
+
   std::vector<Formosa::Gramambular::NodeAnchor> anchoredNodes =
-      builder_->grid().nodesCrossingOrEndingAt(actualCandidateCursorIndex());
+      builder_->grid().nodesCrossingOrEndingAt(candidateCursorIndex);
 
   // sort the nodes, so that longer nodes (representing longer phrases) are
   // placed at the top of the candidate list
@@ -563,8 +1216,124 @@ KeyHandler::buildChoosingCandidateState(InputStates::NotEmpty* nonEmptyState) {
     }
   }
 
+  // Completions come first, as they are what the first readings were typed
+  // for. Those that are also candidates of the grid are left to the grid.
+  phraseCompletions_.clear();
+  if (phraseCompletion_) {
+    std::vector<std::string> completionValues;
+    for (PhraseCompletion& completion : phraseCompletionsAtCursor()) {
+      if (std::find(candidates.begin(), candidates.end(), completion.value) ==
+          candidates.end()) {
+        completionValues.push_back(completion.value);
+        phraseCompletions_.push_back(std::move(completion));
+      }
+    }
+    candidates.insert(candidates.begin(), completionValues.begin(),
+                      completionValues.end());
+  }
+
+  // The values of a reading suggested for a rare one come last, as the
+  // reading was typed as it is.
+  readingCorrections_.clear();
+  for (ReadingCorrection& correction : readingCorrectionsAtCursor()) {
+    if (std::find(candidates.begin(), candidates.end(), correction.value) ==
+        candidates.end()) {
+      candidates.push_back(correction.value);
+      readingCorrections_.push_back(std::move(correction));
+    }
+  }
+
+  auto candidateList =
+      std::make_shared<const std::vector<std::string>>(std::move(candidates));
+  candidateCache_[cacheKey] = CachedCandidates{
+      candidateList, phraseCompletions_, readingCorrections_};
   return std::make_unique<InputStates::ChoosingCandidate>(
-      nonEmptyState->composingBuffer, nonEmptyState->cursorIndex, candidates);
+      nonEmptyState->composingBuffer, nonEmptyState->cursorIndex,
+      std::move(candidateList));
+}
+
+std::unique_ptr<InputStates::SymbolPicking>
+KeyHandler::buildSymbolPickingState() {
+  auto inputtingState = buildInputtingState();
+  std::vector<std::string> candidates;
+  std::string shownSearch = symbolSearch_;
+  bool choosingCategory = false;
+  if (!symbolSearch_.empty()) {
+    std::string readings;
+    candidates = searchSymbols(symbolSearch_, &readings);
+    if (!readings.empty()) {
+      shownSearch = readings + " " + symbolSearch_;
+    }
+  } else if (!symbolCategory_.empty()) {
+    for (std::string_view symbol :
+         symbolTable_->symbolsInCategory(symbolCategory_)) {
+      candidates.emplace_back(symbol);
+    }
+    shownSearch = symbolCategory_;
+  } else {
+    for (std::string_view category : symbolTable_->categories()) {
+      candidates.emplace_back(category);
+    }
+    choosingCategory = true;
+  }
+  return std::make_unique<InputStates::SymbolPicking>(
+      inputtingState->composingBuffer, inputtingState->cursorIndex, candidates,
+      symbolSearch_, choosingCategory,
+      localizedStrings_->symbolSearch(shownSearch));
+}
+
+std::vector<std::string> KeyHandler::searchSymbols(
+    const std::string& search, std::string* readings) const {
+  // Each tone ends a syllable, as when composing. Keys that are not for
+  // readings, or that replace a component typed before them, as the letters
+  // of a name do, make the search a name only.
+  const Formosa::Mandarin::BopomofoKeyboardLayout* layout =
+      reading_.keyboardLayout();
+  bool isPinyin =
+      layout == Formosa::Mandarin::BopomofoKeyboardLayout::HanyuPinyinLayout();
+  Formosa::Mandarin::BopomofoReadingBuffer buffer(layout);
+  std::string syllableKeys;
+  readings->clear();
+  for (char c : search) {
+    syllableKeys += c;
+    if (!buffer.isValidKey(c) || !buffer.combineKey(c) ||
+        (!isPinyin &&
+         layout->keySequenceFromSyllable(buffer.syllable()) != syllableKeys)) {
+      readings->clear();
+      buffer.clear();
+      break;
+    }
+    if (buffer.hasToneMarker()) {
+      *readings += buffer.syllable().composedString() + kJoinSeparator;
+      buffer.clear();
+      syllableKeys.clear();
+    }
+  }
+  *readings += buffer.syllable().composedString();
+  if (!readings->empty() && readings->back() == kJoinSeparator[0]) {
+    readings->pop_back();
+  }
+
+  std::string name = search;
+  std::transform(name.begin(), name.end(), name.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+
+  // Each search is one lookup of the symbol table's index, and the readings
+  // come first.
+  std::vector<std::string> symbols;
+  for (const std::string* prefix : {readings, &name}) {
+    if (prefix->empty()) {
+      continue;
+    }
+    for (std::string_view symbol : symbolTable_->symbolsForPrefix(
+             *prefix, SymbolTable::MaxSymbolsPerPrefix)) {
+      if (std::find(symbols.begin(), symbols.end(), symbol) ==
+          symbols.end()) {
+        symbols.emplace_back(symbol);
+      }
+    }
+  }
+  return symbols;
 }
 
 std::unique_ptr<InputStates::Marking> KeyHandler::buildMarkingState(
@@ -608,26 +1377,36 @@ std::unique_ptr<InputStates::Marking> KeyHandler::buildMarkingState(
   std::string status;
   // Validate the marking.
   if (readings.size() < kMinValidMarkingReadingCount) {
-    status = fmt::format(_("{0} syllables required"),
-                         std::to_string(kMinValidMarkingReadingCount));
+    status = localizedStrings_->syllablesRequired(kMinValidMarkingReadingCount);
   } else if (readings.size() > kMaxValidMarkingReadingCount) {
-    status = fmt::format(_("{0} syllables maximum"),
-                         std::to_string(kMaxValidMarkingReadingCount));
-  } else if (MarkedPhraseExists(languageModel_.get(), readingValue, marked)) {
-    status = _("phrase already exists");
+    status = localizedStrings_->syllablesMaximum(kMaxValidMarkingReadingCount);
+  } else if (markedPhraseExists(readingValue, marked)) {
+    status = localizedStrings_->phraseAlreadyExists();
   } else {
-    status = _("press Enter to add the phrase");
+    status = localizedStrings_->pressEnterToAddThePhrase();
     isValid = true;
   }
 
-  std::string tooltip = fmt::format(_("Marked: {0}, syllables: {1}, {2}"),
-                                    marked, readingUiText, status);
+  std::string tooltip = localizedStrings_->markedWithSyllablesAndStatus(
+      marked, readingUiText, status);
 
   return std::make_unique<InputStates::Marking>(
       composed, composedStringCursorIndex, tooltip, beginCursorIndex, head,
       marked, tail, readingValue, isValid);
 }
 
+bool KeyHandler::markedPhraseExists(const std::string& reading,
+                                    const std::string& value) {
+  std::string cacheKey = reading + "\t" + value;
+  auto cached = markedPhraseExistence_.find(cacheKey);
+  if (cached != markedPhraseExistence_.end()) {
+    return cached->second;
+  }
+  bool exists = languageModel_->hasKeyValue(reading, value);
+  markedPhraseExistence_.emplace(std::move(cacheKey), exists);
+  return exists;
+}
+
 size_t KeyHandler::actualCandidateCursorIndex() {
   size_t cursorIndex = builder_->cursorIndex();
   if (selectPhraseAfterCursorAsCandidate_) {
@@ -644,24 +1423,172 @@ size_t KeyHandler::actualCandidateCursorIndex() {
   return cursorIndex;
 }
 
+std::unique_ptr<InputStates::Inputting> KeyHandler::insertPendingReadings(
+    bool walkInBackground) {
+  std::vector<std::string> readings;
+  readings.swap(pendingReadings_);
+
+  if (walkInBackground && backgroundWalker_ != nullptr &&
+      builder_->length() + readings.size() >= kMinBackgroundWalkGridWidth) {
+    if (!walkPending_) {
+      // Keep the previous walk valid and shown until the new one is ready.
+      // The previous walk's nodes stay alive in the copy, since the builder's
+      // grid copies shared spans before changing them.
+      saveUndoSnapshot();
+      previewGrid_ = builder_->grid();
+      previewCursorIndex_ = builder_->cursorIndex();
+      walkPending_ = true;
+    }
+    for (const std::string& reading : readings) {
+      builder_->insertReadingAtCursor(reading);
+    }
+    unwalkedPreview_ += pendingPreview_;
+    pendingPreview_.clear();
+    backgroundWalker_->request(++walkGeneration_, builder_->grid());
+    return nullptr;
+  }
+
+  std::string evictedText;
+  if (walkPending_) {
+    // Walk the readings inserted for the background walk right away.
+    cancelBackgroundWalk();
+    evictedText += popEvictedTextAndWalk();
+    applyUserOverrideModelSuggestion();
+  }
+
+  pendingPreview_.clear();
+  for (const std::string& reading : readings) {
+    evictedText += insertReadingAndWalk(reading);
+  }
+
+  auto inputtingState = buildInputtingState();
+  inputtingState->evictedText = evictedText;
+  return inputtingState;
+}
+
+void KeyHandler::cancelBackgroundWalk() {
+  if (backgroundWalker_ != nullptr) {
+    backgroundWalker_->cancel();
+  }
+  walkGeneration_++;
+  walkPending_ = false;
+  previewGrid_ = Formosa::Gramambular::Grid();
+  unwalkedPreview_.clear();
+}
+
+std::string KeyHandler::insertReadingAndWalk(const std::string& reading) {
+  saveUndoSnapshot();
+  builder_->insertReadingAtCursor(reading);
+  std::string evictedText = popEvictedTextAndWalk();
+  applyUserOverrideModelSuggestion();
+  return evictedText;
+}
+
+void KeyHandler::applyUserOverrideModelSuggestion() {
+  std::string overrideValue = userOverrideModel_.suggest(
+      walkedNodes_, builder_->cursorIndex(), GetEpochNowInSeconds());
+  if (!overrideValue.empty()) {
+    size_t cursorIndex = actualCandidateCursorIndex();
+    std::vector<Formosa::Gramambular::NodeAnchor> nodes =
+        builder_->grid().nodesCrossingOrEndingAt(cursorIndex);
+    double highestScore = FindHighestScore(nodes, kEpsilon);
+    builder_->grid().overlayScoreForSelectedCandidate(cursorIndex,
+                                                      overrideValue,
+                                                      highestScore);
+    // The overlay invalidates the best paths from the nodes it adjusts on,
+    // so this walks those few locations again, and the suggestion shows now
+    // rather than after the next key.
+    walk();
+    if (metrics_ != nullptr) {
+      metrics_->increment(Metrics::Counter::kOverrideSuggestionsApplied);
+    }
+  }
+}
+
 std::string KeyHandler::popEvictedTextAndWalk() {
+  // The grid has just been changed, and inserting a reading in the middle may
+  // have removed nodes referenced by the previous walk, so walk first before
+  // determining what to evict.
+  walk();
+  std::string evictedText = evictConvergedText();
+  evictedText += evictOverflownText();
+  return evictedText;
+}
+
+std::string KeyHandler::evictConvergedText() {
+  Formosa::Gramambular::Grid& grid = builder_->grid();
+  if (!commitConvergedText_ || builder_->cursorIndex() != grid.width()) {
+    return std::string();
+  }
+
+  // A reading typed at the end adds nodes starting at most
+  // MaximumBuildSpanLength - 1 locations before it. The user override model
+  // may also boost the nodes ending at the cursor, which start one further.
+  Formosa::Gramambular::Walker walker(&grid);
+  size_t convergence = walker.convergenceLocation(
+      grid.width(),
+      Formosa::Gramambular::BlockReadingBuilder::MaximumBuildSpanLength + 1);
+
+  std::string evictedText;
+  size_t evictedLength = 0;
+  for (const Formosa::Gramambular::NodeAnchor& anchor : walkedNodes_) {
+    if (evictedLength + anchor.spanningLength > convergence) {
+      break;
+    }
+    evictedText += anchor.currentKeyValue().value;
+    evictedLength += anchor.spanningLength;
+  }
+  if (evictedLength == 0) {
+    return evictedText;
+  }
+
+  builder_->removeHeadReadings(evictedLength);
+  walk();
+  if (metrics_ != nullptr) {
+    metrics_->increment(Metrics::Counter::kConvergedEvictions);
+  }
+
+  // The evicted text is committed, and earlier snapshots still contain it.
+  clearUndoHistory();
+  return evictedText;
+}
+
+std::string KeyHandler::evictOverflownText() {
   // in an ideal world, we can as well let the user type forever,
-  // but because the Viterbi algorithm has a complexity of O(N^2),
-  // the walk will become slower as the number of nodes increase,
-  // therefore we need to "pop out" overflown text -- they usually
+  // but because the walk becomes slower as the number of nodes increase,
+  // we need to "pop out" overflown text -- they usually
   // lose their influence over the whole MLE anyway -- so that when
   // the user type along, the already composed text at front will
   // be popped out
-  // TODO(unassigned): Is the algorithm really O(n^2)? Audit.
   std::string evictedText;
-  if (builder_->grid().width() > kComposingBufferSize &&
-      !walkedNodes_.empty()) {
+  while (builder_->grid().width() > composingBufferSize_ &&
+         !walkedNodes_.empty()) {
     Formosa::Gramambular::NodeAnchor& anchor = walkedNodes_[0];
-    evictedText = anchor.node->currentKeyValue().value;
+    evictedText += anchor.currentKeyValue().value;
     builder_->removeHeadReadings(anchor.spanningLength);
+    walk();
+
+    // The evicted text is committed, and earlier snapshots still contain it.
+    clearUndoHistory();
+  }
+  return evictedText;
+}
+
+std::string KeyHandler::evictTextBeforeCursor() {
+  size_t cursor = builder_->cursorIndex();
+  if (cursor == 0) {
+    return std::string();
   }
 
+  // The text is taken as it is shown, even if the cursor is within a phrase.
+  auto inputtingState = buildInputtingState();
+  std::string evictedText =
+      inputtingState->composingBuffer.substr(0, inputtingState->cursorIndex);
+  builder_->removeHeadReadings(cursor);
   walk();
+
+  // The evicted text is committed, and earlier snapshots still contain it.
+  clearUndoHistory();
   return evictedText;
 }
 
@@ -691,7 +1618,125 @@ void KeyHandler::pinNode(const std::string& candidate) {
   }
 }
 
+std::vector<KeyHandler::PhraseCompletion>
+KeyHandler::phraseCompletionsAtCursor() {
+  std::vector<PhraseCompletion> completions;
+  auto lm = dynamic_cast<McBopomofoLM*>(languageModel_.get());
+  if (lm == nullptr) {
+    return completions;
+  }
+
+  const std::vector<std::string>& readings = builder_->readings();
+  size_t cursor = builder_->cursorIndex();
+  for (size_t prefixLength = std::min(cursor, kMaxPhraseCompletionPrefix);
+       prefixLength > 0; prefixLength--) {
+    std::vector<std::string> prefix(readings.begin() + cursor - prefixLength,
+                                    readings.begin() + cursor);
+    for (const auto& unigram :
+         lm->completionsForReadings(prefix, kMaxPhraseCompletions)) {
+      bool listed = std::any_of(
+          completions.begin(), completions.end(),
+          [&](const auto& c) { return c.value == unigram.keyValue.value; });
+      if (listed) {
+        continue;
+      }
+      std::vector<std::string> phraseReadings =
+          SplitReadings(unigram.keyValue.key);
+      completions.push_back(PhraseCompletion{
+          unigram.keyValue.value,
+          std::vector<std::string>(phraseReadings.begin() + prefixLength,
+                                   phraseReadings.end())});
+    }
+  }
+  if (completions.size() > kMaxPhraseCompletions) {
+    completions.resize(kMaxPhraseCompletions);
+  }
+  return completions;
+}
+
+std::string KeyHandler::insertPhraseCompletion(
+    const PhraseCompletion& completion) {
+  saveUndoSnapshot();
+  for (const std::string& reading : completion.remainingReadings) {
+    builder_->insertReadingAtCursor(reading);
+  }
+  builder_->grid().fixNodeSelectedCandidate(builder_->cursorIndex(),
+                                            completion.value);
+  std::string evictedText = popEvictedTextAndWalk();
+  return evictedText;
+}
+
+std::vector<KeyHandler::ReadingCorrection>
+KeyHandler::readingCorrectionsAtCursor() {
+  std::vector<ReadingCorrection> corrections;
+  size_t location = actualCandidateCursorIndex();
+  if (readingCorrector_ == nullptr || location == 0) {
+    return corrections;
+  }
+
+  const std::string& typed = builder_->readings()[location - 1];
+  auto suggested = readingCorrector_->suggest(
+      Formosa::Mandarin::BopomofoSyllable::FromComposedString(typed),
+      reading_.keyboardLayout());
+  if (!suggested.has_value()) {
+    return corrections;
+  }
+
+  std::string reading = suggested->composedString();
+  std::vector<Formosa::Gramambular::Unigram> unigrams =
+      languageModel_->unigramsForKey(reading);
+  std::stable_sort(unigrams.begin(), unigrams.end(),
+                   Formosa::Gramambular::Unigram::ScoreCompare);
+  for (const auto& unigram : unigrams) {
+    if (corrections.size() == kMaxReadingCorrections) {
+      break;
+    }
+    corrections.push_back(
+        ReadingCorrection{unigram.keyValue.value, location, reading});
+  }
+  return corrections;
+}
+
+void KeyHandler::applyReadingCorrection(const ReadingCorrection& correction) {
+  saveUndoSnapshot();
+  size_t cursorIndex = builder_->cursorIndex();
+  builder_->setCursorIndex(correction.location);
+  builder_->deleteReadingBeforeCursor();
+  builder_->insertReadingAtCursor(correction.reading);
+  builder_->setCursorIndex(cursorIndex);
+  builder_->grid().fixNodeSelectedCandidate(correction.location,
+                                            correction.value);
+  walk();
+}
+
+KeyHandler::CompositionSnapshot KeyHandler::takeSnapshot() const {
+  return CompositionSnapshot{*builder_, walkedNodes_};
+}
+
+void KeyHandler::restoreSnapshot(const CompositionSnapshot& snapshot) {
+  *builder_ = snapshot.builder;
+  walkedNodes_ = snapshot.walkedNodes;
+}
+
+void KeyHandler::saveUndoSnapshot() {
+  undoStack_.push_back(takeSnapshot());
+  if (undoStack_.size() > kMaxUndoDepth) {
+    undoStack_.pop_front();
+  }
+  redoStack_.clear();
+}
+
+void KeyHandler::clearUndoHistory() {
+  undoStack_.clear();
+  redoStack_.clear();
+}
+
 void KeyHandler::walk() {
+  ScopedLatency latency(metrics_, Metrics::Histogram::kWalk);
+  if (metrics_ != nullptr) {
+    metrics_->increment(Metrics::Counter::kWalks);
+  }
+
   // retrieve the most likely trellis, i.e. a Maximum Likelihood Estimation
   // of the best possible Mandarin characters given the input syllables,
   // using the Viterbi algorithm implemented in the Gramambular library.
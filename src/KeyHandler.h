@@ -24,37 +24,67 @@
 #ifndef SRC_KEYHANDLER_H_
 #define SRC_KEYHANDLER_H_
 
-#include <fcitx/inputmethodengine.h>
-
+#include <deque>
 #include <functional>
+#include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "BackgroundWalker.h"
 #include "Gramambular.h"
 #include "InputState.h"
-#include "LanguageModelLoader.h"
+#include "Key.h"
 #include "Mandarin.h"
 #include "McBopomofoLM.h"
+#include "Metrics.h"
+#include "PinyinSegmenter.h"
+#include "ReadingCorrector.h"
+#include "SymbolTable.h"
 #include "UserOverrideModel.h"
+#include "UserPhraseAdder.h"
 
 namespace McBopomofo {
 
 class KeyHandler {
  public:
+  // The strings KeyHandler shows to the user, such as the tooltips of the
+  // Marking state. The defaults are in English; frontends override them with
+  // translated ones.
+  class LocalizedStrings {
+   public:
+    virtual ~LocalizedStrings() = default;
+
+    virtual std::string cursorIsBetweenSyllables(
+        const std::string& prevReading, const std::string& nextReading);
+    virtual std::string syllablesRequired(size_t count);
+    virtual std::string syllablesMaximum(size_t count);
+    virtual std::string phraseAlreadyExists();
+    virtual std::string pressEnterToAddThePhrase();
+    virtual std::string markedWithSyllablesAndStatus(
+        const std::string& marked, const std::string& readingUiText,
+        const std::string& status);
+    virtual std::string symbolSearch(const std::string& search);
+  };
+
+  // The user phrase adder may be nullptr if marked phrases are not to be
+  // added, and the localized strings nullptr to use the default ones.
   explicit KeyHandler(
       std::shared_ptr<Formosa::Gramambular::LanguageModel> languageModel,
-      std::shared_ptr<LanguageModelLoader> languageModelLoader);
+      std::shared_ptr<UserPhraseAdder> userPhraseAdder,
+      std::unique_ptr<LocalizedStrings> localizedStrings = nullptr);
 
   using StateCallback =
       std::function<void(std::unique_ptr<McBopomofo::InputState>)>;
   using ErrorCallback = std::function<void(void)>;
 
-  // Given a fcitx5 KeyEvent and the current state, invokes the stateCallback if
-  // a new state is entered, or errorCallback will be invoked. Returns true if
-  // the key should be absorbed, signaling that the key is accepted and handled,
-  // or false if the event should be let pass through.
-  bool handle(fcitx::Key key, McBopomofo::InputState* state,
+  // Given a key and the current state, invokes the stateCallback if a new
+  // state is entered, or errorCallback will be invoked. Returns true if the key
+  // should be absorbed, signaling that the key is accepted and handled, or
+  // false if the event should be let pass through.
+  bool handle(Key key, McBopomofo::InputState* state,
               const StateCallback& stateCallback,
               const ErrorCallback& errorCallback);
 
@@ -64,8 +94,54 @@ class KeyHandler {
   // Candidate panel canceled. Can assume the context is in a candidate state.
   void candidatePanelCancelled(const StateCallback& stateCallback);
 
+  // Given a key typed in the SymbolPicking state, refines the search and
+  // enters the updated state. Printable keys add to the search, and BackSpace
+  // takes the last one back, or leaves the category, or closes the picker.
+  // Returns false if the key is not for the search. A reading can be searched
+  // for without its tone.
+  bool handleSymbolSearchKey(Key key, const StateCallback& stateCallback);
+
+  // Returns true if the key typed in the SymbolPicking state types the search
+  // even if it is a selection key: a key for readings, or any printable key
+  // once a search is typed. Frontends give such keys to
+  // handleSymbolSearchKey() rather than candidateSelected().
+  bool isSymbolSearchKey(Key key) const;
+
   void reset();
 
+  // The composition, including the reading being composed. It can be kept
+  // while the input context does not have focus, and restored later without
+  // rebuilding or walking the grid.
+  struct Composition {
+    Formosa::Gramambular::BlockReadingBuilder builder;
+    std::vector<Formosa::Gramambular::NodeAnchor> walkedNodes;
+    Formosa::Mandarin::BopomofoReadingBuffer reading;
+    // The language model the builder uses, kept alive with the composition.
+    std::shared_ptr<Formosa::Gramambular::LanguageModel> languageModel;
+    // The letters typed for continuous pinyin and not converted yet.
+    std::string pinyinInput;
+
+    // An estimate of the memory the composition holds, counting every
+    // reading as starting a node of each length.
+    size_t estimatedSize() const;
+  };
+
+  // Returns true if there are readings or a reading being composed.
+  bool hasComposition() const;
+
+  Composition composition() const;
+
+  // Replaces the current composition and enters the Inputting state. The
+  // current keyboard layout is kept.
+  void restoreComposition(Composition composition,
+                          const StateCallback& stateCallback);
+
+  // Sets the language model, such as one published after a profile switch.
+  // A composition in progress keeps using the current language model, which
+  // is replaced once there is no composition.
+  void setLanguageModel(
+      std::shared_ptr<Formosa::Gramambular::LanguageModel> languageModel);
+
   // Sets the Bopomofo keyboard layout.
   void setKeyboardLayout(
       const Formosa::Mandarin::BopomofoKeyboardLayout* layout);
@@ -76,16 +152,103 @@ class KeyHandler {
   // Sets move cursor after selection.
   void setMoveCursorAfterSelection(bool flag);
 
+  // Sets whether a composed reading is first shown with its most likely value,
+  // leaving the update of the grid and the walk to flushPendingReadings().
+  void setInstantPreview(bool flag);
+
+  // Sets whether letters typed with the Hanyu Pinyin layout are segmented into
+  // syllables as a whole, so that a sentence can be typed without tones or
+  // separators. Space converts the letters.
+  void setContinuousPinyin(bool flag);
+
+  // Sets whether a reading is corrected when it was likely typed by hitting a
+  // key next to the intended one.
+  void setReadingCorrection(bool flag);
+
+  // Sets whether the candidates include the phrases that the readings before
+  // the cursor begin, so that a long phrase can be chosen from its first
+  // readings. Requires the language model to be a McBopomofoLM with phrase
+  // completion enabled.
+  void setPhraseCompletion(bool flag);
+
+  // Returns true if there are readings shown in preview only.
+  bool hasPendingReadings() const;
+
+  // Inserts the pending readings into the grid, walks the grid, and enters the
+  // refined Inputting state. Does nothing if there are no pending readings.
+  // If walkInBackground is true and a background walker is set, large grids
+  // are walked on the worker thread instead, and the refined state is entered
+  // by applyBackgroundWalk().
+  void flushPendingReadings(const StateCallback& stateCallback,
+                            bool walkInBackground);
+
+  // Sets the walker used to walk large grids on a worker thread, or nullptr.
+  // The walker must outlive the key handler or be unset first. With a
+  // background walker, composed readings are previewed as with instant
+  // preview.
+  void setBackgroundWalker(BackgroundWalker* walker);
+
+  // Applies the result of the background walk and enters the refined
+  // Inputting state, unless the result is stale. To be called on the main
+  // thread once the background walker has notified.
+  void applyBackgroundWalk(const StateCallback& stateCallback);
+
+  // Sets whether warmUp() looks up the syllables the reading being composed
+  // may become, so that the tone key finds them ready. Requires the language
+  // model to be a McBopomofoLM.
+  void setSpeculativeWarmUp(bool flag);
+
+  // Returns true if there is a reading being composed whose lookups are not
+  // warmed up yet.
+  bool hasPendingWarmUp() const;
+
+  // Looks up, ahead of the tone key, the syllable the reading being composed
+  // makes with each tone, and the phrases each would form with the readings
+  // around the cursor. To be called when the event loop is idle; the lookups
+  // are dropped when the key after the next one is handled.
+  void warmUp();
+
+  // Sets the symbol table that Ctrl-` opens the symbol picker with, or
+  // nullptr to disable the picker.
+  void setSymbolTable(std::shared_ptr<const SymbolTable> symbolTable);
+
+  // Sets the maximum composing buffer size, in readings.
+  void setComposingBufferSize(size_t size);
+
+  // Sets whether the text at the front is committed as soon as readings typed
+  // at the end can no longer change it, rather than only when the composing
+  // buffer overflows.
+  void setCommitConvergedText(bool flag);
+
+  // Sets the metrics to record to, or nullptr. The metrics must outlive the
+  // key handler or be unset first.
+  void setMetrics(Metrics* metrics);
+
+  // The user override model. Exposed for instrumentation such as the soak test.
+  const UserOverrideModel& userOverrideModel() const {
+    return userOverrideModel_;
+  }
+
  private:
-  bool handleCursorKeys(fcitx::Key key, McBopomofo::InputState* state,
+  bool handleKey(Key key, McBopomofo::InputState* state,
+                 const StateCallback& stateCallback,
+                 const ErrorCallback& errorCallback);
+  bool handleCursorKeys(Key key, McBopomofo::InputState* state,
                         const StateCallback& stateCallback,
                         const ErrorCallback& errorCallback);
-  bool handleDeleteKeys(fcitx::Key key, McBopomofo::InputState* state,
+  bool handleDeleteKeys(Key key, McBopomofo::InputState* state,
                         const StateCallback& stateCallback,
                         const ErrorCallback& errorCallback);
   bool handlePunctuation(const std::string& punctuationUnigramKey,
                          const StateCallback& stateCallback,
                          const ErrorCallback& errorCallback);
+  bool handleContinuousPinyin(Key key, char asciiChar,
+                              const StateCallback& stateCallback,
+                              const ErrorCallback& errorCallback);
+  bool isContinuousPinyinActive() const;
+  bool handleUndoRedoKeys(Key key, McBopomofo::InputState* state,
+                          const StateCallback& stateCallback,
+                          const ErrorCallback& errorCallback);
 
   // Get the head and the tail of current composed string, separated by the
   // current cursor.
@@ -101,27 +264,130 @@ class KeyHandler {
   std::unique_ptr<InputStates::ChoosingCandidate> buildChoosingCandidateState(
       InputStates::NotEmpty* nonEmptyState);
 
+  // Builds the SymbolPicking state for the current search or category, and the
+  // composition the picker was opened on.
+  std::unique_ptr<InputStates::SymbolPicking> buildSymbolPickingState();
+
+  // Returns the symbols whose keywords start with the search, taken both as
+  // keys typed for readings with the current keyboard layout and as a name.
+  // Sets readings to the readings typed, if any.
+  std::vector<std::string> searchSymbols(const std::string& search,
+                                         std::string* readings) const;
+
+  // Closes the symbol picker, if open.
+  void closeSymbolPicker();
+
   // Build a Marking state, ranging from beginCursorIndex to the current builder
   // cursor. It doesn't matter if the beginCursorIndex is behind or after the
   // builder cursor.
   std::unique_ptr<InputStates::Marking> buildMarkingState(
       size_t beginCursorIndex);
 
+  // Returns true if the language model has the marked phrase. The results are
+  // cached for the marking session.
+  bool markedPhraseExists(const std::string& reading, const std::string& value);
+
+  // Inserts the pending readings into the grid, and returns the Inputting state
+  // with the text evicted by doing so. Returns nullptr if the grid is to be
+  // walked in background.
+  std::unique_ptr<InputStates::Inputting> insertPendingReadings(
+      bool walkInBackground);
+
+  // Discards the background walk, if any, and the preview shown meanwhile.
+  void cancelBackgroundWalk();
+
+  // Boosts the user override model's suggestion for the walked nodes at the
+  // cursor, if any.
+  void applyUserOverrideModelSuggestion();
+
+  // Inserts the reading at the cursor and walks the grid, applying the user
+  // override model's suggestion. Returns the evicted text, if any.
+  std::string insertReadingAndWalk(const std::string& reading);
+
   // Returns the text that needs to be evicted from the walked grid due to the
   // grid now being overflown with the recently added reading, then walk the
   // grid.
   std::string popEvictedTextAndWalk();
 
+  // Evicts walked nodes from the head while the grid is wider than the
+  // composing buffer size, and returns their text.
+  std::string evictOverflownText();
+
+  // Evicts the readings before the cursor and returns their text as shown.
+  std::string evictTextBeforeCursor();
+
+  // If the cursor is at the end, evicts the walked nodes before the location
+  // where the best paths to the last locations converge, and returns their
+  // text. Does nothing unless committing converged text is enabled.
+  std::string evictConvergedText();
+
   // Compute the actual candidate cursor index.
   size_t actualCandidateCursorIndex();
 
   // Pin a node with a fixed unigram value, usually a candidate.
   void pinNode(const std::string& candidate);
 
+  // A phrase that the readings before the cursor begin.
+  struct PhraseCompletion {
+    std::string value;
+    // The readings of the phrase after those before the cursor.
+    std::vector<std::string> remainingReadings;
+  };
+
+  // Returns the completions of the readings before the cursor, those of the
+  // last two readings first.
+  std::vector<PhraseCompletion> phraseCompletionsAtCursor();
+
+  // Inserts the remaining readings of the completion at the cursor and pins
+  // the phrase. Returns the evicted text, if any.
+  std::string insertPhraseCompletion(const PhraseCompletion& completion);
+
+  // A value of the reading suggested for a rare reading typed, which the
+  // reading corrector keeps as typed.
+  struct ReadingCorrection {
+    std::string value;
+    // The location the suggested reading ends at, and the reading.
+    size_t location;
+    std::string reading;
+  };
+
+  // Returns the most likely values of the reading suggested for the reading
+  // before the candidate cursor, if any.
+  std::vector<ReadingCorrection> readingCorrectionsAtCursor();
+
+  // Replaces the reading with the suggested one and pins the value.
+  void applyReadingCorrection(const ReadingCorrection& correction);
+
   void walk();
 
+  // Switches to the language model set by setLanguageModel(), if any. There
+  // must be no composition.
+  void applyPendingLanguageModel();
+
+  // Rebuilds the reading corrector and the Pinyin segmenter, if enabled, for
+  // the current language model, and drops the cached candidate lists.
+  void rebuildLanguageModelHelpers();
+
+  // A snapshot of the composition. The builder's grid shares its spans with
+  // the grid the snapshot is taken from, so taking a snapshot is cheap, and
+  // restoring one requires neither language model lookups nor a walk.
+  struct CompositionSnapshot {
+    Formosa::Gramambular::BlockReadingBuilder builder;
+    std::vector<Formosa::Gramambular::NodeAnchor> walkedNodes;
+  };
+
+  CompositionSnapshot takeSnapshot() const;
+  void restoreSnapshot(const CompositionSnapshot& snapshot);
+
+  // Saves the current composition to the undo stack before it is changed.
+  void saveUndoSnapshot();
+  void clearUndoHistory();
+
   std::shared_ptr<Formosa::Gramambular::LanguageModel> languageModel_;
-  std::shared_ptr<LanguageModelLoader> languageModelLoader_;
+  std::shared_ptr<UserPhraseAdder> userPhraseAdder_;
+  std::unique_ptr<LocalizedStrings> localizedStrings_;
+  // The language model to switch to once there is no composition.
+  std::shared_ptr<Formosa::Gramambular::LanguageModel> pendingLanguageModel_;
 
   UserOverrideModel userOverrideModel_;
   Formosa::Mandarin::BopomofoReadingBuffer reading_;
@@ -130,8 +396,73 @@ class KeyHandler {
   // latest walked path (trellis) using the Viterbi algorithm
   std::vector<Formosa::Gramambular::NodeAnchor> walkedNodes_;
 
-  bool selectPhraseAfterCursorAsCandidate_;
-  bool moveCursorAfterSelection_;
+  std::deque<CompositionSnapshot> undoStack_;
+  std::deque<CompositionSnapshot> redoStack_;
+
+  // Readings composed but not yet inserted into the grid, and their preview.
+  std::vector<std::string> pendingReadings_;
+  std::string pendingPreview_;
+
+  bool selectPhraseAfterCursorAsCandidate_ = false;
+  bool moveCursorAfterSelection_ = false;
+  bool instantPreview_ = false;
+  size_t composingBufferSize_;
+  bool commitConvergedText_ = false;
+  bool speculativeWarmUp_ = false;
+  bool warmUpPending_ = false;
+  // Whether the language model holds the keys warmUp() looked up, and whether
+  // a key has been handled with them. They are dropped before the next one,
+  // as pending readings are still built with them after the key.
+  bool warmedUpKeysLive_ = false;
+  bool warmedUpKeysUsed_ = false;
+
+  bool phraseCompletion_ = false;
+  // The completions listed in the current candidate state.
+  std::vector<PhraseCompletion> phraseCompletions_;
+  // The reading corrections listed in the current candidate state.
+  std::vector<ReadingCorrection> readingCorrections_;
+
+  // The candidate lists built for the grid generation, by builder cursor and
+  // candidate cursor index, so that reopening the candidate panel on an
+  // unchanged grid does not build the list again. Both are needed: the nodes
+  // are found at the candidate cursor index, but the phrase completions at the
+  // builder cursor, and two builder cursors may share a candidate cursor index.
+  struct CachedCandidates {
+    std::shared_ptr<const std::vector<std::string>> candidates;
+    std::vector<PhraseCompletion> phraseCompletions;
+    std::vector<ReadingCorrection> readingCorrections;
+  };
+  uint64_t candidateCacheGeneration_ = 0;
+  std::map<std::pair<size_t, size_t>, CachedCandidates> candidateCache_;
+
+  // Whether marked phrases exist, by reading and value, for the current
+  // marking session.
+  std::unordered_map<std::string, bool> markedPhraseExistence_;
+
+  // The symbol picker. While it is open, symbolSearch_ is the keys typed to
+  // search, and symbolCategory_ the category chosen, if any.
+  std::shared_ptr<const SymbolTable> symbolTable_;
+  bool symbolPicking_ = false;
+  std::string symbolSearch_;
+  std::string symbolCategory_;
+
+  // Set if reading correction is enabled.
+  std::unique_ptr<ReadingCorrector> readingCorrector_;
+
+  // Set if continuous Hanyu Pinyin input is enabled.
+  std::unique_ptr<PinyinSegmenter> pinyinSegmenter_;
+
+  // Background walk state. While a walk is pending, the previous walk is shown
+  // and kept valid by previewGrid_, the grid it was walked on, followed by the
+  // preview of the readings inserted since.
+  BackgroundWalker* backgroundWalker_ = nullptr;
+  uint64_t walkGeneration_ = 0;
+  bool walkPending_ = false;
+  Formosa::Gramambular::Grid previewGrid_;
+  size_t previewCursorIndex_ = 0;
+  std::string unwalkedPreview_;
+
+  Metrics* metrics_ = nullptr;
 };
 
 }  // namespace McBopomofo
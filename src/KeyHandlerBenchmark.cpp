@@ -0,0 +1,534 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+// A replay benchmark. It replays a typing session through KeyHandler and
+// measures, for every keystroke, the latency to first paint (the time until
+// the first new state is entered) and, with instant preview, the latency of
+// the refinement that walks the grid afterwards. In the background mode, the
+// refinement latency lasts until the result of the background walk is applied.
+// With --metrics=both, every mode is replayed with and without metrics, to
+// measure the overhead of recording them. Each replay also reports how many
+// times the language model database was searched per key.
+//
+// With --mode=lookup, the language model is instead asked about every key of
+// the database in turn, to measure the cost and the number of database
+// searches of each kind of lookup.
+//
+// A session is either synthesized or read from a file, in which each line is
+// a sequence of keys in the Standard layout, followed by Enter. With
+// --input=pinyin, sentences are typed in continuous Hanyu Pinyin instead: the
+// letters of all the syllables without tones, then Space and Enter.
+//
+// Usage: McBopomofoBenchmark [--data=PATH] [--replay=FILE] [--sentences=N]
+//            [--max-length=N] [--seed=N] [--burst=N] [--buffer-size=N]
+//            [--mode=sync|preview|background|both|lookup|all]
+//            [--metrics=off|on|both] [--input=bopomofo|pinyin]
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "BackgroundWalker.h"
+#include "KeyHandler.h"
+#include "Mandarin.h"
+#include "McBopomofoLM.h"
+#include "Metrics.h"
+
+#ifndef MCBOPOMOFO_BENCHMARK_DATA_PATH
+#define MCBOPOMOFO_BENCHMARK_DATA_PATH "data/data.txt"
+#endif
+
+namespace McBopomofo {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::string dataPath = MCBOPOMOFO_BENCHMARK_DATA_PATH;
+  std::string replayPath;
+  // The user files merged over the language model, if any.
+  std::string userPhrasesPath;
+  std::string excludedPhrasesPath;
+  std::string phraseReplacementPath;
+  size_t sentences = 2000;
+  // The maximum number of syllables in a synthesized sentence.
+  size_t maxLength = 30;
+  uint32_t seed = 5381;
+  // Number of keys that arrive before the event loop becomes idle. Larger
+  // values simulate a slow machine or a fast typist.
+  size_t burst = 1;
+  // The composing buffer size. Sentences longer than it are evicted from.
+  size_t bufferSize = 10;
+  std::string mode = "both";
+  std::string metrics = "off";
+  // Whether the lookups of the syllable being composed are warmed up when
+  // the event loop is idle.
+  std::string warmUp = "off";
+  std::string input = "bopomofo";
+};
+
+enum class Mode { kSync, kPreview, kBackground };
+
+const char* ModeName(Mode mode) {
+  switch (mode) {
+    case Mode::kSync:
+      return "synchronous walk";
+    case Mode::kPreview:
+      return "instant preview";
+    case Mode::kBackground:
+      return "background walk";
+  }
+  return "";
+}
+
+constexpr const char* kSyllables[] = {
+    "ㄋㄧˇ",   "ㄏㄠˇ",   "ㄨㄛˇ",  "ㄕˋ",    "ㄉㄜ˙",   "ㄓㄨㄥ",
+    "ㄍㄨㄛˊ", "ㄖㄣˊ",   "ㄧ",     "ㄅㄨˋ",  "ㄗㄞˋ",   "ㄧㄡˇ",
+    "ㄊㄚ",    "ㄓㄜˋ",   "ㄍㄜˋ",  "ㄕㄤˋ",  "ㄒㄧㄚˋ", "ㄉㄚˋ",
+    "ㄒㄧㄠˇ", "ㄌㄞˊ",   "ㄑㄩˋ",  "ㄕㄨㄛ", "ㄏㄨㄚˋ", "ㄒㄩㄝˊ",
+    "ㄕㄥ",    "ㄍㄨㄥ",  "ㄗㄨㄛˋ", "ㄉㄧㄢˋ", "ㄋㄠˇ",  "ㄖˋ",
+    "ㄅㄣˇ",   "ㄐㄧㄣ",  "ㄊㄧㄢ", "ㄑㄧˋ",  "ㄇㄟˇ",   "ㄌㄧˋ",
+    "ㄒㄧㄣ",  "ㄕˊ",     "ㄐㄧㄢ", "ㄊㄞˊ",  "ㄨㄢ",    "ㄉㄨㄟˋ"};
+
+// One line of the session: the keys typed, then Enter.
+using Session = std::vector<std::string>;
+
+Session SynthesizeSession(const Options& options) {
+  const auto* layout =
+      Formosa::Mandarin::BopomofoKeyboardLayout::StandardLayout();
+  bool pinyin = options.input == "pinyin";
+  std::vector<std::string> sequences;
+  for (const char* composed : kSyllables) {
+    auto syllable =
+        Formosa::Mandarin::BopomofoSyllable::FromComposedString(composed);
+    if (pinyin) {
+      sequences.push_back(syllable.HanyuPinyinString(false, true));
+      continue;
+    }
+    std::string sequence = layout->keySequenceFromSyllable(syllable);
+    if (!layout->syllableFromKeySequence(sequence).hasToneMarker()) {
+      sequence += " ";
+    }
+    sequences.push_back(sequence);
+  }
+
+  std::mt19937 random(options.seed);
+  std::uniform_int_distribution<size_t> length(
+      4, std::max<size_t>(4, options.maxLength));
+  std::uniform_int_distribution<size_t> pick(0, sequences.size() - 1);
+  Session session;
+  for (size_t i = 0; i < options.sentences; i++) {
+    std::string line;
+    for (size_t j = 0, n = length(random); j < n; j++) {
+      line += sequences[pick(random)];
+    }
+    if (pinyin) {
+      line += " ";
+    }
+    session.push_back(line);
+  }
+  return session;
+}
+
+bool ReadSession(const std::string& path, Session* session) {
+  std::ifstream file(path);
+  if (!file) {
+    return false;
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    if (!line.empty()) {
+      session->push_back(line);
+    }
+  }
+  return true;
+}
+
+struct Latencies {
+  std::vector<double> firstPaint;
+  std::vector<double> refinement;
+  double totalSeconds = 0;
+  size_t keys = 0;
+  uint64_t searches = 0;
+  uint64_t warmedUpKeys = 0;
+  uint64_t warmUpHits = 0;
+  uint64_t warmUpWaste = 0;
+};
+
+double Percentile(std::vector<double> values, double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  size_t index = static_cast<size_t>(p * static_cast<double>(values.size()));
+  return values[std::min(index, values.size() - 1)];
+}
+
+void PrintLatencies(const char* name, const std::vector<double>& values) {
+  if (values.empty()) {
+    return;
+  }
+  printf("  %-12s %9zu samples  p50 %8.1f us  p90 %8.1f us  p99 %8.1f us  "
+         "max %8.1f us\n",
+         name, values.size(), Percentile(values, 0.5),
+         Percentile(values, 0.9), Percentile(values, 0.99),
+         *std::max_element(values.begin(), values.end()));
+}
+
+// Reads the distinct keys of the rows of the database at the path.
+std::vector<std::string> ReadKeys(const std::string& path) {
+  std::vector<std::string> keys;
+  std::ifstream file(path);
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::string key = line.substr(0, line.find(' '));
+    if (keys.empty() || keys.back() != key) {
+      keys.push_back(key);
+    }
+  }
+  return keys;
+}
+
+template <typename Lookup>
+void MeasureLookups(McBopomofoLM* lm, const char* name,
+                    const std::vector<std::string>& keys, Lookup lookup) {
+  uint64_t searches = lm->languageModelSearchCount();
+  auto start = Clock::now();
+  size_t found = 0;
+  for (const std::string& key : keys) {
+    found += lookup(key) ? 1 : 0;
+  }
+  double micros =
+      std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+  printf("  %-18s %6.2f searches/key %8.2f us/key  %zu found\n", name,
+         static_cast<double>(lm->languageModelSearchCount() - searches) /
+             static_cast<double>(keys.size()),
+         micros / static_cast<double>(keys.size()), found);
+}
+
+void RunLookups(McBopomofoLM* lm, const std::vector<std::string>& keys) {
+  printf("lookup (%zu keys)\n", keys.size());
+  if (keys.empty()) {
+    return;
+  }
+  MeasureLookups(lm, "hasUnigramsForKey", keys, [&](const std::string& key) {
+    return lm->hasUnigramsForKey(key);
+  });
+  MeasureLookups(lm, "unigramsForKey", keys, [&](const std::string& key) {
+    return !lm->unigramsForKey(key).empty();
+  });
+  MeasureLookups(lm, "topUnigramForKey", keys, [&](const std::string& key) {
+    Formosa::Gramambular::Unigram unigram;
+    return lm->topUnigramForKey(key, &unigram);
+  });
+}
+
+Latencies Replay(std::shared_ptr<McBopomofoLM> lm, const Session& session,
+                 Mode mode, bool warmUp, const Options& options,
+                 Metrics* metrics) {
+  // Stands in for the engine's event dispatcher.
+  std::mutex mutex;
+  std::condition_variable walked;
+  bool walkFinished = false;
+  BackgroundWalker walker([&]() {
+    std::lock_guard<std::mutex> lock(mutex);
+    walkFinished = true;
+    walked.notify_one();
+  });
+
+  KeyHandler handler(lm, nullptr);
+  if (options.input == "pinyin") {
+    handler.setKeyboardLayout(
+        Formosa::Mandarin::BopomofoKeyboardLayout::HanyuPinyinLayout());
+    handler.setContinuousPinyin(true);
+  } else {
+    handler.setKeyboardLayout(
+        Formosa::Mandarin::BopomofoKeyboardLayout::StandardLayout());
+  }
+  handler.setSelectPhraseAfterCursorAsCandidate(false);
+  handler.setMoveCursorAfterSelection(false);
+  handler.setInstantPreview(mode == Mode::kPreview);
+  handler.setComposingBufferSize(options.bufferSize);
+  handler.setMetrics(metrics);
+  handler.setSpeculativeWarmUp(warmUp);
+  if (mode == Mode::kBackground) {
+    handler.setBackgroundWalker(&walker);
+  }
+
+  std::unique_ptr<InputState> state = std::make_unique<InputStates::Empty>();
+  Clock::time_point painted;
+  bool hasPainted = false;
+  auto stateCallback = [&](std::unique_ptr<InputState> next) {
+    if (!hasPainted) {
+      painted = Clock::now();
+      hasPainted = true;
+    }
+    if (dynamic_cast<InputStates::EmptyIgnoringPrevious*>(next.get()) !=
+            nullptr ||
+        dynamic_cast<InputStates::Committing*>(next.get()) != nullptr) {
+      state = std::make_unique<InputStates::Empty>();
+    } else {
+      state = std::move(next);
+    }
+  };
+
+  Latencies latencies;
+  size_t keysSinceIdle = 0;
+  uint64_t searches = lm->languageModelSearchCount();
+  uint64_t warmedUpKeys = lm->warmedUpKeyCount();
+  uint64_t warmUpHits = lm->warmUpHitCount();
+  uint64_t warmUpWaste = lm->warmUpWasteCount();
+  auto start = Clock::now();
+  auto press = [&](Key key) {
+    latencies.keys++;
+    hasPainted = false;
+    auto begin = Clock::now();
+    handler.handle(key, state.get(), stateCallback, []() {});
+    if (hasPainted) {
+      latencies.firstPaint.push_back(
+          std::chrono::duration<double, std::micro>(painted - begin).count());
+    }
+
+    // The engine walks the pending readings once the event loop is idle.
+    if (++keysSinceIdle >= options.burst && handler.hasPendingReadings()) {
+      auto refineBegin = Clock::now();
+      hasPainted = false;
+      handler.flushPendingReadings(stateCallback, mode == Mode::kBackground);
+      if (!hasPainted) {
+        // Wait for the background walk, as if the event loop were idle.
+        std::unique_lock<std::mutex> lock(mutex);
+        walked.wait(lock, [&]() { return walkFinished; });
+        walkFinished = false;
+        lock.unlock();
+        handler.applyBackgroundWalk(stateCallback);
+      }
+      latencies.refinement.push_back(std::chrono::duration<double, std::micro>(
+                                         Clock::now() - refineBegin)
+                                         .count());
+    }
+    if (keysSinceIdle >= options.burst) {
+      // The user pauses before the tone key, and the engine warms up the
+      // lookups meanwhile.
+      handler.warmUp();
+      keysSinceIdle = 0;
+    }
+  };
+
+  for (const std::string& line : session) {
+    for (char c : line) {
+      press(Key::asciiKey(c));
+    }
+    press(Key::namedKey(Key::Name::kReturn));
+  }
+  latencies.totalSeconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  latencies.searches = lm->languageModelSearchCount() - searches;
+  latencies.warmedUpKeys = lm->warmedUpKeyCount() - warmedUpKeys;
+  latencies.warmUpHits = lm->warmUpHitCount() - warmUpHits;
+  latencies.warmUpWaste = lm->warmUpWasteCount() - warmUpWaste;
+  handler.setBackgroundWalker(nullptr);
+  return latencies;
+}
+
+bool ParseOptions(int argc, char* argv[], Options* options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+      return false;
+    }
+    std::string name = arg.substr(2, eq - 2);
+    std::string value = arg.substr(eq + 1);
+    if (name == "data") {
+      options->dataPath = value;
+    } else if (name == "replay") {
+      options->replayPath = value;
+    } else if (name == "user-phrases") {
+      options->userPhrasesPath = value;
+    } else if (name == "excluded-phrases") {
+      options->excludedPhrasesPath = value;
+    } else if (name == "phrase-replacement") {
+      options->phraseReplacementPath = value;
+    } else if (name == "sentences") {
+      options->sentences = std::stoull(value);
+    } else if (name == "max-length") {
+      options->maxLength = std::stoull(value);
+    } else if (name == "seed") {
+      options->seed = static_cast<uint32_t>(std::stoul(value));
+    } else if (name == "burst") {
+      options->burst = std::max<size_t>(1, std::stoull(value));
+    } else if (name == "buffer-size") {
+      options->bufferSize = std::max<size_t>(1, std::stoull(value));
+    } else if (name == "metrics" &&
+               (value == "off" || value == "on" || value == "both")) {
+      options->metrics = value;
+    } else if (name == "warm-up" &&
+               (value == "off" || value == "on" || value == "both")) {
+      options->warmUp = value;
+    } else if (name == "input" && (value == "bopomofo" || value == "pinyin")) {
+      options->input = value;
+    } else if (name == "mode" &&
+               (value == "sync" || value == "preview" ||
+                value == "background" || value == "both" ||
+                value == "lookup" || value == "all")) {
+      options->mode = value;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int RunBenchmark(int argc, char* argv[]) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    fprintf(stderr,
+            "usage: %s [--data=PATH] [--replay=FILE] [--user-phrases=PATH] "
+            "[--excluded-phrases=PATH] [--phrase-replacement=PATH] "
+            "[--sentences=N] [--max-length=N] [--seed=N] [--burst=N] "
+            "[--buffer-size=N] "
+            "[--mode=sync|preview|background|both|lookup|all] "
+            "[--metrics=off|on|both] [--warm-up=off|on|both] "
+            "[--input=bopomofo|pinyin]\n",
+            argv[0]);
+    return 2;
+  }
+
+  auto lm = std::make_shared<McBopomofoLM>();
+  lm->loadLanguageModel(options.dataPath.c_str());
+  if (!lm->isDataModelLoaded()) {
+    fprintf(stderr, "failed to load the language model: %s\n",
+            options.dataPath.c_str());
+    return 2;
+  }
+  if (!options.userPhrasesPath.empty() ||
+      !options.excludedPhrasesPath.empty() ||
+      !options.phraseReplacementPath.empty()) {
+    auto loadBegin = Clock::now();
+    lm->loadUserPhrases(options.userPhrasesPath.empty()
+                            ? nullptr
+                            : options.userPhrasesPath.c_str(),
+                        options.excludedPhrasesPath.empty()
+                            ? nullptr
+                            : options.excludedPhrasesPath.c_str());
+    if (!options.phraseReplacementPath.empty()) {
+      lm->loadPhraseReplacementMap(options.phraseReplacementPath.c_str());
+      lm->setPhraseReplacementEnabled(true);
+    }
+    printf("user files loaded in %.2f ms\n",
+           std::chrono::duration<double, std::milli>(Clock::now() - loadBegin)
+               .count());
+  }
+
+  Session session;
+  if (!options.replayPath.empty()) {
+    if (!ReadSession(options.replayPath, &session)) {
+      fprintf(stderr, "failed to read %s\n", options.replayPath.c_str());
+      return 2;
+    }
+  } else {
+    session = SynthesizeSession(options);
+  }
+
+  std::vector<Mode> modes;
+  if (options.mode == "sync" || options.mode == "both" ||
+      options.mode == "all") {
+    modes.push_back(Mode::kSync);
+  }
+  if (options.mode == "preview" || options.mode == "both" ||
+      options.mode == "all") {
+    modes.push_back(Mode::kPreview);
+  }
+  if (options.mode == "background" || options.mode == "all") {
+    modes.push_back(Mode::kBackground);
+  }
+
+  std::vector<bool> metricsModes;
+  if (options.metrics != "on") {
+    metricsModes.push_back(false);
+  }
+  if (options.metrics != "off") {
+    metricsModes.push_back(true);
+  }
+
+  std::vector<bool> warmUpModes;
+  if (options.warmUp != "on") {
+    warmUpModes.push_back(false);
+  }
+  if (options.warmUp != "off") {
+    warmUpModes.push_back(true);
+  }
+
+  for (Mode mode : modes) {
+    for (bool withWarmUp : warmUpModes) {
+      for (bool withMetrics : metricsModes) {
+        Metrics metrics;
+        Latencies latencies = Replay(lm, session, mode, withWarmUp, options,
+                                     withMetrics ? &metrics : nullptr);
+        printf("%s%s%s (%zu lines, %.2f s)\n", ModeName(mode),
+               withWarmUp ? ", with warm-up" : "",
+               withMetrics ? ", with metrics" : "", session.size(),
+               latencies.totalSeconds);
+        PrintLatencies("first paint", latencies.firstPaint);
+        PrintLatencies("refinement", latencies.refinement);
+        printf("  %-12s %9.2f per key\n", "lm searches",
+               static_cast<double>(latencies.searches) /
+                   static_cast<double>(std::max<size_t>(1, latencies.keys)));
+        if (withWarmUp) {
+          printf("  %-12s %9" PRIu64 " keys  %" PRIu64 " hits  %" PRIu64
+                 " wasted\n",
+                 "warm-up", latencies.warmedUpKeys, latencies.warmUpHits,
+                 latencies.warmUpWaste);
+        }
+        if (withMetrics) {
+          printf("%s", metrics.dump().c_str());
+        }
+      }
+    }
+  }
+
+  if (options.mode == "lookup" || options.mode == "all") {
+    RunLookups(lm.get(), ReadKeys(options.dataPath));
+  }
+  return 0;
+}
+
+}  // namespace McBopomofo
+
+int main(int argc, char* argv[]) {
+  return McBopomofo::RunBenchmark(argc, argv);
+}
@@ -0,0 +1,439 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+// A long-session soak test. It drives KeyHandler with a large number of
+// synthesized keystrokes against the real language model, samples the resident
+// set size, the heap, the number of live allocations and the size of the user
+// override model over time, and fails if any of them grows beyond the
+// configured bounds once the session has warmed up.
+//
+// Usage: McBopomofoSoakTest [--data=PATH] [--keystrokes=N] [--samples=N]
+//            [--seed=N] [--max-rss-growth-kb=N] [--max-live-alloc-growth=N]
+//            [--max-override-model-size=N]
+
+#include <malloc.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "KeyHandler.h"
+#include "Mandarin.h"
+#include "McBopomofoLM.h"
+
+#ifndef MCBOPOMOFO_SOAK_TEST_DATA_PATH
+#define MCBOPOMOFO_SOAK_TEST_DATA_PATH "data/data.txt"
+#endif
+
+// Allocation counting. All allocations made through the global operator new
+// (including the array and nothrow forms, which forward to it) are counted.
+static std::atomic<uint64_t> allocationCount{0};
+static std::atomic<uint64_t> deallocationCount{0};
+
+// The replacements pair operator new with malloc() and operator delete with
+// free(), which GCC cannot see across the two.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size) {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+  if (ptr != nullptr) {
+    deallocationCount.fetch_add(1, std::memory_order_relaxed);
+    free(ptr);
+  }
+}
+
+void operator delete(void* ptr, size_t) noexcept { operator delete(ptr); }
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+namespace McBopomofo {
+
+namespace {
+
+struct Options {
+  std::string dataPath = MCBOPOMOFO_SOAK_TEST_DATA_PATH;
+  uint64_t keystrokes = 2'000'000;
+  uint64_t samples = 20;
+  uint32_t seed = 5381;
+  // Allowed growth after warm-up, which is the first sample.
+  int64_t maxRssGrowthKb = 16 * 1024;
+  int64_t maxLiveAllocationGrowth = 20'000;
+  // Same as the capacity KeyHandler gives the user override model.
+  size_t maxUserOverrideModelSize = 500;
+};
+
+struct Sample {
+  uint64_t keystrokes;
+  int64_t rssKb;
+  int64_t liveAllocations;
+  uint64_t totalAllocations;
+  size_t heapInUseBytes;
+  size_t heapFreeBytes;
+  size_t userOverrideModelSize;
+};
+
+// Common syllables; they are converted into Standard layout key sequences.
+constexpr const char* kSyllables[] = {
+    "ㄋㄧˇ",   "ㄏㄠˇ",  "ㄨㄛˇ",  "ㄕˋ",   "ㄉㄜ˙",   "ㄓㄨㄥ", "ㄍㄨㄛˊ",
+    "ㄖㄣˊ",   "ㄧ",     "ㄅㄨˋ",  "ㄗㄞˋ", "ㄧㄡˇ",   "ㄊㄚ",   "ㄌㄜ˙",
+    "ㄓㄜˋ",   "ㄍㄜˋ",  "ㄕㄤˋ",  "ㄒㄧㄚˋ", "ㄉㄚˋ", "ㄒㄧㄠˇ", "ㄌㄞˊ",
+    "ㄑㄩˋ",   "ㄕㄨㄛ", "ㄏㄨㄚˋ", "ㄒㄩㄝˊ", "ㄕㄥ",  "ㄍㄨㄥ",  "ㄗㄨㄛˋ",
+    "ㄉㄧㄢˋ", "ㄋㄠˇ",  "ㄖˋ",    "ㄅㄣˇ",  "ㄐㄧㄣ", "ㄊㄧㄢ",  "ㄑㄧˋ",
+    "ㄇㄟˇ",   "ㄌㄧˋ",  "ㄒㄧㄣ", "ㄕˊ",    "ㄐㄧㄢ", "ㄊㄞˊ",  "ㄨㄢ"};
+
+int64_t GetResidentSetSizeKb() {
+  std::ifstream statm("/proc/self/statm");
+  int64_t pages = 0;
+  int64_t residentPages = 0;
+  statm >> pages >> residentPages;
+  return residentPages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+void GetHeapUsage(size_t* inUse, size_t* free) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  struct mallinfo2 info = mallinfo2();
+#else
+  struct mallinfo info = mallinfo();
+#endif
+  *inUse = static_cast<size_t>(info.uordblks);
+  *free = static_cast<size_t>(info.fordblks);
+}
+
+class SoakDriver {
+ public:
+  SoakDriver(std::shared_ptr<McBopomofoLM> lm, uint32_t seed)
+      : handler_(lm, nullptr), random_(seed) {
+    handler_.setKeyboardLayout(
+        Formosa::Mandarin::BopomofoKeyboardLayout::StandardLayout());
+    handler_.setSelectPhraseAfterCursorAsCandidate(false);
+    handler_.setMoveCursorAfterSelection(true);
+    state_ = std::make_unique<InputStates::Empty>();
+
+    const auto* layout =
+        Formosa::Mandarin::BopomofoKeyboardLayout::StandardLayout();
+    for (const char* syllable : kSyllables) {
+      std::string sequence = layout->keySequenceFromSyllable(
+          Formosa::Mandarin::BopomofoSyllable::FromComposedString(syllable));
+      // Tone 1 has no key; the reading is composed with the space key.
+      Formosa::Mandarin::BopomofoSyllable s =
+          layout->syllableFromKeySequence(sequence);
+      if (!s.hasToneMarker()) {
+        sequence += " ";
+      }
+      keySequences_.push_back(sequence);
+    }
+  }
+
+  // Runs one randomly chosen user action and returns the number of keystrokes
+  // it took.
+  uint64_t step() {
+    if (dynamic_cast<InputStates::ChoosingCandidate*>(state_.get()) !=
+        nullptr) {
+      return chooseCandidate();
+    }
+
+    int dice = pick(100);
+    if (dice < 68) {
+      return typeSyllable();
+    }
+    if (dice < 76) {
+      static const Key::Name cursorKeys[] = {
+          Key::Name::kLeft, Key::Name::kRight, Key::Name::kHome,
+          Key::Name::kEnd};
+      press(Key::namedKey(cursorKeys[pick(4)]));
+      return 1;
+    }
+    if (dice < 82) {
+      press(Key::asciiKey(' '));
+      return 1;
+    }
+    if (dice < 87) {
+      return mark();
+    }
+    if (dice < 90) {
+      press(Key::namedKey(pick(2) ? Key::Name::kBackSpace
+                                  : Key::Name::kDelete));
+      return 1;
+    }
+    if (dice < 92) {
+      press(Key::asciiKey(pick(3) ? 'z' : 'y', /*shiftPressed=*/false,
+                          /*ctrlPressed=*/true));
+      return 1;
+    }
+    if (dice < 95) {
+      press(Key::namedKey(Key::Name::kReturn));
+      return 1;
+    }
+    if (dice < 98) {
+      static const char punctuations[] = {'`', ',', '.', ';', '!', '?'};
+      press(Key::asciiKey(punctuations[pick(6)]));
+      return 1;
+    }
+    // Simulates a focus change.
+    handler_.reset();
+    state_ = std::make_unique<InputStates::Empty>();
+    return 0;
+  }
+
+  const KeyHandler& handler() const { return handler_; }
+
+ private:
+  int pick(int n) {
+    return std::uniform_int_distribution<int>(0, n - 1)(random_);
+  }
+
+  void press(Key key) {
+    handler_.handle(
+        key, state_.get(),
+        [this](std::unique_ptr<InputState> next) {
+          enterNewState(std::move(next));
+        },
+        []() {});
+  }
+
+  void enterNewState(std::unique_ptr<InputState> next) {
+    // Mirrors the transition McBopomofoEngine::enterNewState does.
+    if (dynamic_cast<InputStates::EmptyIgnoringPrevious*>(next.get()) !=
+            nullptr ||
+        dynamic_cast<InputStates::Committing*>(next.get()) != nullptr) {
+      state_ = std::make_unique<InputStates::Empty>();
+      return;
+    }
+    state_ = std::move(next);
+  }
+
+  uint64_t typeSyllable() {
+    const std::string& sequence = keySequences_[pick(keySequences_.size())];
+    for (char c : sequence) {
+      press(Key::asciiKey(c));
+    }
+    return sequence.length();
+  }
+
+  uint64_t chooseCandidate() {
+    auto* choosing = static_cast<InputStates::ChoosingCandidate*>(state_.get());
+    auto callback = [this](std::unique_ptr<InputState> next) {
+      enterNewState(std::move(next));
+    };
+    if (choosing->candidates.empty() || pick(5) == 0) {
+      handler_.candidatePanelCancelled(callback);
+    } else {
+      // Favor the first page, as real users do.
+      size_t limit = std::min<size_t>(choosing->candidates.size(), 9);
+      handler_.candidateSelected(choosing->candidates[pick(limit)], callback);
+    }
+    return 1;
+  }
+
+  uint64_t mark() {
+    uint64_t count = 1 + pick(4);
+    Key key = Key::namedKey(pick(2) ? Key::Name::kLeft : Key::Name::kRight,
+                            /*shiftPressed=*/true);
+    for (uint64_t i = 0; i < count; i++) {
+      press(key);
+    }
+    // Leave the marking state without adding the phrase, so that the user
+    // phrase file is not involved.
+    press(Key::namedKey(Key::Name::kEscape));
+    return count + 1;
+  }
+
+  KeyHandler handler_;
+  std::mt19937 random_;
+  std::unique_ptr<InputState> state_;
+  std::vector<std::string> keySequences_;
+};
+
+Sample TakeSample(uint64_t keystrokes, const KeyHandler& handler) {
+  Sample sample;
+  sample.keystrokes = keystrokes;
+  sample.rssKb = GetResidentSetSizeKb();
+  sample.totalAllocations = allocationCount.load();
+  sample.liveAllocations = static_cast<int64_t>(sample.totalAllocations) -
+                           static_cast<int64_t>(deallocationCount.load());
+  GetHeapUsage(&sample.heapInUseBytes, &sample.heapFreeBytes);
+  sample.userOverrideModelSize = handler.userOverrideModel().size();
+  return sample;
+}
+
+void PrintSample(const Sample& sample, double elapsedSeconds) {
+  size_t heapTotal = sample.heapInUseBytes + sample.heapFreeBytes;
+  double fragmentation =
+      heapTotal ? 100.0 * static_cast<double>(sample.heapFreeBytes) /
+                      static_cast<double>(heapTotal)
+                : 0.0;
+  printf(
+      "%10llu keys %8.1fs  rss %7lld KB  live allocs %8lld  total allocs "
+      "%11llu  heap %8zu KB used %7zu KB free (%4.1f%%)  override model %4zu\n",
+      static_cast<unsigned long long>(sample.keystrokes), elapsedSeconds,
+      static_cast<long long>(sample.rssKb),
+      static_cast<long long>(sample.liveAllocations),
+      static_cast<unsigned long long>(sample.totalAllocations),
+      sample.heapInUseBytes / 1024, sample.heapFreeBytes / 1024, fragmentation,
+      sample.userOverrideModelSize);
+  fflush(stdout);
+}
+
+bool ParseOptions(int argc, char* argv[], Options* options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+      return false;
+    }
+    std::string name = arg.substr(2, eq - 2);
+    std::string value = arg.substr(eq + 1);
+    if (name == "data") {
+      options->dataPath = value;
+    } else if (name == "keystrokes") {
+      options->keystrokes = std::stoull(value);
+    } else if (name == "samples") {
+      options->samples = std::max<uint64_t>(1, std::stoull(value));
+    } else if (name == "seed") {
+      options->seed = static_cast<uint32_t>(std::stoul(value));
+    } else if (name == "max-rss-growth-kb") {
+      options->maxRssGrowthKb = std::stoll(value);
+    } else if (name == "max-live-alloc-growth") {
+      options->maxLiveAllocationGrowth = std::stoll(value);
+    } else if (name == "max-override-model-size") {
+      options->maxUserOverrideModelSize = std::stoull(value);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int RunSoakTest(int argc, char* argv[]) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    fprintf(stderr,
+            "usage: %s [--data=PATH] [--keystrokes=N] [--samples=N] "
+            "[--seed=N] [--max-rss-growth-kb=N] [--max-live-alloc-growth=N] "
+            "[--max-override-model-size=N]\n",
+            argv[0]);
+    return 2;
+  }
+
+  auto lm = std::make_shared<McBopomofoLM>();
+  lm->loadLanguageModel(options.dataPath.c_str());
+  if (!lm->isDataModelLoaded()) {
+    fprintf(stderr, "failed to load the language model: %s\n",
+            options.dataPath.c_str());
+    return 2;
+  }
+
+  SoakDriver driver(lm, options.seed);
+  uint64_t interval =
+      std::max<uint64_t>(1, options.keystrokes / options.samples);
+  uint64_t keystrokes = 0;
+  uint64_t nextSample = interval;
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<Sample> samples;
+  while (keystrokes < options.keystrokes) {
+    keystrokes += driver.step();
+    if (keystrokes >= nextSample) {
+      samples.push_back(TakeSample(keystrokes, driver.handler()));
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      PrintSample(samples.back(), elapsed.count());
+      nextSample += interval;
+    }
+  }
+
+  if (samples.size() < 2) {
+    printf("not enough samples to evaluate growth\n");
+    return 0;
+  }
+
+  // The first sample is the warm-up baseline: by then the LM pages touched by
+  // the typing vocabulary are resident and the override model is populated.
+  const Sample& baseline = samples.front();
+  int64_t maxRssGrowthKb = 0;
+  int64_t maxLiveAllocationGrowth = 0;
+  size_t maxUserOverrideModelSize = 0;
+  for (const Sample& sample : samples) {
+    maxUserOverrideModelSize =
+        std::max(maxUserOverrideModelSize, sample.userOverrideModelSize);
+    maxRssGrowthKb = std::max(maxRssGrowthKb, sample.rssKb - baseline.rssKb);
+    maxLiveAllocationGrowth =
+        std::max(maxLiveAllocationGrowth,
+                 sample.liveAllocations - baseline.liveAllocations);
+  }
+
+  printf("rss growth: %lld KB (bound %lld KB), live allocation growth: %lld "
+         "(bound %lld)\n",
+         static_cast<long long>(maxRssGrowthKb),
+         static_cast<long long>(options.maxRssGrowthKb),
+         static_cast<long long>(maxLiveAllocationGrowth),
+         static_cast<long long>(options.maxLiveAllocationGrowth));
+
+  bool passed = true;
+  if (maxRssGrowthKb > options.maxRssGrowthKb) {
+    printf("FAILED: resident set size grew beyond the bound\n");
+    passed = false;
+  }
+  if (maxLiveAllocationGrowth > options.maxLiveAllocationGrowth) {
+    printf("FAILED: live allocations grew beyond the bound\n");
+    passed = false;
+  }
+  if (maxUserOverrideModelSize > options.maxUserOverrideModelSize) {
+    printf("FAILED: user override model grew beyond the bound\n");
+    passed = false;
+  }
+  if (passed) {
+    printf("PASSED\n");
+  }
+  return passed ? 0 : 1;
+}
+
+}  // namespace McBopomofo
+
+int main(int argc, char* argv[]) {
+  return McBopomofo::RunSoakTest(argc, argv);
+}
@@ -21,9 +21,14 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 // OTHER DEALINGS IN THE SOFTWARE.
 
+#include <algorithm>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "KeyHandler.h"
+#include "McBopomofoLM.h"
+#include "TestSupport.h"
 #include "gtest/gtest.h"
 
 namespace McBopomofo {
@@ -37,7 +42,7 @@ TEST(KeyHandlerTest, Trivial) {
   auto emptyState = std::make_unique<InputStates::Empty>();
 
   bool handled = handler.handle(
-      fcitx::Key(), emptyState.get(),
+      Key(), emptyState.get(),
       [&stateCallbackInvoked](std::unique_ptr<McBopomofo::InputState>) {
         stateCallbackInvoked = true;
       },
@@ -48,4 +53,343 @@ TEST(KeyHandlerTest, Trivial) {
   EXPECT_FALSE(handled);
 }
 
+TEST(KeyHandlerTest, ShowsUserOverrideSuggestionRightAway) {
+  auto lm = std::make_shared<TestLanguageModel>();
+  lm->add("ㄋㄧˇ", "你", -2.0);
+  lm->add("ㄋㄧˇ", "妳", -3.0);
+  KeyHandler handler(lm, nullptr);
+  handler.setKeyboardLayout(
+      Formosa::Mandarin::BopomofoKeyboardLayout::StandardLayout());
+
+  std::unique_ptr<InputState> state = std::make_unique<InputStates::Empty>();
+  auto stateCallback = [&state](std::unique_ptr<InputState> newState) {
+    state = std::move(newState);
+  };
+  auto errorCallback = []() {};
+  auto type = [&](const std::string& keys) {
+    for (char c : keys) {
+      handler.handle(Key::asciiKey(c), state.get(), stateCallback,
+                     errorCallback);
+    }
+  };
+  auto composingBuffer = [&]() {
+    auto inputting = dynamic_cast<InputStates::Inputting*>(state.get());
+    return inputting != nullptr ? inputting->composingBuffer : "";
+  };
+
+  type("su3");
+  EXPECT_EQ(composingBuffer(), "你");
+  handler.candidateSelected("妳", stateCallback);
+  EXPECT_EQ(composingBuffer(), "妳");
+  handler.handle(Key::namedKey(Key::Name::kReturn), state.get(),
+                 stateCallback, errorCallback);
+  ASSERT_NE(dynamic_cast<InputStates::Committing*>(state.get()), nullptr);
+  handler.reset();
+
+  // The observed choice is suggested as the reading is typed again, and shown
+  // without waiting for another key.
+  state = std::make_unique<InputStates::Empty>();
+  type("su3");
+  EXPECT_EQ(composingBuffer(), "妳");
+}
+
+TEST(KeyHandlerTest, DropsWarmedUpKeysAfterUse) {
+  ScopedTempFile languageModel(MakeSortedDatabase({
+      {"ㄋㄧˇ", "你", "-2"},
+      {"ㄋㄧˊ", "泥", "-3"},
+  }));
+  auto lm = std::make_shared<McBopomofoLM>();
+  lm->loadLanguageModel(languageModel.path().c_str());
+  KeyHandler handler(lm, nullptr);
+  handler.setKeyboardLayout(
+      Formosa::Mandarin::BopomofoKeyboardLayout::StandardLayout());
+  handler.setSpeculativeWarmUp(true);
+
+  std::unique_ptr<InputState> state = std::make_unique<InputStates::Empty>();
+  auto stateCallback = [&state](std::unique_ptr<InputState> newState) {
+    state = std::move(newState);
+  };
+  auto errorCallback = []() {};
+  auto type = [&](const std::string& keys) {
+    for (char c : keys) {
+      handler.handle(Key::asciiKey(c), state.get(), stateCallback,
+                     errorCallback);
+    }
+  };
+
+  // Each tone of ㄋㄧ is looked up once.
+  type("su");
+  ASSERT_TRUE(handler.hasPendingWarmUp());
+  uint64_t searches = lm->languageModelSearchCount();
+  handler.warmUp();
+  EXPECT_EQ(lm->warmedUpKeyCount(), 5);
+  EXPECT_EQ(lm->languageModelSearchCount() - searches, 5);
+
+  type("3");
+  EXPECT_GT(lm->warmUpHitCount(), 0);
+  EXPECT_EQ(lm->warmUpWasteCount(), 0);
+
+  // The next key drops the ones not asked for, and the lookups search again.
+  uint64_t hits = lm->warmUpHitCount();
+  type("s");
+  EXPECT_EQ(lm->warmUpWasteCount(), 5 - hits);
+  searches = lm->languageModelSearchCount();
+  EXPECT_TRUE(lm->hasUnigramsForKey("ㄋㄧˊ"));
+  EXPECT_EQ(lm->languageModelSearchCount() - searches, 1);
+  EXPECT_EQ(lm->warmUpHitCount(), hits);
+}
+
+TEST(KeyHandlerTest, ListsPhraseCompletionsForCursorAfterItMoves) {
+  ScopedTempFile languageModel(MakeSortedDatabase({
+      {"ㄋㄧˇ", "你", "-2"},
+      {"ㄏㄠˇ", "好", "-2"},
+      {"ㄋㄧˇ-ㄏㄠˇ", "你好", "-3"},
+  }));
+  auto lm = std::make_shared<McBopomofoLM>();
+  lm->loadLanguageModel(languageModel.path().c_str());
+  lm->setPhraseCompletionEnabled(true);
+  KeyHandler handler(lm, nullptr);
+  handler.setKeyboardLayout(
+      Formosa::Mandarin::BopomofoKeyboardLayout::StandardLayout());
+  handler.setPhraseCompletion(true);
+
+  std::unique_ptr<InputState> state = std::make_unique<InputStates::Empty>();
+  auto stateCallback = [&state](std::unique_ptr<InputState> newState) {
+    state = std::move(newState);
+  };
+  auto errorCallback = []() {};
+  auto handle = [&](Key key) {
+    handler.handle(key, state.get(), stateCallback, errorCallback);
+  };
+  auto candidates = [&]() {
+    auto choosing = dynamic_cast<InputStates::ChoosingCandidate*>(state.get());
+    return choosing != nullptr ? choosing->candidates
+                               : std::vector<std::string>();
+  };
+  auto lists = [](const std::vector<std::string>& values,
+                  const std::string& value) {
+    return std::find(values.begin(), values.end(), value) != values.end();
+  };
+
+  for (char c : std::string("su3 ")) {
+    handle(Key::asciiKey(c));
+  }
+  EXPECT_TRUE(lists(candidates(), "你好"));
+  handler.candidatePanelCancelled(stateCallback);
+
+  // Before the reading, the candidates are still those of ㄋㄧˇ, but there is
+  // nothing to complete.
+  handle(Key::namedKey(Key::Name::kHome));
+  handle(Key::asciiKey(' '));
+  EXPECT_TRUE(lists(candidates(), "你"));
+  EXPECT_FALSE(lists(candidates(), "你好"));
+  handler.candidatePanelCancelled(stateCallback);
+
+  // After the reading again, the completion is listed and completes in place.
+  handle(Key::namedKey(Key::Name::kEnd));
+  handle(Key::asciiKey(' '));
+  ASSERT_TRUE(lists(candidates(), "你好"));
+  handler.candidateSelected("你好", stateCallback);
+  auto inputting = dynamic_cast<InputStates::Inputting*>(state.get());
+  ASSERT_NE(inputting, nullptr);
+  EXPECT_EQ(inputting->composingBuffer, "你好");
+}
+
+TEST(KeyHandlerTest, KeepsPinyinLettersWithComposition) {
+  auto lm = std::make_shared<TestLanguageModel>();
+  lm->add("ㄋㄧˇ", "你", -2.0);
+  lm->add("ㄏㄠˇ", "好", -2.0);
+  KeyHandler handler(lm, nullptr);
+  handler.setKeyboardLayout(
+      Formosa::Mandarin::BopomofoKeyboardLayout::HanyuPinyinLayout());
+  handler.setContinuousPinyin(true);
+
+  std::unique_ptr<InputState> state = std::make_unique<InputStates::Empty>();
+  auto stateCallback = [&state](std::unique_ptr<InputState> newState) {
+    state = std::move(newState);
+  };
+  auto errorCallback = []() {};
+  for (char c : std::string("ni3 ha")) {
+    Key key = c == ' ' ? Key::namedKey(Key::Name::kSpace) : Key::asciiKey(c);
+    handler.handle(key, state.get(), stateCallback, errorCallback);
+  }
+  auto inputting = dynamic_cast<InputStates::Inputting*>(state.get());
+  ASSERT_NE(inputting, nullptr);
+  std::string shown = inputting->composingBuffer;
+
+  // The letters not converted yet are kept, and typed on after the restore.
+  KeyHandler::Composition composition = handler.composition();
+  EXPECT_EQ(composition.pinyinInput, "ha");
+  size_t size = composition.estimatedSize();
+  handler.reset();
+  handler.restoreComposition(std::move(composition), stateCallback);
+  inputting = dynamic_cast<InputStates::Inputting*>(state.get());
+  ASSERT_NE(inputting, nullptr);
+  EXPECT_EQ(inputting->composingBuffer, shown);
+
+  for (char c : std::string("o ")) {
+    Key key = c == ' ' ? Key::namedKey(Key::Name::kSpace) : Key::asciiKey(c);
+    handler.handle(key, state.get(), stateCallback, errorCallback);
+  }
+  inputting = dynamic_cast<InputStates::Inputting*>(state.get());
+  ASSERT_NE(inputting, nullptr);
+  EXPECT_EQ(inputting->composingBuffer, "你好");
+
+  // Each reading adds to the estimated size.
+  EXPECT_GT(handler.composition().estimatedSize(), size);
+}
+
+class KeyHandlerUndoTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    lm_ = std::make_shared<TestLanguageModel>();
+    lm_->add("ㄋㄧˇ", "你", -2.0);
+    lm_->add("ㄋㄧˇ", "妳", -3.0);
+    lm_->add("ㄏㄠˇ", "好", -2.0);
+    handler_ = std::make_unique<KeyHandler>(lm_, nullptr);
+    handler_->setKeyboardLayout(
+        Formosa::Mandarin::BopomofoKeyboardLayout::StandardLayout());
+    state_ = std::make_unique<InputStates::Empty>();
+  }
+
+  void handle(Key key) {
+    handler_->handle(key, state_.get(), stateCallback(),
+                     [this]() { errors_++; });
+  }
+
+  void type(const std::string& keys) {
+    for (char c : keys) {
+      handle(Key::asciiKey(c));
+    }
+  }
+
+  void undo() { handle(Key::asciiKey('z', false, true)); }
+  void redo() { handle(Key::asciiKey('y', false, true)); }
+  void shiftRedo() { handle(Key::asciiKey('Z', true, true)); }
+
+  std::string composingBuffer() {
+    auto inputting = dynamic_cast<InputStates::Inputting*>(state_.get());
+    return inputting != nullptr ? inputting->composingBuffer : "";
+  }
+
+  KeyHandler::StateCallback stateCallback() {
+    return [this](std::unique_ptr<InputState> newState) {
+      state_ = std::move(newState);
+    };
+  }
+
+  std::shared_ptr<TestLanguageModel> lm_;
+  std::unique_ptr<KeyHandler> handler_;
+  std::unique_ptr<InputState> state_;
+  int errors_ = 0;
+};
+
+TEST_F(KeyHandlerUndoTest, UndoesCandidatePickAndBackspace) {
+  type("su3");
+  handler_->candidateSelected("妳", stateCallback());
+  type("cl3");
+  EXPECT_EQ(composingBuffer(), "妳好");
+  handle(Key::namedKey(Key::Name::kBackSpace));
+  EXPECT_EQ(composingBuffer(), "妳");
+
+  // The picked candidate is still fixed after the grid is restored, or the
+  // walk would prefer 你.
+  undo();
+  EXPECT_EQ(composingBuffer(), "妳好");
+  undo();
+  EXPECT_EQ(composingBuffer(), "妳");
+  undo();
+  EXPECT_EQ(composingBuffer(), "你");
+  EXPECT_EQ(errors_, 0);
+
+  // Undone to before the first reading, the composition is gone.
+  undo();
+  EXPECT_NE(dynamic_cast<InputStates::EmptyIgnoringPrevious*>(state_.get()),
+            nullptr);
+}
+
+TEST_F(KeyHandlerUndoTest, RedoesWithEitherKey) {
+  type("su3");
+  handler_->candidateSelected("妳", stateCallback());
+  type("cl3");
+  undo();
+  undo();
+  EXPECT_EQ(composingBuffer(), "你");
+
+  redo();
+  EXPECT_EQ(composingBuffer(), "妳");
+  shiftRedo();
+  EXPECT_EQ(composingBuffer(), "妳好");
+  EXPECT_EQ(errors_, 0);
+
+  // Nothing left to redo.
+  redo();
+  EXPECT_EQ(errors_, 1);
+  EXPECT_EQ(composingBuffer(), "妳好");
+}
+
+TEST_F(KeyHandlerUndoTest, NewEditClearsRedo) {
+  type("su3cl3");
+  undo();
+  EXPECT_EQ(composingBuffer(), "你");
+  type("su3");
+  EXPECT_EQ(composingBuffer(), "你你");
+
+  redo();
+  EXPECT_EQ(errors_, 1);
+  EXPECT_EQ(composingBuffer(), "你你");
+  undo();
+  EXPECT_EQ(composingBuffer(), "你");
+}
+
+TEST_F(KeyHandlerUndoTest, EvictionClearsHistory) {
+  handler_->setComposingBufferSize(2);
+  type("su3su3");
+  undo();
+  EXPECT_EQ(composingBuffer(), "你");
+  redo();
+  EXPECT_EQ(errors_, 0);
+
+  // The evicted text is committed, so it cannot be undone.
+  type("cl3");
+  auto inputting = dynamic_cast<InputStates::Inputting*>(state_.get());
+  ASSERT_NE(inputting, nullptr);
+  EXPECT_EQ(inputting->evictedText, "你");
+  EXPECT_EQ(composingBuffer(), "你好");
+  undo();
+  EXPECT_EQ(errors_, 1);
+  EXPECT_EQ(composingBuffer(), "你好");
+}
+
+TEST_F(KeyHandlerUndoTest, ConvergedEvictionClearsHistory) {
+  handler_->setComposingBufferSize(100);
+  handler_->setCommitConvergedText(true);
+  std::string evictedText;
+  for (int i = 0; i < 12; i++) {
+    type("su3");
+    auto inputting = dynamic_cast<InputStates::Inputting*>(state_.get());
+    ASSERT_NE(inputting, nullptr);
+    evictedText += inputting->evictedText;
+  }
+  ASSERT_FALSE(evictedText.empty());
+  undo();
+  EXPECT_EQ(errors_, 1);
+}
+
+TEST_F(KeyHandlerUndoTest, KeepsFiftySteps) {
+  handler_->setComposingBufferSize(100);
+  for (int i = 0; i < 60; i++) {
+    type("su3");
+  }
+  for (int i = 0; i < 50; i++) {
+    undo();
+  }
+  EXPECT_EQ(errors_, 0);
+  EXPECT_EQ(composingBuffer().size(), 10 * std::string("你").size());
+
+  undo();
+  EXPECT_EQ(errors_, 1);
+  EXPECT_EQ(composingBuffer().size(), 10 * std::string("你").size());
+}
+
 }  // namespace McBopomofo
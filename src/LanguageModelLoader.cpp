@@ -34,19 +34,29 @@
 namespace McBopomofo {
 
 constexpr char kDataPath[] = "data/mcbopomofo-data.txt";
+// The built-in language model of a profile is kProfileDataPathPrefix +
+// profile + ".txt".
+constexpr char kProfileDataPathPrefix[] = "data/mcbopomofo-data-";
+constexpr char kSymbolTablePath[] = "data/mcbopomofo-symbols.txt";
 constexpr char kUserPhraseFilename[] = "data.txt";  // same as macOS version
 constexpr char kExcludedPhraseFilename[] = "exclude-phrases.txt";  // ditto
 
 LanguageModelLoader::LanguageModelLoader()
-    : lm_(std::make_shared<McBopomofoLM>()) {
-  std::string buildInLMPath = fcitx::StandardPath::global().locate(
-      fcitx::StandardPath::Type::PkgData, kDataPath);
+    : lm_(std::make_shared<McBopomofoLM>()),
+      symbolTable_(std::make_shared<SymbolTable>()) {
+  std::string buildInLMPath = builtInLMPath(profile_);
   FCITX_MCBOPOMOFO_INFO() << "Built-in LM: " << buildInLMPath;
   lm_->loadLanguageModel(buildInLMPath.c_str());
   if (!lm_->isDataModelLoaded()) {
     FCITX_MCBOPOMOFO_INFO() << "Failed to open built-in LM";
   }
 
+  std::string symbolTablePath = fcitx::StandardPath::global().locate(
+      fcitx::StandardPath::Type::PkgData, kSymbolTablePath);
+  if (!symbolTable_->open(symbolTablePath.c_str())) {
+    FCITX_MCBOPOMOFO_INFO() << "Failed to open symbol table";
+  }
+
   std::string userDataPath = fcitx::StandardPath::global().userDirectory(
       fcitx::StandardPath::Type::PkgData);
 
@@ -75,6 +85,47 @@ LanguageModelLoader::LanguageModelLoader()
   reloadUserModelsIfNeeded();
 }
 
+std::string LanguageModelLoader::builtInLMPath(const std::string& profile) {
+  std::string path =
+      profile.empty() ? kDataPath : kProfileDataPathPrefix + profile + ".txt";
+  return fcitx::StandardPath::global().locate(
+      fcitx::StandardPath::Type::PkgData, path);
+}
+
+void LanguageModelLoader::loadProfile(const std::string& profile) {
+  if (profile == profile_) {
+    return;
+  }
+
+  std::string newProfile = profile;
+  std::string path = builtInLMPath(newProfile);
+  if (path.empty() && !newProfile.empty()) {
+    FCITX_MCBOPOMOFO_WARN() << "No built-in LM for profile: " << profile;
+    newProfile.clear();
+    if (newProfile == profile_) {
+      return;
+    }
+    path = builtInLMPath(newProfile);
+  }
+
+  auto lm = std::make_shared<McBopomofoLM>();
+  lm->loadLanguageModel(path.c_str());
+  if (!lm->isDataModelLoaded()) {
+    FCITX_MCBOPOMOFO_WARN() << "Failed to open built-in LM: " << path;
+    return;
+  }
+  FCITX_MCBOPOMOFO_INFO() << "Built-in LM: " << path;
+
+  // The new language model is published with the user phrases loaded, and
+  // the holders of the previous one keep using it until they let it go.
+  lm->setPhraseCompletionEnabled(lm_->phraseCompletionEnabled());
+  lm_ = lm;
+  profile_ = newProfile;
+  userPhrasesTimestamp_ = {};
+  excludedPhrasesTimestamp_ = {};
+  reloadUserModelsIfNeeded();
+}
+
 void LanguageModelLoader::addUserPhrase(const std::string_view& reading,
                                         const std::string_view& phrase) {
   if (userPhrasesPath_.empty() || !std::filesystem::exists(userPhrasesPath_)) {
@@ -123,6 +174,7 @@ void LanguageModelLoader::reloadUserModelsIfNeeded() {
 
   if (shouldReload) {
     lm_->loadUserPhrases(userPhrasesPathPtr, excludedPhrasesPathPtr);
+    userModelReloadCount_++;
   }
 }
 
@@ -24,38 +24,65 @@
 #ifndef SRC_LANGUAGEMODELLOADER_H_
 #define SRC_LANGUAGEMODELLOADER_H_
 
+#include <cstdint>
 #include <filesystem>
 #include <memory>
 #include <string>
 #include <string_view>
 
 #include "McBopomofoLM.h"
+#include "SymbolTable.h"
+#include "UserPhraseAdder.h"
 
 namespace McBopomofo {
 
-class LanguageModelLoader {
+class LanguageModelLoader : public UserPhraseAdder {
  public:
   LanguageModelLoader();
 
+  // Returns the current language model. A profile switch replaces it with a
+  // new one, while the one returned before stays valid for its holders.
   std::shared_ptr<McBopomofoLM> getLM() { return lm_; }
 
+  // Switches to the built-in language model of the profile, "" being the
+  // default one, by publishing a new language model that also has the user
+  // phrases. Falls back to the default profile if the profile has no data.
+  // Does nothing if the profile is the current one.
+  void loadProfile(const std::string& profile);
+
   void addUserPhrase(const std::string_view& reading,
-                     const std::string_view& phrase);
+                     const std::string_view& phrase) override;
 
   void reloadUserModelsIfNeeded();
 
+  // The number of times the user models have been reloaded.
+  uint64_t userModelReloadCount() const { return userModelReloadCount_; }
+
   std::string userPhrasesPath() { return userPhrasesPath_; }
 
   std::string excludedPhrasesPath() { return excludedPhrasesPath_; };
 
+  // The built-in symbol table of the symbol picker. It is not loaded if the
+  // file is missing or rejected.
+  std::shared_ptr<const SymbolTable> symbolTable() const {
+    return symbolTable_;
+  }
+
  private:
   void populateUserDataFilesIfNeeded();
 
+  // Returns the path of the built-in language model of the profile, or an
+  // empty string if there is none.
+  static std::string builtInLMPath(const std::string& profile);
+
   std::shared_ptr<McBopomofoLM> lm_;
+  std::shared_ptr<SymbolTable> symbolTable_;
+  std::string profile_;
   std::string userPhrasesPath_;
   std::filesystem::file_time_type userPhrasesTimestamp_;
   std::string excludedPhrasesPath_;
   std::filesystem::file_time_type excludedPhrasesTimestamp_;
+  uint64_t userModelReloadCount_ = 0;
 };
 
 }  // namespace McBopomofo
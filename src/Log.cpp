@@ -24,3 +24,45 @@
 #include "Log.h"
 
 FCITX_DEFINE_LOG_CATEGORY(mcbopomofo_log, "mcbopomofo");
+
+namespace McBopomofo {
+
+namespace {
+
+fcitx::LogLevel ToFcitxLogLevel(LogLevel level) {
+  switch (level) {
+    case LogLevel::Debug:
+      return fcitx::LogLevel::Debug;
+    case LogLevel::Info:
+      return fcitx::LogLevel::Info;
+    case LogLevel::Warn:
+      return fcitx::LogLevel::Warn;
+    case LogLevel::Error:
+      return fcitx::LogLevel::Error;
+  }
+  return fcitx::LogLevel::Info;
+}
+
+}  // namespace
+
+void InstallFcitxLogWriter() {
+  AsyncLog& log = AsyncLog::shared();
+  log.setWriter([](LogLevel level, const char* file, int line,
+                   const std::string& message) {
+    fcitx::LogMessageBuilder(fcitx::Log::logStream(), ToFcitxLogLevel(level),
+                             file, line)
+            .self()
+        << message;
+  });
+
+  // For the code below src/Engine, which logs without the Fcitx category.
+  LogLevel level = LogLevel::Error;
+  for (LogLevel l : {LogLevel::Warn, LogLevel::Info, LogLevel::Debug}) {
+    if (mcbopomofo_log().checkLogLevel(ToFcitxLogLevel(l))) {
+      level = l;
+    }
+  }
+  log.setLevel(level);
+}
+
+}  // namespace McBopomofo
@@ -26,9 +26,26 @@
 
 #include <fcitx-utils/log.h>
 
+#include "AsyncLog.h"
+
 FCITX_DECLARE_LOG_CATEGORY(mcbopomofo_log);
 
-#define FCITX_MCBOPOMOFO_WARN() FCITX_LOGC(::mcbopomofo_log, Warn)
-#define FCITX_MCBOPOMOFO_INFO() FCITX_LOGC(::mcbopomofo_log, Info)
+// Messages go through the asynchronous sink to the Fcitx log. The level is
+// checked against the log category before the message is formatted.
+#define FCITX_MCBOPOMOFO_LOG(level)                     \
+  MCBOPOMOFO_ASYNC_LOG(::McBopomofo::LogLevel::level,   \
+                       ::mcbopomofo_log().checkLogLevel( \
+                           ::fcitx::LogLevel::level))
+
+#define FCITX_MCBOPOMOFO_WARN() FCITX_MCBOPOMOFO_LOG(Warn)
+#define FCITX_MCBOPOMOFO_INFO() FCITX_MCBOPOMOFO_LOG(Info)
+
+namespace McBopomofo {
+
+// Makes the asynchronous sink write to the Fcitx log, at the level of the
+// log category.
+void InstallFcitxLogWriter();
+
+}  // namespace McBopomofo
 
 #endif
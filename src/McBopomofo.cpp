@@ -23,10 +23,15 @@
 
 #include "McBopomofo.h"
 
+#ifdef MCBOPOMOFO_ENABLE_DBUS
+#include <fcitx-module/dbus/dbus_public.h>
+#include <fcitx-utils/dbus/bus.h>
+#endif
 #include <fcitx-utils/standardpath.h>
 #include <fcitx/candidatelist.h>
 #include <fcitx/event.h>
 #include <fcitx/inputcontext.h>
+#include <fcitx/inputcontextmanager.h>
 #include <fcitx/inputpanel.h>
 #include <fcitx/userinterfacemanager.h>
 
@@ -34,6 +39,7 @@
 #include <utility>
 #include <vector>
 
+#include "FcitxAdapter.h"
 #include "Log.h"
 
 namespace McBopomofo {
@@ -66,9 +72,15 @@ class DisplayOnlyCandidateWord : public fcitx::CandidateWord {
 
 McBopomofoEngine::McBopomofoEngine(fcitx::Instance* instance)
     : instance_(instance) {
+  InstallFcitxLogWriter();
+
   languageModelLoader_ = std::make_shared<LanguageModelLoader>();
-  keyHandler_ = std::make_unique<KeyHandler>(languageModelLoader_->getLM(),
-                                             languageModelLoader_);
+  keyHandler_ = std::make_unique<KeyHandler>(
+      languageModelLoader_->getLM(), languageModelLoader_,
+      std::make_unique<FcitxLocalizedStrings>());
+  keyHandler_->setMetrics(&metrics_);
+  keyHandler_->setSpeculativeWarmUp(true);
+  keyHandler_->setSymbolTable(languageModelLoader_->symbolTable());
   state_ = std::make_unique<InputStates::Empty>();
   stateCommittedTimestampMicroseconds_ = GetEpochNowInMicroseconds();
 
@@ -93,10 +105,52 @@ McBopomofoEngine::McBopomofoEngine(fcitx::Instance* instance)
   instance_->userInterfaceManager().registerAction(
       "mcbopomofo-user-excluded-phrases-edit", excludedPhreasesAction_.get());
 
+  instance_->inputContextManager().registerProperty(
+      "mcbopomofoState", &inputContextPropertyFactory_);
+
+  dispatcher_.attach(&instance_->eventLoop());
+
+#ifdef MCBOPOMOFO_ENABLE_DBUS
+  if (auto* dbusAddon = dbus()) {
+    auto* bus = dbusAddon->call<fcitx::IDBusModule::bus>();
+    metricsService_ = std::make_unique<McBopomofoMetricsService>(this);
+    if (!bus->addObjectVTable("/mcbopomofo", "org.fcitx.Fcitx.McBopomofo1",
+                              *metricsService_)) {
+      FCITX_MCBOPOMOFO_WARN() << "failed to register /mcbopomofo on DBus, "
+                              << "metrics will not be available";
+    }
+  }
+#endif
+
   // Required by convention of fcitx5 modules to load config on its own.
   reloadConfig();
 }
 
+McBopomofoEngine::~McBopomofoEngine() {
+  // Write out the messages still queued before the module goes away.
+  AsyncLog::shared().flush();
+}
+
+std::string McBopomofoEngine::dumpMetrics() {
+  return metrics_.dump(
+      {{"lm_unigram_lookups",
+        languageModelLoader_->getLM()->unigramLookupCount()},
+       {"lm_searches",
+        languageModelLoader_->getLM()->languageModelSearchCount()},
+       {"lm_warm_up_keys",
+        languageModelLoader_->getLM()->warmedUpKeyCount()},
+       {"lm_warm_up_hits", languageModelLoader_->getLM()->warmUpHitCount()},
+       {"lm_warm_up_waste",
+        languageModelLoader_->getLM()->warmUpWasteCount()},
+       {"user_model_reloads", languageModelLoader_->userModelReloadCount()}});
+}
+
+#ifdef MCBOPOMOFO_ENABLE_DBUS
+std::string McBopomofoMetricsService::dumpMetrics() {
+  return engine_->dumpMetrics();
+}
+#endif
+
 const fcitx::Configuration* McBopomofoEngine::getConfig() const {
   return &config_;
 }
@@ -155,7 +209,40 @@ void McBopomofoEngine::activate(const fcitx::InputMethodEntry&,
   keyHandler_->setMoveCursorAfterSelection(
       config_.moveCursorAfterSelection.value());
 
+  keyHandler_->setInstantPreview(config_.instantPreview.value());
+
+  keyHandler_->setContinuousPinyin(config_.continuousPinyin.value());
+
+  // A composition in progress keeps the language model it was started with.
+  languageModelLoader_->loadProfile(config_.languageModelProfile.value());
+  keyHandler_->setLanguageModel(languageModelLoader_->getLM());
+
+  languageModelLoader_->getLM()->setPhraseCompletionEnabled(
+      config_.phraseCompletion.value());
+  keyHandler_->setPhraseCompletion(config_.phraseCompletion.value());
+
+  keyHandler_->setReadingCorrection(config_.readingCorrection.value());
+
+  keyHandler_->setComposingBufferSize(
+      static_cast<size_t>(config_.composingBufferSize.value()));
+  keyHandler_->setCommitConvergedText(config_.commitConvergedText.value());
+
+  if (config_.backgroundWalk.value()) {
+    if (backgroundWalker_ == nullptr) {
+      // The walker notifies on its own thread; hand over to the main thread.
+      backgroundWalker_ = std::make_unique<BackgroundWalker>([this]() {
+        dispatcher_.schedule([this]() { onBackgroundWalkFinished(); });
+      });
+    }
+    keyHandler_->setBackgroundWalker(backgroundWalker_.get());
+  } else {
+    keyHandler_->setBackgroundWalker(nullptr);
+    backgroundWalker_.reset();
+  }
+
   languageModelLoader_->reloadUserModelsIfNeeded();
+
+  restoreKeptComposition(inputContext);
 }
 
 void McBopomofoEngine::reset(const fcitx::InputMethodEntry&,
@@ -182,10 +269,101 @@ void McBopomofoEngine::reset(const fcitx::InputMethodEntry&,
     }
   }
 
+  refinementEvent_.reset();
+  warmUpEvent_.reset();
+
+  if (isFocusOutEvent && config_.keepCompositionOnFocusOut.value() &&
+      dynamic_cast<InputStates::NotEmpty*>(state_.get()) != nullptr &&
+      keyHandler_->hasComposition()) {
+    keyHandler_->flushPendingReadings(
+        [this, &event](std::unique_ptr<InputState> next) {
+          enterNewState(event.inputContext(), std::move(next));
+        },
+        /*walkInBackground=*/false);
+    keepComposition(event.inputContext());
+    keyHandler_->reset();
+    // Clear the preedit without committing the composing buffer.
+    enterNewState(event.inputContext(),
+                  std::make_unique<InputStates::EmptyIgnoringPrevious>());
+    return;
+  }
+
   keyHandler_->reset();
   enterNewState(event.inputContext(), std::make_unique<InputStates::Empty>());
 }
 
+void McBopomofoEngine::keepComposition(fcitx::InputContext* context) {
+  auto* property = context->propertyFor(&inputContextPropertyFactory_);
+  property->keptComposition =
+      std::make_unique<KeyHandler::Composition>(keyHandler_->composition());
+
+  // Move the context to the back of the list, and drop the references to
+  // destroyed contexts, whose properties are gone with them.
+  keptCompositionContexts_.remove_if(
+      [context](const fcitx::TrackableObjectReference<fcitx::InputContext>&
+                    reference) {
+        return !reference.isValid() || reference.get() == context;
+      });
+  keptCompositionContexts_.push_back(context->watch());
+
+  // Drop the least recently kept compositions while all of them are estimated
+  // to take more than the memory allowed.
+  size_t keptSize = 0;
+  for (const auto& reference : keptCompositionContexts_) {
+    const auto& kept = reference.get()
+                           ->propertyFor(&inputContextPropertyFactory_)
+                           ->keptComposition;
+    if (kept != nullptr) {
+      keptSize += kept->estimatedSize();
+    }
+  }
+  size_t limit =
+      static_cast<size_t>(config_.keptCompositionsMemory.value()) * 1024;
+  while (keptSize > limit && keptCompositionContexts_.size() > 1) {
+    auto& evicted = keptCompositionContexts_.front()
+                        .get()
+                        ->propertyFor(&inputContextPropertyFactory_)
+                        ->keptComposition;
+    if (evicted != nullptr) {
+      keptSize -= evicted->estimatedSize();
+      FCITX_MCBOPOMOFO_WARN()
+          << "dropping a kept composition of " << evicted->builder.length()
+          << " readings, which was never committed, to stay within "
+          << config_.keptCompositionsMemory.value() << " KiB";
+      evicted.reset();
+    }
+    keptCompositionContexts_.pop_front();
+  }
+}
+
+void McBopomofoEngine::restoreKeptComposition(fcitx::InputContext* context) {
+  auto* property = context->propertyFor(&inputContextPropertyFactory_);
+  if (property->keptComposition == nullptr) {
+    return;
+  }
+
+  // Another input context may still be composing if its focus out was ignored;
+  // see reset(). Keep the composition for later in that case.
+  if (dynamic_cast<InputStates::Empty*>(state_.get()) == nullptr ||
+      keyHandler_->hasComposition()) {
+    return;
+  }
+
+  std::unique_ptr<KeyHandler::Composition> composition =
+      std::move(property->keptComposition);
+  keptCompositionContexts_.remove_if(
+      [context](const fcitx::TrackableObjectReference<fcitx::InputContext>&
+                    reference) {
+        return !reference.isValid() || reference.get() == context;
+      });
+
+  keyHandler_->restoreComposition(
+      std::move(*composition),
+      [this, context](std::unique_ptr<InputState> next) {
+        enterNewState(context, std::move(next));
+      });
+}
+
 void McBopomofoEngine::keyEvent(const fcitx::InputMethodEntry&,
                                 fcitx::KeyEvent& keyEvent) {
   if (!keyEvent.isInputContextEvent()) {
@@ -199,6 +377,11 @@ void McBopomofoEngine::keyEvent(const fcitx::InputMethodEntry&,
   fcitx::InputContext* context = keyEvent.inputContext();
   fcitx::Key key = keyEvent.key();
 
+  // A new key arrived before the pending readings were walked. The key handler
+  // either adds to them or walks them before handling the key.
+  refinementEvent_.reset();
+  warmUpEvent_.reset();
+
   if (dynamic_cast<InputStates::ChoosingCandidate*>(state_.get()) != nullptr) {
     // Absorb all keys when the candidate panel is on.
     keyEvent.filterAndAccept();
@@ -222,7 +405,7 @@ void McBopomofoEngine::keyEvent(const fcitx::InputMethodEntry&,
   }
 
   bool accepted = keyHandler_->handle(
-      key, state_.get(),
+      ConvertFcitxKey(key), state_.get(),
       [this, context](std::unique_ptr<InputState> next) {
         enterNewState(context, std::move(next));
       },
@@ -230,16 +413,72 @@ void McBopomofoEngine::keyEvent(const fcitx::InputMethodEntry&,
         // TODO(unassigned): beep?
       });
 
+  if (keyHandler_->hasPendingReadings()) {
+    scheduleRefinement(context);
+  }
+  if (keyHandler_->hasPendingWarmUp()) {
+    scheduleWarmUp();
+  }
+
   if (accepted) {
     keyEvent.filterAndAccept();
     return;
   }
 }
 
+void McBopomofoEngine::scheduleRefinement(fcitx::InputContext* context) {
+  refinementEvent_ = instance_->eventLoop().addDeferEvent(
+      [this, reference = context->watch()](fcitx::EventSource*) {
+        if (auto* context = reference.get()) {
+          backgroundWalkContext_ = reference;
+          keyHandler_->flushPendingReadings(
+              [this, context](std::unique_ptr<InputState> next) {
+                enterNewState(context, std::move(next));
+              },
+              /*walkInBackground=*/true);
+        }
+        return true;
+      });
+}
+
+void McBopomofoEngine::scheduleWarmUp() {
+  warmUpEvent_ =
+      instance_->eventLoop().addDeferEvent([this](fcitx::EventSource*) {
+        keyHandler_->warmUp();
+        return true;
+      });
+}
+
+void McBopomofoEngine::onBackgroundWalkFinished() {
+  auto* context = backgroundWalkContext_.get();
+  if (context == nullptr ||
+      dynamic_cast<InputStates::Inputting*>(state_.get()) == nullptr) {
+    return;
+  }
+  keyHandler_->applyBackgroundWalk(
+      [this, context](std::unique_ptr<InputState> next) {
+        enterNewState(context, std::move(next));
+      });
+}
+
 void McBopomofoEngine::handleCandidateKeyEvent(
     fcitx::InputContext* context, fcitx::Key key,
     fcitx::CommonCandidateList* candidateList) {
   int idx = key.keyListIndex(selectionKeys_);
+  // In the symbol picker, the selection keys may also type the search, as the
+  // digits of the standard layout do. The keys for readings, and every key
+  // once a search is typed, go to the search, and the candidates are chosen
+  // with Return, which takes the first one on the page, or with the selection
+  // keys while Ctrl is held.
+  if (dynamic_cast<InputStates::SymbolPicking*>(state_.get()) != nullptr) {
+    if (keyHandler_->isSymbolSearchKey(ConvertFcitxKey(key))) {
+      idx = -1;
+    } else if (key.check(FcitxKey_Return) || key.check(FcitxKey_KP_Enter)) {
+      idx = 0;
+    } else if (key.states() == fcitx::KeyStates(fcitx::KeyState::Ctrl)) {
+      idx = fcitx::Key(key.sym()).keyListIndex(selectionKeys_);
+    }
+  }
   if (idx >= 0) {
     if (idx < candidateList->size()) {
 #ifdef USE_LEGACY_FCITX5_API
@@ -263,6 +502,16 @@ void McBopomofoEngine::handleCandidateKeyEvent(
     return;
   }
 
+  // In the symbol picker, the keys that did not select search.
+  if (dynamic_cast<InputStates::SymbolPicking*>(state_.get()) != nullptr &&
+      keyHandler_->handleSymbolSearchKey(
+          ConvertFcitxKey(key),
+          [this, context](std::unique_ptr<InputState> next) {
+            enterNewState(context, std::move(next));
+          })) {
+    return;
+  }
+
   // Space goes to next page or wraps to the first if at the end.
   if (key.check(FcitxKey_space)) {
     if (candidateList->hasNext()) {
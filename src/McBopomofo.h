@@ -27,23 +27,33 @@
 #include <fcitx-config/configuration.h>
 #include <fcitx-config/enum.h>
 #include <fcitx-config/iniparser.h>
+#ifdef MCBOPOMOFO_ENABLE_DBUS
+#include <fcitx-utils/dbus/objectvtable.h>
+#endif
+#include <fcitx-utils/event.h>
+#include <fcitx-utils/eventdispatcher.h>
 #include <fcitx-utils/i18n.h>
 #include <fcitx/action.h>
 #include <fcitx/addonfactory.h>
 #include <fcitx/addonmanager.h>
 #include <fcitx/candidatelist.h>
+#include <fcitx/inputcontext.h>
+#include <fcitx/inputcontextproperty.h>
 #include <fcitx/inputmethodengine.h>
 #include <fcitx/instance.h>
 #include <fcitx/menu.h>
 #include <fcitx/statusarea.h>
 
+#include <list>
 #include <memory>
 #include <string>
 #include <type_traits>
 
+#include "BackgroundWalker.h"
 #include "InputState.h"
 #include "KeyHandler.h"
 #include "LanguageModelLoader.h"
+#include "Metrics.h"
 
 namespace McBopomofo {
 
@@ -93,11 +103,100 @@ FCITX_CONFIGURATION(
     // Move the cursor at the end of the selected candidate phrase.
     fcitx::Option<bool> moveCursorAfterSelection{
         this, "moveCursorAfterSelection", _("Move cursor after selection"),
-        false};);
+        false};
+
+    // Show the most likely character of a reading right away, and update the
+    // rest of the composing buffer when idle.
+    fcitx::Option<bool> instantPreview{this, "InstantPreview",
+                                       _("Show typed characters instantly"),
+                                       false};
+
+    // Keep the composition of an input context when it loses focus, instead
+    // of committing it.
+    fcitx::Option<bool> keepCompositionOnFocusOut{
+        this, "KeepCompositionOnFocusOut",
+        _("Keep composition when switching windows"), false};
+
+    // The memory, in KiB, that the kept compositions may take, estimated
+    // from their readings. The composition kept last is always kept.
+    fcitx::Option<int, fcitx::IntConstrain> keptCompositionsMemory{
+        this, "KeptCompositionsMemory",
+        _("Memory for kept compositions (KiB)"), 4096,
+        fcitx::IntConstrain(256, 65536)};
+
+    // The number of readings composed before the text at the front is
+    // committed.
+    fcitx::Option<int, fcitx::IntConstrain> composingBufferSize{
+        this, "ComposingBufferSize", _("Composing buffer size"), 10,
+        fcitx::IntConstrain(10, 500)};
+
+    // Walk long compositions on a worker thread, so that typing is not held
+    // up by the walk when the composing buffer size is large.
+    fcitx::Option<bool> backgroundWalk{
+        this, "BackgroundWalk", _("Update long compositions in background"),
+        false};
+
+    // With the Hanyu Pinyin layout, segment letters typed without tones or
+    // separators into syllables, converted as a whole with Space.
+    fcitx::Option<bool> continuousPinyin{this, "ContinuousPinyin",
+                                         _("Continuous Hanyu Pinyin input"),
+                                         false};
+
+    // List the phrases that the readings before the cursor begin first among
+    // the candidates.
+    fcitx::Option<bool> phraseCompletion{
+        this, "PhraseCompletion",
+        _("Suggest phrases from their first readings"), false};
+
+    // Correct a reading that was likely typed by hitting a key next to the
+    // intended one.
+    fcitx::Option<bool> readingCorrection{
+        this, "ReadingCorrection", _("Correct keys mistyped for adjacent ones"),
+        false};
+
+    // The built-in language model to use: "" for the default one, or a name
+    // for data/mcbopomofo-data-<name>.txt.
+    fcitx::Option<std::string> languageModelProfile{
+        this, "LanguageModelProfile", _("Language model profile"), ""};
+
+    // Commit the text at the front as soon as readings typed after it can no
+    // longer change it, instead of when the composing buffer overflows.
+    fcitx::Option<bool> commitConvergedText{
+        this, "CommitConvergedText",
+        _("Commit text once later input cannot change it"), false};);
+
+// Per input context state of the engine.
+class McBopomofoInputContextProperty : public fcitx::InputContextProperty {
+ public:
+  // The composition kept when the input context lost focus, if any.
+  std::unique_ptr<KeyHandler::Composition> keptComposition;
+};
+
+class McBopomofoEngine;
+
+#ifdef MCBOPOMOFO_ENABLE_DBUS
+// Exposes the engine's metrics at /mcbopomofo on the Fcitx bus, e.g.:
+//
+//   dbus-send --session --print-reply --dest=org.fcitx.Fcitx5 /mcbopomofo \
+//       org.fcitx.Fcitx.McBopomofo1.DumpMetrics
+class McBopomofoMetricsService
+    : public fcitx::dbus::ObjectVTable<McBopomofoMetricsService> {
+ public:
+  explicit McBopomofoMetricsService(McBopomofoEngine* engine)
+      : engine_(engine) {}
+
+  std::string dumpMetrics();
+
+ private:
+  McBopomofoEngine* engine_;
+  FCITX_OBJECT_VTABLE_METHOD(dumpMetrics, "DumpMetrics", "", "s");
+};
+#endif
 
 class McBopomofoEngine : public fcitx::InputMethodEngine {
  public:
   explicit McBopomofoEngine(fcitx::Instance* instance);
+  ~McBopomofoEngine() override;
   fcitx::Instance* instance() { return instance_; }
 
   void activate(const fcitx::InputMethodEntry& entry,
@@ -107,12 +206,18 @@ class McBopomofoEngine : public fcitx::InputMethodEngine {
   void keyEvent(const fcitx::InputMethodEntry& entry,
                 fcitx::KeyEvent& keyEvent) override;
 
+  // Returns a text dump of the runtime metrics.
+  std::string dumpMetrics();
+
   const fcitx::Configuration* getConfig() const override;
   void setConfig(const fcitx::RawConfig& config) override;
   void reloadConfig() override;
 
  private:
   FCITX_ADDON_DEPENDENCY_LOADER(chttrans, instance_->addonManager());
+#ifdef MCBOPOMOFO_ENABLE_DBUS
+  FCITX_ADDON_DEPENDENCY_LOADER(dbus, instance_->addonManager());
+#endif
   fcitx::Instance* instance_;
 
   void handleCandidateKeyEvent(fcitx::InputContext* context, fcitx::Key key,
@@ -144,9 +249,52 @@ class McBopomofoEngine : public fcitx::InputMethodEngine {
   void updatePreedit(fcitx::InputContext* context,
                      InputStates::NotEmpty* state);
 
+  // Schedules the key handler's pending readings to be walked when the event
+  // loop is idle. The next key event cancels it.
+  void scheduleRefinement(fcitx::InputContext* context);
+
+  // Schedules the key handler to look up the tone variants of the syllable
+  // being composed when the event loop is idle. The next key event cancels it.
+  void scheduleWarmUp();
+
+  // Enters the state refined by the background walk, if it is still current.
+  // Called on the main thread.
+  void onBackgroundWalkFinished();
+
+  // Keeps the current composition in the input context's property, evicting
+  // the least recently kept compositions of other input contexts while the
+  // estimated size of all of them is over the limit.
+  void keepComposition(fcitx::InputContext* context);
+
+  // Restores the composition kept for the input context, if any.
+  void restoreKeptComposition(fcitx::InputContext* context);
+
+  fcitx::LambdaInputContextPropertyFactory<McBopomofoInputContextProperty>
+      inputContextPropertyFactory_{[](fcitx::InputContext&) {
+        return new McBopomofoInputContextProperty();
+      }};
+
+  // Input contexts with kept compositions, least recently kept first.
+  std::list<fcitx::TrackableObjectReference<fcitx::InputContext>>
+      keptCompositionContexts_;
+
+  // Declared before the key handler, which records to it.
+  Metrics metrics_;
+#ifdef MCBOPOMOFO_ENABLE_DBUS
+  std::unique_ptr<McBopomofoMetricsService> metricsService_;
+#endif
+
+  // Declared before the key handler, which refers to the walker, and the walker
+  // before the dispatcher it notifies through.
+  fcitx::EventDispatcher dispatcher_;
+  std::unique_ptr<BackgroundWalker> backgroundWalker_;
+  fcitx::TrackableObjectReference<fcitx::InputContext> backgroundWalkContext_;
+
   std::shared_ptr<LanguageModelLoader> languageModelLoader_;
   std::unique_ptr<KeyHandler> keyHandler_;
   std::unique_ptr<InputState> state_;
+  std::unique_ptr<fcitx::EventSource> refinementEvent_;
+  std::unique_ptr<fcitx::EventSource> warmUpEvent_;
   int64_t stateCommittedTimestampMicroseconds_;
   McBopomofoConfig config_;
   fcitx::KeyList selectionKeys_;
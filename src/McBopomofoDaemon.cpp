@@ -0,0 +1,156 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+// A daemon that serves Bopomofo conversion over a Unix domain socket, so that
+// tools other than the input method can share one loaded language model. See
+// ConversionProtocol.h for the protocol.
+//
+// Usage: mcbopomofo-daemon [--socket=PATH] [--data=PATH]
+//            [--user-phrases=PATH] [--excluded-phrases=PATH] [--workers=N]
+
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "ConversionServer.h"
+#include "McBopomofoLM.h"
+
+#ifndef MCBOPOMOFO_DAEMON_DATA_PATH
+#define MCBOPOMOFO_DAEMON_DATA_PATH "data/data.txt"
+#endif
+
+namespace McBopomofo {
+
+namespace {
+
+struct Options {
+  std::string socketPath;
+  std::string dataPath = MCBOPOMOFO_DAEMON_DATA_PATH;
+  std::string userPhrasesPath;
+  std::string excludedPhrasesPath;
+  size_t workers = std::max(1u, std::thread::hardware_concurrency());
+};
+
+std::string DefaultSocketPath() {
+  const char* runtimeDir = getenv("XDG_RUNTIME_DIR");
+  if (runtimeDir != nullptr && runtimeDir[0] != '\0') {
+    return std::string(runtimeDir) + "/mcbopomofo.sock";
+  }
+  return "/tmp/mcbopomofo-" + std::to_string(getuid()) + ".sock";
+}
+
+bool ParseOptions(int argc, char* argv[], Options* options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+      return false;
+    }
+    std::string name = arg.substr(2, eq - 2);
+    std::string value = arg.substr(eq + 1);
+    if (name == "socket") {
+      options->socketPath = value;
+    } else if (name == "data") {
+      options->dataPath = value;
+    } else if (name == "user-phrases") {
+      options->userPhrasesPath = value;
+    } else if (name == "excluded-phrases") {
+      options->excludedPhrasesPath = value;
+    } else if (name == "workers") {
+      options->workers = std::max<size_t>(1, std::stoull(value));
+    } else {
+      return false;
+    }
+  }
+  if (options->socketPath.empty()) {
+    options->socketPath = DefaultSocketPath();
+  }
+  return true;
+}
+
+}  // namespace
+
+int RunDaemon(int argc, char* argv[]) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    fprintf(stderr,
+            "usage: %s [--socket=PATH] [--data=PATH] [--user-phrases=PATH] "
+            "[--excluded-phrases=PATH] [--workers=N]\n",
+            argv[0]);
+    return 2;
+  }
+
+  auto lm = std::make_shared<McBopomofoLM>();
+  lm->setPhraseReplacementEnabled(false);
+  lm->setExternalConverterEnabled(false);
+  lm->loadLanguageModel(options.dataPath.c_str());
+  if (!lm->isDataModelLoaded()) {
+    fprintf(stderr, "failed to load the language model: %s\n",
+            options.dataPath.c_str());
+    return 1;
+  }
+  if (!options.userPhrasesPath.empty() ||
+      !options.excludedPhrasesPath.empty()) {
+    lm->loadUserPhrases(options.userPhrasesPath.empty()
+                            ? nullptr
+                            : options.userPhrasesPath.c_str(),
+                        options.excludedPhrasesPath.empty()
+                            ? nullptr
+                            : options.excludedPhrasesPath.c_str());
+  }
+
+  // Block the termination signals in all threads, and wait for them here.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  ConversionServer server(lm, options.workers);
+  if (!server.listen(options.socketPath)) {
+    fprintf(stderr, "failed to listen on %s: %s\n",
+            options.socketPath.c_str(), strerror(errno));
+    return 1;
+  }
+  server.start();
+  fprintf(stderr, "listening on %s with %zu workers\n",
+          options.socketPath.c_str(), options.workers);
+
+  int signal;
+  sigwait(&signals, &signal);
+  server.stop();
+  return 0;
+}
+
+}  // namespace McBopomofo
+
+int main(int argc, char* argv[]) { return McBopomofo::RunDaemon(argc, argv); }
@@ -0,0 +1,145 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "Metrics.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+
+namespace McBopomofo {
+
+namespace {
+
+constexpr const char* kCounterNames[] = {
+    "keystrokes",
+    "keystrokes_accepted",
+    "walks",
+    "background_walks_applied",
+    "override_suggestions_applied",
+    "converged_evictions",
+};
+static_assert(std::size(kCounterNames) ==
+              static_cast<size_t>(Metrics::Counter::kCount));
+
+constexpr const char* kHistogramNames[] = {
+    "key_handling_us",
+    "walk_us",
+    "refinement_us",
+};
+static_assert(std::size(kHistogramNames) ==
+              static_cast<size_t>(Metrics::Histogram::kCount));
+
+}  // namespace
+
+size_t LatencyHistogram::BucketIndex(uint64_t value) {
+  if (value < kSubBuckets) {
+    return static_cast<size_t>(value);
+  }
+  // The position of the highest bit, at least kSubBucketBits here.
+  size_t exponent = 63 - static_cast<size_t>(__builtin_clzll(value));
+  size_t subBucket = static_cast<size_t>(value >> (exponent - kSubBucketBits)) &
+                     (kSubBuckets - 1);
+  return (exponent - kSubBucketBits + 1) * kSubBuckets + subBucket;
+}
+
+uint64_t LatencyHistogram::BucketUpperBound(size_t index) {
+  if (index < kSubBuckets) {
+    return index;
+  }
+  size_t exponent = index / kSubBuckets + kSubBucketBits - 1;
+  uint64_t subBucket = index % kSubBuckets;
+  uint64_t width = uint64_t{1} << (exponent - kSubBucketBits);
+  return ((kSubBuckets + subBucket) << (exponent - kSubBucketBits)) + width - 1;
+}
+
+void LatencyHistogram::record(uint64_t micros) {
+  buckets_[BucketIndex(micros)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(micros, std::memory_order_relaxed);
+  uint64_t max = max_.load(std::memory_order_relaxed);
+  while (micros > max &&
+         !max_.compare_exchange_weak(max, micros, std::memory_order_relaxed)) {
+  }
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+  Snapshot snapshot;
+  snapshot.count = count_.load(std::memory_order_relaxed);
+  snapshot.sum = sum_.load(std::memory_order_relaxed);
+  snapshot.max = max_.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < kBucketCount; i++) {
+    snapshot.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+  }
+  return snapshot;
+}
+
+uint64_t LatencyHistogram::Snapshot::percentile(double p) const {
+  // Count the buckets rather than use count, which may be out of sync with
+  // them while values are being recorded.
+  uint64_t total = 0;
+  for (uint64_t n : buckets) {
+    total += n;
+  }
+  if (total == 0) {
+    return 0;
+  }
+  uint64_t rank = static_cast<uint64_t>(p * static_cast<double>(total - 1)) + 1;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBucketCount; i++) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      return std::min(BucketUpperBound(i), max);
+    }
+  }
+  return max;
+}
+
+std::string Metrics::dump(
+    const std::vector<std::pair<std::string, uint64_t>>& sampled) const {
+  std::string output;
+  char line[256];
+  for (size_t i = 0; i < static_cast<size_t>(Counter::kCount); i++) {
+    snprintf(line, sizeof(line), "%s %" PRIu64 "\n", kCounterNames[i],
+             counters_[i].load(std::memory_order_relaxed));
+    output += line;
+  }
+  for (const auto& [name, value] : sampled) {
+    snprintf(line, sizeof(line), "%s %" PRIu64 "\n", name.c_str(), value);
+    output += line;
+  }
+  for (size_t i = 0; i < static_cast<size_t>(Histogram::kCount); i++) {
+    LatencyHistogram::Snapshot s = histograms_[i].snapshot();
+    snprintf(line, sizeof(line),
+             "%s count=%" PRIu64 " mean=%" PRIu64 " p50=%" PRIu64
+             " p90=%" PRIu64 " p99=%" PRIu64 " p999=%" PRIu64 " max=%" PRIu64
+             "\n",
+             kHistogramNames[i], s.count, s.count == 0 ? 0 : s.sum / s.count,
+             s.percentile(0.5), s.percentile(0.9), s.percentile(0.99),
+             s.percentile(0.999), s.max);
+    output += line;
+  }
+  return output;
+}
+
+}  // namespace McBopomofo
@@ -0,0 +1,159 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SRC_METRICS_H_
+#define SRC_METRICS_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace McBopomofo {
+
+// A histogram of latencies in microseconds. Buckets are log-linear: each power
+// of two is split into kSubBuckets buckets, so a recorded value is off by at
+// most 1/kSubBuckets. Recording is lock-free and may race with snapshots.
+class LatencyHistogram {
+ public:
+  static constexpr size_t kSubBucketBits = 3;
+  static constexpr size_t kSubBuckets = 1 << kSubBucketBits;
+  static constexpr size_t kBucketCount = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  void record(uint64_t micros);
+
+  struct Snapshot {
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+    std::array<uint64_t, kBucketCount> buckets{};
+
+    // Returns the upper bound of the bucket holding the p-th value, p in
+    // [0, 1], or 0 if there are no values.
+    uint64_t percentile(double p) const;
+  };
+
+  Snapshot snapshot() const;
+
+  static size_t BucketIndex(uint64_t value);
+  static uint64_t BucketUpperBound(size_t index);
+
+ private:
+  std::array<std::atomic<uint64_t>, kBucketCount> buckets_{};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_{0};
+  std::atomic<uint64_t> max_{0};
+};
+
+// Runtime counters and latency histograms of the input method. All methods
+// are thread-safe and lock-free.
+class Metrics {
+ public:
+  enum class Counter : size_t {
+    kKeystrokes,
+    kKeystrokesAccepted,
+    kWalks,
+    kBackgroundWalksApplied,
+    kOverrideSuggestionsApplied,
+    kConvergedEvictions,
+    kCount,
+  };
+
+  enum class Histogram : size_t {
+    // Time spent in KeyHandler::handle().
+    kKeyHandling,
+    // Time spent walking the grid on the main thread.
+    kWalk,
+    // Time spent inserting and walking pending readings when idle.
+    kRefinement,
+    kCount,
+  };
+
+  void increment(Counter counter, uint64_t n = 1) {
+    counters_[static_cast<size_t>(counter)].fetch_add(
+        n, std::memory_order_relaxed);
+  }
+
+  uint64_t value(Counter counter) const {
+    return counters_[static_cast<size_t>(counter)].load(
+        std::memory_order_relaxed);
+  }
+
+  void record(Histogram histogram, uint64_t micros) {
+    histograms_[static_cast<size_t>(histogram)].record(micros);
+  }
+
+  LatencyHistogram::Snapshot snapshot(Histogram histogram) const {
+    return histograms_[static_cast<size_t>(histogram)].snapshot();
+  }
+
+  // Returns a text dump of all metrics, one per line, followed by the given
+  // values sampled by the caller, such as counters kept elsewhere.
+  std::string dump(
+      const std::vector<std::pair<std::string, uint64_t>>& sampled = {}) const;
+
+ private:
+  std::array<std::atomic<uint64_t>, static_cast<size_t>(Counter::kCount)>
+      counters_{};
+  std::array<LatencyHistogram, static_cast<size_t>(Histogram::kCount)>
+      histograms_;
+};
+
+// Records the time from construction to destruction into a histogram. Does
+// nothing if metrics is nullptr.
+class ScopedLatency {
+ public:
+  ScopedLatency(Metrics* metrics, Metrics::Histogram histogram)
+      : metrics_(metrics), histogram_(histogram) {
+    if (metrics_ != nullptr) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~ScopedLatency() {
+    if (metrics_ != nullptr) {
+      auto elapsed = std::chrono::steady_clock::now() - start_;
+      metrics_->record(
+          histogram_,
+          static_cast<uint64_t>(
+              std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+                  .count()));
+    }
+  }
+
+  ScopedLatency(const ScopedLatency&) = delete;
+  ScopedLatency& operator=(const ScopedLatency&) = delete;
+
+ private:
+  Metrics* metrics_;
+  Metrics::Histogram histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace McBopomofo
+
+#endif  // SRC_METRICS_H_
@@ -0,0 +1,138 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "Metrics.h"
+
+#include <cstdint>
+#include <limits>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace McBopomofo {
+
+namespace {
+
+using Snapshot = LatencyHistogram::Snapshot;
+
+TEST(LatencyHistogramTest, KeepsSmallValuesExact) {
+  for (uint64_t value = 0; value < LatencyHistogram::kSubBuckets; value++) {
+    size_t index = LatencyHistogram::BucketIndex(value);
+    EXPECT_EQ(index, value);
+    EXPECT_EQ(LatencyHistogram::BucketUpperBound(index), value);
+  }
+}
+
+TEST(LatencyHistogramTest, SplitsPowersOfTwoIntoSubBuckets) {
+  // 8 to 15 are still one value per bucket; from 16 on, a bucket is 1/8 of
+  // its power of two wide.
+  EXPECT_EQ(LatencyHistogram::BucketIndex(8), 8);
+  EXPECT_EQ(LatencyHistogram::BucketIndex(15), 15);
+  EXPECT_EQ(LatencyHistogram::BucketIndex(16), 16);
+  EXPECT_EQ(LatencyHistogram::BucketIndex(17), 16);
+  EXPECT_EQ(LatencyHistogram::BucketIndex(18), 17);
+  EXPECT_EQ(LatencyHistogram::BucketUpperBound(16), 17);
+  EXPECT_EQ(LatencyHistogram::BucketIndex(1000), 63);
+  EXPECT_EQ(LatencyHistogram::BucketUpperBound(63), 1023);
+  EXPECT_EQ(LatencyHistogram::BucketIndex(960), 63);
+  EXPECT_EQ(LatencyHistogram::BucketIndex(959), 62);
+}
+
+TEST(LatencyHistogramTest, BucketsAreContiguous) {
+  // The value after each upper bound starts the next bucket, and no value is
+  // off from its upper bound by more than 1/kSubBuckets.
+  for (size_t i = 0; i + 1 < LatencyHistogram::kBucketCount; i++) {
+    uint64_t upper = LatencyHistogram::BucketUpperBound(i);
+    ASSERT_EQ(LatencyHistogram::BucketIndex(upper), i);
+    ASSERT_EQ(LatencyHistogram::BucketIndex(upper + 1), i + 1);
+    uint64_t lower = i == 0 ? 0 : LatencyHistogram::BucketUpperBound(i - 1) + 1;
+    ASSERT_LE(upper - lower, lower / LatencyHistogram::kSubBuckets)
+        << "bucket " << i;
+  }
+}
+
+TEST(LatencyHistogramTest, PutsLargestValuesIntoLastBucket) {
+  constexpr uint64_t kMax = std::numeric_limits<uint64_t>::max();
+  constexpr size_t kLast = LatencyHistogram::kBucketCount - 1;
+  EXPECT_EQ(LatencyHistogram::BucketIndex(kMax), kLast);
+  EXPECT_EQ(LatencyHistogram::BucketIndex(kMax - (kMax >> 4)), kLast);
+  EXPECT_EQ(LatencyHistogram::BucketUpperBound(kLast), kMax);
+
+  LatencyHistogram histogram;
+  histogram.record(kMax);
+  Snapshot snapshot = histogram.snapshot();
+  EXPECT_EQ(snapshot.buckets[kLast], 1);
+  EXPECT_EQ(snapshot.max, kMax);
+  EXPECT_EQ(snapshot.percentile(0.5), kMax);
+}
+
+TEST(LatencyHistogramTest, ReportsPercentilesOfKnownDistribution) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(histogram.snapshot().percentile(0.5), 0);
+
+  for (uint64_t value = 1; value <= 1000; value++) {
+    histogram.record(value);
+  }
+  Snapshot snapshot = histogram.snapshot();
+  EXPECT_EQ(snapshot.count, 1000);
+  EXPECT_EQ(snapshot.sum, 500500);
+  EXPECT_EQ(snapshot.max, 1000);
+
+  // Each percentile is the upper bound of the bucket of the exact value, and
+  // never more than the largest value recorded.
+  EXPECT_EQ(snapshot.percentile(0.0), 1);
+  EXPECT_EQ(snapshot.percentile(0.5), 511);   // 500 is in [480, 511].
+  EXPECT_EQ(snapshot.percentile(0.9), 959);   // 900 is in [896, 959].
+  EXPECT_EQ(snapshot.percentile(0.99), 1000);  // 990 is in [960, 1023].
+  EXPECT_EQ(snapshot.percentile(1.0), 1000);
+}
+
+TEST(LatencyHistogramTest, ReportsPercentilesOfSkewedDistribution) {
+  // 99 fast values and one slow one: only the tail sees the slow value.
+  LatencyHistogram histogram;
+  for (int i = 0; i < 99; i++) {
+    histogram.record(5);
+  }
+  histogram.record(100000);
+  Snapshot snapshot = histogram.snapshot();
+  EXPECT_EQ(snapshot.percentile(0.5), 5);
+  EXPECT_EQ(snapshot.percentile(0.98), 5);
+  EXPECT_EQ(snapshot.percentile(1.0), 100000);
+}
+
+TEST(MetricsTest, DumpsCountersAndHistograms) {
+  Metrics metrics;
+  metrics.increment(Metrics::Counter::kKeystrokes, 3);
+  metrics.record(Metrics::Histogram::kWalk, 10);
+  metrics.record(Metrics::Histogram::kWalk, 30);
+  EXPECT_EQ(metrics.value(Metrics::Counter::kKeystrokes), 3);
+
+  std::string dump = metrics.dump({{"sampled", 7}});
+  EXPECT_NE(dump.find("keystrokes 3\n"), std::string::npos) << dump;
+  EXPECT_NE(dump.find("sampled 7\n"), std::string::npos) << dump;
+  EXPECT_NE(dump.find("walk_us count=2 mean=20 "), std::string::npos) << dump;
+}
+
+}  // namespace
+
+}  // namespace McBopomofo
@@ -0,0 +1,140 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "PhraseCompletionIndex.h"
+
+#include <string>
+#include <vector>
+
+#include "McBopomofoLM.h"
+#include "TestSupport.h"
+#include "gtest/gtest.h"
+
+namespace McBopomofo {
+
+namespace {
+
+std::vector<std::string> ValuesOf(
+    const std::vector<PhraseCompletionIndex::Completion>& completions) {
+  std::vector<std::string> values;
+  for (const auto& completion : completions) {
+    values.emplace_back(completion.value);
+  }
+  return values;
+}
+
+std::vector<std::string> ValuesOf(
+    const std::vector<Formosa::Gramambular::Unigram>& unigrams) {
+  std::vector<std::string> values;
+  for (const auto& unigram : unigrams) {
+    values.push_back(unigram.keyValue.value);
+  }
+  return values;
+}
+
+}  // namespace
+
+TEST(PhraseCompletionIndexTest, KeepsTheMostLikelyCompletionsOfEachPrefix) {
+  std::vector<TestRow> rows;
+  // More two-reading phrases than are kept, listed from the least likely.
+  for (int i = 19; i >= 0; i--) {
+    rows.push_back({"ㄅㄚ-ㄅㄛ", "p" + std::to_string(i),
+                    std::to_string(-1.0 - i * 0.1)});
+  }
+  std::string data = MakeSortedDatabase(rows);
+
+  PhraseCompletionIndex index;
+  index.build(data);
+  auto completions = index.completionsForPrefix(
+      "ㄅㄚ", PhraseCompletionIndex::MaxCompletionsPerPrefix + 4);
+  ASSERT_EQ(completions.size(), PhraseCompletionIndex::MaxCompletionsPerPrefix);
+  for (size_t i = 0; i < completions.size(); i++) {
+    EXPECT_EQ(completions[i].value, "p" + std::to_string(i));
+    EXPECT_EQ(completions[i].key, "ㄅㄚ-ㄅㄛ");
+    EXPECT_DOUBLE_EQ(completions[i].score, -1.0 - i * 0.1);
+  }
+  EXPECT_EQ(ValuesOf(index.completionsForPrefix("ㄅㄚ", 2)),
+            std::vector<std::string>({"p0", "p1"}));
+}
+
+TEST(PhraseCompletionIndexTest, IndexesPrefixesOfOneAndTwoReadings) {
+  std::string data = MakeSortedDatabase({
+      {"ㄅㄚ", "八", "-2.0"},
+      {"ㄅㄚ-ㄅㄛ", "二字", "-3.0"},
+      {"ㄅㄚ-ㄅㄛ-ㄅㄜ", "三字詞", "-4.0"},
+      {"ㄅㄚ-ㄅㄛ-ㄅㄜ-ㄅㄞ", "四字詞語", "-5.0"},
+      // Longer than any node the reading builder builds.
+      {"ㄅㄚ-ㄅㄛ-ㄅㄜ-ㄅㄞ-ㄅㄟ-ㄅㄠ-ㄅㄢ", "七個字的詞語", "-1.0"},
+      {"_punctuation_list", "，", "0.0"},
+  });
+
+  PhraseCompletionIndex index;
+  index.build(data);
+  EXPECT_FALSE(index.isEmpty());
+  EXPECT_EQ(ValuesOf(index.completionsForPrefix("ㄅㄚ", 16)),
+            std::vector<std::string>({"二字", "三字詞", "四字詞語"}));
+  // Completions are longer than the prefix.
+  EXPECT_EQ(ValuesOf(index.completionsForPrefix("ㄅㄚ-ㄅㄛ", 16)),
+            std::vector<std::string>({"三字詞", "四字詞語"}));
+  // Prefixes of three readings are not indexed.
+  EXPECT_TRUE(index.completionsForPrefix("ㄅㄚ-ㄅㄛ-ㄅㄜ", 16).empty());
+  EXPECT_TRUE(index.completionsForPrefix("ㄅ", 16).empty());
+  EXPECT_TRUE(index.completionsForPrefix("_punctuation", 16).empty());
+
+  index.clear();
+  EXPECT_TRUE(index.isEmpty());
+  EXPECT_TRUE(index.completionsForPrefix("ㄅㄚ", 16).empty());
+}
+
+TEST(PhraseCompletionIndexTest, LeavesOutExcludedAndReplacesValues) {
+  ScopedTempFile languageModel(MakeSortedDatabase({
+      {"ㄋㄧˇ", "你", "-2.0"},
+      {"ㄋㄧˇ-ㄏㄠˇ", "你好", "-3.0"},
+      {"ㄋㄧˇ-ㄏㄠˇ", "妳好", "-4.0"},
+      {"ㄋㄧˇ-ㄇㄣˊ", "你們", "-3.5"},
+  }));
+  ScopedTempFile userPhrases("");
+  ScopedTempFile excludedPhrases("妳好 ㄋㄧˇ-ㄏㄠˇ\n");
+  ScopedTempFile phraseReplacement("你們 您們\n");
+
+  McBopomofoLM lm;
+  lm.loadLanguageModel(languageModel.path().c_str());
+  lm.setPhraseCompletionEnabled(true);
+  EXPECT_EQ(ValuesOf(lm.completionsForReadings({"ㄋㄧˇ"}, 8)),
+            std::vector<std::string>({"你好", "你們", "妳好"}));
+
+  lm.loadUserPhrases(userPhrases.path().c_str(),
+                     excludedPhrases.path().c_str());
+  lm.loadPhraseReplacementMap(phraseReplacement.path().c_str());
+  lm.setPhraseReplacementEnabled(true);
+  EXPECT_EQ(ValuesOf(lm.completionsForReadings({"ㄋㄧˇ"}, 8)),
+            std::vector<std::string>({"你好", "您們"}));
+  EXPECT_EQ(ValuesOf(lm.completionsForReadings({"ㄋㄧˇ"}, 1)),
+            std::vector<std::string>({"你好"}));
+  EXPECT_TRUE(lm.completionsForReadings({"ㄋㄧˇ", "ㄏㄠˇ"}, 8).empty());
+
+  lm.setPhraseCompletionEnabled(false);
+  EXPECT_TRUE(lm.completionsForReadings({"ㄋㄧˇ"}, 8).empty());
+}
+
+}  // namespace McBopomofo
@@ -0,0 +1,277 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "PhraseDataVerifier.h"
+
+#include <sys/stat.h>
+
+#include <cinttypes>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "TestSupport.h"
+#include "UserPhrasesLM.h"
+#include "gtest/gtest.h"
+
+namespace McBopomofo {
+
+namespace {
+
+using Format = PhraseDataVerifier::Format;
+
+bool IsValid(const std::string& data, size_t* errorOffset = nullptr) {
+  size_t offset = 0;
+  bool valid = PhraseDataVerifier::isValidUTF8(data, &offset);
+  if (errorOffset != nullptr) {
+    *errorOffset = offset;
+  }
+  return valid;
+}
+
+std::string ChecksumLine(const std::string& rows) {
+  char line[64];
+  snprintf(line, sizeof(line), "# checksum %016" PRIx64 "\n",
+           PhraseDataVerifier::checksum(rows));
+  return line;
+}
+
+// The status of a file that is not on disk, for the verdicts kept by
+// verifyFile().
+struct stat FakeStatus(ino_t inode, off_t size, time_t modified) {
+  struct stat sb = {};
+  sb.st_dev = 0;
+  sb.st_ino = inode;
+  sb.st_size = size;
+  sb.st_mtim.tv_sec = modified;
+  return sb;
+}
+
+}  // namespace
+
+TEST(PhraseDataVerifierTest, AcceptsWellFormedUTF8) {
+  EXPECT_TRUE(IsValid(""));
+  EXPECT_TRUE(IsValid("ㄋㄧˇ 你 -2.0"));
+  EXPECT_TRUE(IsValid("\xC2\x80"));              // U+0080
+  EXPECT_TRUE(IsValid("\xE0\xA0\x80"));          // U+0800
+  EXPECT_TRUE(IsValid("\xED\x9F\xBF"));          // U+D7FF
+  EXPECT_TRUE(IsValid("\xEE\x80\x80"));          // U+E000
+  EXPECT_TRUE(IsValid("\xF0\x90\x80\x80"));      // U+10000
+  EXPECT_TRUE(IsValid("\xF0\x9F\x98\x80"));      // U+1F600
+  EXPECT_TRUE(IsValid("\xF4\x8F\xBF\xBF"));      // U+10FFFF
+}
+
+TEST(PhraseDataVerifierTest, RejectsOverlongFormsAndSurrogates) {
+  for (const std::string& sequence : std::vector<std::string>({
+           "\xC0\xAF",          // "/" in two bytes
+           "\xC1\xBF",          // U+007F in two bytes
+           "\xE0\x80\xAF",      // "/" in three bytes
+           "\xE0\x9F\xBF",      // U+07FF in three bytes
+           "\xF0\x80\x80\xAF",  // "/" in four bytes
+           "\xF0\x8F\xBF\xBF",  // U+FFFF in four bytes
+           "\xED\xA0\x80",      // U+D800
+           "\xED\xBF\xBF",      // U+DFFF
+           "\xF4\x90\x80\x80",  // U+110000
+           "\xF5\x80\x80\x80",
+           "\xFF",
+           "\x80",              // A continuation byte on its own
+           "\xE4\x41\xA0",      // A continuation byte replaced
+       })) {
+    size_t errorOffset = 0;
+    EXPECT_FALSE(IsValid("ab" + sequence + "cd", &errorOffset))
+        << testing::PrintToString(sequence);
+    EXPECT_EQ(errorOffset, 2) << testing::PrintToString(sequence);
+  }
+}
+
+TEST(PhraseDataVerifierTest, RejectsTruncatedTail) {
+  // 你 is E4 BD A0, and 😀 is F0 9F 98 80.
+  for (const std::string& data : std::vector<std::string>(
+           {"ab\xE4\xBD", "ab\xE4", "ab\xF0\x9F\x98", "ab\xC3"})) {
+    size_t errorOffset = 0;
+    EXPECT_FALSE(IsValid(data, &errorOffset))
+        << testing::PrintToString(data);
+    EXPECT_EQ(errorOffset, 2) << testing::PrintToString(data);
+  }
+}
+
+TEST(PhraseDataVerifierTest, SkipsASCIIWordsUpToTheEnd) {
+  // ASCII runs of every length around the word size, with an invalid byte or
+  // a character after them.
+  for (size_t length = 0; length <= 24; length++) {
+    std::string ascii(length, 'a');
+    size_t errorOffset = 0;
+    EXPECT_TRUE(IsValid(ascii)) << length;
+    EXPECT_TRUE(IsValid(ascii + "你")) << length;
+    EXPECT_TRUE(IsValid("你" + ascii)) << length;
+    EXPECT_FALSE(IsValid(ascii + "\x80", &errorOffset)) << length;
+    EXPECT_EQ(errorOffset, length);
+    EXPECT_FALSE(IsValid(ascii + "\xE4\xBD", &errorOffset)) << length;
+    EXPECT_EQ(errorOffset, length);
+    EXPECT_FALSE(IsValid(ascii + "\x80" + ascii, &errorOffset)) << length;
+    EXPECT_EQ(errorOffset, length);
+  }
+
+  // Nothing past the end of the data is read as part of it.
+  std::string buffer = "abcdefghij\x80\x80\x80\x80\x80\x80\x80\x80";
+  for (size_t length = 0; length <= 10; length++) {
+    size_t errorOffset = 0;
+    EXPECT_TRUE(PhraseDataVerifier::isValidUTF8(
+        std::string_view(buffer.data(), length), &errorOffset))
+        << length;
+  }
+}
+
+TEST(PhraseDataVerifierTest, VerifiesSortedRows) {
+  std::string header(SORTED_PRAGMA_HEADER);
+  std::string rows = MakeSortedDatabase({
+      {"ㄅㄚ", "八", "-3.5"},
+      {"ㄅㄚ-ㄅㄛ", "八伯", "-7"},
+      {"ㄅㄚˇ", "把", "-2.1e-1"},
+      {"_punctuation_,", "，", "+0.5"},
+  });
+  EXPECT_TRUE(PhraseDataVerifier::verify(rows, Format::Sorted).valid);
+  EXPECT_TRUE(PhraseDataVerifier::verify(header, Format::Sorted).valid);
+
+  // "ㄅㄚ " sorts before "ㄅㄚ-", as the binary search compares them.
+  auto result = PhraseDataVerifier::verify(
+      header + "ㄅㄚ-ㄅㄛ 八伯 -7\nㄅㄚ 八 -3.5\n", Format::Sorted);
+  EXPECT_FALSE(result.valid);
+  EXPECT_EQ(result.error, "rows not sorted by key");
+  EXPECT_EQ(result.line, 3);
+
+  for (const std::string& score :
+       std::vector<std::string>({"abc", "-", ".", "1e", "1.5x", "--1", ""})) {
+    result = PhraseDataVerifier::verify(header + "ㄅㄚ 八 " + score + "\n",
+                                        Format::Sorted);
+    EXPECT_FALSE(result.valid) << score;
+    EXPECT_EQ(result.line, 2) << score;
+  }
+  EXPECT_EQ(PhraseDataVerifier::verify(header + "ㄅㄚ 八 abc\n", Format::Sorted)
+                .error,
+            "malformed score");
+
+  for (const std::string& row :
+       std::vector<std::string>({"ㄅㄚ 八", " 八 -3.5", "ㄅㄚ  -3.5", ""})) {
+    result = PhraseDataVerifier::verify(header + row + "\n", Format::Sorted);
+    EXPECT_FALSE(result.valid) << row;
+    EXPECT_EQ(result.error, "not a \"key value score\" row") << row;
+  }
+
+  result = PhraseDataVerifier::verify("ㄅㄚ 八 -3.5\n", Format::Sorted);
+  EXPECT_FALSE(result.valid);
+  EXPECT_EQ(result.line, 1);
+
+  // Invalid UTF-8 rejects the whole file, with the line it is on.
+  result = PhraseDataVerifier::verify(header + "ㄅㄚ 八 -3.5\nㄅㄚˇ \xFF -2\n",
+                                      Format::Sorted);
+  EXPECT_FALSE(result.valid);
+  EXPECT_EQ(result.error, "invalid UTF-8");
+  EXPECT_EQ(result.line, 3);
+}
+
+TEST(PhraseDataVerifierTest, VerifiesChecksumLine) {
+  std::string header(SORTED_PRAGMA_HEADER);
+  std::string rows = "ㄅㄚ 八 -3.5\nㄅㄚˇ 把 -2.1\n";
+  EXPECT_TRUE(PhraseDataVerifier::verify(header + ChecksumLine(rows) + rows,
+                                         Format::Sorted)
+                  .valid);
+
+  // A byte changed after the checksum was written.
+  std::string changed = "ㄅㄚ 八 -3.6\nㄅㄚˇ 把 -2.1\n";
+  auto result = PhraseDataVerifier::verify(
+      header + ChecksumLine(rows) + changed, Format::Sorted);
+  EXPECT_FALSE(result.valid);
+  EXPECT_EQ(result.error, "checksum mismatch");
+  EXPECT_EQ(result.line, 0);
+
+  result = PhraseDataVerifier::verify(
+      header + "# checksum 0123456789abcde\n" + rows, Format::Sorted);
+  EXPECT_FALSE(result.valid);
+  EXPECT_EQ(result.error, "malformed checksum line");
+  EXPECT_EQ(result.line, 2);
+
+  result = PhraseDataVerifier::verify(
+      header + "# checksum 0123456789abcdeg\n" + rows, Format::Sorted);
+  EXPECT_EQ(result.error, "malformed checksum line");
+
+  result = PhraseDataVerifier::verify(header + "# checksum 0123",
+                                      Format::Sorted);
+  EXPECT_FALSE(result.valid);
+  EXPECT_EQ(result.error, "truncated checksum line");
+}
+
+TEST(PhraseDataVerifierTest, RejectsOnlyInvalidLinesOfKeyValueFiles) {
+  auto result = PhraseDataVerifier::verify(
+      "你 ㄋㄧˇ\n\xFF ㄅ\n好 ㄏㄠˇ\n\xC3\n", Format::KeyValue);
+  EXPECT_TRUE(result.valid);
+  EXPECT_EQ(result.rejectedLines, 2);
+  EXPECT_EQ(result.line, 2);
+  EXPECT_EQ(result.error, "invalid UTF-8");
+
+  result = PhraseDataVerifier::verify("你 ㄋㄧˇ\n", Format::KeyValue);
+  EXPECT_TRUE(result.valid);
+  EXPECT_EQ(result.rejectedLines, 0);
+
+  ScopedTempFile file("你 ㄋㄧˇ\n\xE4\xBD ㄋㄧˇ\n好 ㄏㄠˇ\n妳 ㄋㄧ\xFF\n");
+  UserPhrasesLM phrases;
+  ASSERT_TRUE(phrases.open(file.path().c_str()));
+  auto unigrams = phrases.unigramsForKey("ㄋㄧˇ");
+  ASSERT_EQ(unigrams.size(), 1);
+  EXPECT_EQ(unigrams[0].keyValue.value, "你");
+  EXPECT_TRUE(phrases.hasUnigramsForKey("ㄏㄠˇ"));
+  EXPECT_EQ(phrases.keys().size(), 2);
+}
+
+TEST(PhraseDataVerifierTest, KeepsVerdictsOfUnchangedFiles) {
+  std::string valid = std::string(SORTED_PRAGMA_HEADER) + "ㄅㄚ 八 -3.5\n";
+  std::string invalid = std::string(SORTED_PRAGMA_HEADER) + "ㄅㄚ 八 x\n";
+  struct stat sb = FakeStatus(1001, 100, 1000);
+  EXPECT_TRUE(PhraseDataVerifier::verifyFile(sb, valid, Format::Sorted).valid);
+
+  // The same file is not read again.
+  EXPECT_TRUE(
+      PhraseDataVerifier::verifyFile(sb, invalid, Format::Sorted).valid);
+
+  // It is when it was modified, or its size changed.
+  struct stat modified = FakeStatus(1001, 100, 1001);
+  EXPECT_FALSE(
+      PhraseDataVerifier::verifyFile(modified, invalid, Format::Sorted).valid);
+  EXPECT_FALSE(
+      PhraseDataVerifier::verifyFile(modified, valid, Format::Sorted).valid);
+  struct stat resized = FakeStatus(1001, 101, 1001);
+  EXPECT_TRUE(
+      PhraseDataVerifier::verifyFile(resized, valid, Format::Sorted).valid);
+  resized.st_mtim.tv_nsec = 1;
+  EXPECT_FALSE(
+      PhraseDataVerifier::verifyFile(resized, invalid, Format::Sorted).valid);
+
+  // Other files, and the same file in another format, have their own.
+  EXPECT_FALSE(PhraseDataVerifier::verifyFile(FakeStatus(1002, 100, 1000),
+                                              invalid, Format::Sorted)
+                   .valid);
+  EXPECT_TRUE(
+      PhraseDataVerifier::verifyFile(sb, invalid, Format::KeyValue).valid);
+}
+
+}  // namespace McBopomofo
@@ -0,0 +1,224 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "PhraseOverlayIndex.h"
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "McBopomofoLM.h"
+#include "TestSupport.h"
+#include "gtest/gtest.h"
+
+namespace McBopomofo {
+
+namespace {
+
+std::vector<std::string> ValuesOf(
+    const std::vector<Formosa::Gramambular::Unigram>& unigrams) {
+  std::vector<std::string> values;
+  for (const auto& unigram : unigrams) {
+    values.push_back(unigram.keyValue.value);
+  }
+  return values;
+}
+
+// Closes and opens the phrases again, as the language model does when the
+// file changes.
+void Reload(UserPhrasesLM* phrases, const ScopedTempFile& file) {
+  phrases->close();
+  phrases->open(file.path().c_str());
+}
+
+void Reload(PhraseReplacementMap* map, const ScopedTempFile& file) {
+  map->close();
+  map->open(file.path().c_str());
+}
+
+}  // namespace
+
+TEST(PhraseOverlayIndexTest, MergesUserAndExcludedPhrasesByReading) {
+  ScopedTempFile userFile("你 ㄋㄧˇ\n妳 ㄋㄧˇ\n你 ㄋㄧˇ\n好 ㄏㄠˇ\n");
+  ScopedTempFile excludedFile("妳 ㄋㄧˇ\n泥 ㄋㄧˊ\n");
+  UserPhrasesLM userPhrases;
+  UserPhrasesLM excludedPhrases;
+  userPhrases.open(userFile.path().c_str());
+  excludedPhrases.open(excludedFile.path().c_str());
+
+  PhraseOverlayIndex index;
+  PhraseOverlayIndex::Sources sources;
+  sources.userPhrases = &userPhrases;
+  sources.excludedPhrases = &excludedPhrases;
+  index.updatePhrases(sources);
+  EXPECT_EQ(index.size(), 3);
+
+  // Excluded user phrases are left out, and duplicates are listed once.
+  const PhraseOverlayIndex::Entry* entry = index.entryForKey("ㄋㄧˇ");
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(ValuesOf(entry->userUnigrams), std::vector<std::string>({"你"}));
+  EXPECT_EQ(entry->excludedValues, std::unordered_set<std::string>({"妳"}));
+  EXPECT_TRUE(entry->replacedValues.empty());
+
+  entry = index.entryForKey("ㄋㄧˊ");
+  ASSERT_NE(entry, nullptr);
+  EXPECT_TRUE(entry->userUnigrams.empty());
+  EXPECT_EQ(entry->excludedValues, std::unordered_set<std::string>({"泥"}));
+
+  entry = index.entryForKey("ㄏㄠˇ");
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(ValuesOf(entry->userUnigrams), std::vector<std::string>({"好"}));
+  EXPECT_TRUE(entry->excludedValues.empty());
+
+  EXPECT_EQ(index.entryForKey("ㄇㄚ"), nullptr);
+
+  index.clear();
+  EXPECT_EQ(index.size(), 0);
+  EXPECT_EQ(index.entryForKey("ㄋㄧˇ"), nullptr);
+}
+
+TEST(PhraseOverlayIndexTest, DropsReadingsRemovedOnReload) {
+  ScopedTempFile userFile("你 ㄋㄧˇ\n好 ㄏㄠˇ\n");
+  ScopedTempFile excludedFile("泥 ㄋㄧˊ\n媽 ㄇㄚ\n");
+  UserPhrasesLM userPhrases;
+  UserPhrasesLM excludedPhrases;
+  userPhrases.open(userFile.path().c_str());
+  excludedPhrases.open(excludedFile.path().c_str());
+
+  PhraseOverlayIndex index;
+  PhraseOverlayIndex::Sources sources;
+  sources.userPhrases = &userPhrases;
+  sources.excludedPhrases = &excludedPhrases;
+  index.updatePhrases(sources);
+  EXPECT_EQ(index.size(), 4);
+
+  userFile.write("好 ㄏㄠˇ\n");
+  Reload(&userPhrases, userFile);
+  index.updatePhrases(sources);
+  EXPECT_EQ(index.entryForKey("ㄋㄧˇ"), nullptr);
+  ASSERT_NE(index.entryForKey("ㄏㄠˇ"), nullptr);
+  EXPECT_EQ(index.size(), 3);
+
+  // A reading moved from one file to the other keeps its entry.
+  excludedFile.write("媽 ㄇㄚ\n");
+  userFile.write("好 ㄏㄠˇ\n尼 ㄋㄧˊ\n");
+  Reload(&excludedPhrases, excludedFile);
+  Reload(&userPhrases, userFile);
+  index.updatePhrases(sources);
+  const PhraseOverlayIndex::Entry* entry = index.entryForKey("ㄋㄧˊ");
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(ValuesOf(entry->userUnigrams), std::vector<std::string>({"尼"}));
+  EXPECT_TRUE(entry->excludedValues.empty());
+  EXPECT_EQ(index.size(), 3);
+
+  excludedFile.write("");
+  Reload(&excludedPhrases, excludedFile);
+  index.updatePhrases(sources);
+  EXPECT_EQ(index.entryForKey("ㄇㄚ"), nullptr);
+  EXPECT_EQ(index.size(), 2);
+}
+
+TEST(PhraseOverlayIndexTest, MergesPhraseReplacements) {
+  std::string languageModelRows = MakeSortedDatabase({
+      {"ㄋㄧˇ", "你", "-2.0"},
+      {"ㄋㄧˇ", "妳", "-3.0"},
+      {"ㄇㄣˊ", "們", "-3.0"},
+  });
+  ScopedTempFile userFile("你 ㄋㄧˇ\n妳 ㄋㄧˇ\n");
+  ScopedTempFile replacementFile("你 妳\n們 們們\n");
+  UserPhrasesLM userPhrases;
+  PhraseReplacementMap phraseReplacement;
+  userPhrases.open(userFile.path().c_str());
+  phraseReplacement.open(replacementFile.path().c_str());
+
+  PhraseOverlayIndex index;
+  PhraseOverlayIndex::Sources sources;
+  sources.userPhrases = &userPhrases;
+  index.updatePhrases(sources);
+  sources.phraseReplacement = &phraseReplacement;
+  index.updateReplacements(sources, languageModelRows);
+
+  // The user phrases are deduplicated by the replaced values.
+  const PhraseOverlayIndex::Entry* entry = index.entryForKey("ㄋㄧˇ");
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(ValuesOf(entry->userUnigrams), std::vector<std::string>({"妳"}));
+  EXPECT_EQ(entry->replacedValues,
+            (std::unordered_map<std::string, std::string>({{"你", "妳"}})));
+  entry = index.entryForKey("ㄇㄣˊ");
+  ASSERT_NE(entry, nullptr);
+  EXPECT_TRUE(entry->userUnigrams.empty());
+  EXPECT_EQ(entry->replacedValues,
+            (std::unordered_map<std::string, std::string>({{"們", "們們"}})));
+
+  // A reading whose values are no longer replaced loses its entry.
+  replacementFile.write("你 妳\n");
+  Reload(&phraseReplacement, replacementFile);
+  index.updateReplacements(sources, languageModelRows);
+  EXPECT_EQ(index.entryForKey("ㄇㄣˊ"), nullptr);
+  ASSERT_NE(index.entryForKey("ㄋㄧˇ"), nullptr);
+
+  // Disabling the replacement keeps the user phrases as they are in the file.
+  sources.phraseReplacement = nullptr;
+  index.updateReplacements(sources, languageModelRows);
+  entry = index.entryForKey("ㄋㄧˇ");
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(ValuesOf(entry->userUnigrams),
+            std::vector<std::string>({"你", "妳"}));
+  EXPECT_TRUE(entry->replacedValues.empty());
+  EXPECT_EQ(index.size(), 1);
+}
+
+TEST(PhraseOverlayIndexTest, UnigramsFollowReloadedFiles) {
+  ScopedTempFile languageModel(MakeSortedDatabase({
+      {"ㄋㄧˇ", "你", "-2.0"},
+      {"ㄋㄧˇ", "妳", "-3.0"},
+      {"ㄏㄠˇ", "好", "-2.0"},
+  }));
+  ScopedTempFile userPhrases("擬 ㄋㄧˇ\n");
+  ScopedTempFile excludedPhrases("好 ㄏㄠˇ\n");
+  ScopedTempFile phraseReplacement("妳 你\n");
+
+  McBopomofoLM lm;
+  lm.loadLanguageModel(languageModel.path().c_str());
+  lm.loadUserPhrases(userPhrases.path().c_str(),
+                     excludedPhrases.path().c_str());
+  lm.loadPhraseReplacementMap(phraseReplacement.path().c_str());
+  lm.setPhraseReplacementEnabled(true);
+  EXPECT_EQ(ValuesOf(lm.unigramsForKey("ㄋㄧˇ")),
+            std::vector<std::string>({"擬", "你"}));
+  EXPECT_FALSE(lm.hasUnigramsForKey("ㄏㄠˇ"));
+
+  userPhrases.write("");
+  excludedPhrases.write("");
+  lm.loadUserPhrases(userPhrases.path().c_str(),
+                     excludedPhrases.path().c_str());
+  phraseReplacement.write("");
+  lm.loadPhraseReplacementMap(phraseReplacement.path().c_str());
+  EXPECT_EQ(ValuesOf(lm.unigramsForKey("ㄋㄧˇ")),
+            std::vector<std::string>({"你", "妳"}));
+  EXPECT_EQ(ValuesOf(lm.unigramsForKey("ㄏㄠˇ")),
+            std::vector<std::string>({"好"}));
+}
+
+}  // namespace McBopomofo
@@ -0,0 +1,362 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "PinyinSegmenter.h"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+namespace McBopomofo {
+
+namespace {
+
+using BPMF = Formosa::Mandarin::BopomofoSyllable;
+
+constexpr double kNoScore = -std::numeric_limits<double>::infinity();
+
+constexpr BPMF::Component kToneComponents[] = {BPMF::Tone1, BPMF::Tone2,
+                                               BPMF::Tone3, BPMF::Tone4,
+                                               BPMF::Tone5};
+
+std::string ReadingWithTone(BPMF syllable, int tone) {
+  return (syllable + BPMF(kToneComponents[tone - 1])).composedString();
+}
+
+}  // namespace
+
+PinyinSegmenter::PinyinSegmenter(Formosa::Gramambular::LanguageModel* lm)
+    : lm_(lm) {
+  TrieNode root;
+  root.children.fill(-1);
+  trie_.push_back(root);
+
+  // Every combination of components that round-trips through Hanyu Pinyin is
+  // a candidate syllable.
+  for (BPMF::Component consonant = 0; consonant <= BPMF::S; consonant++) {
+    for (BPMF::Component medial : {BPMF::Component{0}, BPMF::I, BPMF::U,
+                                   BPMF::UE}) {
+      for (BPMF::Component vowel = 0; vowel <= BPMF::ERR; vowel += BPMF::A) {
+        BPMF::Component components = consonant | medial | vowel;
+        if (components != 0) {
+          addSyllable(BPMF(components));
+        }
+      }
+    }
+  }
+
+  cells_.push_back(Cell{0, 0, -1});
+  fences_.push_back(0);
+}
+
+void PinyinSegmenter::addSyllable(BPMF syllable) {
+  // Bare consonants, such as "g" for ㄍ, are Bopomofo symbols rather than
+  // syllables, and would make any consonant typed a complete syllable.
+  std::string pinyin = syllable.HanyuPinyinString(false, true);
+  if (BPMF::FromHanyuPinyin(pinyin) != syllable ||
+      pinyin.find_first_of("aeiouv") == std::string::npos ||
+      !std::all_of(pinyin.begin(), pinyin.end(),
+                   [](char c) { return c >= 'a' && c <= 'z'; })) {
+    return;
+  }
+
+  Syllable entry{syllable, {}, 0};
+  for (int tone = 1; tone <= 5; tone++) {
+    entry.toneScores[tone - 1] =
+        topUnigramScore(ReadingWithTone(syllable, tone));
+    if (entry.toneScores[tone - 1] == kNoScore) {
+      continue;
+    }
+    if (entry.bestTone == 0 ||
+        entry.toneScores[tone - 1] > entry.toneScores[entry.bestTone - 1]) {
+      entry.bestTone = tone;
+    }
+  }
+  if (entry.bestTone == 0) {
+    return;
+  }
+
+  int32_t node = 0;
+  for (char c : pinyin) {
+    int32_t& child = trie_[node].children[c - 'a'];
+    if (child == -1) {
+      TrieNode newNode;
+      newNode.children.fill(-1);
+      child = static_cast<int32_t>(trie_.size());
+      trie_.push_back(newNode);
+    }
+    node = trie_[node].children[c - 'a'];
+  }
+  // Syllables spelled the same way are alternative spellings; keep the first.
+  if (trie_[node].syllable == -1) {
+    trie_[node].syllable = static_cast<int32_t>(syllables_.size());
+    syllables_.push_back(entry);
+    maxSyllableLength_ = std::max(maxSyllableLength_, pinyin.size());
+  }
+}
+
+int32_t PinyinSegmenter::walkTrie(size_t begin, size_t end, char extra) const {
+  int32_t node = 0;
+  for (size_t i = begin; i < end && node != -1; i++) {
+    node = trie_[node].children[tokens_[i].letter - 'a'];
+  }
+  if (node != -1 && extra != 0) {
+    node = trie_[node].children[extra - 'a'];
+  }
+  return node;
+}
+
+size_t PinyinSegmenter::earliestStart(size_t k, size_t extraLetters) const {
+  size_t lengthLimit = maxSyllableLength_ > k + extraLetters
+                           ? 0
+                           : k + extraLetters - maxSyllableLength_;
+  return std::max(fences_[k], lengthLimit);
+}
+
+bool PinyinSegmenter::appendLetter(char letter) {
+  if (letter < 'a' || letter > 'z') {
+    return false;
+  }
+
+  size_t k = tokens_.size();
+  bool continuesSomething = false;
+  Cell best{kNoScore, 0, -1};
+  for (size_t start = earliestStart(k, 1); start <= k; start++) {
+    if (cells_[start].score == kNoScore) {
+      continue;
+    }
+    int32_t node = walkTrie(start, k, letter);
+    if (node == -1) {
+      continue;
+    }
+    continuesSomething = true;
+    int32_t syllable = trie_[node].syllable;
+    if (syllable == -1) {
+      continue;
+    }
+    const Syllable& s = syllables_[syllable];
+    double score =
+        cells_[start].score + s.toneScores[s.bestTone - 1];
+    if (score > best.score) {
+      best = Cell{score, start, syllable};
+    }
+  }
+  if (!continuesSomething) {
+    return false;
+  }
+
+  tokens_.push_back(Token{letter, 0});
+  cells_.push_back(best);
+  fences_.push_back(fences_[k]);
+  return true;
+}
+
+bool PinyinSegmenter::appendTone(int tone) {
+  size_t k = tokens_.size();
+  if (tone < 1 || tone > 5 || k == 0 || tokens_[k - 1].tone != 0) {
+    return false;
+  }
+
+  Cell best{kNoScore, 0, -1};
+  for (size_t start = earliestStart(k, 0); start < k; start++) {
+    if (cells_[start].score == kNoScore) {
+      continue;
+    }
+    int32_t node = walkTrie(start, k, 0);
+    if (node == -1 || trie_[node].syllable == -1) {
+      continue;
+    }
+    int32_t syllable = trie_[node].syllable;
+    double score =
+        cells_[start].score + syllables_[syllable].toneScores[tone - 1];
+    if (score > best.score) {
+      best = Cell{score, start, syllable};
+    }
+  }
+  if (best.score == kNoScore) {
+    return false;
+  }
+
+  tokens_.push_back(Token{0, tone});
+  cells_.push_back(best);
+  fences_.push_back(k + 1);
+  return true;
+}
+
+void PinyinSegmenter::backspace() {
+  if (tokens_.empty()) {
+    return;
+  }
+  tokens_.pop_back();
+  cells_.pop_back();
+  fences_.pop_back();
+}
+
+void PinyinSegmenter::clear() {
+  tokens_.clear();
+  cells_.resize(1);
+  fences_.resize(1);
+}
+
+bool PinyinSegmenter::isComplete() const {
+  return !tokens_.empty() && cells_.back().score != kNoScore;
+}
+
+size_t PinyinSegmenter::partialStart() const {
+  size_t k = tokens_.size();
+  if (cells_[k].score != kNoScore) {
+    return k;
+  }
+  // The trailing letters start a syllable; pick the best segmentation before
+  // them.
+  size_t bestStart = k;
+  for (size_t start = earliestStart(k, 1); start < k; start++) {
+    if (cells_[start].score != kNoScore && walkTrie(start, k, 0) != -1 &&
+        (bestStart == k || cells_[start].score > cells_[bestStart].score)) {
+      bestStart = start;
+    }
+  }
+  return bestStart;
+}
+
+double PinyinSegmenter::topUnigramScore(const std::string& key) const {
+  Formosa::Gramambular::Unigram top;
+  if (!lm_->topUnigramForKey(key, &top)) {
+    return kNoScore;
+  }
+  return top.score;
+}
+
+std::vector<std::string> PinyinSegmenter::readings() const {
+  std::vector<std::string> result;
+  if (!isComplete()) {
+    return result;
+  }
+
+  // The segmentation, with the typed tone of each syllable, or 0.
+  std::vector<std::pair<const Syllable*, int>> segments;
+  for (size_t k = tokens_.size(); k > 0; k = cells_[k].start) {
+    segments.emplace_back(&syllables_[cells_[k].syllable],
+                          tokens_[k - 1].tone);
+  }
+  std::reverse(segments.begin(), segments.end());
+
+  // Choose the tones by Viterbi: a syllable scores its unigram score in that
+  // tone, and a pair of adjacent syllables that forms a phrase scores the
+  // phrase's score instead, if that is better.
+  auto reading = [&](size_t i, int tone) {
+    return ReadingWithTone(segments[i].first->syllable, tone);
+  };
+  auto tones = [&](size_t i) {
+    std::vector<int> result;
+    for (int tone = 1; tone <= 5; tone++) {
+      if ((segments[i].second == 0 || segments[i].second == tone) &&
+          segments[i].first->toneScores[tone - 1] != kNoScore) {
+        result.push_back(tone);
+      }
+    }
+    return result;
+  };
+
+  size_t n = segments.size();
+  // scores[i][t - 1] is the best score of the first i + 1 syllables with the
+  // last in tone t, and previous[i][t - 1] the tone of the syllable before.
+  std::vector<std::array<double, 5>> scores(n);
+  std::vector<std::array<int, 5>> previous(n);
+  for (auto& row : scores) {
+    row.fill(kNoScore);
+  }
+  for (int tone : tones(0)) {
+    scores[0][tone - 1] = segments[0].first->toneScores[tone - 1];
+  }
+  for (size_t i = 1; i < n; i++) {
+    std::vector<int> previousTones = tones(i - 1);
+    for (int tone : tones(i)) {
+      double single = segments[i].first->toneScores[tone - 1];
+      for (int previousTone : previousTones) {
+        double pair = topUnigramScore(reading(i - 1, previousTone) + "-" +
+                                      reading(i, tone));
+        double bonus = std::max(
+            0.0, pair - segments[i - 1].first->toneScores[previousTone - 1] -
+                     single);
+        double score = scores[i - 1][previousTone - 1] + single + bonus;
+        if (score > scores[i][tone - 1]) {
+          scores[i][tone - 1] = score;
+          previous[i][tone - 1] = previousTone;
+        }
+      }
+    }
+  }
+
+  int tone = static_cast<int>(
+      std::max_element(scores[n - 1].begin(), scores[n - 1].end()) -
+      scores[n - 1].begin()) + 1;
+  for (size_t i = n; i > 0; i--) {
+    result.push_back(reading(i - 1, tone));
+    tone = previous[i - 1][tone - 1];
+  }
+  std::reverse(result.begin(), result.end());
+  return result;
+}
+
+std::string PinyinSegmenter::input() const {
+  std::string result;
+  for (const Token& token : tokens_) {
+    result +=
+        token.tone == 0 ? token.letter : static_cast<char>('0' + token.tone);
+  }
+  return result;
+}
+
+std::string PinyinSegmenter::displayString() const {
+  size_t end = partialStart();
+  std::vector<std::string> segments;
+  for (size_t k = end; k > 0; k = cells_[k].start) {
+    std::string segment;
+    for (size_t i = cells_[k].start; i < k; i++) {
+      const Token& token = tokens_[i];
+      segment += token.tone == 0 ? token.letter
+                                 : static_cast<char>('0' + token.tone);
+    }
+    segments.push_back(segment);
+  }
+  std::reverse(segments.begin(), segments.end());
+  if (end < tokens_.size()) {
+    std::string partial;
+    for (size_t i = end; i < tokens_.size(); i++) {
+      partial += tokens_[i].letter;
+    }
+    segments.push_back(partial);
+  }
+
+  std::string result;
+  for (const std::string& segment : segments) {
+    if (!result.empty()) {
+      result += "'";
+    }
+    result += segment;
+  }
+  return result;
+}
+
+}  // namespace McBopomofo
@@ -0,0 +1,147 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SRC_PINYINSEGMENTER_H_
+#define SRC_PINYINSEGMENTER_H_
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Gramambular.h"
+#include "Mandarin.h"
+
+namespace McBopomofo {
+
+// Segments a stream of Hanyu Pinyin letters, typed without tones or
+// separators, into syllables.
+//
+// The best segmentation maximizes the sum of the syllables' scores, each being
+// the score of the most likely unigram of the syllable in its most likely tone.
+// A tone digit (1 to 5) after a syllable forces a syllable boundary there and
+// the tone of that syllable. The tones not typed are then chosen so that
+// adjacent syllables form two-syllable phrases where the language model has
+// them, since a syllable's most likely tone alone often misses the phrase.
+//
+// The segmentation is updated as letters are typed: appending or removing a
+// letter only looks at the syllables that can end at it, so the cost does not
+// grow with the length of the input.
+class PinyinSegmenter {
+ public:
+  // Builds the syllable table from the syllables the language model has
+  // unigrams for. The scores are read once here. The language model must
+  // outlive the segmenter.
+  explicit PinyinSegmenter(Formosa::Gramambular::LanguageModel* lm);
+
+  // Appends a lowercase letter. Returns false, leaving the input unchanged, if
+  // the letter neither continues nor starts a syllable.
+  bool appendLetter(char letter);
+
+  // Appends a tone digit, from 1 to 5. Returns false, leaving the input
+  // unchanged, if the letters before cannot end with a syllable of that tone.
+  bool appendTone(int tone);
+
+  // Removes the last letter or tone.
+  void backspace();
+
+  void clear();
+
+  bool empty() const { return tokens_.empty(); }
+
+  // Returns true if the whole input is segmented into syllables, that is, the
+  // last syllable is not partially typed.
+  bool isComplete() const;
+
+  // The Bopomofo readings of the best segmentation, with tones. Empty unless
+  // isComplete().
+  std::vector<std::string> readings() const;
+
+  // The input as shown while composing: the syllables separated by "'",
+  // followed by the letters that do not form a syllable yet.
+  std::string displayString() const;
+
+  // The letters and tone digits as typed, to be typed again into another
+  // segmenter.
+  std::string input() const;
+
+ private:
+  struct Syllable {
+    Formosa::Mandarin::BopomofoSyllable syllable;
+    // Indexed by tone - 1; -infinity if there are no unigrams.
+    std::array<double, 5> toneScores;
+    int bestTone;
+  };
+
+  struct TrieNode {
+    std::array<int32_t, 26> children;
+    // Index into syllables_, or -1.
+    int32_t syllable = -1;
+  };
+
+  struct Token {
+    char letter;
+    // 1 to 5 for a tone digit, 0 for a letter.
+    int tone;
+  };
+
+  // The best segmentation of the first k tokens.
+  struct Cell {
+    double score;
+    // Where the last syllable starts.
+    size_t start;
+    int32_t syllable;
+  };
+
+  void addSyllable(Formosa::Mandarin::BopomofoSyllable syllable);
+
+  // Returns the trie node reached by the letters of tokens [begin, end)
+  // followed by extra, if it is not 0, or -1.
+  int32_t walkTrie(size_t begin, size_t end, char extra) const;
+
+  // Where the syllables ending at the end of the first k tokens may start.
+  size_t earliestStart(size_t k, size_t extraLetters) const;
+
+  // Returns where the trailing partial syllable starts, or the input size if
+  // the input is complete.
+  size_t partialStart() const;
+
+  // Returns the score of the most likely unigram of the key, or -infinity.
+  double topUnigramScore(const std::string& key) const;
+
+  Formosa::Gramambular::LanguageModel* lm_;
+  std::vector<Syllable> syllables_;
+  std::vector<TrieNode> trie_;
+  size_t maxSyllableLength_ = 0;
+
+  std::vector<Token> tokens_;
+  // cells_[k] is the best segmentation of the first k tokens.
+  std::vector<Cell> cells_;
+  // fences_[k] is the position after the last tone digit in the first k
+  // tokens. Syllables cannot cross it.
+  std::vector<size_t> fences_;
+};
+
+}  // namespace McBopomofo
+
+#endif  // SRC_PINYINSEGMENTER_H_
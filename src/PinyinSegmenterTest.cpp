@@ -0,0 +1,145 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "PinyinSegmenter.h"
+
+#include <string>
+#include <vector>
+
+#include "TestSupport.h"
+#include "gtest/gtest.h"
+
+namespace McBopomofo {
+
+namespace {
+
+using Readings = std::vector<std::string>;
+
+class PinyinSegmenterTest : public ::testing::Test {
+ protected:
+  PinyinSegmenterTest() {
+    lm_.add("ㄒㄧㄢ", "先", -3.0);
+    lm_.add("ㄒㄧ", "西", -3.5);
+    lm_.add("ㄢ", "安", -3.8);
+    lm_.add("ㄋㄧˇ", "你", -2.0);
+    lm_.add("ㄋㄧˊ", "尼", -4.0);
+    // Alone, "hao" is most likely ㄏㄠˋ; after ㄋㄧˇ, the phrase makes it ㄏㄠˇ.
+    lm_.add("ㄏㄠˇ", "好", -2.5);
+    lm_.add("ㄏㄠˋ", "號", -2.0);
+    lm_.add("ㄋㄧˇ-ㄏㄠˇ", "你好", -3.0);
+    lm_.add("ㄏㄚ", "哈", -4.0);
+  }
+
+  // Types the input, letters and tone digits, into a new segmenter.
+  PinyinSegmenter type(const std::string& input) {
+    PinyinSegmenter segmenter(&lm_);
+    for (char c : input) {
+      bool accepted = c >= '1' && c <= '5' ? segmenter.appendTone(c - '0')
+                                           : segmenter.appendLetter(c);
+      EXPECT_TRUE(accepted) << input << " at " << c;
+    }
+    return segmenter;
+  }
+
+  TestLanguageModel lm_;
+};
+
+}  // namespace
+
+TEST_F(PinyinSegmenterTest, PrefersTheBetterOfAmbiguousSplits) {
+  PinyinSegmenter segmenter = type("xian");
+  EXPECT_TRUE(segmenter.isComplete());
+  EXPECT_EQ(segmenter.readings(), Readings({"ㄒㄧㄢ"}));
+  EXPECT_EQ(segmenter.displayString(), "xian");
+}
+
+TEST_F(PinyinSegmenterTest, ToneDigitFencesTheSyllable) {
+  PinyinSegmenter segmenter = type("xi1an");
+  EXPECT_TRUE(segmenter.isComplete());
+  EXPECT_EQ(segmenter.readings(), Readings({"ㄒㄧ", "ㄢ"}));
+  EXPECT_EQ(segmenter.displayString(), "xi1'an");
+}
+
+TEST_F(PinyinSegmenterTest, ToneDigitForcesTheTone) {
+  EXPECT_EQ(type("hao").readings(), Readings({"ㄏㄠˋ"}));
+  EXPECT_EQ(type("hao3").readings(), Readings({"ㄏㄠˇ"}));
+  EXPECT_EQ(type("nihao4").readings(), Readings({"ㄋㄧˇ", "ㄏㄠˋ"}));
+}
+
+TEST_F(PinyinSegmenterTest, ChoosesTonesThatFormPhrases) {
+  PinyinSegmenter segmenter = type("nihao");
+  EXPECT_EQ(segmenter.readings(), Readings({"ㄋㄧˇ", "ㄏㄠˇ"}));
+  EXPECT_EQ(segmenter.displayString(), "ni'hao");
+}
+
+TEST_F(PinyinSegmenterTest, PartialSyllableIsShownButNotComplete) {
+  PinyinSegmenter segmenter = type("nih");
+  EXPECT_FALSE(segmenter.isComplete());
+  EXPECT_TRUE(segmenter.readings().empty());
+  EXPECT_EQ(segmenter.displayString(), "ni'h");
+
+  // "xia" starts "xian", which beats "xi" followed by the start of "an".
+  segmenter = type("xia");
+  EXPECT_FALSE(segmenter.isComplete());
+  EXPECT_EQ(segmenter.displayString(), "xia");
+}
+
+TEST_F(PinyinSegmenterTest, RejectsWhatCannotBeTyped) {
+  PinyinSegmenter segmenter(&lm_);
+  EXPECT_FALSE(segmenter.appendLetter('q'));
+  EXPECT_FALSE(segmenter.appendLetter('A'));
+  EXPECT_FALSE(segmenter.appendTone(1));
+  EXPECT_TRUE(segmenter.empty());
+
+  segmenter = type("xi");
+  EXPECT_FALSE(segmenter.appendTone(3));
+  EXPECT_FALSE(segmenter.appendTone(6));
+  EXPECT_EQ(segmenter.displayString(), "xi");
+  EXPECT_TRUE(segmenter.appendTone(1));
+  EXPECT_FALSE(segmenter.appendTone(1));
+}
+
+TEST_F(PinyinSegmenterTest, BackspaceRestoresTheEarlierSegmentation) {
+  PinyinSegmenter segmenter = type("nihao4");
+  segmenter.backspace();
+  EXPECT_EQ(segmenter.readings(), Readings({"ㄋㄧˇ", "ㄏㄠˇ"}));
+  EXPECT_EQ(segmenter.displayString(), "ni'hao");
+
+  segmenter.backspace();
+  EXPECT_TRUE(segmenter.isComplete());
+  EXPECT_EQ(segmenter.readings(), Readings({"ㄋㄧˇ", "ㄏㄚ"}));
+  EXPECT_EQ(segmenter.displayString(), "ni'ha");
+  segmenter.backspace();
+  EXPECT_FALSE(segmenter.isComplete());
+  EXPECT_EQ(segmenter.displayString(), "ni'h");
+  segmenter.backspace();
+  EXPECT_EQ(segmenter.readings(), Readings({"ㄋㄧˇ"}));
+
+  segmenter.clear();
+  EXPECT_TRUE(segmenter.empty());
+  EXPECT_FALSE(segmenter.isComplete());
+  segmenter.backspace();
+  EXPECT_TRUE(segmenter.empty());
+}
+
+}  // namespace McBopomofo
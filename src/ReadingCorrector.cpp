@@ -0,0 +1,200 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "ReadingCorrector.h"
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+
+namespace McBopomofo {
+
+namespace {
+
+using BPMF = Formosa::Mandarin::BopomofoSyllable;
+using Formosa::Mandarin::BopomofoKeyboardLayout;
+
+// Readings whose most likely unigram scores below this are rare enough for a
+// reading one key away to be suggested, if it scores at least
+// kCorrectionMargin more.
+constexpr float kRareReadingScore = -7.0;
+constexpr float kCorrectionMargin = 3.0;
+
+constexpr const char* kQwertyRows[] = {"1234567890-=", "qwertyuiop[]",
+                                       "asdfghjkl;'", "zxcvbnm,./"};
+
+size_t Composition(BPMF syllable) {
+  return syllable.consonantComponent() | syllable.middleVowelComponent() |
+         syllable.vowelComponent() | syllable.toneMarkerComponent();
+}
+
+}  // namespace
+
+ReadingCorrector::ReadingCorrector(Formosa::Gramambular::LanguageModel* lm)
+    : topScores_(kSyllableSpace, -std::numeric_limits<float>::infinity()) {
+  for (BPMF::Component consonant = 0; consonant <= BPMF::S; consonant++) {
+    for (BPMF::Component medial :
+         {BPMF::Component{0}, BPMF::I, BPMF::U, BPMF::UE}) {
+      for (BPMF::Component vowel = 0; vowel <= BPMF::ERR; vowel += BPMF::A) {
+        for (BPMF::Component tone : {BPMF::Tone1, BPMF::Tone2, BPMF::Tone3,
+                                     BPMF::Tone4, BPMF::Tone5}) {
+          BPMF syllable(consonant | medial | vowel | tone);
+          std::string reading = syllable.composedString();
+          if (syllable.isEmpty() || !lm->hasUnigramsForKey(reading)) {
+            continue;
+          }
+          size_t composition = Composition(syllable);
+          valid_.set(composition);
+          Formosa::Gramambular::Unigram top;
+          if (lm->topUnigramForKey(reading, &top)) {
+            topScores_[composition] = std::max(topScores_[composition],
+                                               static_cast<float>(top.score));
+          }
+        }
+      }
+    }
+  }
+
+  // Two keys are adjacent if they are next to each other in a row, or touch
+  // across rows, which are each staggered to the right of the one above.
+  std::array<std::string, 128> qwerty;
+  size_t rowCount = std::size(kQwertyRows);
+  for (size_t r = 0; r < rowCount; r++) {
+    std::string row = kQwertyRows[r];
+    for (size_t c = 0; c < row.length(); c++) {
+      std::string& neighbors = qwerty[static_cast<size_t>(row[c])];
+      auto addNeighbor = [&](const std::string& otherRow, size_t column) {
+        if (column < otherRow.length()) {
+          neighbors += otherRow[column];
+        }
+      };
+      if (c > 0) {
+        addNeighbor(row, c - 1);
+      }
+      addNeighbor(row, c + 1);
+      if (r > 0) {
+        addNeighbor(kQwertyRows[r - 1], c);
+        addNeighbor(kQwertyRows[r - 1], c + 1);
+      }
+      if (r + 1 < rowCount) {
+        if (c > 0) {
+          addNeighbor(kQwertyRows[r + 1], c - 1);
+        }
+        addNeighbor(kQwertyRows[r + 1], c);
+      }
+    }
+  }
+
+  for (const BopomofoKeyboardLayout* layout :
+       {BopomofoKeyboardLayout::StandardLayout(),
+        BopomofoKeyboardLayout::ETenLayout(),
+        BopomofoKeyboardLayout::HsuLayout(),
+        BopomofoKeyboardLayout::ETen26Layout(),
+        BopomofoKeyboardLayout::IBMLayout()}) {
+    // Only the keys that compose readings in the layout are candidates. A
+    // reading is composed by its tone key, so a tone key is not taken for
+    // another key, or the other way around.
+    auto isToneKey = [layout](char key) {
+      for (BPMF::Component component : layout->keyToComponents(key)) {
+        if (component & BPMF::ToneMarkerMask) {
+          return true;
+        }
+      }
+      return false;
+    };
+    Adjacency adjacency;
+    for (size_t key = 0; key < qwerty.size(); key++) {
+      for (char neighbor : qwerty[key]) {
+        if (!layout->keyToComponents(neighbor).empty() &&
+            isToneKey(neighbor) == isToneKey(static_cast<char>(key))) {
+          adjacency[key] += neighbor;
+        }
+      }
+    }
+    adjacencies_.emplace_back(layout, adjacency);
+  }
+}
+
+const ReadingCorrector::Adjacency* ReadingCorrector::adjacencyFor(
+    const BopomofoKeyboardLayout* layout) const {
+  for (const auto& [l, adjacency] : adjacencies_) {
+    if (l == layout) {
+      return &adjacency;
+    }
+  }
+  return nullptr;
+}
+
+std::optional<BPMF> ReadingCorrector::correct(
+    BPMF syllable, const BopomofoKeyboardLayout* layout) const {
+  if (syllable.isEmpty() || valid_.test(Composition(syllable))) {
+    return std::nullopt;
+  }
+  return bestNeighbor(syllable, layout,
+                      -std::numeric_limits<float>::infinity());
+}
+
+std::optional<BPMF> ReadingCorrector::suggest(
+    BPMF syllable, const BopomofoKeyboardLayout* layout) const {
+  size_t typed = Composition(syllable);
+  if (syllable.isEmpty() || !valid_.test(typed) ||
+      topScores_[typed] >= kRareReadingScore) {
+    return std::nullopt;
+  }
+  return bestNeighbor(syllable, layout, topScores_[typed] + kCorrectionMargin);
+}
+
+std::optional<BPMF> ReadingCorrector::bestNeighbor(
+    BPMF syllable, const BopomofoKeyboardLayout* layout,
+    float threshold) const {
+  const Adjacency* adjacency = adjacencyFor(layout);
+  if (adjacency == nullptr) {
+    return std::nullopt;
+  }
+
+  std::string sequence = layout->keySequenceFromSyllable(syllable);
+  std::optional<BPMF> best;
+  float bestScore = threshold;
+  for (size_t i = 0; i < sequence.length(); i++) {
+    char key = sequence[i];
+    if (static_cast<unsigned char>(key) >= adjacency->size()) {
+      continue;
+    }
+    for (char neighbor : (*adjacency)[static_cast<size_t>(key)]) {
+      sequence[i] = neighbor;
+      BPMF candidate = layout->syllableFromKeySequence(sequence);
+      if (candidate.hasToneMarker() != syllable.hasToneMarker()) {
+        continue;
+      }
+      size_t composition = Composition(candidate);
+      if (valid_.test(composition) && topScores_[composition] > bestScore) {
+        best = candidate;
+        bestScore = topScores_[composition];
+      }
+    }
+    sequence[i] = key;
+  }
+  return best;
+}
+
+}  // namespace McBopomofo
@@ -0,0 +1,94 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SRC_READINGCORRECTOR_H_
+#define SRC_READINGCORRECTOR_H_
+
+#include <array>
+#include <bitset>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Gramambular.h"
+#include "Mandarin.h"
+
+namespace McBopomofo {
+
+// Corrects readings mistyped by hitting a key next to the intended one.
+//
+// A reading is corrected if the language model has no unigrams for it. A
+// reading that is valid but rare is kept as typed, and a reading one key away
+// that is much more likely is only suggested. The candidates are the readings
+// typed by substituting one key of the reading with a key next to it on a
+// QWERTY keyboard. The key adjacency of each Bopomofo layout
+// and the set of valid syllables are computed once, so a correction only
+// tests a few dozen bits.
+class ReadingCorrector {
+ public:
+  // Reads the valid syllables and their scores from the language model.
+  explicit ReadingCorrector(Formosa::Gramambular::LanguageModel* lm);
+
+  // Returns the corrected reading of a reading the language model has no
+  // unigrams for, or nullopt if the reading is valid or no reading one key
+  // away is. Readings typed with the Hanyu Pinyin layout are not corrected.
+  std::optional<Formosa::Mandarin::BopomofoSyllable> correct(
+      Formosa::Mandarin::BopomofoSyllable syllable,
+      const Formosa::Mandarin::BopomofoKeyboardLayout* layout) const;
+
+  // Returns a reading one key away that is much more likely than the given
+  // valid but rare reading, or nullopt if there is none.
+  std::optional<Formosa::Mandarin::BopomofoSyllable> suggest(
+      Formosa::Mandarin::BopomofoSyllable syllable,
+      const Formosa::Mandarin::BopomofoKeyboardLayout* layout) const;
+
+ private:
+  // Syllables are at most 14 bits wide.
+  static constexpr size_t kSyllableSpace = 0x4000;
+
+  // The keys of the layout next to each key, indexed by ASCII code.
+  using Adjacency = std::array<std::string, 128>;
+
+  const Adjacency* adjacencyFor(
+      const Formosa::Mandarin::BopomofoKeyboardLayout* layout) const;
+
+  // Returns the most likely valid reading one key away whose top score is
+  // above the threshold, if any.
+  std::optional<Formosa::Mandarin::BopomofoSyllable> bestNeighbor(
+      Formosa::Mandarin::BopomofoSyllable syllable,
+      const Formosa::Mandarin::BopomofoKeyboardLayout* layout,
+      float threshold) const;
+
+  // Syllables the language model has unigrams for.
+  std::bitset<kSyllableSpace> valid_;
+  // The score of the most likely unigram of each valid syllable.
+  std::vector<float> topScores_;
+  std::vector<std::pair<const Formosa::Mandarin::BopomofoKeyboardLayout*,
+                        Adjacency>>
+      adjacencies_;
+};
+
+}  // namespace McBopomofo
+
+#endif  // SRC_READINGCORRECTOR_H_
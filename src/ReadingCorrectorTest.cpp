@@ -0,0 +1,115 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "ReadingCorrector.h"
+
+#include <memory>
+#include <string>
+
+#include "KeyHandler.h"
+#include "TestSupport.h"
+#include "gtest/gtest.h"
+
+namespace McBopomofo {
+
+using BPMF = Formosa::Mandarin::BopomofoSyllable;
+using Formosa::Mandarin::BopomofoKeyboardLayout;
+
+class ReadingCorrectorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    // On the standard layout, ㄋ is typed with "s" and ㄇ with "a", next to it,
+    // and ㄌ with "x", below it.
+    lm_ = std::make_shared<TestLanguageModel>();
+    lm_->add("ㄋㄧˇ", "你", -8.0);
+    lm_->add("ㄇㄧˇ", "米", -3.0);
+    lm_->add("ㄇㄧˇ", "靡", -5.0);
+    lm_->add("ㄇㄚ", "媽", -4.0);
+  }
+
+  std::shared_ptr<TestLanguageModel> lm_;
+};
+
+TEST_F(ReadingCorrectorTest, CorrectsOnlyInvalidReadings) {
+  ReadingCorrector corrector(lm_.get());
+  const BopomofoKeyboardLayout* layout =
+      BopomofoKeyboardLayout::StandardLayout();
+
+  auto corrected = corrector.correct(BPMF::FromComposedString("ㄌㄧˇ"), layout);
+  ASSERT_TRUE(corrected.has_value());
+  EXPECT_EQ(corrected->composedString(), "ㄋㄧˇ");
+
+  // A rare reading is kept, and a likelier one is only suggested.
+  EXPECT_FALSE(
+      corrector.correct(BPMF::FromComposedString("ㄋㄧˇ"), layout).has_value());
+  auto suggested = corrector.suggest(BPMF::FromComposedString("ㄋㄧˇ"), layout);
+  ASSERT_TRUE(suggested.has_value());
+  EXPECT_EQ(suggested->composedString(), "ㄇㄧˇ");
+
+  // Likely readings are neither corrected nor given suggestions, and invalid
+  // readings are corrected rather than given suggestions.
+  EXPECT_FALSE(
+      corrector.correct(BPMF::FromComposedString("ㄇㄧˇ"), layout).has_value());
+  EXPECT_FALSE(
+      corrector.suggest(BPMF::FromComposedString("ㄇㄧˇ"), layout).has_value());
+  EXPECT_FALSE(
+      corrector.suggest(BPMF::FromComposedString("ㄌㄧˇ"), layout).has_value());
+
+  // Readings typed with Hanyu Pinyin are left alone.
+  EXPECT_FALSE(corrector
+                   .correct(BPMF::FromComposedString("ㄌㄧˇ"),
+                            BopomofoKeyboardLayout::HanyuPinyinLayout())
+                   .has_value());
+}
+
+TEST_F(ReadingCorrectorTest, OffersSuggestionAsCandidate) {
+  KeyHandler handler(lm_, nullptr);
+  handler.setKeyboardLayout(BopomofoKeyboardLayout::StandardLayout());
+  handler.setReadingCorrection(true);
+
+  std::unique_ptr<InputState> state = std::make_unique<InputStates::Empty>();
+  auto stateCallback = [&state](std::unique_ptr<InputState> newState) {
+    state = std::move(newState);
+  };
+  auto errorCallback = []() {};
+  for (char c : std::string("su3")) {
+    handler.handle(Key::asciiKey(c), state.get(), stateCallback, errorCallback);
+  }
+  auto inputting = dynamic_cast<InputStates::Inputting*>(state.get());
+  ASSERT_NE(inputting, nullptr);
+  EXPECT_EQ(inputting->composingBuffer, "你");
+
+  handler.handle(Key::namedKey(Key::Name::kSpace), state.get(), stateCallback,
+                 errorCallback);
+  auto choosing = dynamic_cast<InputStates::ChoosingCandidate*>(state.get());
+  ASSERT_NE(choosing, nullptr);
+  EXPECT_EQ(choosing->candidates,
+            std::vector<std::string>({"你", "米", "靡"}));
+
+  handler.candidateSelected("米", stateCallback);
+  inputting = dynamic_cast<InputStates::Inputting*>(state.get());
+  ASSERT_NE(inputting, nullptr);
+  EXPECT_EQ(inputting->composingBuffer, "米");
+}
+
+}  // namespace McBopomofo
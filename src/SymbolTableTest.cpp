@@ -0,0 +1,276 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "SymbolTable.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "KeyHandler.h"
+#include "TestSupport.h"
+#include "gtest/gtest.h"
+
+namespace McBopomofo {
+
+namespace {
+
+// On the standard layout, ㄒ is "v", ㄧ is "u", ㄣ is "p", ㄠ is "l", ㄥ is "/",
+// ㄞ is "9", and the fourth tone is "4".
+constexpr char kTable[] =
+    "# format org.openvanilla.mcbopomofo.symbols\n"
+    "# A comment.\n"
+    "表情 😀 ㄒㄧㄠˋ smile\n"
+    "表情 ❤️ ㄞˋ-ㄒㄧㄣ heart\n"
+    "符號 ★ ㄒㄧㄥ-ㄒㄧㄥ star\n"
+    "符號 ♥ ㄒㄧㄣ heart\n";
+
+std::vector<std::string> Strings(const std::vector<std::string_view>& views) {
+  return std::vector<std::string>(views.begin(), views.end());
+}
+
+}  // namespace
+
+TEST(SymbolTableTest, ListsCategoriesAndSymbols) {
+  ScopedTempFile file(kTable);
+  SymbolTable table;
+  ASSERT_TRUE(table.open(file.path().c_str()));
+  EXPECT_EQ(Strings(table.categories()),
+            std::vector<std::string>({"表情", "符號"}));
+  EXPECT_EQ(Strings(table.symbolsInCategory("表情")),
+            std::vector<std::string>({"😀", "❤️"}));
+  EXPECT_EQ(Strings(table.symbolsInCategory("符號")),
+            std::vector<std::string>({"★", "♥"}));
+  EXPECT_TRUE(table.symbolsInCategory("數學").empty());
+
+  table.close();
+  EXPECT_FALSE(table.isLoaded());
+  EXPECT_TRUE(table.categories().empty());
+  EXPECT_TRUE(table.symbolsForPrefix("ㄒ", 8).empty());
+}
+
+TEST(SymbolTableTest, IndexesEveryPrefixOfKeywords) {
+  ScopedTempFile file(kTable);
+  SymbolTable table;
+  ASSERT_TRUE(table.open(file.path().c_str()));
+
+  // In the order of the file, each symbol once even if two of its keywords
+  // match.
+  EXPECT_EQ(Strings(table.symbolsForPrefix("ㄒ", 8)),
+            std::vector<std::string>({"😀", "❤️", "★", "♥"}));
+  EXPECT_EQ(Strings(table.symbolsForPrefix("ㄒㄧ", 2)),
+            std::vector<std::string>({"😀", "❤️"}));
+  EXPECT_EQ(Strings(table.symbolsForPrefix("ㄒㄧㄠˋ", 8)),
+            std::vector<std::string>({"😀"}));
+  EXPECT_EQ(Strings(table.symbolsForPrefix("he", 8)),
+            std::vector<std::string>({"❤️", "♥"}));
+  EXPECT_EQ(Strings(table.symbolsForPrefix("star", 8)),
+            std::vector<std::string>({"★"}));
+
+  // Neither part of a character, nor more than the keyword, nor a name
+  // that is not typed in lowercase.
+  EXPECT_TRUE(table.symbolsForPrefix(std::string_view("ㄒ", 1), 8).empty());
+  EXPECT_TRUE(table.symbolsForPrefix("stars", 8).empty());
+  EXPECT_TRUE(table.symbolsForPrefix("Heart", 8).empty());
+  EXPECT_TRUE(table.symbolsForPrefix("", 8).empty());
+}
+
+TEST(SymbolTableTest, MatchesSyllablesInsideReadings) {
+  ScopedTempFile file(kTable);
+  SymbolTable table;
+  ASSERT_TRUE(table.open(file.path().c_str()));
+
+  // "ㄞˋ-ㄒㄧㄣ" is found from each of its syllables, and across them.
+  EXPECT_EQ(Strings(table.symbolsForPrefix("ㄞˋ", 8)),
+            std::vector<std::string>({"❤️"}));
+  EXPECT_EQ(Strings(table.symbolsForPrefix("ㄞˋ-ㄒ", 8)),
+            std::vector<std::string>({"❤️"}));
+  EXPECT_EQ(Strings(table.symbolsForPrefix("ㄒㄧㄣ", 8)),
+            std::vector<std::string>({"❤️", "♥"}));
+  EXPECT_EQ(Strings(table.symbolsForPrefix("ㄒㄧㄥ-ㄒ", 8)),
+            std::vector<std::string>({"★"}));
+
+  // But not from within a syllable, and not with the separator at either end.
+  EXPECT_TRUE(table.symbolsForPrefix("ㄧㄣ", 8).empty());
+  EXPECT_TRUE(table.symbolsForPrefix("ㄞˋ-", 8).empty());
+  EXPECT_TRUE(table.symbolsForPrefix("-ㄒㄧㄣ", 8).empty());
+}
+
+TEST(SymbolTableTest, KeepsTheFirstSymbolsOfEachPrefix) {
+  std::string data(SYMBOLS_PRAGMA_HEADER);
+  for (size_t i = 0; i < SymbolTable::MaxSymbolsPerPrefix + 8; i++) {
+    data += "數字 " + std::to_string(i) + " ㄕㄨˋ number" + std::to_string(i) +
+            "\n";
+  }
+  ScopedTempFile file(data);
+  SymbolTable table;
+  ASSERT_TRUE(table.open(file.path().c_str()));
+
+  std::vector<std::string> symbols = Strings(table.symbolsForPrefix("ㄕ", 100));
+  ASSERT_EQ(symbols.size(), SymbolTable::MaxSymbolsPerPrefix);
+  EXPECT_EQ(symbols.front(), "0");
+  EXPECT_EQ(symbols.back(),
+            std::to_string(SymbolTable::MaxSymbolsPerPrefix - 1));
+  EXPECT_EQ(Strings(table.symbolsForPrefix("number35", 8)),
+            std::vector<std::string>({"35"}));
+  EXPECT_EQ(table.symbolsForPrefix("ㄕ", 4).size(), 4);
+}
+
+TEST(SymbolTableTest, RejectsMalformedTables) {
+  ScopedTempFile file("表情 😀 ㄒㄧㄠˋ smile\n");
+  SymbolTable table;
+  EXPECT_FALSE(table.open(file.path().c_str()));
+  EXPECT_FALSE(table.isLoaded());
+
+  file.write(std::string(SYMBOLS_PRAGMA_HEADER) + "表情 \xF0\x9F ㄒㄧㄠˋ\n");
+  EXPECT_FALSE(table.open(file.path().c_str()));
+}
+
+class SymbolPickerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    lm_ = std::make_shared<TestLanguageModel>();
+    lm_->add("ㄋㄧˇ", "你", -2.0);
+    lm_->add("ㄏㄠˇ", "好", -2.0);
+    symbolTable_ = std::make_shared<SymbolTable>();
+    ASSERT_TRUE(symbolTable_->open(file_.path().c_str()));
+    handler_ = std::make_unique<KeyHandler>(lm_, nullptr);
+    handler_->setKeyboardLayout(
+        Formosa::Mandarin::BopomofoKeyboardLayout::StandardLayout());
+    handler_->setSymbolTable(symbolTable_);
+    state_ = std::make_unique<InputStates::Empty>();
+  }
+
+  void handle(Key key) {
+    handler_->handle(key, state_.get(), stateCallback(), []() {});
+  }
+
+  void type(const std::string& keys) {
+    for (char c : keys) {
+      handle(Key::asciiKey(c));
+    }
+  }
+
+  void openPicker() { handle(Key::asciiKey('`', false, true)); }
+
+  // Types the keys into the search, as frontends do with the keys
+  // isSymbolSearchKey() takes.
+  void search(const std::string& keys) {
+    for (char c : keys) {
+      Key key = Key::asciiKey(c);
+      ASSERT_TRUE(handler_->isSymbolSearchKey(key)) << c;
+      ASSERT_TRUE(handler_->handleSymbolSearchKey(key, stateCallback())) << c;
+    }
+  }
+
+  std::vector<std::string> candidates() {
+    auto picking = dynamic_cast<InputStates::SymbolPicking*>(state_.get());
+    return picking != nullptr ? picking->candidates
+                              : std::vector<std::string>();
+  }
+
+  KeyHandler::StateCallback stateCallback() {
+    return [this](std::unique_ptr<InputState> newState) {
+      state_ = std::move(newState);
+    };
+  }
+
+  ScopedTempFile file_{kTable};
+  std::shared_ptr<TestLanguageModel> lm_;
+  std::shared_ptr<SymbolTable> symbolTable_;
+  std::unique_ptr<KeyHandler> handler_;
+  std::unique_ptr<InputState> state_;
+};
+
+TEST_F(SymbolPickerTest, SearchesReadingsAndNames) {
+  openPicker();
+  EXPECT_EQ(candidates(), std::vector<std::string>({"表情", "符號"}));
+
+  // Readings without a tone, and syllables within the readings of a name.
+  search("vu");
+  EXPECT_EQ(candidates(), std::vector<std::string>({"😀", "❤️", "★", "♥"}));
+  search("p");
+  EXPECT_EQ(candidates(), std::vector<std::string>({"❤️", "♥"}));
+  for (int i = 0; i < 3; i++) {
+    EXPECT_TRUE(handler_->handleSymbolSearchKey(
+        Key::namedKey(Key::Name::kBackSpace), stateCallback()));
+  }
+  EXPECT_EQ(candidates(), std::vector<std::string>({"表情", "符號"}));
+
+  // A tone ends a syllable, and the next one is joined to it.
+  search("94vup");
+  EXPECT_EQ(candidates(), std::vector<std::string>({"❤️"}));
+}
+
+TEST_F(SymbolPickerTest, SearchesNamesThatAreNotReadings) {
+  openPicker();
+  // "h" is ㄘ and "e" is ㄍ, which would replace it, so "he" is a name.
+  search("he");
+  EXPECT_EQ(candidates(), std::vector<std::string>({"❤️", "♥"}));
+  search("x");
+  EXPECT_TRUE(candidates().empty());
+}
+
+TEST_F(SymbolPickerTest, SelectionKeysTypeTheSearch) {
+  openPicker();
+  // The digits type readings on the standard layout, so they search even
+  // though they are selection keys.
+  EXPECT_TRUE(handler_->isSymbolSearchKey(Key::asciiKey('1')));
+  EXPECT_FALSE(handler_->isSymbolSearchKey(Key::asciiKey('1', false, true)));
+  EXPECT_FALSE(handler_->isSymbolSearchKey(Key::namedKey(Key::Name::kReturn)));
+
+  // Once a search is typed, every key adds to it.
+  search("he");
+  EXPECT_TRUE(handler_->isSymbolSearchKey(Key::asciiKey('`')));
+
+  handler_->candidatePanelCancelled(stateCallback());
+  EXPECT_FALSE(handler_->isSymbolSearchKey(Key::asciiKey('1')));
+}
+
+TEST_F(SymbolPickerTest, InsertsSymbolAndKeepsComposing) {
+  type("su3cl3");
+  handle(Key::namedKey(Key::Name::kLeft));
+  openPicker();
+  search("vup");
+  handler_->candidateSelected("♥", stateCallback());
+
+  // The text before the cursor is committed with the symbol, and the rest is
+  // still composed.
+  auto inputting = dynamic_cast<InputStates::Inputting*>(state_.get());
+  ASSERT_NE(inputting, nullptr);
+  EXPECT_EQ(inputting->evictedText, "你♥");
+  EXPECT_EQ(inputting->composingBuffer, "好");
+  EXPECT_EQ(inputting->cursorIndex, 0);
+
+  // At the end of the composition, everything is committed.
+  handle(Key::namedKey(Key::Name::kEnd));
+  openPicker();
+  search("he");
+  handler_->candidateSelected("❤️", stateCallback());
+  auto committing = dynamic_cast<InputStates::Committing*>(state_.get());
+  ASSERT_NE(committing, nullptr);
+  EXPECT_EQ(committing->text, "好❤️");
+}
+
+}  // namespace McBopomofo
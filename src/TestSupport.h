@@ -0,0 +1,134 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SRC_TESTSUPPORT_H_
+#define SRC_TESTSUPPORT_H_
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "LanguageModel.h"
+#include "ParselessPhraseDB.h"
+
+namespace McBopomofo {
+
+// A language model of the unigrams given to it, for unit tests that need a
+// few readings rather than the whole data file.
+class TestLanguageModel : public Formosa::Gramambular::LanguageModel {
+ public:
+  void add(const std::string& key, const std::string& value, double score) {
+    Formosa::Gramambular::Unigram unigram;
+    unigram.keyValue.key = key;
+    unigram.keyValue.value = value;
+    unigram.score = score;
+    unigrams_[key].push_back(unigram);
+  }
+
+  const std::vector<Formosa::Gramambular::Bigram> bigramsForKeys(
+      const std::string&, const std::string&) override {
+    return std::vector<Formosa::Gramambular::Bigram>();
+  }
+
+  const std::vector<Formosa::Gramambular::Unigram> unigramsForKey(
+      const std::string& key) override {
+    auto it = unigrams_.find(key);
+    return it == unigrams_.end() ? std::vector<Formosa::Gramambular::Unigram>()
+                                 : it->second;
+  }
+
+  bool hasUnigramsForKey(const std::string& key) override {
+    return unigrams_.find(key) != unigrams_.end();
+  }
+
+ private:
+  std::map<std::string, std::vector<Formosa::Gramambular::Unigram>> unigrams_;
+};
+
+// A row of a language model data file.
+struct TestRow {
+  std::string key;
+  std::string value;
+  std::string score;
+};
+
+// Returns a data file in the sorted format of the primary language model,
+// with the rows sorted as it requires.
+inline std::string MakeSortedDatabase(std::vector<TestRow> rows) {
+  std::stable_sort(rows.begin(), rows.end(),
+                   [](const TestRow& a, const TestRow& b) {
+                     return a.key + " " < b.key + " ";
+                   });
+  std::string data(SORTED_PRAGMA_HEADER);
+  for (const TestRow& row : rows) {
+    data += row.key + " " + row.value + " " + row.score + "\n";
+  }
+  return data;
+}
+
+// A file in the temporary directory, removed when the object goes away.
+class ScopedTempFile {
+ public:
+  explicit ScopedTempFile(const std::string& contents) {
+    const char* dir = getenv("TMPDIR");
+    std::string pattern =
+        std::string(dir != nullptr ? dir : "/tmp") + "/mcbopomofo-test-XXXXXX";
+    std::vector<char> buffer(pattern.begin(), pattern.end());
+    buffer.push_back(0);
+    int fd = mkstemp(buffer.data());
+    if (fd != -1) {
+      close(fd);
+      path_ = buffer.data();
+    }
+    write(contents);
+  }
+
+  ~ScopedTempFile() {
+    if (!path_.empty()) {
+      unlink(path_.c_str());
+    }
+  }
+
+  ScopedTempFile(const ScopedTempFile&) = delete;
+  ScopedTempFile& operator=(const ScopedTempFile&) = delete;
+
+  // Replaces the contents, such as to test reloading.
+  void write(const std::string& contents) {
+    std::ofstream stream(path_, std::ios::binary | std::ios::trunc);
+    stream << contents;
+  }
+
+  const std::string& path() const { return path_; }
+
+ private:
+  std::string path_;
+};
+
+}  // namespace McBopomofo
+
+#endif  // SRC_TESTSUPPORT_H_